@@ -0,0 +1,240 @@
+#!/usr/bin/env python3
+#SPDX-License-Identifier: GPL-3.0-or-later
+#
+# Round-trip test of the CBOR output format.
+#
+# Replays a raw frame file through dumphfdl with two outputs - one in json
+# format and one in cbor format - then decodes the CBOR sequence and checks
+# that each item is identical to the corresponding JSON message (same keys in
+# the same order, same values and types).
+#
+# Uses cbor2 module for decoding, if it's installed. Otherwise a minimal
+# built-in decoder is used.
+#
+import argparse
+import io
+import json
+import math
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+
+try:
+    import cbor2
+except ImportError:
+    cbor2 = None
+
+
+class CborDecodeError(Exception):
+    pass
+
+
+class Break:
+    pass
+
+
+BREAK = Break()
+
+
+# Minimal decoder of a CBOR sequence (RFC 8949, RFC 8742).
+# Tags are ignored - only the tagged item is returned.
+class CborReader:
+    def __init__(self, buf):
+        self.buf = buf
+        self.pos = 0
+
+    def at_end(self):
+        return self.pos >= len(self.buf)
+
+    def _take(self, n):
+        if self.pos + n > len(self.buf):
+            raise CborDecodeError(f"truncated item at offset {self.pos}")
+        data = self.buf[self.pos:self.pos + n]
+        self.pos += n
+        return data
+
+    def _argument(self, ai):
+        if ai < 24:
+            return ai
+        if ai in (24, 25, 26, 27):
+            return int.from_bytes(self._take(1 << (ai - 24)), 'big')
+        if ai == 31:
+            return None
+        raise CborDecodeError(f"invalid additional info {ai} at offset {self.pos - 1}")
+
+    def _string(self, major, length):
+        if length is not None:
+            data = self._take(length)
+        else:
+            data = b''
+            while True:
+                chunk = self.read(allow_break=True)
+                if chunk is BREAK:
+                    break
+                data += chunk.encode('utf-8') if major == 3 else chunk
+        return data.decode('utf-8') if major == 3 else data
+
+    def read(self, allow_break=False):
+        ib = self._take(1)[0]
+        major, ai = ib >> 5, ib & 0x1f
+        if major == 7:
+            if ai == 20:
+                return False
+            if ai == 21:
+                return True
+            if ai in (22, 23):
+                return None
+            if ai == 25:
+                return half_to_float(self._take(2))
+            if ai == 26:
+                return struct.unpack('>f', self._take(4))[0]
+            if ai == 27:
+                return struct.unpack('>d', self._take(8))[0]
+            if ai == 31 and allow_break:
+                return BREAK
+            raise CborDecodeError(f"unsupported simple value {ai} at offset {self.pos - 1}")
+        arg = self._argument(ai)
+        if major == 0:
+            return arg
+        if major == 1:
+            return -1 - arg
+        if major in (2, 3):
+            return self._string(major, arg)
+        if major == 4:
+            items = []
+            while arg is None or len(items) < arg:
+                item = self.read(allow_break=arg is None)
+                if item is BREAK:
+                    break
+                items.append(item)
+            return items
+        if major == 5:
+            items = {}
+            cnt = 0
+            while arg is None or cnt < arg:
+                key = self.read(allow_break=arg is None)
+                if key is BREAK:
+                    break
+                items[key] = self.read()
+                cnt += 1
+            return items
+        # major == 6 - tag
+        return self.read()
+
+
+def half_to_float(data):
+    h = int.from_bytes(data, 'big')
+    exp = (h >> 10) & 0x1f
+    mant = h & 0x3ff
+    if exp == 0:
+        val = math.ldexp(mant, -24)
+    elif exp != 31:
+        val = math.ldexp(mant + 1024, exp - 25)
+    else:
+        val = math.inf if mant == 0 else math.nan
+    return -val if h & 0x8000 else val
+
+
+def cbor_items(buf):
+    if cbor2 is not None:
+        fh = io.BytesIO(buf)
+        decoder = cbor2.CBORDecoder(fh)
+        while fh.tell() < len(buf):
+            yield decoder.decode()
+    else:
+        reader = CborReader(buf)
+        while not reader.at_end():
+            yield reader.read()
+
+
+# Compares a decoded CBOR item with a parsed JSON message.
+# Returns None if they are equal or a description of the first difference.
+def compare(c, j, path, tolerance):
+    if isinstance(j, float) or isinstance(c, float):
+        if not isinstance(j, (int, float)) or not isinstance(c, float) or isinstance(j, bool):
+            return f"{path}: type mismatch: CBOR {c!r} vs JSON {j!r}"
+        if not math.isclose(c, j, rel_tol=tolerance, abs_tol=tolerance):
+            return f"{path}: value mismatch: CBOR {c!r} vs JSON {j!r}"
+        return None
+    if type(c) is not type(j):
+        return f"{path}: type mismatch: CBOR {c!r} vs JSON {j!r}"
+    if isinstance(j, dict):
+        if list(c.keys()) != list(j.keys()):
+            return f"{path}: key mismatch: CBOR {list(c.keys())} vs JSON {list(j.keys())}"
+        for k in j:
+            diff = compare(c[k], j[k], f"{path}/{k}", tolerance)
+            if diff is not None:
+                return diff
+        return None
+    if isinstance(j, list):
+        if len(c) != len(j):
+            return f"{path}: length mismatch: CBOR {len(c)} vs JSON {len(j)}"
+        for i, (ci, ji) in enumerate(zip(c, j)):
+            diff = compare(ci, ji, f"{path}/{i}", tolerance)
+            if diff is not None:
+                return diff
+        return None
+    if c != j:
+        return f"{path}: value mismatch: CBOR {c!r} vs JSON {j!r}"
+    return None
+
+
+def run_dumphfdl(args, json_path, cbor_path):
+    cmd = [args.dumphfdl, '--replay', args.frame_file,
+           '--output', f'decoded:json:file:path={json_path}',
+           '--output', f'decoded:cbor:file:path={cbor_path}'] + args.extra_args
+    print(' '.join(cmd), file=sys.stderr)
+    result = subprocess.run(cmd, stdout=subprocess.DEVNULL)
+    if result.returncode != 0:
+        sys.exit(f"dumphfdl exited with code {result.returncode}")
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Checks that the cbor output format carries the same messages as the json format')
+    parser.add_argument('--dumphfdl', default='dumphfdl', help='path to dumphfdl binary (default: %(default)s)')
+    parser.add_argument('--tolerance', type=float, default=1e-6,
+                        help='relative tolerance for comparing floating point values (default: %(default)s)')
+    parser.add_argument('frame_file', help='raw frame file to replay (written by the frame output format)')
+    parser.add_argument('extra_args', nargs=argparse.REMAINDER,
+                        help='additional dumphfdl options (eg. --output-mpdus)')
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        json_path = os.path.join(tmpdir, 'out.json')
+        cbor_path = os.path.join(tmpdir, 'out.cbor')
+        run_dumphfdl(args, json_path, cbor_path)
+        with open(json_path, 'rb') as fh:
+            json_msgs = [json.loads(line) for line in fh if line.strip()]
+        with open(cbor_path, 'rb') as fh:
+            cbor_buf = fh.read()
+
+    cnt = 0
+    errors = 0
+    try:
+        for c in cbor_items(cbor_buf):
+            if cnt >= len(json_msgs):
+                print(f"message {cnt}: present in CBOR output only")
+                errors += 1
+                break
+            diff = compare(c, json_msgs[cnt], '', args.tolerance)
+            if diff is not None:
+                print(f"message {cnt}: {diff}")
+                errors += 1
+            cnt += 1
+    except CborDecodeError as e:
+        print(f"message {cnt}: CBOR decoding failed: {e}")
+        errors += 1
+    if cnt < len(json_msgs):
+        print(f"{len(json_msgs) - cnt} message(s) present in JSON output only")
+        errors += 1
+
+    print(f"{cnt} message(s) compared, {len(cbor_buf)} octets of CBOR, "
+          f"{errors} error(s)", file=sys.stderr)
+    return 1 if errors > 0 else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,61 @@
+#!/usr/bin/env python
+#SPDX-License-Identifier: GPL-3.0-or-later
+#
+# Send raw I/Q samples from a file (or stdin) to dumphfdl --udp-iq input.
+# Each datagram starts with a 32-bit big-endian sequence number followed by
+# I/Q samples. Optionally drops and reorders datagrams to exercise the jitter
+# buffer.
+#
+import argparse
+import random
+import socket
+import struct
+import sys
+import time
+
+SAMPLE_SIZES = { 'CU8': 2, 'CS16': 4, 'CF32': 8 }
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Send raw I/Q samples to dumphfdl --udp-iq input')
+    parser.add_argument('--dest', default='127.0.0.1:5000', help='Destination address and port (default: 127.0.0.1:5000)')
+    parser.add_argument('--sample-rate', type=int, required=True, help='Sampling rate of the input data (samples per second)')
+    parser.add_argument('--sample-format', choices=SAMPLE_SIZES.keys(), required=True, help='Sample format of the input data')
+    parser.add_argument('--samples-per-datagram', type=int, default=1024, help='Number of samples in each datagram (default: 1024)')
+    parser.add_argument('--drop', type=float, default=0.0, help='Fraction of datagrams to drop, for testing (default: 0)')
+    parser.add_argument('--reorder', type=float, default=0.0, help='Fraction of datagrams to swap with their successor, for testing (default: 0)')
+    parser.add_argument('input_file', nargs='?', default='-', help='Input file (default: stdin)')
+    self = parser.parse_args()
+
+    host, _, port = self.dest.rpartition(':')
+    dest = (host, int(port))
+    chunk_len = self.samples_per_datagram * SAMPLE_SIZES[self.sample_format]
+    fh = sys.stdin.buffer if self.input_file == '-' else open(self.input_file, 'rb')
+    sock = socket.socket(socket.AF_INET6 if ':' in host else socket.AF_INET, socket.SOCK_DGRAM)
+
+    seq = 0
+    sent = 0
+    held = None
+    start = time.monotonic()
+    try:
+        while True:
+            data = fh.read(chunk_len)
+            if not data:
+                break
+            datagram = struct.pack('>I', seq) + data
+            seq = (seq + 1) & 0xffffffff
+            sent += len(data) // SAMPLE_SIZES[self.sample_format]
+            ahead = sent / self.sample_rate - (time.monotonic() - start)
+            if ahead > 0:
+                time.sleep(ahead)
+            if random.random() < self.drop:
+                continue
+            if held is None and random.random() < self.reorder:
+                held = datagram
+                continue
+            sock.sendto(datagram, dest)
+            if held is not None:
+                sock.sendto(held, dest)
+                held = None
+    except KeyboardInterrupt:
+        pass
+    print(f'{seq} datagrams processed', file=sys.stderr)
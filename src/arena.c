@@ -0,0 +1,119 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <stddef.h>                 // size_t, max_align_t
+#include <string.h>                 // memset
+#include "arena.h"
+#include "util.h"                   // ASSERT, NEW, XCALLOC, XFREE, max
+
+// A simple bump allocator. Memory is carved out of a list of chunks.
+// Resetting the arena makes all chunks available again without returning
+// them to the system, so after a few frames the arena reaches its working
+// size and no further malloc calls are made.
+
+#define ARENA_ALIGN (sizeof(max_align_t))
+#define ALIGN_UP(x) (((x) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+};
+
+struct arena {
+	struct arena_chunk *head;           // first chunk
+	struct arena_chunk *current;        // chunk allocations are currently made from
+	size_t chunk_size;
+	uint32_t alloc_cnt;                 // allocations made since the last reset
+	size_t bytes_used;                  // bytes allocated since the last reset
+};
+
+static _Thread_local struct arena *frame_arena = NULL;
+
+static struct arena_chunk *arena_chunk_new(size_t size) {
+	struct arena_chunk *chunk = XCALLOC(1, sizeof(struct arena_chunk) + size);
+	chunk->size = size;
+	return chunk;
+}
+
+struct arena *arena_create(size_t chunk_size) {
+	ASSERT(chunk_size > 0);
+	NEW(struct arena, a);
+	a->chunk_size = ALIGN_UP(chunk_size);
+	a->head = a->current = arena_chunk_new(a->chunk_size);
+	return a;
+}
+
+// Returns zeroed memory, suitably aligned for any type.
+void *arena_alloc(struct arena *a, size_t size) {
+	ASSERT(a != NULL);
+	size = ALIGN_UP(max(size, 1));
+	struct arena_chunk *chunk = a->current;
+	while(chunk->used + size > chunk->size) {
+		if(chunk->next == NULL) {
+			chunk->next = arena_chunk_new(max(a->chunk_size, size));
+		}
+		// Chunks which follow the current one are unused, but the next one
+		// might still be too small for this request, so it gets skipped
+		chunk = chunk->next;
+	}
+	a->current = chunk;
+	void *ptr = (uint8_t *)chunk->data + chunk->used;
+	chunk->used += size;
+	a->alloc_cnt++;
+	a->bytes_used += size;
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+void arena_reset(struct arena *a) {
+	ASSERT(a != NULL);
+	for(struct arena_chunk *chunk = a->head; chunk != NULL; chunk = chunk->next) {
+		chunk->used = 0;
+	}
+	a->current = a->head;
+	a->alloc_cnt = 0;
+	a->bytes_used = 0;
+}
+
+uint32_t arena_alloc_count(struct arena const *a) {
+	ASSERT(a != NULL);
+	return a->alloc_cnt;
+}
+
+size_t arena_bytes_used(struct arena const *a) {
+	ASSERT(a != NULL);
+	return a->bytes_used;
+}
+
+void arena_destroy(struct arena *a) {
+	if(a == NULL) {
+		return;
+	}
+	struct arena_chunk *chunk = a->head;
+	while(chunk != NULL) {
+		struct arena_chunk *next = chunk->next;
+		XFREE(chunk);
+		chunk = next;
+	}
+	if(frame_arena == a) {
+		frame_arena = NULL;
+	}
+	XFREE(a);
+}
+
+void frame_arena_set(struct arena *a) {
+	frame_arena = a;
+}
+
+void *frame_arena_alloc(size_t size) {
+	ASSERT(frame_arena != NULL);
+	return arena_alloc(frame_arena, size);
+}
+
+// Destructor for la_type_descriptors of protocol nodes which keep their data
+// in the frame arena. libacars frees node data with free() when the
+// destructor is NULL, so an explicit no-op is required.
+void frame_arena_noop_destroy(void *data) {
+	UNUSED(data);
+}
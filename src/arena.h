@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>                 // size_t
+
+struct arena;
+
+struct arena *arena_create(size_t chunk_size);
+void *arena_alloc(struct arena *a, size_t size);
+void arena_reset(struct arena *a);
+uint32_t arena_alloc_count(struct arena const *a);
+size_t arena_bytes_used(struct arena const *a);
+void arena_destroy(struct arena *a);
+
+// Frame arena - an arena bound to the calling (decoder) thread, from which
+// protocol structures of the currently decoded frame are allocated.
+// Memory obtained with FRAME_NEW must not be freed individually. It is
+// released all at once when the decoder resets the arena after the frame
+// has been processed.
+void frame_arena_set(struct arena *a);
+void *frame_arena_alloc(size_t size);
+void frame_arena_noop_destroy(void *data);
+
+#define FRAME_NEW(type, x) type *(x) = frame_arena_alloc(sizeof(type))
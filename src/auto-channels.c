@@ -0,0 +1,294 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>              // fprintf
+#include <stdlib.h>             // strtod
+#include <string.h>             // strdup, strtok_r, strchr, memcpy
+#include "auto-channels.h"
+#include "frontend.h"           // frontend_*, frequency_in_span
+#include "globals.h"            // Systable, Systable_lock, Systable_unlock
+#include "systable.h"           // systable_get_version, systable_get_frequencies
+#include "util.h"               // ASSERT, NEW, XCALLOC, XREALLOC, XFREE, HZ_TO_KHZ, debug_print, max
+
+// Automatic channel selection.
+// Channels are set up on every system table frequency which lies within the
+// band of any of the inputs and which passes the include/exclude filters.
+// When a newer system table is received, channels are added and removed
+// accordingly. Channels added or removed manually (via the control socket)
+// are left alone, unless the system table change affects them.
+
+struct freq_range {
+	int32_t lo, hi;
+};
+
+struct freq_range_list {
+	struct freq_range *ranges;
+	int32_t cnt;
+};
+
+struct input_span {
+	int32_t centerfreq, sample_rate;
+};
+
+struct auto_channels {
+	struct freq_range_list include, exclude;
+	struct input_span *spans;           // bands of inputs for which channels have been selected
+	int32_t span_cnt;
+	int32_t *frequencies;               // currently selected frequencies (all inputs)
+	int32_t channel_cnt;
+	int32_t systable_version;           // system table version the selection is based on
+};
+
+static bool parse_khz(char const *str, int32_t *result) {
+	char *endptr = NULL;
+	double val = strtod(str, &endptr);
+	if(endptr == str || *endptr != '\0' || val <= 0.0) {
+		return false;
+	}
+	*result = (int32_t)(1e3 * val);
+	return true;
+}
+
+// Parses a comma-separated list of frequencies and frequency ranges
+// (in kHz), eg. "8900-9100,10081"
+static bool freq_range_list_parse(char const *str, struct freq_range_list *result) {
+	if(str == NULL) {
+		return true;
+	}
+	char *copy = strdup(str);
+	int32_t cnt = 1;
+	for(char const *p = str; *p != '\0'; p++) {
+		if(*p == ',') {
+			cnt++;
+		}
+	}
+	result->ranges = XCALLOC(cnt, sizeof(struct freq_range));
+	result->cnt = 0;
+	char *saveptr = NULL;
+	for(char *tok = strtok_r(copy, ",", &saveptr); tok != NULL; tok = strtok_r(NULL, ",", &saveptr)) {
+		struct freq_range *r = &result->ranges[result->cnt];
+		char *dash = strchr(tok, '-');
+		if(dash != NULL) {
+			*dash = '\0';
+			if(!parse_khz(tok, &r->lo) || !parse_khz(dash + 1, &r->hi) || r->lo > r->hi) {
+				*dash = '-';
+				goto fail;
+			}
+		} else {
+			if(!parse_khz(tok, &r->lo)) {
+				goto fail;
+			}
+			r->hi = r->lo;
+		}
+		result->cnt++;
+	}
+	if(result->cnt == 0) {
+		fprintf(stderr, "Empty frequency list\n");
+		XFREE(copy);
+		return false;
+	}
+	XFREE(copy);
+	return true;
+fail:
+	fprintf(stderr, "'%s': not a valid frequency or frequency range\n", str);
+	XFREE(copy);
+	return false;
+}
+
+static bool freq_range_list_match(struct freq_range_list const *list, int32_t freq) {
+	for(int32_t i = 0; i < list->cnt; i++) {
+		if(freq >= list->ranges[i].lo && freq <= list->ranges[i].hi) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool auto_channels_filter(struct auto_channels const *ac, int32_t freq) {
+	if(ac->include.cnt > 0 && !freq_range_list_match(&ac->include, freq)) {
+		return false;
+	}
+	return !freq_range_list_match(&ac->exclude, freq);
+}
+
+static bool is_selected(struct auto_channels const *ac, int32_t freq) {
+	for(int32_t i = 0; i < ac->channel_cnt; i++) {
+		if(ac->frequencies[i] == freq) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Include and exclude lists are optional. Returns NULL if any of them is invalid.
+struct auto_channels *auto_channels_create(char const *include, char const *exclude) {
+	NEW(struct auto_channels, ac);
+	ac->systable_version = -1;
+	if(freq_range_list_parse(include, &ac->include) == false ||
+			freq_range_list_parse(exclude, &ac->exclude) == false) {
+		auto_channels_destroy(ac);
+		return NULL;
+	}
+	return ac;
+}
+
+// Returns a list of system table frequencies for a new input with the given
+// band and stores its length in *cnt. Must be called once for each input, in
+// the order of input IDs. A frequency covered by more than one input is
+// assigned to the first one. The result must be freed by the caller.
+int32_t *auto_channels_select(struct auto_channels *ac, int32_t centerfreq,
+		int32_t sample_rate, int32_t *cnt) {
+	ASSERT(ac != NULL);
+	ASSERT(cnt != NULL);
+	struct input_span span = { .centerfreq = centerfreq, .sample_rate = sample_rate };
+	int32_t freq_cnt = 0;
+	Systable_lock();
+	int32_t *freqs = systable_get_frequencies(Systable, &freq_cnt);
+	ac->systable_version = systable_get_version(Systable);
+	Systable_unlock();
+
+	int32_t *result = XCALLOC(max(freq_cnt, 1), sizeof(int32_t));
+	*cnt = 0;
+	for(int32_t i = 0; i < freq_cnt; i++) {
+		if(!auto_channels_filter(ac, freqs[i]) || !frequency_in_span(freqs[i], span.centerfreq, span.sample_rate)) {
+			continue;
+		}
+		bool taken = false;
+		for(int32_t j = 0; j < ac->span_cnt; j++) {
+			if(frequency_in_span(freqs[i], ac->spans[j].centerfreq, ac->spans[j].sample_rate)) {
+				taken = true;
+				break;
+			}
+		}
+		if(!taken) {
+			debug_print(D_MISC, "input %d: selected %.3f kHz\n", ac->span_cnt, HZ_TO_KHZ(freqs[i]));
+			result[(*cnt)++] = freqs[i];
+		}
+	}
+	XFREE(freqs);
+
+	ac->spans = XREALLOC(ac->spans, (ac->span_cnt + 1) * sizeof(struct input_span));
+	ac->spans[ac->span_cnt++] = span;
+	ac->frequencies = XREALLOC(ac->frequencies, (ac->channel_cnt + max(*cnt, 1)) * sizeof(int32_t));
+	memcpy(ac->frequencies + ac->channel_cnt, result, *cnt * sizeof(int32_t));
+	ac->channel_cnt += *cnt;
+	return result;
+}
+
+static struct frontend *find_frontend(int32_t freq, int32_t frontend_cnt, struct frontend **frontends) {
+	for(int32_t i = 0; i < frontend_cnt; i++) {
+		if(frontend_frequency_in_span(frontends[i], freq)) {
+			return frontends[i];
+		}
+	}
+	return NULL;
+}
+
+static bool has_channel(int32_t freq, int32_t frontend_cnt, struct frontend **frontends) {
+	for(int32_t i = 0; i < frontend_cnt; i++) {
+		if(frontend_has_channel(frontends[i], freq)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Checks if the system table has been updated since the last call. If it has,
+// then adds channels for new frequencies and removes channels for frequencies
+// which are no longer in use. Inputs which are not affected are not paused.
+void auto_channels_update(struct auto_channels *ac, int32_t frontend_cnt, struct frontend **frontends) {
+	ASSERT(ac != NULL);
+	ASSERT(frontends != NULL);
+	int32_t freq_cnt = 0;
+	int32_t *freqs = NULL;
+	Systable_lock();
+	int32_t version = systable_get_version(Systable);
+	if(version != ac->systable_version) {
+		freqs = systable_get_frequencies(Systable, &freq_cnt);
+	}
+	Systable_unlock();
+	if(version == ac->systable_version || freqs == NULL) {
+		XFREE(freqs);
+		return;
+	}
+	debug_print(D_MISC, "system table version changed: %d -> %d\n", ac->systable_version, version);
+	ac->systable_version = version;
+
+	// New selection
+	int32_t *selected = XCALLOC(max(freq_cnt, 1), sizeof(int32_t));
+	int32_t selected_cnt = 0;
+	for(int32_t i = 0; i < freq_cnt; i++) {
+		if(auto_channels_filter(ac, freqs[i]) && find_frontend(freqs[i], frontend_cnt, frontends) != NULL) {
+			selected[selected_cnt++] = freqs[i];
+		}
+	}
+	XFREE(freqs);
+
+	// Frequencies of channels which have been added successfully
+	int32_t *added = XCALLOC(max(selected_cnt, 1), sizeof(int32_t));
+	int32_t added_cnt = 0;
+	for(int32_t i = 0; i < frontend_cnt; i++) {
+		struct frontend *fe = frontends[i];
+		int32_t add[max(selected_cnt, 1)], remove[max(ac->channel_cnt, 1)];
+		int32_t add_cnt = 0, remove_cnt = 0;
+		for(int32_t j = 0; j < selected_cnt; j++) {
+			if(find_frontend(selected[j], frontend_cnt, frontends) == fe &&
+					!is_selected(ac, selected[j]) && !frontend_has_channel(fe, selected[j])) {
+				add[add_cnt++] = selected[j];
+			}
+		}
+		for(int32_t j = 0; j < ac->channel_cnt; j++) {
+			bool still_selected = false;
+			for(int32_t k = 0; k < selected_cnt; k++) {
+				if(selected[k] == ac->frequencies[j]) {
+					still_selected = true;
+					break;
+				}
+			}
+			if(!still_selected && frontend_has_channel(fe, ac->frequencies[j])) {
+				remove[remove_cnt++] = ac->frequencies[j];
+			}
+		}
+		if(add_cnt == 0 && remove_cnt == 0) {
+			continue;
+		}
+		double pause = 0.0;
+		if(frontend_reconfigure(fe, add_cnt, add, remove_cnt, remove, &pause) < 0) {
+			fprintf(stderr, "input %d: failed to update channels after system table change\n", fe->id);
+			continue;
+		}
+		memcpy(added + added_cnt, add, add_cnt * sizeof(int32_t));
+		added_cnt += add_cnt;
+		fprintf(stderr, "System table version %d: input %d: %d channel(s) added, %d channel(s) removed, "
+				"processing paused for %.3f ms\n", version, fe->id, add_cnt, remove_cnt, pause * 1e3);
+	}
+	// Record the managed frequencies which actually have channels now. If an
+	// input could not be reconfigured, its channels are left as they were, so
+	// they must not be recorded as added or removed. Channels which have been
+	// added manually (eg. via the control socket) are not managed, even if
+	// they are on the selected frequencies.
+	int32_t *applied = XCALLOC(max(ac->channel_cnt + added_cnt, 1), sizeof(int32_t));
+	int32_t applied_cnt = 0;
+	for(int32_t i = 0; i < ac->channel_cnt; i++) {
+		if(has_channel(ac->frequencies[i], frontend_cnt, frontends)) {
+			applied[applied_cnt++] = ac->frequencies[i];
+		}
+	}
+	memcpy(applied + applied_cnt, added, added_cnt * sizeof(int32_t));
+	applied_cnt += added_cnt;
+	XFREE(added);
+	XFREE(selected);
+	XFREE(ac->frequencies);
+	ac->frequencies = applied;
+	ac->channel_cnt = applied_cnt;
+}
+
+void auto_channels_destroy(struct auto_channels *ac) {
+	if(ac != NULL) {
+		XFREE(ac->include.ranges);
+		XFREE(ac->exclude.ranges);
+		XFREE(ac->spans);
+		XFREE(ac->frequencies);
+		XFREE(ac);
+	}
+}
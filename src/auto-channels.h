@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdint.h>
+
+struct frontend;
+struct auto_channels;
+
+struct auto_channels *auto_channels_create(char const *include, char const *exclude);
+int32_t *auto_channels_select(struct auto_channels *ac, int32_t centerfreq,
+		int32_t sample_rate, int32_t *cnt);
+void auto_channels_update(struct auto_channels *ac, int32_t frontend_cnt, struct frontend **frontends);
+void auto_channels_destroy(struct auto_channels *ac);
@@ -38,8 +38,13 @@ static int32_t block_shared_buffer_init(struct shared_buffer *buffer, size_t buf
 	buffer->buf = XCALLOC(buf_size, sizeof(float complex));
 	buffer->data_ready = XCALLOC(1, sizeof(pthread_barrier_t));
 	buffer->consumers_ready = XCALLOC(1, sizeof(pthread_barrier_t));
+	buffer->reconf_mutex = XCALLOC(1, sizeof(pthread_mutex_t));
+	buffer->reconf_cond = XCALLOC(1, sizeof(pthread_cond_t));
+	buffer->consumer_cnt = thread_cnt - 1;
 	return pthread_barrier_create(buffer->data_ready, thread_cnt) ||
-		pthread_barrier_create(buffer->consumers_ready, thread_cnt);
+		pthread_barrier_create(buffer->consumers_ready, thread_cnt) ||
+		pthread_mutex_initialize(buffer->reconf_mutex) ||
+		pthread_cond_initialize(buffer->reconf_cond);
 }
 
 static void block_shared_buffer_destroy(struct shared_buffer *buffer) {
@@ -47,6 +52,8 @@ static void block_shared_buffer_destroy(struct shared_buffer *buffer) {
 		XFREE(buffer->buf);
 		XFREE(buffer->data_ready);
 		XFREE(buffer->consumers_ready);
+		XFREE(buffer->reconf_mutex);
+		XFREE(buffer->reconf_cond);
 		// No XFREE(buffer) as this is a member of a struct allocated by the caller
 	}
 }
@@ -153,11 +160,101 @@ bool block_connection_is_shutdown_signaled(struct block_connection *connection)
 	return connection->flags & BLOCK_CONNECTION_SHUTDOWN;
 }
 
+// Changes the set of consumers of a one2many connection.
+// Must be called by the producer thread between two data units, ie. after
+// consumers_ready barrier has been passed and before the next data_ready.
+// Consumers are woken up with the reconfiguration flag set and they park
+// themselves in block_connection_one2many_reconfigure_wait(). Once all of
+// them are parked, barriers are recreated for the new number of consumers,
+// removed sinks are detached and new sinks are attached. Threads of added
+// sinks shall be started by the caller after this function returns and the
+// producer shall then wait on consumers_ready, just like it does on startup.
+void block_connection_one2many_reconfigure(struct block *source,
+		size_t add_cnt, struct block *add[add_cnt],
+		size_t remove_cnt, struct block *remove[remove_cnt]) {
+	ASSERT(source);
+	ASSERT(source->producer.type == PRODUCER_MULTI);
+	struct block_connection *connection = source->producer.out;
+	ASSERT(connection);
+	struct shared_buffer *sb = &connection->shared_buffer;
+	ASSERT(remove_cnt <= sb->consumer_cnt);
+
+	connection->flags |= BLOCK_CONNECTION_RECONFIGURE;
+	pthread_barrier_wait(sb->data_ready);
+
+	pthread_mutex_lock(sb->reconf_mutex);
+	while(sb->parked_cnt < sb->consumer_cnt) {
+		pthread_cond_wait(sb->reconf_cond, sb->reconf_mutex);
+	}
+	// All consumers have left the barriers, so it is safe to replace them
+#ifdef HAVE_PTHREAD_BARRIERS
+	pthread_barrier_destroy(sb->data_ready);
+	pthread_barrier_destroy(sb->consumers_ready);
+#endif
+	XFREE(sb->data_ready);
+	XFREE(sb->consumers_ready);
+	for(size_t i = 0; i < remove_cnt; i++) {
+		ASSERT(remove[i]->consumer.in == connection);
+		remove[i]->consumer.in = NULL;
+	}
+	for(size_t i = 0; i < add_cnt; i++) {
+		ASSERT(add[i]->consumer.type == CONSUMER_MULTI);
+		add[i]->consumer.in = connection;
+	}
+	sb->consumer_cnt = sb->consumer_cnt - remove_cnt + add_cnt;
+	sb->data_ready = XCALLOC(1, sizeof(pthread_barrier_t));
+	sb->consumers_ready = XCALLOC(1, sizeof(pthread_barrier_t));
+	// consumer_cnt + 1 to account for the producer
+	ASSERT_se(pthread_barrier_create(sb->data_ready, sb->consumer_cnt + 1) == 0);
+	ASSERT_se(pthread_barrier_create(sb->consumers_ready, sb->consumer_cnt + 1) == 0);
+	connection->flags &= ~BLOCK_CONNECTION_RECONFIGURE;
+	sb->parked_cnt = 0;
+	sb->generation++;
+	pthread_cond_broadcast(sb->reconf_cond);
+	pthread_mutex_unlock(sb->reconf_mutex);
+	debug_print(D_MISC, "one2many connection reconfigured: %zu consumers (%zu added, %zu removed)\n",
+			sb->consumer_cnt, add_cnt, remove_cnt);
+}
+
+bool block_connection_is_reconfigure_signaled(struct block_connection *connection) {
+	ASSERT(connection);
+	return connection->flags & BLOCK_CONNECTION_RECONFIGURE;
+}
+
+// Called by a consumer of a one2many connection which got woken up with
+// the reconfiguration flag set. Blocks until the reconfiguration is complete.
+// Returns true if the consumer is still connected or false if it has been
+// detached (in which case its thread shall terminate).
+bool block_connection_one2many_reconfigure_wait(struct block *sink) {
+	ASSERT(sink);
+	struct shared_buffer *sb = &sink->consumer.in->shared_buffer;
+	pthread_mutex_lock(sb->reconf_mutex);
+	uint32_t generation = sb->generation;
+	sb->parked_cnt++;
+	pthread_cond_broadcast(sb->reconf_cond);
+	while(sb->generation == generation) {
+		pthread_cond_wait(sb->reconf_cond, sb->reconf_mutex);
+	}
+	bool ret = sink->consumer.in != NULL;
+	pthread_mutex_unlock(sb->reconf_mutex);
+	return ret;
+}
+
+static void *block_thread(void *ctx) {
+	struct block *block = ctx;
+	// Obtain the clock ID from within the thread - the thread is detached,
+	// so its pthread_t might already be invalid when the caller gets to it.
+	block->cpu_clock_valid = (pthread_getcpuclockid(pthread_self(), &block->cpu_clock) == 0);
+	// Don't touch the block after the thread routine returns - it might
+	// have already been destroyed by the main thread.
+	return block->thread_routine(block);
+}
+
 // Returns number of blocks successfully started
 int32_t block_start(struct block *block) {
 	ASSERT(block);
 	ASSERT(block->thread_routine);
-	int32_t ret = start_thread(&block->thread, block->thread_routine, block);
+	int32_t ret = start_thread(&block->thread, block_thread, block);
 	if(ret == 0) {
 		block->running = true;
 		return 1;
@@ -191,3 +288,16 @@ bool block_set_is_any_running(size_t block_cnt, struct block *blocks[block_cnt])
 	return false;
 }
 
+// Returns CPU time consumed by the block thread so far, in seconds.
+// When the thread is no longer running, the last value sampled while
+// it was still alive is returned, so this should be called periodically
+// to get accurate totals.
+double block_cpu_time(struct block *block) {
+	ASSERT(block);
+	struct timespec ts;
+	if(block->running && block->cpu_clock_valid && clock_gettime(block->cpu_clock, &ts) == 0) {
+		block->cpu_time = (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+	}
+	return block->cpu_time;
+}
+
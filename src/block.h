@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <complex.h>
 #include <pthread.h>
+#include <time.h>               // clockid_t
 #include <liquid/liquid.h>
 #include "config.h"
 #ifndef HAVE_PTHREAD_BARRIERS
@@ -34,6 +35,11 @@ struct shared_buffer {
 	float complex *buf;
 	pthread_barrier_t *data_ready;
 	pthread_barrier_t *consumers_ready;
+	pthread_mutex_t *reconf_mutex;      // protects the fields below
+	pthread_cond_t *reconf_cond;
+	uint32_t generation;                // incremented after each reconfiguration
+	size_t parked_cnt;                  // consumers waiting for reconfiguration to complete
+	size_t consumer_cnt;
 };
 
 struct block_connection {
@@ -46,6 +52,7 @@ struct block_connection {
 
 // Block connection flags
 #define BLOCK_CONNECTION_SHUTDOWN      (1 << 0)
+#define BLOCK_CONNECTION_RECONFIGURE   (1 << 1)
 
 struct producer {
 	struct block_connection *out;
@@ -64,6 +71,9 @@ struct block {
 	struct producer producer;
 	pthread_t thread;
 	void *(*thread_routine)(void *);
+	clockid_t cpu_clock;                // CPU time clock of the block thread
+	double cpu_time;                    // last known CPU time used by the thread (seconds)
+	bool cpu_clock_valid;
 	bool running;
 };
 
@@ -77,5 +87,11 @@ int32_t block_set_start(size_t block_cnt, struct block *block[block_cnt]);
 void block_connection_one2one_shutdown(struct block_connection *connection);
 void block_connection_one2many_shutdown(struct block_connection *connection);
 bool block_connection_is_shutdown_signaled(struct block_connection *connection);
+void block_connection_one2many_reconfigure(struct block *source,
+		size_t add_cnt, struct block *add[add_cnt],
+		size_t remove_cnt, struct block *remove[remove_cnt]);
+bool block_connection_is_reconfigure_signaled(struct block_connection *connection);
+bool block_connection_one2many_reconfigure_wait(struct block *sink);
 bool block_is_running(struct block *block);
 bool block_set_is_any_running(size_t block_cnt, struct block *blocks[block_cnt]);
+double block_cpu_time(struct block *block);
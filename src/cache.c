@@ -101,13 +101,19 @@ bool cache_entry_delete(cache *c, void *key) {
 }
 
 void *cache_entry_lookup(cache *c, void const *key) {
+	return cache_entry_lookup_at(c, key, time(NULL));
+}
+
+// Same as cache_entry_lookup, but entry expiration is checked against
+// the given timestamp instead of the current time
+void *cache_entry_lookup_at(cache *c, void const *key, time_t current_timestamp) {
 	ASSERT(c);
 	ASSERT(key);
 
 	struct cache_entry *e = la_hash_lookup(c->table, key);
 	if(e == NULL) {
 		return NULL;
-	} else if(e->created_time + c->ttl < time(NULL)) {
+	} else if(e->created_time + c->ttl < current_timestamp) {
 		debug_print(D_CACHE, "%s: key %p: entry expired\n", c->name, key);
 		return NULL;
 	}
@@ -19,5 +19,6 @@ bool cache_entry_create(cache *c, void *key, void *value,
 		time_t created_time);
 bool cache_entry_delete(cache *c, void *key);
 void *cache_entry_lookup(cache *c, void const *key);
+void *cache_entry_lookup_at(cache *c, void const *key, time_t current_timestamp);
 int32_t cache_expire(cache *c, time_t current_timestamp);
 void cache_destroy(cache *c);
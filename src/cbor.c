@@ -0,0 +1,519 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>                     // strtod, strtoll
+#include <string.h>                     // memcpy, memmove, strlen, strncmp, strchr, strpbrk
+#include <errno.h>                      // errno, ERANGE
+#include "cbor.h"
+#include "util.h"                       // ASSERT, XCALLOC, XREALLOC, XFREE, max
+
+#define CBOR_MAJOR_UINT     0
+#define CBOR_MAJOR_NEGINT   1
+#define CBOR_MAJOR_TEXT     3
+#define CBOR_MAJOR_ARRAY    4
+#define CBOR_MAJOR_MAP      5
+#define CBOR_FALSE          0xf4
+#define CBOR_TRUE           0xf5
+#define CBOR_NULL           0xf6
+#define CBOR_FLOAT64        0xfb
+
+#define JSON_DEPTH_MAX      64
+#define JSON_NUMBER_LEN_MAX 64
+
+struct json_parser {
+	char const *p;
+	char const *end;
+	int32_t depth;
+};
+
+static bool json_transcode_value(struct json_parser *jp, struct cbor_encoder *e);
+
+/******************************
+ * Encoder primitives
+ ******************************/
+
+static void cbor_reserve(struct cbor_encoder *e, size_t len) {
+	if(e->len + len > e->size) {
+		e->size = max(2 * e->size, e->len + len);
+		e->buf = XREALLOC(e->buf, e->size);
+	}
+}
+
+static void cbor_append(struct cbor_encoder *e, void const *data, size_t len) {
+	cbor_reserve(e, len);
+	memcpy(e->buf + e->len, data, len);
+	e->len += len;
+}
+
+static void cbor_append_byte(struct cbor_encoder *e, uint8_t byte) {
+	cbor_reserve(e, 1);
+	e->buf[e->len++] = byte;
+}
+
+// Encodes the initial byte and the argument of a data item.
+// Returns the number of bytes written to out (1-9).
+static size_t cbor_head_encode(uint8_t out[9], uint8_t major, uint64_t val) {
+	size_t arg_len;
+	major <<= 5;
+	if(val < 24) {
+		out[0] = major | (uint8_t)val;
+		return 1;
+	} else if(val <= UINT8_MAX) {
+		out[0] = major | 24;
+		arg_len = 1;
+	} else if(val <= UINT16_MAX) {
+		out[0] = major | 25;
+		arg_len = 2;
+	} else if(val <= UINT32_MAX) {
+		out[0] = major | 26;
+		arg_len = 4;
+	} else {
+		out[0] = major | 27;
+		arg_len = 8;
+	}
+	for(size_t i = 0; i < arg_len; i++) {
+		out[1 + i] = (uint8_t)(val >> (8 * (arg_len - 1 - i)));
+	}
+	return 1 + arg_len;
+}
+
+static void cbor_append_head(struct cbor_encoder *e, uint8_t major, uint64_t val) {
+	uint8_t head[9];
+	cbor_append(e, head, cbor_head_encode(head, major, val));
+}
+
+// Replaces the one-byte placeholder at pos with the head of a data item
+// whose length is known only after its contents have been encoded.
+static void cbor_head_fixup(struct cbor_encoder *e, size_t pos, uint8_t major, uint64_t val) {
+	uint8_t head[9];
+	size_t head_len = cbor_head_encode(head, major, val);
+	if(head_len > 1) {
+		cbor_reserve(e, head_len - 1);
+		memmove(e->buf + pos + head_len, e->buf + pos + 1, e->len - pos - 1);
+		e->len += head_len - 1;
+	}
+	memcpy(e->buf + pos, head, head_len);
+}
+
+static void cbor_append_text(struct cbor_encoder *e, char const *str, size_t len) {
+	cbor_append_head(e, CBOR_MAJOR_TEXT, len);
+	cbor_append(e, str, len);
+}
+
+static void cbor_append_uint_or_negint(struct cbor_encoder *e, int64_t val) {
+	if(val >= 0) {
+		cbor_append_head(e, CBOR_MAJOR_UINT, (uint64_t)val);
+	} else {
+		cbor_append_head(e, CBOR_MAJOR_NEGINT, (uint64_t)(-(val + 1)));
+	}
+}
+
+static void cbor_append_float64(struct cbor_encoder *e, double val) {
+	uint64_t bits;
+	memcpy(&bits, &val, sizeof(bits));
+	uint8_t out[9];
+	out[0] = CBOR_FLOAT64;
+	for(int32_t i = 0; i < 8; i++) {
+		out[1 + i] = (uint8_t)(bits >> (8 * (7 - i)));
+	}
+	cbor_append(e, out, sizeof(out));
+}
+
+// Writes the key (if any) and counts the item in the enclosing container
+static void cbor_item_start(struct cbor_encoder *e, char const *key) {
+	if(key != NULL) {
+		cbor_append_text(e, key, strlen(key));
+	}
+	if(e->depth > 0 && e->depth <= CBOR_DEPTH_MAX) {
+		e->stack[e->depth - 1].cnt++;
+	}
+}
+
+static void cbor_container_start(struct cbor_encoder *e, char const *key) {
+	cbor_item_start(e, key);
+	if(e->depth < CBOR_DEPTH_MAX) {
+		e->stack[e->depth].pos = e->len;
+		e->stack[e->depth].cnt = 0;
+	} else {
+		e->err = true;
+	}
+	e->depth++;
+	cbor_append_byte(e, 0);         // placeholder for the head
+}
+
+static void cbor_container_end(struct cbor_encoder *e, uint8_t major) {
+	ASSERT(e->depth > 0);
+	e->depth--;
+	if(e->depth < CBOR_DEPTH_MAX) {
+		struct cbor_container const *c = &e->stack[e->depth];
+		cbor_head_fixup(e, c->pos, major, c->cnt);
+	}
+}
+
+/******************************
+ * Public encoder API
+ ******************************/
+
+void cbor_encoder_init(struct cbor_encoder *e, size_t size) {
+	ASSERT(e != NULL);
+	e->size = max(size, 1);
+	e->buf = XCALLOC(e->size, sizeof(uint8_t));
+	e->len = 0;
+	e->depth = 0;
+	e->err = false;
+}
+
+void cbor_encoder_destroy(struct cbor_encoder *e) {
+	if(e == NULL) {
+		return;
+	}
+	XFREE(e->buf);
+	e->len = e->size = 0;
+}
+
+void cbor_map_start(struct cbor_encoder *e, char const *key) {
+	cbor_container_start(e, key);
+}
+
+void cbor_map_end(struct cbor_encoder *e) {
+	cbor_container_end(e, CBOR_MAJOR_MAP);
+}
+
+void cbor_array_start(struct cbor_encoder *e, char const *key) {
+	cbor_container_start(e, key);
+}
+
+void cbor_array_end(struct cbor_encoder *e) {
+	cbor_container_end(e, CBOR_MAJOR_ARRAY);
+}
+
+void cbor_append_bool(struct cbor_encoder *e, char const *key, bool val) {
+	cbor_item_start(e, key);
+	cbor_append_byte(e, val ? CBOR_TRUE : CBOR_FALSE);
+}
+
+void cbor_append_double(struct cbor_encoder *e, char const *key, double val) {
+	cbor_item_start(e, key);
+	cbor_append_float64(e, val);
+}
+
+void cbor_append_int64(struct cbor_encoder *e, char const *key, int64_t val) {
+	cbor_item_start(e, key);
+	cbor_append_uint_or_negint(e, val);
+}
+
+void cbor_append_char(struct cbor_encoder *e, char const *key, char val) {
+	cbor_item_start(e, key);
+	cbor_append_text(e, &val, 1);
+}
+
+void cbor_append_string(struct cbor_encoder *e, char const *key, char const *val) {
+	cbor_item_start(e, key);
+	if(val != NULL) {
+		cbor_append_text(e, val, strlen(val));
+	} else {
+		cbor_append_byte(e, CBOR_NULL);
+	}
+}
+
+// Same as la_json_append_octet_string - an array of byte values
+void cbor_append_octet_string(struct cbor_encoder *e, char const *key, uint8_t const *buf, size_t len) {
+	cbor_item_start(e, key);
+	cbor_append_head(e, CBOR_MAJOR_ARRAY, buf != NULL ? len : 0);
+	for(size_t i = 0; buf != NULL && i < len; i++) {
+		cbor_append_head(e, CBOR_MAJOR_UINT, buf[i]);
+	}
+}
+
+/******************************
+ * JSON transcoder
+ ******************************/
+
+// Protocol nodes which can only be serialized by libacars (eg. ACARS and its
+// payloads) are formatted as JSON and transcoded.
+
+static void cbor_append_utf8(struct cbor_encoder *e, uint32_t cp) {
+	uint8_t out[4];
+	size_t len;
+	if(cp < 0x80) {
+		out[0] = cp;
+		len = 1;
+	} else if(cp < 0x800) {
+		out[0] = 0xc0 | (cp >> 6);
+		out[1] = 0x80 | (cp & 0x3f);
+		len = 2;
+	} else if(cp < 0x10000) {
+		out[0] = 0xe0 | (cp >> 12);
+		out[1] = 0x80 | ((cp >> 6) & 0x3f);
+		out[2] = 0x80 | (cp & 0x3f);
+		len = 3;
+	} else {
+		out[0] = 0xf0 | (cp >> 18);
+		out[1] = 0x80 | ((cp >> 12) & 0x3f);
+		out[2] = 0x80 | ((cp >> 6) & 0x3f);
+		out[3] = 0x80 | (cp & 0x3f);
+		len = 4;
+	}
+	cbor_append(e, out, len);
+}
+
+static void json_skip_whitespace(struct json_parser *jp) {
+	while(jp->p < jp->end && (*jp->p == ' ' || *jp->p == '\t' || *jp->p == '\r' || *jp->p == '\n')) {
+		jp->p++;
+	}
+}
+
+static bool json_parse_hex4(struct json_parser *jp, uint32_t *result) {
+	if(jp->end - jp->p < 4) {
+		return false;
+	}
+	uint32_t val = 0;
+	for(int32_t i = 0; i < 4; i++) {
+		char c = *jp->p++;
+		val <<= 4;
+		if(c >= '0' && c <= '9') {
+			val |= c - '0';
+		} else if(c >= 'a' && c <= 'f') {
+			val |= c - 'a' + 10;
+		} else if(c >= 'A' && c <= 'F') {
+			val |= c - 'A' + 10;
+		} else {
+			return false;
+		}
+	}
+	*result = val;
+	return true;
+}
+
+static bool json_parse_escape(struct json_parser *jp, struct cbor_encoder *e) {
+	if(jp->p >= jp->end) {
+		return false;
+	}
+	char c = *jp->p++;
+	switch(c) {
+		case '"':
+		case '\\':
+		case '/':
+			cbor_append_byte(e, c);
+			return true;
+		case 'b':
+			cbor_append_byte(e, '\b');
+			return true;
+		case 'f':
+			cbor_append_byte(e, '\f');
+			return true;
+		case 'n':
+			cbor_append_byte(e, '\n');
+			return true;
+		case 'r':
+			cbor_append_byte(e, '\r');
+			return true;
+		case 't':
+			cbor_append_byte(e, '\t');
+			return true;
+		case 'u':
+			break;
+		default:
+			return false;
+	}
+	uint32_t cp = 0, lo = 0;
+	if(!json_parse_hex4(jp, &cp)) {
+		return false;
+	}
+	if(cp >= 0xd800 && cp <= 0xdbff) {
+		// High surrogate - a low surrogate must follow
+		if(jp->end - jp->p < 2 || jp->p[0] != '\\' || jp->p[1] != 'u') {
+			return false;
+		}
+		jp->p += 2;
+		if(!json_parse_hex4(jp, &lo) || lo < 0xdc00 || lo > 0xdfff) {
+			return false;
+		}
+		cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+	}
+	cbor_append_utf8(e, cp);
+	return true;
+}
+
+static bool json_transcode_string(struct json_parser *jp, struct cbor_encoder *e) {
+	if(jp->p >= jp->end || *jp->p != '"') {
+		return false;
+	}
+	jp->p++;
+	size_t start = e->len;
+	cbor_append_byte(e, 0);         // placeholder for the head
+	while(jp->p < jp->end && *jp->p != '"') {
+		// Copy unescaped characters in one go
+		char const *run = jp->p;
+		while(jp->p < jp->end && *jp->p != '"' && *jp->p != '\\') {
+			jp->p++;
+		}
+		cbor_append(e, run, jp->p - run);
+		if(jp->p < jp->end && *jp->p == '\\') {
+			jp->p++;
+			if(!json_parse_escape(jp, e)) {
+				return false;
+			}
+		}
+	}
+	if(jp->p >= jp->end) {
+		return false;
+	}
+	jp->p++;        // closing quote
+	cbor_head_fixup(e, start, CBOR_MAJOR_TEXT, e->len - start - 1);
+	return true;
+}
+
+// Integers are encoded as CBOR integers, everything else as 64-bit floats.
+// strtod() also handles "nan" and "inf", which JSON does not allow, but
+// libacars may produce them when formatting doubles.
+static bool json_transcode_number(struct json_parser *jp, struct cbor_encoder *e) {
+	char const *start = jp->p;
+	while(jp->p < jp->end && strchr(",]} \t\r\n", *jp->p) == NULL) {
+		jp->p++;
+	}
+	size_t len = jp->p - start;
+	if(len == 0 || len >= JSON_NUMBER_LEN_MAX) {
+		return false;
+	}
+	char tmp[JSON_NUMBER_LEN_MAX];
+	memcpy(tmp, start, len);
+	tmp[len] = '\0';
+	char *endptr = NULL;
+	if(strpbrk(tmp, ".eEnNiI") == NULL) {
+		errno = 0;
+		long long val = strtoll(tmp, &endptr, 10);
+		if(*endptr == '\0' && errno != ERANGE) {
+			cbor_append_uint_or_negint(e, val);
+			return true;
+		}
+	}
+	double val = strtod(tmp, &endptr);
+	if(*endptr != '\0') {
+		return false;
+	}
+	cbor_append_float64(e, val);
+	return true;
+}
+
+static bool json_match_literal(struct json_parser *jp, char const *literal) {
+	size_t len = strlen(literal);
+	if((size_t)(jp->end - jp->p) >= len && strncmp(jp->p, literal, len) == 0) {
+		jp->p += len;
+		return true;
+	}
+	return false;
+}
+
+// Transcodes members of a JSON object or elements of an array, up to the
+// closing bracket. Returns the number of members or -1 on error.
+static int64_t json_transcode_members(struct json_parser *jp, struct cbor_encoder *e, bool is_map) {
+	char const closing = is_map ? '}' : ']';
+	int64_t cnt = 0;
+	json_skip_whitespace(jp);
+	if(jp->p < jp->end && *jp->p == closing) {
+		jp->p++;
+		return 0;
+	}
+	while(true) {
+		if(is_map) {
+			json_skip_whitespace(jp);
+			if(!json_transcode_string(jp, e)) {
+				return -1;
+			}
+			json_skip_whitespace(jp);
+			if(jp->p >= jp->end || *jp->p != ':') {
+				return -1;
+			}
+			jp->p++;
+		}
+		if(!json_transcode_value(jp, e)) {
+			return -1;
+		}
+		cnt++;
+		json_skip_whitespace(jp);
+		if(jp->p >= jp->end) {
+			return -1;
+		}
+		char c = *jp->p++;
+		if(c == closing) {
+			return cnt;
+		} else if(c != ',') {
+			return -1;
+		}
+	}
+}
+
+static bool json_transcode_container(struct json_parser *jp, struct cbor_encoder *e, bool is_map) {
+	if(++jp->depth > JSON_DEPTH_MAX) {
+		return false;
+	}
+	jp->p++;        // opening bracket
+	size_t start = e->len;
+	cbor_append_byte(e, 0);         // placeholder for the head
+	int64_t cnt = json_transcode_members(jp, e, is_map);
+	if(cnt < 0) {
+		return false;
+	}
+	cbor_head_fixup(e, start, is_map ? CBOR_MAJOR_MAP : CBOR_MAJOR_ARRAY, cnt);
+	jp->depth--;
+	return true;
+}
+
+static bool json_transcode_value(struct json_parser *jp, struct cbor_encoder *e) {
+	json_skip_whitespace(jp);
+	if(jp->p >= jp->end) {
+		return false;
+	}
+	switch(*jp->p) {
+		case '{':
+			return json_transcode_container(jp, e, true);
+		case '[':
+			return json_transcode_container(jp, e, false);
+		case '"':
+			return json_transcode_string(jp, e);
+		default:
+			break;
+	}
+	if(json_match_literal(jp, "true")) {
+		cbor_append_byte(e, CBOR_TRUE);
+	} else if(json_match_literal(jp, "false")) {
+		cbor_append_byte(e, CBOR_FALSE);
+	} else if(json_match_literal(jp, "null")) {
+		cbor_append_byte(e, CBOR_NULL);
+	} else {
+		return json_transcode_number(jp, e);
+	}
+	return true;
+}
+
+// Transcodes members of a JSON object and puts them into the map
+// which is currently open. On error, sets the error flag of the encoder
+// and returns false.
+bool cbor_append_json_members(struct cbor_encoder *e, char const *json, size_t len) {
+	ASSERT(e != NULL);
+	ASSERT(json != NULL);
+	struct json_parser jp = {
+		.p = json,
+		.end = json + len,
+		.depth = 1
+	};
+	json_skip_whitespace(&jp);
+	if(jp.p >= jp.end || *jp.p != '{') {
+		goto fail;
+	}
+	jp.p++;
+	int64_t cnt = json_transcode_members(&jp, e, true);
+	json_skip_whitespace(&jp);
+	if(cnt < 0 || jp.p != jp.end) {
+		goto fail;
+	}
+	if(e->depth > 0 && e->depth <= CBOR_DEPTH_MAX) {
+		e->stack[e->depth - 1].cnt += cnt;
+	}
+	return true;
+fail:
+	debug_print(D_OUTPUT, "could not transcode JSON to CBOR (error at offset %td)\n", jp.p - json);
+	e->err = true;
+	return false;
+}
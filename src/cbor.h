@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>                     // size_t
+
+// Minimal CBOR (RFC 8949) encoder. The API mirrors libacars la_json_*
+// routines - a key is required for items put into maps and must be NULL
+// for items put into arrays. Maps and arrays are definite-length.
+
+#define CBOR_DEPTH_MAX 64
+
+struct cbor_container {
+	size_t pos;                         // position of the head in the buffer
+	uint64_t cnt;                       // number of items (or key/value pairs)
+};
+
+struct cbor_encoder {
+	uint8_t *buf;
+	size_t len;
+	size_t size;
+	int32_t depth;
+	bool err;                           // containers nested too deeply or a transcoding error
+	struct cbor_container stack[CBOR_DEPTH_MAX];
+};
+
+void cbor_encoder_init(struct cbor_encoder *e, size_t size);
+void cbor_encoder_destroy(struct cbor_encoder *e);
+void cbor_map_start(struct cbor_encoder *e, char const *key);
+void cbor_map_end(struct cbor_encoder *e);
+void cbor_array_start(struct cbor_encoder *e, char const *key);
+void cbor_array_end(struct cbor_encoder *e);
+void cbor_append_bool(struct cbor_encoder *e, char const *key, bool val);
+void cbor_append_double(struct cbor_encoder *e, char const *key, double val);
+void cbor_append_int64(struct cbor_encoder *e, char const *key, int64_t val);
+void cbor_append_char(struct cbor_encoder *e, char const *key, char val);
+void cbor_append_string(struct cbor_encoder *e, char const *key, char const *val);
+void cbor_append_octet_string(struct cbor_encoder *e, char const *key, uint8_t const *buf, size_t len);
+bool cbor_append_json_members(struct cbor_encoder *e, char const *json, size_t len);
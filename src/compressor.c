@@ -0,0 +1,283 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>                      // FILE, fprintf, fwrite
+#include <string.h>                     // strcmp
+#include "config.h"                     // WITH_ZLIB, WITH_ZSTD
+#ifdef WITH_ZLIB
+#include <zlib.h>                       // deflate*, z_stream
+#endif
+#ifdef WITH_ZSTD
+#include <zstd.h>                       // ZSTD_*
+#endif
+#include "compressor.h"
+#include "util.h"                       // ASSERT, NEW, XCALLOC, XFREE, UNUSED
+
+// Streaming compressor writing to a stdio stream.
+// compressor_flush() makes all data written so far decodable (it does not
+// end the gzip member or zstd frame), so that a file which has not been
+// closed properly (eg. after a crash) can still be decompressed up to the
+// last flush. compressor_finish() ends the member / frame.
+
+#define COMPRESSOR_OUTBUF_LEN 65536
+
+struct compressor {
+	compressor_type type;
+	FILE *fh;
+	uint8_t *outbuf;
+	size_t outbuf_len;
+	struct compressor_stats stats;
+	bool failed;                        // an error has been reported already
+#ifdef WITH_ZLIB
+	z_stream zs;
+#endif
+#ifdef WITH_ZSTD
+	ZSTD_CCtx *cctx;
+#endif
+};
+
+/******************************
+ * Forward declarations
+ ******************************/
+
+#ifdef WITH_ZLIB
+static int32_t gzip_compress(struct compressor *c, uint8_t const *buf, size_t len, int32_t flush);
+#endif
+#ifdef WITH_ZSTD
+static int32_t zstd_compress(struct compressor *c, uint8_t const *buf, size_t len, ZSTD_EndDirective mode);
+#endif
+
+/******************************
+ * Public methods
+ ******************************/
+
+compressor_type compressor_type_from_string(char const *str) {
+	ASSERT(str != NULL);
+	if(!strcmp(str, "none")) {
+		return COMPRESSOR_NONE;
+	} else if(!strcmp(str, "gzip")) {
+		return COMPRESSOR_GZIP;
+	} else if(!strcmp(str, "zstd")) {
+		return COMPRESSOR_ZSTD;
+	}
+	return COMPRESSOR_UNKNOWN;
+}
+
+bool compressor_is_available(compressor_type type) {
+	switch(type) {
+		case COMPRESSOR_NONE:
+			return true;
+#ifdef WITH_ZLIB
+		case COMPRESSOR_GZIP:
+			return true;
+#endif
+#ifdef WITH_ZSTD
+		case COMPRESSOR_ZSTD:
+			return true;
+#endif
+		default:
+			return false;
+	}
+}
+
+char const *compressor_file_suffix(compressor_type type) {
+	switch(type) {
+		case COMPRESSOR_GZIP:
+			return ".gz";
+		case COMPRESSOR_ZSTD:
+			return ".zst";
+		default:
+			return "";
+	}
+}
+
+int32_t compressor_level_max(compressor_type type) {
+	switch(type) {
+		case COMPRESSOR_GZIP:
+			return 9;
+		case COMPRESSOR_ZSTD:
+			return 19;          // higher levels need --ultra to decompress with zstd CLI
+		default:
+			return 0;
+	}
+}
+
+// level == 0 selects the default compression level of the library
+struct compressor *compressor_create(compressor_type type, int32_t level, FILE *fh) {
+	ASSERT(fh != NULL);
+	ASSERT(compressor_is_available(type));
+	ASSERT(type != COMPRESSOR_NONE);
+	NEW(struct compressor, c);
+	c->type = type;
+	c->fh = fh;
+#ifdef WITH_ZLIB
+	if(type == COMPRESSOR_GZIP) {
+		// windowBits + 16 - produce gzip header and trailer instead of zlib ones
+		int32_t ret = deflateInit2(&c->zs, level > 0 ? level : Z_DEFAULT_COMPRESSION,
+				Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+		if(ret != Z_OK) {
+			fprintf(stderr, "compressor: deflateInit2 failed: %d\n", ret);
+			goto fail;
+		}
+		c->outbuf_len = COMPRESSOR_OUTBUF_LEN;
+	}
+#endif
+#ifdef WITH_ZSTD
+	if(type == COMPRESSOR_ZSTD) {
+		if((c->cctx = ZSTD_createCCtx()) == NULL) {
+			fprintf(stderr, "compressor: could not create zstd context\n");
+			goto fail;
+		}
+		if(level > 0) {
+			size_t ret = ZSTD_CCtx_setParameter(c->cctx, ZSTD_c_compressionLevel, level);
+			if(ZSTD_isError(ret)) {
+				fprintf(stderr, "compressor: could not set zstd compression level: %s\n",
+						ZSTD_getErrorName(ret));
+				ZSTD_freeCCtx(c->cctx);
+				goto fail;
+			}
+		}
+		c->outbuf_len = ZSTD_CStreamOutSize();
+	}
+#endif
+	c->outbuf = XCALLOC(c->outbuf_len, sizeof(uint8_t));
+	return c;
+fail:
+	XFREE(c);
+	return NULL;
+}
+
+int32_t compressor_write(struct compressor *c, uint8_t const *buf, size_t len) {
+	ASSERT(c != NULL);
+	c->stats.bytes_in += len;
+	switch(c->type) {
+#ifdef WITH_ZLIB
+		case COMPRESSOR_GZIP:
+			return gzip_compress(c, buf, len, Z_NO_FLUSH);
+#endif
+#ifdef WITH_ZSTD
+		case COMPRESSOR_ZSTD:
+			return zstd_compress(c, buf, len, ZSTD_e_continue);
+#endif
+		default:
+			UNUSED(buf);
+			return -1;
+	}
+}
+
+int32_t compressor_flush(struct compressor *c) {
+	ASSERT(c != NULL);
+	switch(c->type) {
+#ifdef WITH_ZLIB
+		case COMPRESSOR_GZIP:
+			return gzip_compress(c, NULL, 0, Z_SYNC_FLUSH);
+#endif
+#ifdef WITH_ZSTD
+		case COMPRESSOR_ZSTD:
+			return zstd_compress(c, NULL, 0, ZSTD_e_flush);
+#endif
+		default:
+			return -1;
+	}
+}
+
+int32_t compressor_finish(struct compressor *c) {
+	ASSERT(c != NULL);
+	switch(c->type) {
+#ifdef WITH_ZLIB
+		case COMPRESSOR_GZIP:
+			return gzip_compress(c, NULL, 0, Z_FINISH);
+#endif
+#ifdef WITH_ZSTD
+		case COMPRESSOR_ZSTD:
+			return zstd_compress(c, NULL, 0, ZSTD_e_end);
+#endif
+		default:
+			return -1;
+	}
+}
+
+struct compressor_stats const *compressor_stats(struct compressor const *c) {
+	ASSERT(c != NULL);
+	return &c->stats;
+}
+
+void compressor_destroy(struct compressor *c) {
+	if(c == NULL) {
+		return;
+	}
+#ifdef WITH_ZLIB
+	if(c->type == COMPRESSOR_GZIP) {
+		deflateEnd(&c->zs);
+	}
+#endif
+#ifdef WITH_ZSTD
+	if(c->type == COMPRESSOR_ZSTD) {
+		ZSTD_freeCCtx(c->cctx);
+	}
+#endif
+	XFREE(c->outbuf);
+	XFREE(c);
+}
+
+/****************************************
+ * Private variables and methods
+ ****************************************/
+
+static int32_t compressor_output(struct compressor *c, size_t len) {
+	if(len == 0) {
+		return 0;
+	}
+	c->stats.bytes_out += len;
+	if(fwrite(c->outbuf, sizeof(uint8_t), len, c->fh) != len) {
+		if(!c->failed) {
+			perror("compressor: write error");
+			c->failed = true;
+		}
+		return -1;
+	}
+	return 0;
+}
+
+#ifdef WITH_ZLIB
+static int32_t gzip_compress(struct compressor *c, uint8_t const *buf, size_t len, int32_t flush) {
+	int32_t result = 0;
+	c->zs.next_in = (Bytef *)buf;
+	c->zs.avail_in = len;
+	do {
+		c->zs.next_out = c->outbuf;
+		c->zs.avail_out = c->outbuf_len;
+		if(deflate(&c->zs, flush) == Z_STREAM_ERROR) {
+			fprintf(stderr, "compressor: deflate failed\n");
+			return -1;
+		}
+		if(compressor_output(c, c->outbuf_len - c->zs.avail_out) < 0) {
+			result = -1;
+		}
+	} while(c->zs.avail_out == 0);
+	return result;
+}
+#endif
+
+#ifdef WITH_ZSTD
+static int32_t zstd_compress(struct compressor *c, uint8_t const *buf, size_t len, ZSTD_EndDirective mode) {
+	int32_t result = 0;
+	ZSTD_inBuffer in = { .src = buf, .size = len, .pos = 0 };
+	bool done = false;
+	do {
+		ZSTD_outBuffer out = { .dst = c->outbuf, .size = c->outbuf_len, .pos = 0 };
+		size_t remaining = ZSTD_compressStream2(c->cctx, &out, &in, mode);
+		if(ZSTD_isError(remaining)) {
+			fprintf(stderr, "compressor: zstd error: %s\n", ZSTD_getErrorName(remaining));
+			return -1;
+		}
+		if(compressor_output(c, out.pos) < 0) {
+			result = -1;
+		}
+		// When flushing or ending the frame, the call must be repeated until
+		// everything has been written out. Otherwise, until the input is consumed.
+		done = (mode == ZSTD_e_continue) ? (in.pos == in.size) : (remaining == 0);
+	} while(!done);
+	return result;
+}
+#endif
@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>                      // FILE
+
+typedef enum {
+	COMPRESSOR_UNKNOWN = -1,
+	COMPRESSOR_NONE = 0,
+	COMPRESSOR_GZIP,
+	COMPRESSOR_ZSTD
+} compressor_type;
+
+struct compressor_stats {
+	uint64_t bytes_in;                  // uncompressed data
+	uint64_t bytes_out;                 // compressed data
+};
+
+struct compressor;
+
+compressor_type compressor_type_from_string(char const *str);
+bool compressor_is_available(compressor_type type);
+char const *compressor_file_suffix(compressor_type type);
+int32_t compressor_level_max(compressor_type type);
+struct compressor *compressor_create(compressor_type type, int32_t level, FILE *fh);
+int32_t compressor_write(struct compressor *c, uint8_t const *buf, size_t len);
+int32_t compressor_flush(struct compressor *c);
+int32_t compressor_finish(struct compressor *c);
+struct compressor_stats const *compressor_stats(struct compressor const *c);
+void compressor_destroy(struct compressor *c);
@@ -0,0 +1,306 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>              // fprintf, vsnprintf
+#include <stdarg.h>             // va_list
+#include <stdlib.h>             // strtod
+#include <string.h>             // strerror, strtok_r, strcmp, memmove
+#include <errno.h>              // errno
+#include <unistd.h>             // read, write, close, unlink, usleep
+#include <pthread.h>            // pthread_t
+#include <poll.h>               // poll
+#include <sys/socket.h>         // socket, bind, listen, accept
+#include <sys/un.h>             // struct sockaddr_un
+#include "control.h"
+#include "frontend.h"           // frontend_*
+#include "globals.h"            // do_exit
+#include "util.h"               // ASSERT, NEW, XCALLOC, XFREE, HZ_TO_KHZ, start_thread
+
+#define CONTROL_POLL_TIMEOUT_MS 500
+#define CONTROL_LINE_LEN_MAX 1024
+#define CONTROL_ARGS_MAX 64
+
+struct control_ctx {
+	char *path;
+	struct frontend **frontends;
+	int32_t frontend_cnt;
+	int32_t sockfd;
+	bool running;
+};
+
+static struct control_ctx *Control = NULL;
+
+static void control_reply(int32_t fd, char const *fmt, ...) {
+	char buf[CONTROL_LINE_LEN_MAX];
+	va_list ap;
+	va_start(ap, fmt);
+	int32_t len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if(len < 0) {
+		return;
+	}
+	if((size_t)len >= sizeof(buf)) {
+		len = sizeof(buf) - 1;
+	}
+	// Errors are ignored - the client will notice a broken connection anyway
+	if(write(fd, buf, len) < 0) {
+		debug_print(D_MISC, "write error: %s\n", strerror(errno));
+	}
+}
+
+static bool parse_freq(char const *str, int32_t *result) {
+	char *endptr = NULL;
+	double val = strtod(str, &endptr);
+	if(endptr == str || *endptr != '\0' || val <= 0.0) {
+		return false;
+	}
+	*result = (int32_t)(1e3 * val);
+	return true;
+}
+
+static struct frontend *control_find_frontend_by_channel(struct control_ctx *ctx, int32_t freq) {
+	for(int32_t i = 0; i < ctx->frontend_cnt; i++) {
+		if(frontend_has_channel(ctx->frontends[i], freq)) {
+			return ctx->frontends[i];
+		}
+	}
+	return NULL;
+}
+
+static struct frontend *control_find_frontend_by_span(struct control_ctx *ctx, int32_t freq) {
+	for(int32_t i = 0; i < ctx->frontend_cnt; i++) {
+		if(frontend_frequency_in_span(ctx->frontends[i], freq)) {
+			return ctx->frontends[i];
+		}
+	}
+	return NULL;
+}
+
+static void control_cmd_list(struct control_ctx *ctx, int32_t fd) {
+	for(int32_t i = 0; i < ctx->frontend_cnt; i++) {
+		struct frontend *fe = ctx->frontends[i];
+		int32_t cnt = 0;
+		int32_t *freqs = frontend_get_channel_list(fe, &cnt);
+		control_reply(fd, "input %d (%s, %.3f kHz +/- %.3f kHz): %d channel(s):",
+				fe->id, fe->input_cfg->source, HZ_TO_KHZ(fe->input_cfg->centerfreq),
+				HZ_TO_KHZ(fe->input_cfg->sample_rate / 2), cnt);
+		for(int32_t j = 0; j < cnt; j++) {
+			control_reply(fd, " %.3f", HZ_TO_KHZ(freqs[j]));
+		}
+		control_reply(fd, "\n");
+		XFREE(freqs);
+	}
+	control_reply(fd, "OK\n");
+}
+
+// Handles "add" and "remove" commands. All frequencies are validated
+// before any change is made. Then each affected input is reconfigured once.
+static void control_cmd_change(struct control_ctx *ctx, int32_t fd, bool add, int32_t argc, char **argv) {
+	if(argc < 1) {
+		control_reply(fd, "ERR no frequencies given\n");
+		return;
+	}
+	int32_t freqs[argc];
+	struct frontend *targets[argc];
+	for(int32_t i = 0; i < argc; i++) {
+		if(parse_freq(argv[i], &freqs[i]) == false) {
+			control_reply(fd, "ERR '%s': not a valid frequency\n", argv[i]);
+			return;
+		}
+		for(int32_t j = 0; j < i; j++) {
+			if(freqs[j] == freqs[i]) {
+				control_reply(fd, "ERR %.3f kHz: given more than once\n", HZ_TO_KHZ(freqs[i]));
+				return;
+			}
+		}
+		struct frontend *fe = control_find_frontend_by_channel(ctx, freqs[i]);
+		if(add) {
+			if(fe != NULL) {
+				control_reply(fd, "ERR %.3f kHz: channel already exists on input %d\n",
+						HZ_TO_KHZ(freqs[i]), fe->id);
+				return;
+			}
+			if((fe = control_find_frontend_by_span(ctx, freqs[i])) == NULL) {
+				control_reply(fd, "ERR %.3f kHz: not within the band of any input\n",
+						HZ_TO_KHZ(freqs[i]));
+				return;
+			}
+		} else if(fe == NULL) {
+			control_reply(fd, "ERR %.3f kHz: no such channel\n", HZ_TO_KHZ(freqs[i]));
+			return;
+		}
+		targets[i] = fe;
+	}
+	for(int32_t i = 0; i < ctx->frontend_cnt; i++) {
+		struct frontend *fe = ctx->frontends[i];
+		int32_t list[argc];
+		int32_t cnt = 0;
+		for(int32_t j = 0; j < argc; j++) {
+			if(targets[j] == fe) {
+				list[cnt++] = freqs[j];
+			}
+		}
+		if(cnt == 0) {
+			continue;
+		}
+		double pause = 0.0;
+		int32_t ret = add ?
+			frontend_reconfigure(fe, cnt, list, 0, NULL, &pause) :
+			frontend_reconfigure(fe, 0, NULL, cnt, list, &pause);
+		if(ret < 0) {
+			control_reply(fd, "ERR input %d: reconfiguration failed\n", fe->id);
+			return;
+		}
+		fprintf(stderr, "input %d: %d channel(s) %s, processing paused for %.3f ms\n",
+				fe->id, cnt, add ? "added" : "removed", pause * 1e3);
+		control_reply(fd, "input %d: %d channel(s) %s, processing paused for %.3f ms\n",
+				fe->id, cnt, add ? "added" : "removed", pause * 1e3);
+	}
+	control_reply(fd, "OK\n");
+}
+
+static void control_cmd_help(int32_t fd) {
+	control_reply(fd,
+			"list                            list inputs and their channels\n"
+			"add <freq_1> [<freq_2> [...]]   add channels (frequencies in kHz)\n"
+			"remove <freq_1> [<freq_2> [...]]  remove channels (frequencies in kHz)\n"
+			"OK\n");
+}
+
+static void control_handle_line(struct control_ctx *ctx, int32_t fd, char *line) {
+	char *argv[CONTROL_ARGS_MAX];
+	int32_t argc = 0;
+	char *saveptr = NULL;
+	for(char *tok = strtok_r(line, " \t\r", &saveptr); tok != NULL; tok = strtok_r(NULL, " \t\r", &saveptr)) {
+		if(argc == CONTROL_ARGS_MAX) {
+			control_reply(fd, "ERR too many arguments\n");
+			return;
+		}
+		argv[argc++] = tok;
+	}
+	if(argc == 0) {
+		return;
+	}
+	debug_print(D_MISC, "command: %s, %d args\n", argv[0], argc - 1);
+	if(strcmp(argv[0], "list") == 0) {
+		control_cmd_list(ctx, fd);
+	} else if(strcmp(argv[0], "add") == 0) {
+		control_cmd_change(ctx, fd, true, argc - 1, argv + 1);
+	} else if(strcmp(argv[0], "remove") == 0) {
+		control_cmd_change(ctx, fd, false, argc - 1, argv + 1);
+	} else if(strcmp(argv[0], "help") == 0) {
+		control_cmd_help(fd);
+	} else {
+		control_reply(fd, "ERR unknown command '%s' (try 'help')\n", argv[0]);
+	}
+}
+
+static void control_handle_client(struct control_ctx *ctx, int32_t fd) {
+	char buf[CONTROL_LINE_LEN_MAX];
+	size_t len = 0;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	while(do_exit == 0) {
+		int32_t ret = poll(&pfd, 1, CONTROL_POLL_TIMEOUT_MS);
+		if(ret < 0 && errno != EINTR) {
+			break;
+		} else if(ret <= 0) {
+			continue;
+		}
+		ssize_t n = read(fd, buf + len, sizeof(buf) - 1 - len);
+		if(n <= 0) {
+			break;
+		}
+		len += n;
+		buf[len] = '\0';
+		char *eol;
+		while((eol = strchr(buf, '\n')) != NULL) {
+			*eol = '\0';
+			control_handle_line(ctx, fd, buf);
+			len -= eol + 1 - buf;
+			memmove(buf, eol + 1, len + 1);
+		}
+		if(len == sizeof(buf) - 1) {
+			control_reply(fd, "ERR line too long\n");
+			break;
+		}
+	}
+	close(fd);
+}
+
+static void *control_thread(void *arg) {
+	ASSERT(arg != NULL);
+	struct control_ctx *ctx = arg;
+	struct pollfd pfd = { .fd = ctx->sockfd, .events = POLLIN };
+	while(do_exit == 0) {
+		int32_t ret = poll(&pfd, 1, CONTROL_POLL_TIMEOUT_MS);
+		if(ret <= 0) {
+			continue;
+		}
+		int32_t fd = accept(ctx->sockfd, NULL, NULL);
+		if(fd < 0) {
+			debug_print(D_MISC, "accept failed: %s\n", strerror(errno));
+			continue;
+		}
+		// One client at a time - this is an administrative interface
+		control_handle_client(ctx, fd);
+	}
+	close(ctx->sockfd);
+	ctx->running = false;
+	return NULL;
+}
+
+// Starts a thread serving the control socket at the given path.
+// Returns 0 on success, -1 on failure.
+int32_t control_socket_start(char const *path, int32_t frontend_cnt, struct frontend **frontends) {
+	ASSERT(path != NULL);
+	ASSERT(frontends != NULL);
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Control socket path %s is too long\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	int32_t sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(sockfd < 0) {
+		fprintf(stderr, "Could not create control socket: %s\n", strerror(errno));
+		return -1;
+	}
+	// Remove a stale socket left behind by a previous run
+	unlink(path);
+	if(bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sockfd, 1) < 0) {
+		fprintf(stderr, "Could not bind control socket to %s: %s\n", path, strerror(errno));
+		close(sockfd);
+		return -1;
+	}
+	NEW(struct control_ctx, ctx);
+	ctx->path = strdup(path);
+	ctx->frontends = frontends;
+	ctx->frontend_cnt = frontend_cnt;
+	ctx->sockfd = sockfd;
+	ctx->running = true;
+	pthread_t th;
+	if(start_thread(&th, control_thread, ctx) != 0) {
+		close(sockfd);
+		unlink(path);
+		XFREE(ctx->path);
+		XFREE(ctx);
+		return -1;
+	}
+	Control = ctx;
+	fprintf(stderr, "Control socket listening on %s\n", path);
+	return 0;
+}
+
+// Waits for the control thread to terminate (which happens shortly after
+// do_exit is set) and removes the socket file. Must be called before the
+// frontends are destroyed.
+void control_socket_stop(void) {
+	if(Control != NULL) {
+		while(Control->running) {
+			usleep(100000);
+		}
+		unlink(Control->path);
+		XFREE(Control->path);
+		XFREE(Control);
+	}
+}
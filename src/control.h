@@ -0,0 +1,7 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdint.h>
+#include "frontend.h"           // struct frontend
+
+int32_t control_socket_start(char const *path, int32_t frontend_cnt, struct frontend **frontends);
+void control_socket_stop(void);
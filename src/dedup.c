@@ -0,0 +1,261 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>               // struct timeval, gettimeofday
+#include <pthread.h>                // pthread_mutex_*, pthread_cond_*
+#include <glib.h>                   // GHashTable, g_hash_table_*, GQueue, g_queue_*
+#include "util.h"                   // NEW, ASSERT, XFREE, debug_print, pthread_*_initialize,
+                                    // pthread_cond_wait_ms
+#include "dedup.h"
+
+// Frame deduplicator.
+// The same transmission is often received on more than one channel (eg. on
+// adjacent frequencies, harmonics or via several inputs covering the same
+// frequency). Duplicates are detected by looking up a hash of the frame
+// payload in a set of frames seen during the last few seconds. Only the
+// payload is hashed, so receiver-specific data (frequency, signal level,
+// timestamp) does not affect the result. The set is shared by all decoder
+// threads, as copies from different channels may be processed by different
+// threads.
+// The first copy of a frame is not passed on right away. A copy of it is held
+// for the duration of the window. Later copies are dropped, but if one of them
+// has a better signal, it replaces the held one. When the window elapses, the
+// held copy is returned by dedup_release(), so that the best received copy
+// gets decoded and logged.
+// The window is measured with frame reception timestamps, not with the
+// current time, so the result does not depend on how long the frame has
+// been waiting for the decoder and it is the same when replaying old frames.
+// When receiving live, the current time also advances the clock, so that held
+// frames are released when no new frames arrive.
+// Some frames are legitimately transmitted on several channels with the same
+// contents (eg. squitters, which a ground station broadcasts on each of its
+// frequencies). The caller may request such frames to be deduplicated only
+// within a channel - the frequency is then made a part of the key.
+
+struct dedup {
+	GHashTable *seen;               // struct dedup_key -> struct dedup_entry
+	GQueue *held;                   // struct dedup_entry, oldest first
+	struct dedup_vtable const *vtable;
+	int64_t window;                 // microseconds
+	int64_t clock;                  // latest reception timestamp seen (microseconds)
+	pthread_mutex_t lock;
+	pthread_cond_t cond;            // signaled when a held frame becomes due
+	uint64_t duplicate_cnt;
+	bool realtime;
+	bool closed;
+};
+
+struct dedup_key {
+	uint64_t hash;
+	uint32_t len;
+	int32_t freq;                   // 0, unless deduplicating per channel
+};
+
+struct dedup_entry {
+	struct dedup_key key;
+	int64_t deadline;               // when the held frame is to be released
+	void *frame;                    // the best copy received so far
+	int32_t freq;                   // reception details of the held copy
+	float snr;
+};
+
+/******************************
+ * Forward declarations
+ ******************************/
+
+static uint64_t dedup_payload_hash(uint8_t const *buf, uint32_t len);
+static guint dedup_key_hash(gconstpointer key);
+static gboolean dedup_key_compare(gconstpointer key1, gconstpointer key2);
+static int64_t dedup_clock(struct dedup *d);
+
+/******************************
+ * Public methods
+ ******************************/
+
+// window - number of seconds during which copies of the frame are treated
+// as duplicates (and for which the first copy is held)
+// realtime - true if frames are being received live (reception timestamps
+// follow the current time)
+struct dedup *dedup_create(time_t window, bool realtime, struct dedup_vtable const *vtable) {
+	ASSERT(window > 0);
+	ASSERT(vtable != NULL);
+	ASSERT(vtable->frame_copy != NULL);
+	ASSERT(vtable->frame_destroy != NULL);
+	NEW(struct dedup, d);
+	d->seen = g_hash_table_new(dedup_key_hash, dedup_key_compare);
+	d->held = g_queue_new();
+	d->vtable = vtable;
+	d->window = (int64_t)window * 1000000;
+	d->realtime = realtime;
+	ASSERT(pthread_mutex_initialize(&d->lock) == 0);
+	ASSERT(pthread_cond_initialize(&d->cond) == 0);
+	return d;
+}
+
+// Checks whether the frame has already been received within the window.
+// If per_channel is true, only copies received on the same frequency are
+// considered duplicates. frame is an opaque caller's object describing the
+// received frame - it is copied with frame_copy() when it has to be held.
+// Returns:
+// DEDUP_HELD - this is the first copy - it has been held
+// DEDUP_DUPLICATE - a copy is already held - the frame shall be dropped.
+//   If it has a better signal than the held copy, it replaces it and the
+//   held copy is dropped instead. The frequency of the dropped copy is
+//   stored in *dropped_freq.
+// DEDUP_PASS - this is the first copy, but the deduplicator has been closed,
+//   so the frame shall be processed immediately
+enum dedup_result dedup_check(struct dedup *d, uint8_t const *buf, uint32_t len, struct timeval rx_timestamp,
+		int32_t freq, float snr, bool per_channel, void const *frame, int32_t *dropped_freq) {
+	ASSERT(d != NULL);
+	ASSERT(buf != NULL);
+	ASSERT(dropped_freq != NULL);
+
+	struct dedup_key key = {
+		.hash = dedup_payload_hash(buf, len),
+		.len = len,
+		.freq = per_channel ? freq : 0
+	};
+	int64_t ts = (int64_t)rx_timestamp.tv_sec * 1000000 + rx_timestamp.tv_usec;
+	enum dedup_result result;
+	pthread_mutex_lock(&d->lock);
+	if(ts > d->clock) {
+		d->clock = ts;
+	}
+	struct dedup_entry *e = g_hash_table_lookup(d->seen, &key);
+	if(e != NULL) {
+		debug_print(D_MISC, "%d: duplicate of frame received on %d (SNR %.1f dB vs %.1f dB)\n",
+				freq, e->freq, snr, e->snr);
+		*dropped_freq = freq;
+		if(snr > e->snr) {
+			*dropped_freq = e->freq;
+			d->vtable->frame_destroy(e->frame);
+			e->frame = d->vtable->frame_copy(frame);
+			e->freq = freq;
+			e->snr = snr;
+		}
+		d->duplicate_cnt++;
+		result = DEDUP_DUPLICATE;
+	} else if(d->closed) {
+		result = DEDUP_PASS;
+	} else {
+		NEW(struct dedup_entry, entry);
+		entry->key = key;
+		entry->deadline = ts + d->window;
+		entry->frame = d->vtable->frame_copy(frame);
+		entry->freq = freq;
+		entry->snr = snr;
+		g_hash_table_insert(d->seen, &entry->key, entry);
+		g_queue_push_tail(d->held, entry);
+		result = DEDUP_HELD;
+	}
+	struct dedup_entry *oldest = g_queue_peek_head(d->held);
+	if(oldest != NULL && oldest->deadline <= d->clock) {
+		pthread_cond_signal(&d->cond);
+	}
+	pthread_mutex_unlock(&d->lock);
+	return result;
+}
+
+// Waits up to timeout_ms for the window of the oldest held frame to elapse.
+// If it does, the frame is stored in *frame and the caller takes it over.
+// Otherwise *frame is set to NULL. After dedup_close(), all held frames are
+// returned without waiting. Returns false when the deduplicator is closed and
+// there are no more held frames.
+bool dedup_release(struct dedup *d, int32_t timeout_ms, void **frame) {
+	ASSERT(d != NULL);
+	ASSERT(frame != NULL);
+	*frame = NULL;
+	pthread_mutex_lock(&d->lock);
+	struct dedup_entry *e = g_queue_peek_head(d->held);
+	if(!d->closed && (e == NULL || e->deadline > dedup_clock(d))) {
+		pthread_cond_wait_ms(&d->cond, &d->lock, timeout_ms);
+		e = g_queue_peek_head(d->held);
+	}
+	bool result = true;
+	if(e != NULL && (d->closed || e->deadline <= dedup_clock(d))) {
+		g_queue_pop_head(d->held);
+		g_hash_table_remove(d->seen, &e->key);
+		*frame = e->frame;
+		XFREE(e);
+	} else if(e == NULL && d->closed) {
+		result = false;
+	}
+	pthread_mutex_unlock(&d->lock);
+	return result;
+}
+
+// Stops holding frames. Frames which are currently held are returned by
+// dedup_release() straight away. Copies of them are still dropped until
+// they are released, but the first copy of any other frame is not held
+// anymore (dedup_check() returns DEDUP_PASS).
+void dedup_close(struct dedup *d) {
+	ASSERT(d != NULL);
+	pthread_mutex_lock(&d->lock);
+	d->closed = true;
+	pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->lock);
+}
+
+uint64_t dedup_duplicate_count(struct dedup *d) {
+	ASSERT(d != NULL);
+	pthread_mutex_lock(&d->lock);
+	uint64_t cnt = d->duplicate_cnt;
+	pthread_mutex_unlock(&d->lock);
+	return cnt;
+}
+
+void dedup_destroy(struct dedup *d) {
+	if(d != NULL) {
+		struct dedup_entry *e;
+		while((e = g_queue_pop_head(d->held)) != NULL) {
+			d->vtable->frame_destroy(e->frame);
+			XFREE(e);
+		}
+		g_queue_free(d->held);
+		g_hash_table_destroy(d->seen);
+		pthread_mutex_destroy(&d->lock);
+		pthread_cond_destroy(&d->cond);
+		XFREE(d);
+	}
+}
+
+/****************************************
+ * Private variables and methods
+ ****************************************/
+
+// Returns the current time of the deduplicator (microseconds)
+static int64_t dedup_clock(struct dedup *d) {
+	if(d->realtime) {
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		int64_t t = (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+		if(t > d->clock) {
+			return t;
+		}
+	}
+	return d->clock;
+}
+
+// 64-bit FNV-1a
+static uint64_t dedup_payload_hash(uint8_t const *buf, uint32_t len) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for(uint32_t i = 0; i < len; i++) {
+		hash ^= buf[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static guint dedup_key_hash(gconstpointer key) {
+	ASSERT(key);
+	struct dedup_key const *k = key;
+	return (guint)(k->hash ^ (k->hash >> 32)) ^ (guint)k->freq;
+}
+
+static gboolean dedup_key_compare(gconstpointer key1, gconstpointer key2) {
+	ASSERT(key1);
+	ASSERT(key2);
+	struct dedup_key const *k1 = key1;
+	struct dedup_key const *k2 = key2;
+	return (k1->hash == k2->hash && k1->len == k2->len && k1->freq == k2->freq);
+}
@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>                   // time_t
+#include <sys/time.h>               // struct timeval
+
+struct dedup_vtable {
+	void *(*frame_copy)(void const *frame);
+	void (*frame_destroy)(void *frame);
+};
+
+enum dedup_result {
+	DEDUP_HELD,
+	DEDUP_DUPLICATE,
+	DEDUP_PASS
+};
+
+struct dedup;
+
+struct dedup *dedup_create(time_t window, bool realtime, struct dedup_vtable const *vtable);
+enum dedup_result dedup_check(struct dedup *d, uint8_t const *buf, uint32_t len, struct timeval rx_timestamp,
+		int32_t freq, float snr, bool per_channel, void const *frame, int32_t *dropped_freq);
+bool dedup_release(struct dedup *d, int32_t timeout_ms, void **frame);
+void dedup_close(struct dedup *d);
+uint64_t dedup_duplicate_count(struct dedup *d);
+void dedup_destroy(struct dedup *d);
@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <string.h>         // memcpy, memmove
 #include <pthread.h>        // pthread_*
+#include <time.h>           // clock_gettime
 #include <liquid/liquid.h>  // cbuffercf_*
 #include "config.h"
 #ifndef HAVE_PTHREAD_BARRIERS
@@ -11,14 +12,52 @@
 #include "block.h"          // block_*
 #include "fastddc.h"        // fastddc_t
 #include "fft.h"
-#include "util.h"           // XCALLOC, NEW
+#include "util.h"           // XCALLOC, NEW, ASSERT_se
+
+struct fft_reconf_request {
+	struct block **add, **remove;
+	size_t add_cnt, remove_cnt;
+	double pause;                   // how long the output has been stalled (seconds)
+	int32_t result;
+	bool done;
+};
 
 struct fft {
 	struct block block;
 	fastddc_t *ddc;
 	float complex *input;
+	pthread_mutex_t reconf_mutex;
+	pthread_cond_t reconf_cond;
+	struct fft_reconf_request *reconf_request;
+	bool stopped;
 };
 
+// Applies pending change of the consumer set, if any.
+// Called by the FFT thread between two frames, when all consumers are idle.
+static void fft_reconf_request_process(struct fft *fft) {
+	struct block *block = &fft->block;
+	pthread_mutex_lock(&fft->reconf_mutex);
+	struct fft_reconf_request *req = fft->reconf_request;
+	if(LIKELY(req == NULL)) {
+		pthread_mutex_unlock(&fft->reconf_mutex);
+		return;
+	}
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	block_connection_one2many_reconfigure(block, req->add_cnt, req->add, req->remove_cnt, req->remove);
+	// New consumers can't be started earlier, because they would
+	// synchronize on the old barriers.
+	ASSERT_se(block_set_start(req->add_cnt, req->add) == (int32_t)req->add_cnt);
+	pthread_barrier_wait(block->producer.out->shared_buffer.consumers_ready);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	req->pause = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+	req->result = 0;
+	req->done = true;
+	fft->reconf_request = NULL;
+	pthread_cond_broadcast(&fft->reconf_cond);
+	pthread_mutex_unlock(&fft->reconf_mutex);
+}
+
 static void *fft_thread(void *ctx) {
 	struct block *block = ctx;
 	struct fft *fft = container_of(block, struct fft, block);
@@ -59,8 +98,18 @@ static void *fft_thread(void *ctx) {
 		fft_swap_sides(output->buf, ddc->fft_size);
 		pthread_barrier_wait(output->data_ready);
 		pthread_barrier_wait(output->consumers_ready);
+		fft_reconf_request_process(fft);
 	}
 shutdown:
+	pthread_mutex_lock(&fft->reconf_mutex);
+	fft->stopped = true;
+	if(fft->reconf_request != NULL) {
+		fft->reconf_request->result = -1;
+		fft->reconf_request->done = true;
+		fft->reconf_request = NULL;
+	}
+	pthread_cond_broadcast(&fft->reconf_cond);
+	pthread_mutex_unlock(&fft->reconf_mutex);
 	block_connection_one2many_shutdown(block->producer.out);
 	csdr_destroy_fft_c2c(fwd_plan);
 	block->running = false;
@@ -77,6 +126,10 @@ struct block *fft_create(int32_t decimation, float transition_bw) {
 	fastddc_print(ddc,"fastddc_fwd_cc");
 	fft->ddc = ddc;
 	fft->input = XCALLOC(ddc->fft_size, sizeof(float complex));
+	if(pthread_mutex_initialize(&fft->reconf_mutex) != 0 ||
+			pthread_cond_initialize(&fft->reconf_cond) != 0) {
+		return NULL;
+	}
 	struct producer producer = { .type = PRODUCER_MULTI, .max_tu = ddc->fft_size };
 	struct consumer consumer = { .type = CONSUMER_SINGLE, .min_ru = ddc->fft_size };
 	fft->block.producer = producer;
@@ -85,11 +138,43 @@ struct block *fft_create(int32_t decimation, float transition_bw) {
 	return &fft->block;
 }
 
+// Adds and removes consumers of the FFT block while it is running.
+// Blocks until the FFT thread has applied the change. The time during which
+// the consumers have been stalled is returned in *pause.
+// Returns 0 on success, -1 if the FFT thread has terminated.
+int32_t fft_reconfigure(struct block *fft_block, size_t add_cnt, struct block *add[add_cnt],
+		size_t remove_cnt, struct block *remove[remove_cnt], double *pause) {
+	ASSERT(fft_block != NULL);
+	struct fft *fft = container_of(fft_block, struct fft, block);
+	struct fft_reconf_request req = {
+		.add = add, .add_cnt = add_cnt,
+		.remove = remove, .remove_cnt = remove_cnt,
+		.pause = 0.0, .result = -1, .done = false
+	};
+	pthread_mutex_lock(&fft->reconf_mutex);
+	while(fft->reconf_request != NULL && !fft->stopped) {
+		pthread_cond_wait(&fft->reconf_cond, &fft->reconf_mutex);
+	}
+	if(!fft->stopped) {
+		fft->reconf_request = &req;
+		while(!req.done) {
+			pthread_cond_wait(&fft->reconf_cond, &fft->reconf_mutex);
+		}
+	}
+	pthread_mutex_unlock(&fft->reconf_mutex);
+	if(pause != NULL) {
+		*pause = req.pause;
+	}
+	return req.result;
+}
+
 void fft_destroy(struct block *fft_block) {
 	if(fft_block != NULL) {
 		struct fft *fft = container_of(fft_block, struct fft, block);
 		XFREE(fft->input);
 		XFREE(fft->ddc);
+		pthread_mutex_destroy(&fft->reconf_mutex);
+		pthread_cond_destroy(&fft->reconf_cond);
 		XFREE(fft);
 	}
 }
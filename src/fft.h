@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #pragma once
 #include <stdint.h>
+#include <stddef.h>         // size_t
 #include <complex.h>
 
 // FIXME: this should be hidden.
@@ -29,4 +30,6 @@ void csdr_fft_execute(FFT_PLAN_T* plan);
 
 // fft.c
 struct block *fft_create(int32_t decimation, float transition_bw);
+int32_t fft_reconfigure(struct block *fft_block, size_t add_cnt, struct block *add[add_cnt],
+		size_t remove_cnt, struct block *remove[remove_cnt], double *pause);
 void fft_destroy(struct block *fft_block);
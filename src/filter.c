@@ -0,0 +1,432 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>                      // fprintf, snprintf
+#include <stdlib.h>                     // strtoll
+#include <string.h>                     // strdup, strsep, strchr, strlen
+#include <libacars/libacars.h>          // la_proto_node
+#include <libacars/acars.h>             // la_proto_tree_find_acars, la_acars_msg
+#include "filter.h"
+#include "pdu.h"                        // struct hfdl_pdu_metadata, struct hfdl_pdu_hdr_data
+#include "mpdu.h"                       // mpdu_msg_props_extract
+#include "spdu.h"                       // spdu_msg_props_extract
+#include "lpdu.h"                       // lpdu_msg_props_extract
+#include "hfnpdu.h"                     // hfnpdu_msg_props_extract
+#include "options.h"                    // describe_option
+#include "statsd.h"                     // statsd_*
+#include "util.h"                       // NEW, ASSERT, XCALLOC, XFREE, container_of
+
+// Filter expression syntax:
+//
+//   <condition>[;<condition>...]
+//
+// where <condition> is either <property>=<value>[|<value>...]
+// or <property>!=<value>[|<value>...]
+//
+// A message passes the filter if it matches all conditions. A condition
+// matches if the property equals any of the given values (or none of them,
+// in case of !=). A condition on a property which is not present in the
+// message (eg. ACARS label in a Squitter) never matches.
+//
+// Commas are not allowed, as they separate output parameters.
+
+enum msg_filter_value_type {
+	VAL_INT,                // decimal or hexadecimal (0x-prefixed) integer
+	VAL_INT_RANGE,          // integer or an inclusive range of integers (<min>-<max>)
+	VAL_HEX,                // hexadecimal integer without prefix
+	VAL_DIRECTION,          // "up" or "down"
+	VAL_CRC,                // "ok" or "bad"
+	VAL_LABEL               // two-character ACARS label
+};
+
+struct msg_filter_prop_descr {
+	char const *name;
+	char const *description;
+	uint32_t prop;
+	enum msg_filter_value_type type;
+};
+
+static struct msg_filter_prop_descr const msg_filter_props[] = {
+	{
+		.name = "freq",
+		.description = "Channel frequency in kHz (single value or a range, eg. 8900-9000)",
+		.prop = MSG_PROP_FREQ,
+		.type = VAL_INT_RANGE
+	},
+	{
+		.name = "gs",
+		.description = "Ground station ID",
+		.prop = MSG_PROP_GS_ID,
+		.type = VAL_INT
+	},
+	{
+		.name = "dir",
+		.description = "Message direction (up, down)",
+		.prop = MSG_PROP_DIRECTION,
+		.type = VAL_DIRECTION
+	},
+	{
+		.name = "lpdu_type",
+		.description = "LPDU type ID (eg. 0x0d)",
+		.prop = MSG_PROP_LPDU_TYPE,
+		.type = VAL_INT
+	},
+	{
+		.name = "hfnpdu_type",
+		.description = "HFNPDU type ID (eg. 0xd1)",
+		.prop = MSG_PROP_HFNPDU_TYPE,
+		.type = VAL_INT
+	},
+	{
+		.name = "acars_label",
+		.description = "ACARS message label (eg. H1)",
+		.prop = MSG_PROP_ACARS_LABEL,
+		.type = VAL_LABEL
+	},
+	{
+		.name = "icao",
+		.description = "Aircraft ICAO address in hex (eg. 3C6586)",
+		.prop = MSG_PROP_ICAO_ADDRESS,
+		.type = VAL_HEX
+	},
+	{
+		.name = "crc",
+		.description = "CRC check result (ok, bad)",
+		.prop = MSG_PROP_CRC_OK,
+		.type = VAL_CRC
+	},
+	{
+		.name = NULL
+	}
+};
+
+struct msg_filter_value {
+	int64_t min;
+	int64_t max;
+};
+
+struct msg_filter_cond {
+	struct msg_filter_prop_descr const *descr;
+	struct msg_filter_value *values;
+	int32_t value_cnt;
+	bool negate;
+};
+
+struct msg_filter {
+	struct msg_filter_cond *conds;
+	int32_t cond_cnt;
+	uint32_t props_used;
+#ifdef WITH_STATSD
+	char *counters[3];              // matched, rejected, NULL
+#endif
+};
+
+/******************************
+ * Forward declarations
+ ******************************/
+
+static bool msg_filter_cond_parse(char *str, struct msg_filter_cond *cond);
+static int64_t msg_props_value_get(struct msg_props const *props, uint32_t prop);
+
+/******************************
+ * Public methods
+ ******************************/
+
+// Compiles the filter expression.
+// output_idx is used to name StatsD counters of this filter.
+// Returns NULL and prints the reason if the expression is invalid.
+struct msg_filter *msg_filter_create(char const *expr, int32_t output_idx) {
+	ASSERT(expr != NULL);
+#ifndef WITH_STATSD
+	UNUSED(output_idx);
+#endif
+	NEW(struct msg_filter, f);
+	char *copy = strdup(expr);
+	char *ptr = copy, *token = NULL;
+	while((token = strsep(&ptr, ";")) != NULL) {
+		f->conds = XREALLOC(f->conds, (f->cond_cnt + 1) * sizeof(struct msg_filter_cond));
+		struct msg_filter_cond *cond = &f->conds[f->cond_cnt];
+		memset(cond, 0, sizeof(struct msg_filter_cond));
+		// Increment first, so that msg_filter_destroy() frees a partially parsed condition
+		f->cond_cnt++;
+		if(msg_filter_cond_parse(token, cond) == false) {
+			goto fail;
+		}
+		f->props_used |= cond->descr->prop;
+	}
+	XFREE(copy);
+#ifdef WITH_STATSD
+	char metric[64];
+	snprintf(metric, sizeof(metric), "outputs.%d.filter.matched", output_idx);
+	f->counters[0] = strdup(metric);
+	snprintf(metric, sizeof(metric), "outputs.%d.filter.rejected", output_idx);
+	f->counters[1] = strdup(metric);
+	f->counters[2] = NULL;
+#endif
+	return f;
+fail:
+	fprintf(stderr, "Invalid filter expression '%s'\n", expr);
+	XFREE(copy);
+	msg_filter_destroy(f);
+	return NULL;
+}
+
+// Returns MSG_PROP_* flags of properties referenced by the filter
+uint32_t msg_filter_props_used(struct msg_filter const *f) {
+	ASSERT(f != NULL);
+	return f->props_used;
+}
+
+// Collects message properties. Only properties given in wanted
+// are guaranteed to be extracted. tree is NULL for undecoded frames.
+void msg_props_extract(struct msg_props *props, struct metadata const *metadata,
+		la_proto_node *tree, uint32_t wanted) {
+	ASSERT(props != NULL);
+	ASSERT(metadata != NULL);
+	memset(props, 0, sizeof(struct msg_props));
+	struct hfdl_pdu_metadata const *hm = container_of(metadata, struct hfdl_pdu_metadata, metadata);
+	props->freq = hm->freq;
+	props->present = MSG_PROP_FREQ;
+	if(tree == NULL || (wanted & ~MSG_PROP_FREQ) == 0) {
+		return;
+	}
+	if(lpdu_msg_props_extract(tree, props, wanted & MSG_PROP_ICAO_ADDRESS) == false &&
+			mpdu_msg_props_extract(tree, props) == false) {
+		spdu_msg_props_extract(tree, props);
+	}
+	if(wanted & MSG_PROP_HFNPDU_TYPE) {
+		hfnpdu_msg_props_extract(tree, props);
+	}
+	if(wanted & MSG_PROP_ACARS_LABEL) {
+		la_proto_node *acars_node = la_proto_tree_find_acars(tree);
+		if(acars_node != NULL) {
+			la_acars_msg const *msg = acars_node->data;
+			if(msg->err == false && msg->label[0] != '\0') {
+				memcpy(props->acars_label, msg->label, sizeof(props->acars_label));
+				props->present |= MSG_PROP_ACARS_LABEL;
+			}
+		}
+	}
+}
+
+// Sets properties which are common to all PDU types from the PDU header
+void msg_props_header_set(struct msg_props *props, struct hfdl_pdu_hdr_data const *hdr) {
+	ASSERT(props != NULL);
+	ASSERT(hdr != NULL);
+	props->direction = hdr->direction;
+	props->gs_id = hdr->direction == UPLINK_PDU ? hdr->src_id : hdr->dst_id;
+	props->crc_ok = hdr->crc_ok;
+	props->present |= MSG_PROP_DIRECTION | MSG_PROP_GS_ID | MSG_PROP_CRC_OK;
+}
+
+// Formats message properties as a topic string: <freq>/<gs_id>/<msg_type>,
+// where freq is the channel frequency in kHz and msg_type is the HFNPDU type
+// or, if the message does not carry an HFNPDU, the LPDU type (as two hex
+// digits). Missing properties are replaced with "-". Subscribers can select
+// messages by topic prefix (eg. "8977/" or "8977/2/").
+// Returns the length of the topic (as snprintf does).
+int32_t msg_props_topic_format(struct msg_props const *props, char *buf, size_t len) {
+	ASSERT(props != NULL);
+	ASSERT(buf != NULL);
+	char gs_id[4] = "-", msg_type[3] = "-";
+	if(props->present & MSG_PROP_GS_ID) {
+		snprintf(gs_id, sizeof(gs_id), "%u", props->gs_id);
+	}
+	if(props->present & MSG_PROP_HFNPDU_TYPE) {
+		snprintf(msg_type, sizeof(msg_type), "%02x", props->hfnpdu_type & 0xff);
+	} else if(props->present & MSG_PROP_LPDU_TYPE) {
+		snprintf(msg_type, sizeof(msg_type), "%02x", props->lpdu_type & 0xff);
+	}
+	return snprintf(buf, len, "%d/%s/%s", props->freq / 1000, gs_id, msg_type);
+}
+
+// Returns true if the message passes the filter
+bool msg_filter_match(struct msg_filter const *f, struct msg_props const *props) {
+	ASSERT(f != NULL);
+	ASSERT(props != NULL);
+	bool result = true;
+	for(int32_t i = 0; i < f->cond_cnt && result == true; i++) {
+		struct msg_filter_cond const *cond = &f->conds[i];
+		if((props->present & cond->descr->prop) == 0) {
+			result = false;
+			break;
+		}
+		int64_t val = msg_props_value_get(props, cond->descr->prop);
+		bool found = false;
+		for(int32_t j = 0; j < cond->value_cnt; j++) {
+			if(val >= cond->values[j].min && val <= cond->values[j].max) {
+				found = true;
+				break;
+			}
+		}
+		result = (found != cond->negate);
+	}
+#ifdef WITH_STATSD
+	statsd_increment(f->counters[result ? 0 : 1]);
+#endif
+	return result;
+}
+
+void msg_filter_initialize_counters(struct msg_filter *f) {
+	ASSERT(f != NULL);
+#ifdef WITH_STATSD
+	statsd_initialize_counter_set(f->counters);
+#endif
+}
+
+void msg_filter_destroy(struct msg_filter *f) {
+	if(f == NULL) {
+		return;
+	}
+	for(int32_t i = 0; i < f->cond_cnt; i++) {
+		XFREE(f->conds[i].values);
+	}
+	XFREE(f->conds);
+#ifdef WITH_STATSD
+	XFREE(f->counters[0]);
+	XFREE(f->counters[1]);
+#endif
+	XFREE(f);
+}
+
+void msg_filter_usage(void) {
+	describe_option("filter", "Send only messages matching the given expression", 2);
+	fprintf(stderr,
+			"\n%*sFilter expression syntax: <condition>[;<condition>...]\n"
+			"%*swhere <condition> is <property>=<value>[|<value>...] or <property>!=<value>[|<value>...]\n"
+			"%*sA message must match all conditions. Supported properties:\n\n",
+			IND(2), "", IND(2), "", IND(2), ""
+		   );
+	for(struct msg_filter_prop_descr const *p = msg_filter_props; p->name != NULL; p++) {
+		describe_option(p->name, p->description, 3);
+	}
+}
+
+/****************************************
+ * Private variables and methods
+ ****************************************/
+
+static bool msg_filter_int_parse(char const *str, int32_t base, int64_t *result) {
+	char *endptr = NULL;
+	if(str[0] == '\0') {
+		return false;
+	}
+	*result = strtoll(str, &endptr, base);
+	return *endptr == '\0';
+}
+
+static bool msg_filter_value_parse(char *str, enum msg_filter_value_type type,
+		struct msg_filter_value *result) {
+	switch(type) {
+		case VAL_INT: {
+			// Base 0 would treat a leading zero as an octal prefix
+			int32_t base = (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) ? 16 : 10;
+			if(msg_filter_int_parse(str, base, &result->min) == false) {
+				return false;
+			}
+			result->max = result->min;
+			return true;
+		}
+		case VAL_INT_RANGE: {
+			char *endptr = NULL;
+			result->min = strtoll(str, &endptr, 10);
+			if(endptr == str) {
+				return false;
+			} else if(*endptr == '\0') {
+				result->max = result->min;
+				return true;
+			} else if(*endptr != '-') {
+				return false;
+			}
+			return msg_filter_int_parse(endptr + 1, 10, &result->max) && result->max >= result->min;
+		}
+		case VAL_HEX:
+			if(msg_filter_int_parse(str, 16, &result->min) == false) {
+				return false;
+			}
+			result->max = result->min;
+			return true;
+		case VAL_DIRECTION:
+			if(!strcmp(str, "up")) {
+				result->min = result->max = UPLINK_PDU;
+			} else if(!strcmp(str, "down")) {
+				result->min = result->max = DOWNLINK_PDU;
+			} else {
+				return false;
+			}
+			return true;
+		case VAL_CRC:
+			if(!strcmp(str, "ok")) {
+				result->min = result->max = true;
+			} else if(!strcmp(str, "bad")) {
+				result->min = result->max = false;
+			} else {
+				return false;
+			}
+			return true;
+		case VAL_LABEL:
+			if(strlen(str) != 2) {
+				return false;
+			}
+			result->min = result->max = ((uint8_t)str[0] << 8) | (uint8_t)str[1];
+			return true;
+	}
+	return false;
+}
+
+static bool msg_filter_cond_parse(char *str, struct msg_filter_cond *cond) {
+	char *eq = strchr(str, '=');
+	if(eq == NULL || eq == str) {
+		fprintf(stderr, "Filter condition '%s': expected <property>=<value> or <property>!=<value>\n", str);
+		return false;
+	}
+	char *values = eq + 1;
+	if(eq[-1] == '!') {
+		cond->negate = true;
+		eq--;
+	}
+	*eq = '\0';
+	for(struct msg_filter_prop_descr const *p = msg_filter_props; p->name != NULL; p++) {
+		if(!strcmp(str, p->name)) {
+			cond->descr = p;
+			break;
+		}
+	}
+	if(cond->descr == NULL) {
+		fprintf(stderr, "Filter condition: unknown property '%s'\n", str);
+		return false;
+	}
+	char *token = NULL;
+	while((token = strsep(&values, "|")) != NULL) {
+		cond->values = XREALLOC(cond->values, (cond->value_cnt + 1) * sizeof(struct msg_filter_value));
+		if(msg_filter_value_parse(token, cond->descr->type, &cond->values[cond->value_cnt]) == false) {
+			fprintf(stderr, "Filter condition: invalid value '%s' for property '%s'\n",
+					token, cond->descr->name);
+			return false;
+		}
+		cond->value_cnt++;
+	}
+	return true;
+}
+
+static int64_t msg_props_value_get(struct msg_props const *props, uint32_t prop) {
+	switch(prop) {
+		case MSG_PROP_FREQ:
+			return props->freq / 1000;
+		case MSG_PROP_GS_ID:
+			return props->gs_id;
+		case MSG_PROP_DIRECTION:
+			return props->direction;
+		case MSG_PROP_LPDU_TYPE:
+			return props->lpdu_type;
+		case MSG_PROP_HFNPDU_TYPE:
+			return props->hfnpdu_type;
+		case MSG_PROP_ACARS_LABEL:
+			return ((uint8_t)props->acars_label[0] << 8) | (uint8_t)props->acars_label[1];
+		case MSG_PROP_ICAO_ADDRESS:
+			return props->icao_address;
+		case MSG_PROP_CRC_OK:
+			return props->crc_ok;
+	}
+	return -1;
+}
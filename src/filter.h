@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>                     // size_t
+#include <libacars/libacars.h>          // la_proto_node
+#include "metadata.h"                   // struct metadata
+#include "pdu.h"                        // enum hfdl_pdu_direction, struct hfdl_pdu_hdr_data
+
+// Message properties which output filters can match on
+#define MSG_PROP_FREQ           (1 << 0)
+#define MSG_PROP_GS_ID          (1 << 1)
+#define MSG_PROP_DIRECTION      (1 << 2)
+#define MSG_PROP_LPDU_TYPE      (1 << 3)
+#define MSG_PROP_HFNPDU_TYPE    (1 << 4)
+#define MSG_PROP_ACARS_LABEL    (1 << 5)
+#define MSG_PROP_ICAO_ADDRESS   (1 << 6)
+#define MSG_PROP_CRC_OK         (1 << 7)
+
+// Properties used by msg_props_topic_format()
+#define MSG_PROPS_TOPIC (MSG_PROP_FREQ | MSG_PROP_GS_ID | MSG_PROP_LPDU_TYPE | MSG_PROP_HFNPDU_TYPE)
+
+struct msg_props {
+	uint32_t present;                   // MSG_PROP_* flags of properties found in the message
+	int32_t freq;                       // Hz
+	enum hfdl_pdu_direction direction;
+	uint8_t gs_id;
+	bool crc_ok;
+	int32_t lpdu_type;
+	int32_t hfnpdu_type;
+	uint32_t icao_address;
+	char acars_label[3];
+};
+
+struct msg_filter;
+
+struct msg_filter *msg_filter_create(char const *expr, int32_t output_idx);
+uint32_t msg_filter_props_used(struct msg_filter const *f);
+void msg_props_extract(struct msg_props *props, struct metadata const *metadata,
+		la_proto_node *tree, uint32_t wanted);
+void msg_props_header_set(struct msg_props *props, struct hfdl_pdu_hdr_data const *hdr);
+bool msg_filter_match(struct msg_filter const *f, struct msg_props const *props);
+int32_t msg_props_topic_format(struct msg_props const *props, char *buf, size_t len);
+void msg_filter_initialize_counters(struct msg_filter *f);
+void msg_filter_destroy(struct msg_filter *f);
+void msg_filter_usage(void);
@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdbool.h>
+#include <stdint.h>
+#include <libacars/libacars.h>          // la_proto_node, la_proto_tree_format_json
+#include <libacars/vstring.h>           // la_vstring
+#include "fmtr-cbor.h"
+#include "fmtr-json.h"                  // td_DEF_hfdl_message, hfdl_message_serialize
+#include "fmtr-writer.h"                // struct fmtr_writer, fmtr_serialize_fn, fw_*
+#include "cbor.h"                       // struct cbor_encoder, cbor_*
+#include "output-common.h"              // fmtr_descriptor_t
+#include "mpdu.h"                       // proto_DEF_hfdl_mpdu, mpdu_serialize
+#include "spdu.h"                       // proto_DEF_hfdl_spdu, spdu_serialize
+#include "lpdu.h"                       // proto_DEF_hfdl_lpdu, lpdu_serialize
+#include "hfnpdu.h"                     // proto_DEF_hfdl_hfnpdu, hfnpdu_serialize
+#include "systable.h"                   // proto_DEF_systable_complete, systable_complete_serialize
+#include "util.h"                       // struct octet_string, ASSERT, proto_DEF_unknown, unknown_proto_serialize
+
+// CBOR (RFC 8949) formatter.
+// Metadata and HFDL protocol nodes are encoded directly, with the same
+// serializers which produce JSON, so the CBOR message has exactly the same
+// structure and keys as the JSON message. libacars is only able to serialize
+// its own nodes (ACARS and its payloads) to text and JSON, so these subtrees
+// are formatted as JSON and transcoded. See doc/CBOR.md for mapping rules.
+// Each message is a single definite-length map, so a stream of messages is
+// a valid CBOR sequence (RFC 8742) and needs no additional framing.
+
+// Typical message length, used as the initial size of the buffer
+#define CBOR_MSG_LEN_HINT 1024
+
+static struct {
+	la_type_descriptor const *td;
+	fmtr_serialize_fn *serialize;
+} const cbor_serializers[] = {
+	{ &td_DEF_hfdl_message,         hfdl_message_serialize },
+	{ &proto_DEF_hfdl_spdu,         spdu_serialize },
+	{ &proto_DEF_hfdl_mpdu,         mpdu_serialize },
+	{ &proto_DEF_hfdl_lpdu,         lpdu_serialize },
+	{ &proto_DEF_hfdl_hfnpdu,       hfnpdu_serialize },
+	{ &proto_DEF_systable_complete, systable_complete_serialize },
+	{ &proto_DEF_unknown,           unknown_proto_serialize },
+	{ NULL,                         NULL }
+};
+
+static fmtr_serialize_fn *cbor_serializer_find(la_type_descriptor const *td) {
+	for(int32_t i = 0; cbor_serializers[i].td != NULL; i++) {
+		if(cbor_serializers[i].td == td) {
+			return cbor_serializers[i].serialize;
+		}
+	}
+	return NULL;
+}
+
+// Same layout as la_proto_tree_format_json() - each node is a map keyed with
+// td->json_key, which contains the node's fields and its child node.
+static void cbor_format_node(struct fmtr_writer *w, la_proto_node const *node) {
+	for(; node != NULL; node = node->next) {
+		if(node->td == NULL) {
+			continue;
+		}
+		fmtr_serialize_fn *serialize = cbor_serializer_find(node->td);
+		if(serialize == NULL) {
+			// Foreign node - let libacars serialize it, together with its children
+			la_vstring *vstr = la_proto_tree_format_json(NULL, node);
+			cbor_append_json_members(w->cbor, vstr->str, vstr->len);
+			la_vstring_destroy(vstr, true);
+			break;
+		}
+		if(node->td->json_key != NULL) {
+			fw_object_start(w, node->td->json_key);
+		}
+		serialize(w, node->data);
+		if(node->td->json_key != NULL) {
+			cbor_format_node(w, node->next);
+			fw_object_end(w);
+			break;
+		}
+	}
+}
+
+static bool fmtr_cbor_supports_data_type(fmtr_input_type_t type) {
+	return(type == FMTR_INTYPE_DECODED_FRAME);
+}
+
+static struct octet_string *fmtr_cbor_format_decoded_msg(struct metadata *metadata, la_proto_node *root) {
+	ASSERT(metadata != NULL);
+	ASSERT(root != NULL);
+
+	// Prepend the metadata node to the tree
+	la_proto_node hfdl_pdu = {
+		.td = &td_DEF_hfdl_message,
+		.data = metadata,
+		.next = root
+	};
+	struct cbor_encoder e;
+	cbor_encoder_init(&e, CBOR_MSG_LEN_HINT);
+	struct fmtr_writer w = { .vstr = NULL, .cbor = &e };
+	cbor_map_start(&e, NULL);
+	cbor_format_node(&w, &hfdl_pdu);
+	cbor_map_end(&e);
+	if(e.err) {
+		debug_print(D_OUTPUT, "could not encode message to CBOR\n");
+		cbor_encoder_destroy(&e);
+		return NULL;
+	}
+	return octet_string_new(e.buf, e.len);
+}
+
+fmtr_descriptor_t fmtr_DEF_cbor = {
+	.name = "cbor",
+	.description = "Concise Binary Object Representation (RFC 8949)",
+	.format_decoded_msg = fmtr_cbor_format_decoded_msg,
+	.format_raw_msg = NULL,
+	.supports_data_type = fmtr_cbor_supports_data_type,
+	.output_format = OFMT_CBOR
+};
@@ -0,0 +1,5 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include "output-common.h"              // fmtr_descriptor_t
+
+extern fmtr_descriptor_t fmtr_DEF_cbor;
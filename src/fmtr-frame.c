@@ -0,0 +1,135 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>                     // memcpy
+#include "fmtr-frame.h"
+#include "output-common.h"              // fmtr_descriptor_t
+#include "metadata.h"                   // struct metadata
+#include "util.h"                       // struct octet_string, ASSERT, XCALLOC, container_of
+#include "pdu.h"                        // struct hfdl_pdu_metadata, HFDL_PDU_LEN_MAX
+
+// Raw frame formatter.
+// Produces undecoded frames together with the metadata which is needed to
+// decode them again at a later time (eg. with --replay option). Record layout:
+//
+//  offset  size  field
+//  0       2     magic ("HF")
+//  2       1     record version
+//  3       1     slot ('S' or 'D')
+//  4       8     reception timestamp - seconds (signed)
+//  12      4     reception timestamp - microseconds (signed)
+//  16      4     channel frequency, Hz (signed)
+//  20      4     bit rate (signed)
+//  24      4     frequency error, Hz (float)
+//  28      4     signal level, dBFS (float)
+//  32      4     noise floor, dBFS (float)
+//  36      2     PDU length (unsigned)
+//  38      -     PDU
+
+static void put_le16(uint8_t *buf, uint16_t val) {
+	buf[0] = val & 0xff;
+	buf[1] = (val >> 8) & 0xff;
+}
+
+static void put_le32(uint8_t *buf, uint32_t val) {
+	for(int32_t i = 0; i < 4; i++, val >>= 8) {
+		buf[i] = val & 0xff;
+	}
+}
+
+static void put_le64(uint8_t *buf, uint64_t val) {
+	for(int32_t i = 0; i < 8; i++, val >>= 8) {
+		buf[i] = val & 0xff;
+	}
+}
+
+static void put_float(uint8_t *buf, float val) {
+	uint32_t u;
+	memcpy(&u, &val, sizeof(u));
+	put_le32(buf, u);
+}
+
+static uint16_t get_le16(uint8_t const *buf) {
+	return (uint16_t)(buf[0] | (buf[1] << 8));
+}
+
+static uint32_t get_le32(uint8_t const *buf) {
+	return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) |
+		((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static uint64_t get_le64(uint8_t const *buf) {
+	return (uint64_t)get_le32(buf) | ((uint64_t)get_le32(buf + 4) << 32);
+}
+
+static float get_float(uint8_t const *buf) {
+	uint32_t u = get_le32(buf);
+	float val;
+	memcpy(&val, &u, sizeof(val));
+	return val;
+}
+
+// Decodes the header of a raw frame record into hm.
+// Returns the length of the PDU which follows the header
+// or -1 if the header is invalid (including an empty PDU).
+int32_t frame_record_header_decode(uint8_t const *buf, struct hfdl_pdu_metadata *hm) {
+	ASSERT(buf != NULL);
+	ASSERT(hm != NULL);
+	if(buf[0] != FRAME_RECORD_MAGIC_0 || buf[1] != FRAME_RECORD_MAGIC_1 ||
+			buf[2] != FRAME_RECORD_VERSION) {
+		return -1;
+	}
+	uint16_t len = get_le16(buf + 36);
+	if(len == 0 || len > HFDL_PDU_LEN_MAX) {
+		return -1;
+	}
+	hm->version = 1;
+	hm->slot = (char)buf[3];
+	hm->metadata.rx_timestamp.tv_sec = (int64_t)get_le64(buf + 4);
+	hm->metadata.rx_timestamp.tv_usec = (int32_t)get_le32(buf + 12);
+	hm->freq = (int32_t)get_le32(buf + 16);
+	hm->bit_rate = (int32_t)get_le32(buf + 20);
+	hm->freq_err_hz = get_float(buf + 24);
+	hm->rssi = get_float(buf + 28);
+	hm->noise_floor = get_float(buf + 32);
+	return len;
+}
+
+static bool fmtr_frame_supports_data_type(fmtr_input_type_t type) {
+	return(type == FMTR_INTYPE_RAW_FRAME);
+}
+
+static struct octet_string *fmtr_frame_format_raw_msg(struct metadata *metadata, struct octet_string *pdu) {
+	ASSERT(metadata != NULL);
+	ASSERT(pdu != NULL);
+	ASSERT(pdu->len <= HFDL_PDU_LEN_MAX);
+
+	struct hfdl_pdu_metadata *hm = container_of(metadata, struct hfdl_pdu_metadata, metadata);
+	size_t len = FRAME_RECORD_HDR_LEN + pdu->len;
+	uint8_t *buf = XCALLOC(len, sizeof(uint8_t));
+	buf[0] = FRAME_RECORD_MAGIC_0;
+	buf[1] = FRAME_RECORD_MAGIC_1;
+	buf[2] = FRAME_RECORD_VERSION;
+	buf[3] = (uint8_t)hm->slot;
+	put_le64(buf + 4, (uint64_t)metadata->rx_timestamp.tv_sec);
+	put_le32(buf + 12, (uint32_t)metadata->rx_timestamp.tv_usec);
+	put_le32(buf + 16, (uint32_t)hm->freq);
+	put_le32(buf + 20, (uint32_t)hm->bit_rate);
+	put_float(buf + 24, hm->freq_err_hz);
+	put_float(buf + 28, hm->rssi);
+	put_float(buf + 32, hm->noise_floor);
+	put_le16(buf + 36, (uint16_t)pdu->len);
+	if(pdu->len > 0) {
+		memcpy(buf + FRAME_RECORD_HDR_LEN, pdu->buf, pdu->len);
+	}
+	return octet_string_new(buf, len);
+}
+
+fmtr_descriptor_t fmtr_DEF_frame = {
+	.name = "frame",
+	.description = "Binary frame records (payload and reception metadata) for archiving and replay",
+	.format_decoded_msg = NULL,
+	.format_raw_msg = fmtr_frame_format_raw_msg,
+	.supports_data_type = fmtr_frame_supports_data_type,
+	.output_format = OFMT_FRAME
+};
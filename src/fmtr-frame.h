@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdint.h>
+#include "output-common.h"              // fmtr_descriptor_t
+#include "pdu.h"                        // struct hfdl_pdu_metadata
+
+// Raw frame record: a fixed-size header followed by the PDU.
+// All fields are little-endian. See doc/RAW_FRAMES.md for details.
+#define FRAME_RECORD_MAGIC_0 'H'
+#define FRAME_RECORD_MAGIC_1 'F'
+#define FRAME_RECORD_VERSION 1
+#define FRAME_RECORD_HDR_LEN 38
+
+extern fmtr_descriptor_t fmtr_DEF_frame;
+
+int32_t frame_record_header_decode(uint8_t const *buf, struct hfdl_pdu_metadata *hm);
@@ -2,39 +2,39 @@
 #include <stdbool.h>
 #include <libacars/libacars.h>          // la_proto_node
 #include <libacars/vstring.h>           // la_vstring
-#include <libacars/json.h>
 #include "fmtr-json.h"
 #include "output-common.h"              // fmtr_descriptor_t
 #include "util.h"                       // struct octet_string, Config, EOL
+#include "fmtr-writer.h"                // struct fmtr_writer, fw_*
 #include "pdu.h"                        // struct hfdl_pdu_metadata
 
 // forward declarations
 la_type_descriptor const td_DEF_hfdl_message;
 
-static void hfdl_format_json(la_vstring *vstr, void const *data) {
-	ASSERT(vstr);
+void hfdl_message_serialize(struct fmtr_writer *w, void const *data) {
+	ASSERT(w);
 	ASSERT(data);
 
 	struct hfdl_pdu_metadata const *m = data;
-	la_json_object_start(vstr, "app");
-	la_json_append_string(vstr, "name", "dumphfdl");
-	la_json_append_string(vstr, "ver", DUMPHFDL_VERSION);
-	la_json_object_end(vstr);
+	fw_object_start(w, "app");
+	fw_append_string(w, "name", "dumphfdl");
+	fw_append_string(w, "ver", DUMPHFDL_VERSION);
+	fw_object_end(w);
 	if(Config.station_id != NULL) {
-		la_json_append_string(vstr, "station", Config.station_id);
+		fw_append_string(w, "station", Config.station_id);
 	}
 
-	la_json_object_start(vstr, "t");
-	la_json_append_int64(vstr, "sec", m->metadata.rx_timestamp.tv_sec);
-	la_json_append_int64(vstr, "usec", m->metadata.rx_timestamp.tv_usec);
-	la_json_object_end(vstr);
+	fw_object_start(w, "t");
+	fw_append_int64(w, "sec", m->metadata.rx_timestamp.tv_sec);
+	fw_append_int64(w, "usec", m->metadata.rx_timestamp.tv_usec);
+	fw_object_end(w);
 
-	la_json_append_int64(vstr, "freq", m->freq);
-	la_json_append_int64(vstr, "bit_rate", m->bit_rate);
-	la_json_append_double(vstr, "sig_level", m->rssi);
-	la_json_append_double(vstr, "noise_level", m->noise_floor);
-	la_json_append_double(vstr, "freq_skew", m->freq_err_hz);
-	la_json_append_char(vstr, "slot", m->slot);
+	fw_append_int64(w, "freq", m->freq);
+	fw_append_int64(w, "bit_rate", m->bit_rate);
+	fw_append_double(w, "sig_level", m->rssi);
+	fw_append_double(w, "noise_level", m->noise_floor);
+	fw_append_double(w, "freq_skew", m->freq_err_hz);
+	fw_append_char(w, "slot", m->slot);
 }
 
 static bool fmtr_json_supports_data_type(fmtr_input_type_t type) {
@@ -59,6 +59,10 @@ static struct octet_string *fmtr_json_format_decoded_msg(struct metadata *metada
 	return ret;
 }
 
+static void hfdl_format_json(la_vstring *vstr, void const *data) {
+	fw_format_json(vstr, hfdl_message_serialize, data);
+}
+
 la_type_descriptor const td_DEF_hfdl_message = {
 	.format_text = NULL,
 	.format_json = hfdl_format_json,
@@ -1,5 +1,11 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #pragma once
+#include <libacars/libacars.h>          // la_type_descriptor
 #include "output-common.h"              // fmtr_descriptor_t
 
 extern fmtr_descriptor_t fmtr_DEF_json;
+
+// Metadata node prepended to the protocol tree of each message
+struct fmtr_writer;
+extern la_type_descriptor const td_DEF_hfdl_message;
+void hfdl_message_serialize(struct fmtr_writer *w, void const *data);
@@ -0,0 +1,95 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <stdbool.h>
+#include <libacars/vstring.h>           // la_vstring
+#include <libacars/json.h>              // la_json_*
+#include "cbor.h"                       // cbor_*
+#include "util.h"                       // ASSERT
+#include "fmtr-writer.h"
+
+void fw_object_start(struct fmtr_writer *w, char const *key) {
+	if(w->cbor != NULL) {
+		cbor_map_start(w->cbor, key);
+	} else {
+		la_json_object_start(w->vstr, key);
+	}
+}
+
+void fw_object_end(struct fmtr_writer *w) {
+	if(w->cbor != NULL) {
+		cbor_map_end(w->cbor);
+	} else {
+		la_json_object_end(w->vstr);
+	}
+}
+
+void fw_array_start(struct fmtr_writer *w, char const *key) {
+	if(w->cbor != NULL) {
+		cbor_array_start(w->cbor, key);
+	} else {
+		la_json_array_start(w->vstr, key);
+	}
+}
+
+void fw_array_end(struct fmtr_writer *w) {
+	if(w->cbor != NULL) {
+		cbor_array_end(w->cbor);
+	} else {
+		la_json_array_end(w->vstr);
+	}
+}
+
+void fw_append_bool(struct fmtr_writer *w, char const *key, bool val) {
+	if(w->cbor != NULL) {
+		cbor_append_bool(w->cbor, key, val);
+	} else {
+		la_json_append_bool(w->vstr, key, val);
+	}
+}
+
+void fw_append_double(struct fmtr_writer *w, char const *key, double val) {
+	if(w->cbor != NULL) {
+		cbor_append_double(w->cbor, key, val);
+	} else {
+		la_json_append_double(w->vstr, key, val);
+	}
+}
+
+void fw_append_int64(struct fmtr_writer *w, char const *key, int64_t val) {
+	if(w->cbor != NULL) {
+		cbor_append_int64(w->cbor, key, val);
+	} else {
+		la_json_append_int64(w->vstr, key, val);
+	}
+}
+
+void fw_append_char(struct fmtr_writer *w, char const *key, char val) {
+	if(w->cbor != NULL) {
+		cbor_append_char(w->cbor, key, val);
+	} else {
+		la_json_append_char(w->vstr, key, val);
+	}
+}
+
+void fw_append_string(struct fmtr_writer *w, char const *key, char const *val) {
+	if(w->cbor != NULL) {
+		cbor_append_string(w->cbor, key, val);
+	} else {
+		la_json_append_string(w->vstr, key, val);
+	}
+}
+
+void fw_append_octet_string(struct fmtr_writer *w, char const *key, uint8_t const *buf, size_t len) {
+	if(w->cbor != NULL) {
+		cbor_append_octet_string(w->cbor, key, buf, len);
+	} else {
+		la_json_append_octet_string(w->vstr, key, buf, len);
+	}
+}
+
+void fw_format_json(la_vstring *vstr, fmtr_serialize_fn *serialize, void const *data) {
+	ASSERT(vstr != NULL);
+	ASSERT(serialize != NULL);
+	struct fmtr_writer w = { .vstr = vstr, .cbor = NULL };
+	serialize(&w, data);
+}
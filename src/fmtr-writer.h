@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>                     // size_t
+#include <libacars/vstring.h>           // la_vstring
+#include "cbor.h"                       // struct cbor_encoder
+
+// Structured message writer. Protocol nodes are serialized once, through
+// this interface, and the result is either JSON text (with libacars
+// la_json_* routines) or CBOR (encoded directly, without going through JSON).
+// Exactly one of vstr and cbor must be set.
+struct fmtr_writer {
+	la_vstring *vstr;
+	struct cbor_encoder *cbor;
+};
+
+typedef void (fmtr_serialize_fn)(struct fmtr_writer *w, void const *data);
+
+void fw_object_start(struct fmtr_writer *w, char const *key);
+void fw_object_end(struct fmtr_writer *w);
+void fw_array_start(struct fmtr_writer *w, char const *key);
+void fw_array_end(struct fmtr_writer *w);
+void fw_append_bool(struct fmtr_writer *w, char const *key, bool val);
+void fw_append_double(struct fmtr_writer *w, char const *key, double val);
+void fw_append_int64(struct fmtr_writer *w, char const *key, int64_t val);
+void fw_append_char(struct fmtr_writer *w, char const *key, char val);
+void fw_append_string(struct fmtr_writer *w, char const *key, char const *val);
+void fw_append_octet_string(struct fmtr_writer *w, char const *key, uint8_t const *buf, size_t len);
+
+// Runs a serializer on data, producing JSON into vstr
+void fw_format_json(la_vstring *vstr, fmtr_serialize_fn *serialize, void const *data);
+
+#define SAFE_FW_APPEND_STRING(w, n, val) \
+	do { \
+		if((val) != NULL) { \
+			fw_append_string((w), (n), (val)); \
+		} \
+	} while(0)
@@ -0,0 +1,681 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>             // abs
+#include <string.h>             // strdup, memcpy
+#include <math.h>               // roundf
+#include <unistd.h>             // usleep
+#include <pthread.h>            // pthread_mutex_*
+#include <libconfig.h>          // config_*
+#include <libacars/list.h>      // la_list
+#include "config.h"
+#include "frontend.h"
+#include "auto-channels.h"      // auto_channels_select
+#include "block.h"              // block_*
+#include "libcsdr.h"            // compute_fft_decimation_rate, compute_filter_relative_transition_bw
+#include "fft.h"                // fft_create, fft_destroy
+#include "hfdl.h"               // hfdl_channel_create, hfdl_channel_destroy, HFDL_*
+#include "input-common.h"       // input_*
+#include "input-helpers.h"      // sample_format_from_string
+#include "statsd.h"             // statsd_set, statsd_initialize_counters_per_channel
+#include "util.h"               // ASSERT, NEW, XCALLOC, XFREE, HZ_TO_KHZ, debug_print, max, pthread_mutex_initialize
+
+struct frontend_params *frontend_params_create(struct input_cfg *input_cfg,
+		int32_t *frequencies, int32_t channel_cnt) {
+	ASSERT(input_cfg != NULL);
+	ASSERT(channel_cnt >= 0);
+	NEW(struct frontend_params, params);
+	params->input_cfg = input_cfg;
+	params->frequencies = XCALLOC(max(channel_cnt, 1), sizeof(int32_t));
+	if(channel_cnt > 0) {
+		ASSERT(frequencies != NULL);
+		memcpy(params->frequencies, frequencies, channel_cnt * sizeof(int32_t));
+	}
+	params->channel_cnt = channel_cnt;
+	return params;
+}
+
+void frontend_params_destroy(void *p) {
+	if(p != NULL) {
+		struct frontend_params *params = p;
+		input_cfg_destroy(params->input_cfg);
+		XFREE(params->frequencies);
+		XFREE(params);
+	}
+}
+
+/******************************
+ * Input configuration file
+ ******************************/
+
+// Returns true and stores the value in *result if the setting exists and is
+// a number. Integers are accepted wherever floats are, because it's easy to
+// forget the decimal point in a frequency value.
+static bool config_setting_get_number(config_setting_t const *setting, double *result) {
+	int32_t type = config_setting_type(setting);
+	if(type == CONFIG_TYPE_FLOAT) {
+		*result = config_setting_get_float(setting);
+		return true;
+	} else if(type == CONFIG_TYPE_INT) {
+		*result = (double)config_setting_get_int(setting);
+		return true;
+	}
+	return false;
+}
+
+#define INPUT_ERR(idx, fmt, ...) \
+	fprintf(stderr, "%s: inputs[%d]: " fmt "\n", file, (idx), ##__VA_ARGS__)
+
+// Reads an optional string setting into *result (the value is duplicated).
+static bool input_setting_get_string(config_setting_t const *input, char const *name, char **result) {
+	config_setting_t *s = config_setting_get_member(input, name);
+	if(s == NULL) {
+		return true;
+	}
+	char const *str = config_setting_get_string(s);
+	if(str == NULL) {
+		return false;
+	}
+	*result = strdup(str);
+	return true;
+}
+
+// Reads an optional integer setting.
+static bool input_setting_get_int(config_setting_t const *input, char const *name, int32_t *result) {
+	config_setting_t *s = config_setting_get_member(input, name);
+	if(s == NULL) {
+		return true;
+	}
+	if(config_setting_type(s) != CONFIG_TYPE_INT) {
+		return false;
+	}
+	*result = config_setting_get_int(s);
+	return true;
+}
+
+// Reads an optional numeric setting.
+static bool input_setting_get_double(config_setting_t const *input, char const *name, double *result) {
+	config_setting_t *s = config_setting_get_member(input, name);
+	if(s == NULL) {
+		return true;
+	}
+	return config_setting_get_number(s, result);
+}
+
+// Reads an optional frequency setting (expressed in kHz) and converts it to Hz.
+static bool input_setting_get_frequency(config_setting_t const *input, char const *name, int32_t *result) {
+	double val = 0.0;
+	config_setting_t *s = config_setting_get_member(input, name);
+	if(s == NULL) {
+		return true;
+	}
+	if(config_setting_get_number(s, &val) == false) {
+		return false;
+	}
+	*result = (int32_t)(1e3 * val);
+	return true;
+}
+
+static struct frontend_params *frontend_params_from_setting(char const *file, int32_t idx,
+		config_setting_t const *input, bool auto_channels) {
+	struct input_cfg *cfg = input_cfg_create();
+	int32_t *frequencies = NULL;
+	struct frontend_params *params = NULL;
+	char const *str = NULL;
+
+	if(!config_setting_is_group(input)) {
+		INPUT_ERR(idx, "not a group");
+		goto fail;
+	}
+	if(config_setting_lookup_string(input, "type", &str) == CONFIG_FALSE) {
+		INPUT_ERR(idx, "type is missing or is not a string");
+		goto fail;
+	}
+	if((cfg->type = input_type_from_string(str)) == INPUT_TYPE_UNDEF) {
+		INPUT_ERR(idx, "input type '%s' is unknown or not supported by this build", str);
+		goto fail;
+	}
+	if(config_setting_lookup_string(input, "source", &str) == CONFIG_FALSE) {
+		INPUT_ERR(idx, "source is missing or is not a string");
+		goto fail;
+	}
+	cfg->source = strdup(str);
+	if(config_setting_lookup_string(input, "sample_format", &str) == CONFIG_TRUE) {
+		if((cfg->sfmt = sample_format_from_string(str)) == SFMT_UNDEF) {
+			INPUT_ERR(idx, "sample format '%s' is unknown", str);
+			goto fail;
+		}
+	}
+	if(input_setting_get_int(input, "sample_rate", &cfg->sample_rate) == false) {
+		INPUT_ERR(idx, "sample_rate must be an integer");
+		goto fail;
+	}
+	if(input_setting_get_frequency(input, "centerfreq", &cfg->centerfreq) == false) {
+		INPUT_ERR(idx, "centerfreq must be a number");
+		goto fail;
+	}
+	if(input_setting_get_frequency(input, "freq_offset", &cfg->freq_offset) == false) {
+		INPUT_ERR(idx, "freq_offset must be a number");
+		goto fail;
+	}
+	if(input_setting_get_double(input, "gain", &cfg->gain) == false) {
+		INPUT_ERR(idx, "gain must be a number");
+		goto fail;
+	}
+	if(input_setting_get_double(input, "freq_correction", &cfg->correction) == false) {
+		INPUT_ERR(idx, "freq_correction must be a number");
+		goto fail;
+	}
+	if(input_setting_get_string(input, "gain_elements", &cfg->gain_elements) == false ||
+			input_setting_get_string(input, "antenna", &cfg->antenna) == false ||
+			input_setting_get_string(input, "device_settings", &cfg->device_settings) == false) {
+		INPUT_ERR(idx, "gain_elements, antenna and device_settings must be strings");
+		goto fail;
+	}
+	if(input_setting_get_int(input, "read_buffer_size", &cfg->read_buffer_size) == false) {
+		INPUT_ERR(idx, "read_buffer_size must be an integer");
+		goto fail;
+	}
+	if(input_setting_get_int(input, "jitter_buffer", &cfg->jitter_buffer_len) == false) {
+		INPUT_ERR(idx, "jitter_buffer must be an integer");
+		goto fail;
+	}
+
+	config_setting_t *channels = config_setting_get_member(input, "channels");
+	int32_t channel_cnt = channels != NULL ? config_setting_length(channels) : 0;
+	if(auto_channels && channel_cnt > 0) {
+		INPUT_ERR(idx, "channels can't be set when --auto-channels option is used");
+		goto fail;
+	} else if(!auto_channels && channel_cnt < 1) {
+		INPUT_ERR(idx, "no channel frequencies given");
+		goto fail;
+	}
+	frequencies = XCALLOC(max(channel_cnt, 1), sizeof(int32_t));
+	for(int32_t i = 0; i < channel_cnt; i++) {
+		double freq = 0.0;
+		if(config_setting_get_number(config_setting_get_elem(channels, i), &freq) == false) {
+			INPUT_ERR(idx, "channels[%d] is not a number", i);
+			goto fail;
+		}
+		frequencies[i] = (int32_t)(1e3 * freq);
+	}
+	params = frontend_params_create(cfg, frequencies, channel_cnt);
+	XFREE(frequencies);
+	return params;
+fail:
+	XFREE(frequencies);
+	input_cfg_destroy(cfg);
+	return NULL;
+}
+
+static bool frontend_params_check_duplicate_channels(la_list *params_list) {
+	for(la_list *p = params_list; p != NULL; p = la_list_next(p)) {
+		struct frontend_params *params = p->data;
+		for(int32_t i = 0; i < params->channel_cnt; i++) {
+			for(la_list *q = p; q != NULL; q = la_list_next(q)) {
+				struct frontend_params *other = q->data;
+				for(int32_t j = (q == p ? i + 1 : 0); j < other->channel_cnt; j++) {
+					if(params->frequencies[i] == other->frequencies[j]) {
+						fprintf(stderr, "Channel %.3f kHz is configured more than once\n",
+								HZ_TO_KHZ(params->frequencies[i]));
+						return false;
+					}
+				}
+			}
+		}
+	}
+	return true;
+}
+
+// Reads the list of inputs from a libconfig-formatted file. Returns a list of
+// struct frontend_params or NULL on error. If auto_channels is true, then
+// channel lists must be omitted.
+la_list *frontend_params_read_from_file(char const *file, bool auto_channels) {
+	ASSERT(file != NULL);
+	la_list *params_list = NULL;
+	config_t cfg;
+	config_init(&cfg);
+	if(config_read_file(&cfg, file) != CONFIG_TRUE) {
+		if(config_error_type(&cfg) == CONFIG_ERR_PARSE) {
+			fprintf(stderr, "%s: line %d: %s\n", file, config_error_line(&cfg), config_error_text(&cfg));
+		} else {
+			fprintf(stderr, "%s: %s\n", file, config_error_text(&cfg));
+		}
+		goto fail;
+	}
+	config_setting_t *inputs = config_lookup(&cfg, "inputs");
+	if(inputs == NULL || !config_setting_is_list(inputs) || config_setting_length(inputs) < 1) {
+		fprintf(stderr, "%s: inputs list is missing or empty\n", file);
+		goto fail;
+	}
+	config_setting_t *input = NULL;
+	for(int32_t idx = 0; (input = config_setting_get_elem(inputs, idx)) != NULL; idx++) {
+		struct frontend_params *params = frontend_params_from_setting(file, idx, input, auto_channels);
+		if(params == NULL) {
+			goto fail;
+		}
+		params_list = la_list_append(params_list, params);
+	}
+	if(frontend_params_check_duplicate_channels(params_list) == false) {
+		goto fail;
+	}
+	config_destroy(&cfg);
+	return params_list;
+fail:
+	la_list_free_full(params_list, frontend_params_destroy);
+	config_destroy(&cfg);
+	return NULL;
+}
+
+/******************************
+ * Frontends
+ ******************************/
+
+// Checks if the frequency is within the band of an input with the given
+// center frequency and sampling rate
+bool frequency_in_span(int32_t freq, int32_t centerfreq, int32_t source_rate) {
+	return abs(centerfreq - freq) < source_rate / 2;
+}
+
+static bool check_frequency_span(int32_t *freqs, int32_t cnt, int32_t centerfreq, int32_t source_rate) {
+	ASSERT(freqs);
+	int32_t half_bandwidth = source_rate / 2;
+	for(int32_t i = 0; i < cnt; i++) {
+		if(!frequency_in_span(freqs[i], centerfreq, source_rate)) {
+			fprintf(stderr, "Error: channel frequency %.3f kHz is too far away from the center frequency (%.3f kHz).\n",
+					HZ_TO_KHZ(freqs[i]), HZ_TO_KHZ(centerfreq));
+			fprintf(stderr, "Maximum distance from the center frequency for sampling rate %d sps is %.3f kHz.\n", source_rate, HZ_TO_KHZ(half_bandwidth));
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool compute_centerfreq(int32_t *freqs, int32_t cnt, int32_t *result) {
+	ASSERT(result);
+	ASSERT(cnt > 0);
+	int32_t freq_min, freq_max;
+	freq_min = freq_max = freqs[0];
+	for(int32_t i = 0; i < cnt; i++) {
+		if(freqs[i] < freq_min) freq_min = freqs[i];
+		if(freqs[i] > freq_max) freq_max = freqs[i];
+	}
+	*result = freq_min + (freq_max - freq_min) / 2;
+	return true;
+}
+
+static struct block *frontend_channel_create(struct frontend *fe, int32_t freq) {
+	return hfdl_channel_create(fe->input_cfg->sample_rate, fe->fft_decimation_rate,
+			fe->fftfilt_transition_bw, fe->input_cfg->centerfreq, freq);
+}
+
+// Creates the input, the channelizer and the channels and connects them
+// together. Takes ownership of the input configuration and channel list
+// stored in params.
+struct frontend *frontend_create(int32_t id, struct frontend_params *params) {
+	ASSERT(params != NULL);
+	NEW(struct frontend, fe);
+	fe->id = id;
+	fe->input_cfg = params->input_cfg;
+	fe->frequencies = params->frequencies;
+	fe->channel_cnt = params->channel_cnt;
+	params->input_cfg = NULL;
+	params->frequencies = NULL;
+	struct input_cfg *cfg = fe->input_cfg;
+	if(pthread_mutex_initialize(&fe->lock) != 0 ||
+			pthread_mutex_initialize(&fe->reconf_lock) != 0) {
+		goto fail;
+	}
+
+	// Some inputs learn the stream parameters (sample rate, center frequency)
+	// from the source, so the input has to be created before these are validated.
+	fe->input = input_create(cfg);
+	if(fe->input == NULL) {
+		fprintf(stderr, "%s: invalid input specified\n", cfg->source);
+		goto fail;
+	}
+	if(cfg->sample_rate < HFDL_SYMBOL_RATE * SPS) {
+		fprintf(stderr, "%s: sample rate must be greater or equal to %d\n",
+				cfg->source, HFDL_SYMBOL_RATE * SPS);
+		goto fail;
+	}
+	if(params->auto_channels != NULL) {
+		if(cfg->centerfreq < 0) {
+			fprintf(stderr, "%s: center frequency must be set when using --auto-channels\n", cfg->source);
+			goto fail;
+		}
+		XFREE(fe->frequencies);
+		fe->frequencies = auto_channels_select(params->auto_channels, cfg->centerfreq,
+				cfg->sample_rate, &fe->channel_cnt);
+		if(fe->channel_cnt < 1) {
+			fprintf(stderr, "%s: no system table frequencies found within %.3f kHz +/- %.3f kHz\n",
+					cfg->source, HZ_TO_KHZ(cfg->centerfreq), HZ_TO_KHZ(cfg->sample_rate / 2));
+			goto fail;
+		}
+		fprintf(stderr, "%s: %d channel(s) selected from the system table\n", cfg->source, fe->channel_cnt);
+	}
+	if(cfg->centerfreq < 0) {
+		if(compute_centerfreq(fe->frequencies, fe->channel_cnt, &cfg->centerfreq) == true) {
+			fprintf(stderr, "%s: computed center frequency: %.3f kHz\n", cfg->source, HZ_TO_KHZ(cfg->centerfreq));
+		} else {
+			fprintf(stderr, "%s: failed to compute center frequency\n", cfg->source);
+			goto fail;
+		}
+	}
+	if(check_frequency_span(fe->frequencies, fe->channel_cnt, cfg->centerfreq, cfg->sample_rate) == false) {
+		goto fail;
+	}
+	if(input_init(fe->input) < 0) {
+		fprintf(stderr, "%s: unable to initialize input\n", cfg->source);
+		goto fail;
+	}
+
+	int32_t fft_decimation_rate = compute_fft_decimation_rate(cfg->sample_rate, HFDL_SYMBOL_RATE * SPS);
+	ASSERT(fft_decimation_rate > 0);
+#ifdef DEBUG
+	int32_t sample_rate_post_fft = roundf((float)cfg->sample_rate / (float)fft_decimation_rate);
+#endif
+	float fftfilt_transition_bw = compute_filter_relative_transition_bw(cfg->sample_rate, HFDL_CHANNEL_TRANSITION_BW_HZ);
+	debug_print(D_DSP, "input %d: fft_decimation_rate: %d sample_rate_post_fft: %d transition_bw: %.f\n",
+			id, fft_decimation_rate, sample_rate_post_fft, fftfilt_transition_bw);
+	// Needed later, for channels added at runtime
+	fe->fft_decimation_rate = fft_decimation_rate;
+	fe->fftfilt_transition_bw = fftfilt_transition_bw;
+
+	fe->fft = fft_create(fft_decimation_rate, fftfilt_transition_bw);
+	if(fe->fft == NULL) {
+		goto fail;
+	}
+	fe->channels = XCALLOC(fe->channel_cnt, sizeof(struct block *));
+	for(int32_t i = 0; i < fe->channel_cnt; i++) {
+		fe->channels[i] = frontend_channel_create(fe, fe->frequencies[i]);
+		if(fe->channels[i] == NULL) {
+			fprintf(stderr, "Failed to initialize channel %.3f kHz\n",
+					HZ_TO_KHZ(fe->frequencies[i]));
+			goto fail;
+		}
+	}
+	if(block_connect_one2one(fe->input, fe->fft) != 1 ||
+			block_connect_one2many(fe->fft, fe->channel_cnt, fe->channels) != fe->channel_cnt) {
+		goto fail;
+	}
+	return fe;
+fail:
+	// Blocks are never connected at this point, except when
+	// block_connect_one2many failed, which is not recoverable anyway.
+	if(fe->channels != NULL) {
+		for(int32_t i = 0; i < fe->channel_cnt; i++) {
+			if(fe->channels[i] != NULL) {
+				hfdl_channel_destroy(fe->channels[i]);
+			}
+		}
+		XFREE(fe->channels);
+	}
+	if(fe->fft != NULL) {
+		fft_destroy(fe->fft);
+	}
+	if(fe->input != NULL) {
+		input_destroy(fe->input);
+	}
+	input_cfg_destroy(fe->input_cfg);
+	XFREE(fe->frequencies);
+	XFREE(fe);
+	return NULL;
+}
+
+// Starts consumers first, so that no samples get lost.
+// Returns 0 on success, -1 on failure.
+int32_t frontend_start(struct frontend *fe) {
+	ASSERT(fe != NULL);
+	if(block_set_start(fe->channel_cnt, fe->channels) != fe->channel_cnt ||
+			block_start(fe->fft) != 1 ||
+			block_start(fe->input) != 1) {
+		return -1;
+	}
+	return 0;
+}
+
+bool frontend_is_running(struct frontend *fe) {
+	ASSERT(fe != NULL);
+	pthread_mutex_lock(&fe->lock);
+	bool ret = block_is_running(fe->input) ||
+		block_is_running(fe->fft) ||
+		block_set_is_any_running(fe->channel_cnt, fe->channels);
+	pthread_mutex_unlock(&fe->lock);
+	return ret;
+}
+
+bool frontend_set_is_any_running(size_t fe_cnt, struct frontend *frontends[fe_cnt]) {
+	ASSERT(frontends != NULL);
+	for(size_t i = 0; i < fe_cnt; i++) {
+		if(frontend_is_running(frontends[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Refreshes the CPU time counters of all threads of the frontend.
+// Threads which have already terminated keep their last sampled value, so
+// this should be called frequently enough to keep the totals accurate.
+void frontend_update_cpu_time(struct frontend *fe) {
+	ASSERT(fe != NULL);
+	block_cpu_time(fe->input);
+	block_cpu_time(fe->fft);
+	pthread_mutex_lock(&fe->lock);
+	for(int32_t i = 0; i < fe->channel_cnt; i++) {
+		block_cpu_time(fe->channels[i]);
+	}
+	pthread_mutex_unlock(&fe->lock);
+}
+
+// Includes channels which have been removed at runtime
+static double channels_cpu_time(struct frontend *fe) {
+	pthread_mutex_lock(&fe->lock);
+	double result = fe->removed_channels_cpu_time;
+	for(int32_t i = 0; i < fe->channel_cnt; i++) {
+		result += fe->channels[i]->cpu_time;
+	}
+	pthread_mutex_unlock(&fe->lock);
+	return result;
+}
+
+static int32_t frontend_channel_index(struct frontend *fe, int32_t freq) {
+	for(int32_t i = 0; i < fe->channel_cnt; i++) {
+		if(fe->frequencies[i] == freq) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool frontend_has_channel(struct frontend *fe, int32_t freq) {
+	ASSERT(fe != NULL);
+	pthread_mutex_lock(&fe->lock);
+	bool ret = frontend_channel_index(fe, freq) >= 0;
+	pthread_mutex_unlock(&fe->lock);
+	return ret;
+}
+
+bool frontend_frequency_in_span(struct frontend *fe, int32_t freq) {
+	ASSERT(fe != NULL);
+	return frequency_in_span(freq, fe->input_cfg->centerfreq, fe->input_cfg->sample_rate);
+}
+
+// Returns a copy of the current channel frequency list (to be freed by the caller)
+// and stores its length in *cnt.
+int32_t *frontend_get_channel_list(struct frontend *fe, int32_t *cnt) {
+	ASSERT(fe != NULL);
+	ASSERT(cnt != NULL);
+	pthread_mutex_lock(&fe->lock);
+	int32_t *result = XCALLOC(max(fe->channel_cnt, 1), sizeof(int32_t));
+	memcpy(result, fe->frequencies, fe->channel_cnt * sizeof(int32_t));
+	*cnt = fe->channel_cnt;
+	pthread_mutex_unlock(&fe->lock);
+	return result;
+}
+
+// Adds and removes channels of a running frontend. Frequencies to be added
+// must lie within the input band and must not be configured yet. Frequencies
+// to be removed must be configured. The input keeps running, but channels
+// stop receiving data while the channelizer output is being rewired.
+// The duration of this pause is returned in *pause.
+// Returns 0 on success, -1 on failure.
+int32_t frontend_reconfigure(struct frontend *fe, size_t add_cnt, int32_t add_freqs[add_cnt],
+		size_t remove_cnt, int32_t remove_freqs[remove_cnt], double *pause) {
+	ASSERT(fe != NULL);
+	if(add_cnt == 0 && remove_cnt == 0) {
+		return 0;
+	}
+	int32_t ret = -1;
+	pthread_mutex_lock(&fe->reconf_lock);
+	// This is the only place where the channel list is modified, so it may be
+	// read without taking fe->lock while reconf_lock is held.
+	struct block **blocks = XCALLOC(add_cnt + remove_cnt, sizeof(struct block *));
+	struct block **add = blocks, **remove = blocks + add_cnt;
+	size_t created = 0;
+	for(size_t i = 0; i < remove_cnt; i++) {
+		int32_t idx = frontend_channel_index(fe, remove_freqs[i]);
+		if(idx < 0) {
+			fprintf(stderr, "input %d: channel %.3f kHz is not configured\n",
+					fe->id, HZ_TO_KHZ(remove_freqs[i]));
+			goto end;
+		}
+		remove[i] = fe->channels[idx];
+	}
+	for(size_t i = 0; i < add_cnt; i++) {
+		if(frontend_channel_index(fe, add_freqs[i]) >= 0) {
+			fprintf(stderr, "input %d: channel %.3f kHz is already configured\n",
+					fe->id, HZ_TO_KHZ(add_freqs[i]));
+			goto end;
+		}
+		if(!frontend_frequency_in_span(fe, add_freqs[i])) {
+			fprintf(stderr, "input %d: channel %.3f kHz is outside of the input band\n",
+					fe->id, HZ_TO_KHZ(add_freqs[i]));
+			goto end;
+		}
+	}
+	for(created = 0; created < add_cnt; created++) {
+		if((add[created] = frontend_channel_create(fe, add_freqs[created])) == NULL) {
+			fprintf(stderr, "input %d: failed to initialize channel %.3f kHz\n",
+					fe->id, HZ_TO_KHZ(add_freqs[created]));
+			goto end;
+		}
+#ifdef WITH_STATSD
+		statsd_initialize_counters_per_channel(add_freqs[created]);
+#endif
+	}
+	if(fft_reconfigure(fe->fft, add_cnt, add, remove_cnt, remove, pause) < 0) {
+		fprintf(stderr, "input %d: channelizer is not running\n", fe->id);
+		goto end;
+	}
+	// New channels are running now and removed ones are about to terminate
+	created = 0;
+
+	int32_t new_cnt = fe->channel_cnt - remove_cnt + add_cnt;
+	struct block **channels = XCALLOC(max(new_cnt, 1), sizeof(struct block *));
+	int32_t *frequencies = XCALLOC(max(new_cnt, 1), sizeof(int32_t));
+	int32_t n = 0;
+	pthread_mutex_lock(&fe->lock);
+	for(int32_t i = 0; i < fe->channel_cnt; i++) {
+		bool removed = false;
+		for(size_t j = 0; j < remove_cnt; j++) {
+			if(fe->channels[i] == remove[j]) {
+				fe->removed_channels_cpu_time += block_cpu_time(remove[j]);
+				removed = true;
+				break;
+			}
+		}
+		if(!removed) {
+			channels[n] = fe->channels[i];
+			frequencies[n++] = fe->frequencies[i];
+		}
+	}
+	for(size_t i = 0; i < add_cnt; i++) {
+		channels[n] = add[i];
+		frequencies[n++] = add_freqs[i];
+	}
+	ASSERT(n == new_cnt);
+	XFREE(fe->channels);
+	XFREE(fe->frequencies);
+	fe->channels = channels;
+	fe->frequencies = frequencies;
+	fe->channel_cnt = new_cnt;
+	pthread_mutex_unlock(&fe->lock);
+
+	for(size_t i = 0; i < remove_cnt; i++) {
+		while(block_is_running(remove[i])) {
+			usleep(1000);
+		}
+		hfdl_channel_destroy(remove[i]);
+	}
+	ret = 0;
+end:
+	for(size_t i = 0; i < created; i++) {
+		hfdl_channel_destroy(add[i]);
+	}
+	XFREE(blocks);
+	pthread_mutex_unlock(&fe->reconf_lock);
+	return ret;
+}
+
+#define CPU_PCT(cpu_time, elapsed) ((elapsed) > 0.0 ? 100.0 * (cpu_time) / (elapsed) : 0.0)
+
+// Reports CPU utilization of the frontend threads during the last interval
+// (in seconds) via StatsD.
+void frontend_report_stats(struct frontend *fe, double interval) {
+	ASSERT(fe != NULL);
+	frontend_update_cpu_time(fe);
+	double input = fe->input->cpu_time;
+	double fft = fe->fft->cpu_time;
+	double channels = channels_cpu_time(fe);
+	debug_print(D_STATS, "input %d: CPU usage: input: %.1f%% fft: %.1f%% channels: %.1f%%\n", fe->id,
+			CPU_PCT(input - fe->cpu_time_last.input, interval),
+			CPU_PCT(fft - fe->cpu_time_last.fft, interval),
+			CPU_PCT(channels - fe->cpu_time_last.channels, interval));
+#ifdef WITH_STATSD
+	char metric[64];
+	snprintf(metric, sizeof(metric), "inputs.%d.cpu_pct.input", fe->id);
+	statsd_set(metric, (size_t)roundf(CPU_PCT(input - fe->cpu_time_last.input, interval)));
+	snprintf(metric, sizeof(metric), "inputs.%d.cpu_pct.fft", fe->id);
+	statsd_set(metric, (size_t)roundf(CPU_PCT(fft - fe->cpu_time_last.fft, interval)));
+	snprintf(metric, sizeof(metric), "inputs.%d.cpu_pct.channels", fe->id);
+	statsd_set(metric, (size_t)roundf(CPU_PCT(channels - fe->cpu_time_last.channels, interval)));
+#endif
+	fe->cpu_time_last.input = input;
+	fe->cpu_time_last.fft = fft;
+	fe->cpu_time_last.channels = channels;
+}
+
+// Prints the thread count and the total CPU time used by the frontend
+// threads during the program run time (elapsed, in seconds).
+void frontend_print_stats(struct frontend *fe, double elapsed) {
+	ASSERT(fe != NULL);
+	double input = fe->input->cpu_time;
+	double fft = fe->fft->cpu_time;
+	double channels = channels_cpu_time(fe);
+	fprintf(stderr, "Input %d (%s): %d channel(s), %d threads, CPU time: "
+			"input: %.1f s (%.1f%%), fft: %.1f s (%.1f%%), channels: %.1f s (%.1f%%)\n",
+			fe->id, fe->input_cfg->source, fe->channel_cnt, fe->channel_cnt + 2,
+			input, CPU_PCT(input, elapsed), fft, CPU_PCT(fft, elapsed),
+			channels, CPU_PCT(channels, elapsed));
+}
+
+void frontend_destroy(struct frontend *fe) {
+	if(fe != NULL) {
+		pthread_mutex_destroy(&fe->lock);
+		pthread_mutex_destroy(&fe->reconf_lock);
+		block_disconnect_one2many(fe->fft, fe->channel_cnt, fe->channels);
+		block_disconnect_one2one(fe->input, fe->fft);
+		for(int32_t i = 0; i < fe->channel_cnt; i++) {
+			hfdl_channel_destroy(fe->channels[i]);
+		}
+		XFREE(fe->channels);
+		input_destroy(fe->input);
+		input_cfg_destroy(fe->input_cfg);
+		fft_destroy(fe->fft);
+		XFREE(fe->frequencies);
+		XFREE(fe);
+	}
+}
@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>             // size_t
+#include <stdbool.h>
+#include <pthread.h>            // pthread_mutex_t
+#include <libacars/list.h>      // la_list
+#include "auto-channels.h"      // struct auto_channels
+#include "block.h"              // struct block
+#include "input-common.h"       // struct input_cfg
+
+// A frontend is a complete DSP chain: an input, an FFT channelizer fed by it
+// and a set of HFDL channels fed by the channelizer. All frontends feed the
+// same PDU decoder.
+
+// How often per-input CPU usage is reported via StatsD (seconds)
+#define FRONTEND_STATS_INTERVAL 10
+
+struct frontend_params {
+	struct input_cfg *input_cfg;
+	int32_t *frequencies;
+	int32_t channel_cnt;
+	struct auto_channels *auto_channels;    // if set, channels are selected from the system table
+};
+
+struct frontend {
+	struct input_cfg *input_cfg;
+	struct block *input;
+	struct block *fft;
+	struct block **channels;
+	int32_t *frequencies;
+	int32_t channel_cnt;
+	int32_t id;
+	int32_t fft_decimation_rate;
+	float fftfilt_transition_bw;
+	pthread_mutex_t lock;           // protects channels, frequencies and channel_cnt
+	pthread_mutex_t reconf_lock;    // serializes channel set changes
+	double removed_channels_cpu_time;
+	struct {
+		double input, fft, channels;
+	} cpu_time_last;                // CPU time at the previous stats report
+};
+
+struct frontend_params *frontend_params_create(struct input_cfg *input_cfg,
+		int32_t *frequencies, int32_t channel_cnt);
+void frontend_params_destroy(void *params);
+la_list *frontend_params_read_from_file(char const *file, bool auto_channels);
+
+struct frontend *frontend_create(int32_t id, struct frontend_params *params);
+int32_t frontend_start(struct frontend *fe);
+bool frontend_is_running(struct frontend *fe);
+bool frontend_set_is_any_running(size_t fe_cnt, struct frontend *frontends[fe_cnt]);
+void frontend_update_cpu_time(struct frontend *fe);
+bool frontend_has_channel(struct frontend *fe, int32_t freq);
+bool frontend_frequency_in_span(struct frontend *fe, int32_t freq);
+bool frequency_in_span(int32_t freq, int32_t centerfreq, int32_t source_rate);
+int32_t *frontend_get_channel_list(struct frontend *fe, int32_t *cnt);
+int32_t frontend_reconfigure(struct frontend *fe, size_t add_cnt, int32_t add_freqs[add_cnt],
+		size_t remove_cnt, int32_t remove_freqs[remove_cnt], double *pause);
+void frontend_report_stats(struct frontend *fe, double interval);
+void frontend_print_stats(struct frontend *fe, double elapsed);
+void frontend_destroy(struct frontend *fe);
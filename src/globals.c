@@ -21,3 +21,4 @@ pthread_mutex_t AC_cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
 // basestation.sqb cache
 ac_data *AC_data;
+pthread_mutex_t AC_data_lock = PTHREAD_MUTEX_INITIALIZER;
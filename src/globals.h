@@ -56,3 +56,6 @@ extern pthread_mutex_t AC_cache_lock;
 #define AC_cache_unlock() do { pthread_mutex_unlock(&AC_cache_lock); } while(0)
 
 extern ac_data *AC_data;
+extern pthread_mutex_t AC_data_lock;
+#define AC_data_lock() do { pthread_mutex_lock(&AC_data_lock); } while(0)
+#define AC_data_unlock() do { pthread_mutex_unlock(&AC_data_lock); } while(0)
@@ -16,14 +16,14 @@
 #ifndef HAVE_PTHREAD_BARRIERS
 #include "pthread_barrier.h"
 #endif
-#include "block.h"                  // struct block, block_connection_is_shutdown_signaled
+#include "block.h"                  // struct block, block_connection_*
 #include "dumpfile.h"               // dumpfile_*
 #include "util.h"                   // NEW, XCALLOC, octet_string_new
 #include "fastddc.h"                // fft_channelizer_create, fastddc_inv_cc
 #include "libfec/fec.h"             // viterbi27
 #include "hfdl.h"                   // HFDL_SYMBOL_RATE, SPS
 #include "metadata.h"               // struct metadata
-#include "pdu.h"                    // pdu_decoder_queue_push, hfdl_pdu_metadata_create
+#include "pdu.h"                    // pdu_decoder_slot_*, hfdl_pdu_decoder_shard_get
 #include "statsd.h"                 // statsd_*
 
 #define PREKEY_LEN 448
@@ -37,6 +37,7 @@
 #define DATA_FRAME_CNT_SINGLE_SLOT 72
 #define DATA_FRAME_CNT_DOUBLE_SLOT 168
 #define DATA_SYMBOLS_CNT_MAX (DATA_FRAME_CNT_DOUBLE_SLOT * DATA_FRAME_LEN)
+#define ENCODED_BITS_CNT_MAX (DATA_SYMBOLS_CNT_MAX * MOD_ARITY_MAX)
 #define PREAMBLE_LEN (2 * A_LEN + M1_LEN + M2_LEN + 9 * T_LEN)
 #define SINGLE_SLOT_FRAME_LEN (PREKEY_LEN + PREAMBLE_LEN + DATA_FRAME_CNT_SINGLE_SLOT * (DATA_FRAME_LEN + T_LEN))
 #define CORR_THRESHOLD_A1 0.36f
@@ -137,11 +138,6 @@ static struct hfdl_params const hfdl_frame_params[M_SHIFT_CNT] = {
 	}
 };
 
-struct nf_stats_thread_ctx {
-	struct block **channel_block_list;
-	int32_t channel_cnt;
-};
-
 #define SYMSYNC_PFB_CNT 16          // number of filter in symsync polyphase filterbank
 #define HFDL_MF_SYMBOL_DELAY 3      // delay introduced by matched filter (measured in symbols)
 #define HFDL_MF_TAPS_CNT 19         // SPS * 3 symbols of delay * 2 + 1
@@ -182,12 +178,21 @@ static uint32_t T = 0x9AF;      // training sequence
 
 static bsequence A_bs, M1[M_SHIFT_CNT], M2[M_SHIFT_CNT];
 
+// All existing channels (used by the noise floor stats thread, since
+// channels may be added and removed at runtime)
+static struct {
+	struct hfdl_channel *head;
+	pthread_mutex_t lock;
+} Channel_list = {
+	.head = NULL,
+	.lock = PTHREAD_MUTEX_INITIALIZER
+};
+
 /**********************************
  * Forward declarations
  **********************************/
 
 typedef struct costas *costas;
-typedef struct deinterleaver *deinterleaver;
 typedef struct descrambler *descrambler;
 struct hfdl_channel;
 
@@ -216,8 +221,10 @@ struct hfdl_channel {
 	cbuffercf data_symbols;
 	cbuffercf current_buffer;
 	descrambler descrambler;
-	deinterleaver deinterleaver[M_SHIFT_CNT];
-	void *viterbi_ctx[M_SHIFT_CNT];
+	// FEC decoder state, sized for the longest frame and reused for every frame
+	uint8_t *fec_buf;                   // deinterleaved soft bits (Viterbi decoder input)
+	uint8_t *pdu_buf;                   // Viterbi decoder output
+	void *viterbi_ctx;                  // created when the first frame is decoded
 	uint64_t symbol_cnt, sample_cnt;
 	float resamp_rate;
 	sampler_state s_state;
@@ -225,6 +232,8 @@ struct hfdl_channel {
 	mod_arity data_mod_arity;
 	mod_arity current_mod_arity;
 	int32_t chan_freq;
+	int32_t decoder_shard;              // decoder thread handling frames from this channel
+	struct hfdl_channel *next;          // next channel in Channel_list
 	int32_t resampler_delay;
 	int32_t symbols_wanted;
 	int32_t search_retries;
@@ -350,66 +359,54 @@ static descrambler hfdl_descrambler_create(void) {
  * Deinterleaver
  **********************************/
 
-struct deinterleaver {
-	uint8_t **table;
-	int32_t row, col;
-	int32_t column_cnt;
-	int32_t push_column_shift;
-};
+// Deinterleaving is a fixed permutation of soft bits which depends only on
+// the frame type. Permutations for all frame types are computed once and
+// shared by all channels. Soft bits are stored directly at their
+// deinterleaved positions as they are demodulated.
 
 #define DEINTERLEAVER_ROW_CNT 40
 #define DEINTERLEAVER_POP_ROW_SHIFT 9
 
-static deinterleaver deinterleaver_create(int32_t M1) {
-	deinterleaver d = XCALLOC(DEINTERLEAVER_ROW_CNT, sizeof(struct deinterleaver));
-	d->column_cnt = hfdl_frame_params[M1].data_segment_cnt * DATA_FRAME_LEN
+// deinterleaver_map[M1][i] is the position of i-th received soft bit
+// in the deinterleaved sequence
+static uint16_t *deinterleaver_map[M_SHIFT_CNT];
+
+static uint16_t *deinterleaver_map_create(int32_t M1) {
+	int32_t column_cnt = hfdl_frame_params[M1].data_segment_cnt * DATA_FRAME_LEN
 		* hfdl_frame_params[M1].scheme / DEINTERLEAVER_ROW_CNT;
-	d->table = XCALLOC(DEINTERLEAVER_ROW_CNT, sizeof(uint8_t *));
-	for(int32_t i = 0; i < DEINTERLEAVER_ROW_CNT; i++) {
-		d->table[i] = XCALLOC(d->column_cnt, sizeof(uint8_t));
-	}
-	d->push_column_shift = hfdl_frame_params[M1].deinterleaver_push_column_shift;
+	int32_t push_column_shift = hfdl_frame_params[M1].deinterleaver_push_column_shift;
+	int32_t size = column_cnt * DEINTERLEAVER_ROW_CNT;
+	ASSERT(size <= ENCODED_BITS_CNT_MAX);
 	debug_print(D_FRAME, "M1: %d column_cnt: %d total_size: %d column_shift: %d\n",
-			M1, d->column_cnt, d->column_cnt * DEINTERLEAVER_ROW_CNT, d->push_column_shift);
-	return d;
-}
-
-static void deinterleaver_destroy(deinterleaver d) {
-	if(d) {
-		for(int32_t i = 0; i < DEINTERLEAVER_ROW_CNT; i++) {
-			XFREE(d->table[i]);
+			M1, column_cnt, size, push_column_shift);
+
+	// Fill the interleaver table with soft bit numbers in the push order...
+	uint16_t *table = XCALLOC(size, sizeof(uint16_t));
+	int32_t row = 0, col = 0;
+	for(int32_t i = 0; i < size; i++) {
+		table[row * column_cnt + col] = i;
+		row++;
+		if(row == DEINTERLEAVER_ROW_CNT) {
+			row = 0;
+			col++;
+		}
+		col -= push_column_shift;
+		if(col < 0) {
+			col += column_cnt;
 		}
-		XFREE(d->table);
-		XFREE(d);
-	}
-}
-
-static void deinterleaver_push(deinterleaver d, uint8_t val) {
-	debug_print(D_FRAME_DETAIL, "push:%d:%d:%hhu\n", d->row, d->col, val);
-	d->table[d->row][d->col] = val;
-	d->row++;
-	if(d->row == DEINTERLEAVER_ROW_CNT) {
-		d->row = 0;
-		d->col++;
-	}
-	d->col -= d->push_column_shift;
-	if(d->col < 0) {
-		d->col += d->column_cnt;
 	}
-}
-
-static uint8_t deinterleaver_pop(deinterleaver d) {
-	uint8_t ret = d->table[d->row][d->col];
-	debug_print(D_FRAME_DETAIL, "pop:%d:%d:%hhu\n", d->row, d->col, ret);
-	d->row = (d->row + DEINTERLEAVER_POP_ROW_SHIFT) % DEINTERLEAVER_ROW_CNT;
-	if(d->row == 0) {
-		d->col++;
+	// ...and read them back in the pop order
+	uint16_t *map = XCALLOC(size, sizeof(uint16_t));
+	row = col = 0;
+	for(int32_t i = 0; i < size; i++) {
+		map[table[row * column_cnt + col]] = i;
+		row = (row + DEINTERLEAVER_POP_ROW_SHIFT) % DEINTERLEAVER_ROW_CNT;
+		if(row == 0) {
+			col++;
+		}
 	}
-	return ret;
-}
-
-static void deinterleaver_reset(deinterleaver d) {
-	d->row = d->col = 0;
+	XFREE(table);
+	return map;
 }
 
 /**********************************
@@ -438,6 +435,14 @@ void hfdl_init_globals(void) {
 	A_bs = bsequence_create(A_LEN);
 	bsequence_init(A_bs, A_octets);
 
+	for(int32_t i = 0; i < M_SHIFT_CNT; i++) {
+		deinterleaver_map[i] = deinterleaver_map_create(i);
+	}
+	// Initialize libfec tables here, as Viterbi decoders are created
+	// lazily by channel threads.
+	int32_t polys[2] = { V27POLYA, V27POLYB };
+	set_viterbi27_polynomial(polys);
+
 	uint32_t M1_bits[M1_LEN] = {
 		0,1,1,1,0,1,1,0,1,1,1,1,0,1,0,0,0,1,0,1,1,0,0,
 		1,0,1,1,1,1,1,0,0,0,1,0,0,0,0,0,0,1,1,0,0,1,1,0,1,1,
@@ -473,6 +478,7 @@ struct block *hfdl_channel_create(int32_t sample_rate, int32_t pre_decimation_ra
 	c->resampler_delay = (int32_t)ceilf(msresamp_crcf_get_delay(c->resampler));
 
 	c->chan_freq = frequency;
+	c->decoder_shard = -1;              // assigned when the first frame arrives
 	float freq_shift = (float)(centerfreq - (frequency + HFDL_SSB_CARRIER_OFFSET_HZ)) / (float)sample_rate;
 	debug_print(D_DSP, "create: centerfreq=%d frequency=%d freq_shift=%f\n",
 			centerfreq, frequency, freq_shift);
@@ -508,13 +514,8 @@ struct block *hfdl_channel_create(int32_t sample_rate, int32_t pre_decimation_ra
 	c->training_symbols = cbuffercf_create(T_LEN);
 	c->data_symbols = cbuffercf_create(DATA_SYMBOLS_CNT_MAX);
 	c->descrambler = hfdl_descrambler_create();
-	for(int32_t i = 0; i < M_SHIFT_CNT; i++) {
-		c->deinterleaver[i] = deinterleaver_create(i);
-		struct hfdl_params const p = hfdl_frame_params[i];
-		int32_t user_data_bits_cnt = p.data_segment_cnt * DATA_FRAME_LEN * p.scheme / p.code_rate;
-		debug_print(D_DSP, "user_data_bits_cnt[%d]: %d\n", i, user_data_bits_cnt);
-		c->viterbi_ctx[i] = create_viterbi27(user_data_bits_cnt);
-	}
+	c->fec_buf = XCALLOC(ENCODED_BITS_CNT_MAX, sizeof(uint8_t));
+	c->pdu_buf = XCALLOC(HFDL_PDU_LEN_MAX, sizeof(uint8_t));
 
 	c->user_data = bsequence_create(DATA_SYMBOLS_CNT_MAX * MOD_ARITY_MAX);
 
@@ -526,6 +527,10 @@ struct block *hfdl_channel_create(int32_t sample_rate, int32_t pre_decimation_ra
 	c->block.consumer = consumer;
 	c->block.thread_routine = hfdl_decoder_thread;
 
+	pthread_mutex_lock(&Channel_list.lock);
+	c->next = Channel_list.head;
+	Channel_list.head = c;
+	pthread_mutex_unlock(&Channel_list.lock);
 	return &c->block;
 fail:
 	XFREE(c);
@@ -538,6 +543,14 @@ void hfdl_channel_destroy(struct block *channel_block) {
 		return;
 	}
 	struct hfdl_channel *c = container_of(channel_block, struct hfdl_channel, block);
+	pthread_mutex_lock(&Channel_list.lock);
+	for(struct hfdl_channel **p = &Channel_list.head; *p != NULL; p = &(*p)->next) {
+		if(*p == c) {
+			*p = c->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&Channel_list.lock);
 	msresamp_crcf_destroy(c->resampler);
 	fft_channelizer_destroy(c->channelizer);
 	agc_crcf_destroy(c->agc);
@@ -552,10 +565,9 @@ void hfdl_channel_destroy(struct block *channel_block) {
 	cbuffercf_destroy(c->training_symbols);
 	cbuffercf_destroy(c->data_symbols);
 	descrambler_destroy(c->descrambler);
-	for(int32_t i = 0; i < M_SHIFT_CNT; i++) {
-		deinterleaver_destroy(c->deinterleaver[i]);
-		delete_viterbi27(c->viterbi_ctx[i]);
-	}
+	XFREE(c->fec_buf);
+	XFREE(c->pdu_buf);
+	delete_viterbi27(c->viterbi_ctx);
 	bsequence_destroy(c->user_data);
 	XFREE(c);
 }
@@ -572,12 +584,9 @@ void hfdl_print_summary(void) {
 #endif
 }
 
-int32_t hfdl_nf_stats_thread_start(struct block **channel_block_list, int32_t channel_cnt) {
+int32_t hfdl_nf_stats_thread_start(void) {
 	pthread_t nfstats_th;
-	NEW(struct nf_stats_thread_ctx, ctx);
-	ctx->channel_block_list = channel_block_list;
-	ctx->channel_cnt = channel_cnt;
-	int32_t ret = start_thread(&nfstats_th, noise_floor_stats_thread, ctx);
+	int32_t ret = start_thread(&nfstats_th, noise_floor_stats_thread, NULL);
 	return ret;
 }
 
@@ -666,6 +675,14 @@ static void *hfdl_decoder_thread(void *ctx) {
 			debug_print(D_MISC, "channel %d: Exiting (ordered shutdown)\n", c->chan_freq);
 			break;
 		}
+		if(UNLIKELY(block_connection_is_reconfigure_signaled(block->consumer.in))) {
+			// Channel set is being changed - no data in the buffer this time
+			if(block_connection_one2many_reconfigure_wait(block) == false) {
+				debug_print(D_MISC, "channel %d: Exiting (channel removed)\n", c->chan_freq);
+				break;
+			}
+			continue;
+		}
 #ifdef DUMP_FFT
 		// XXX: Does not work now due to missing sample clock
 		//dumpfile_cf32_write_block(f_fft_out, input->buf, c->channelizer->ddc->fft_size);
@@ -984,66 +1001,63 @@ static void framer_reset(struct hfdl_channel *c) {
 	cbuffercf_reset(c->data_symbols);
 	cbuffercf_reset(c->training_symbols);
 	bsequence_reset(c->user_data);
-	for(int32_t i = 0; i < M_SHIFT_CNT; i++) {
-		deinterleaver_reset(c->deinterleaver[i]);
-	}
 	sampler_reset(c);
 }
 
 static void decode_user_data(struct hfdl_channel *c) {
-#define deinterleaver_table_size(d) (uint32_t)((d)->column_cnt * DEINTERLEAVER_ROW_CNT)
 	static float const phase_flip[2] = { [0] = 1.0f, [1] = -1.0f };
 	int32_t M1 = c->M1;
 	uint32_t num_symbols = hfdl_frame_params[M1].data_segment_cnt * DATA_FRAME_LEN;
 	ASSERT(num_symbols == cbuffercf_size(c->data_symbols));
 	uint32_t num_encoded_bits = num_symbols * c->data_mod_arity;
-	chan_debug("got %d user data symbols, deinterleaver table size: %u bitmask: 0x%x\n", num_symbols,
-			deinterleaver_table_size(c->deinterleaver[M1]), c->bitmask);
-	ASSERT(num_encoded_bits == deinterleaver_table_size(c->deinterleaver[M1]));
+	chan_debug("got %d user data symbols, encoded bits: %u bitmask: 0x%x\n", num_symbols,
+			num_encoded_bits, c->bitmask);
+	ASSERT(num_encoded_bits <= ENCODED_BITS_CNT_MAX);
 	uint32_t bits = 0;
 	uint32_t descrambler_bit = 0;
 	float complex symbol;
-	uint8_t soft_bits[c->data_mod_arity];
+	uint8_t soft_bits[MOD_ARITY_MAX];
+	uint8_t *fec_buf = c->fec_buf;
+	uint16_t const *map = deinterleaver_map[M1];
 	modem data_modem = c->m[c->data_mod_arity];
-	for(uint32_t i = 0; i < num_symbols; i++) {
+	for(uint32_t i = 0, n = 0; i < num_symbols; i++) {
 		cbuffercf_pop(c->data_symbols, &symbol);
 		descrambler_bit = descrambler_advance(c->descrambler);
 		// Flip symbol phase by M_PI when descrambler outputs 1
 		// Flip symbol phase by M_PI when Costas loop synced in an opposite phase
 		modem_demodulate_soft(data_modem, symbol * phase_flip[descrambler_bit] * phase_flip[c->bitmask & 1],
 				&bits, soft_bits);
-		for(uint32_t j = 0; j < c->data_mod_arity; j++) {
-			deinterleaver_push(c->deinterleaver[M1], soft_bits[j]);
+		for(uint32_t j = 0; j < c->data_mod_arity; j++, n++) {
+			fec_buf[map[n]] = soft_bits[j];
 		}
 	}
 #define CONV_CODE_RATE 2
 	uint32_t viterbi_input_len = num_encoded_bits;
 	// When FEC rate is 1/4, every chip is transmitted twice, so we take mean value of them
+	// (in place, as the result never overtakes the input)
 	if(hfdl_frame_params[M1].code_rate == 4) {
 		viterbi_input_len /= 2;
-	}
-	uint8_t viterbi_input[viterbi_input_len];
-	if(hfdl_frame_params[M1].code_rate == 4) {
 		uint8_t a, b;
 		for(uint32_t i = 0; i < viterbi_input_len; i++) {
-			a = deinterleaver_pop(c->deinterleaver[M1]);
-			b = deinterleaver_pop(c->deinterleaver[M1]);
+			a = fec_buf[2 * i];
+			b = fec_buf[2 * i + 1];
 			// Average without overflow (http://aggregate.org/MAGIC/#Average%20of%20Integers)
-			viterbi_input[i] = (a & b) + ((a ^ b) >> 1);
-		}
-	} else {    // code_rate == 2
-		for(uint32_t i = 0; i < viterbi_input_len; i++) {
-			viterbi_input[i] = deinterleaver_pop(c->deinterleaver[M1]);
+			fec_buf[i] = (a & b) + ((a ^ b) >> 1);
 		}
 	}
-	debug_print_buf_hex(D_FRAME_DETAIL, viterbi_input, viterbi_input_len, "viterbi_input:\n");
+	debug_print_buf_hex(D_FRAME_DETAIL, fec_buf, viterbi_input_len, "viterbi_input:\n");
 
-	void *v = c->viterbi_ctx[M1];
+	// All frame types share a single decoder sized for the longest one
+	if(c->viterbi_ctx == NULL) {
+		c->viterbi_ctx = create_viterbi27(ENCODED_BITS_CNT_MAX / CONV_CODE_RATE);
+	}
+	void *v = c->viterbi_ctx;
 	uint32_t viterbi_output_len = viterbi_input_len / CONV_CODE_RATE;
 	uint32_t viterbi_output_len_octets = viterbi_output_len / 8 + (viterbi_output_len % 8 != 0 ? 1 : 0);
-	uint8_t viterbi_output[viterbi_output_len_octets];
+	ASSERT(viterbi_output_len_octets <= HFDL_PDU_LEN_MAX);
+	uint8_t *viterbi_output = c->pdu_buf;
 	init_viterbi27(v, 0);
-	update_viterbi27_blk(v, viterbi_input, viterbi_output_len);
+	update_viterbi27_blk(v, fec_buf, viterbi_output_len);
 	chainback_viterbi27(v, viterbi_output, viterbi_output_len, 0);
 	debug_print(D_FRAME, "code_rate: 1/%d num_encoded_bits: %u viterbi_input_len: %u viterbi_output_len: %u, viterbi_output_len_octets: %u\n",
 			hfdl_frame_params[M1].code_rate, num_encoded_bits, viterbi_input_len, viterbi_output_len, viterbi_output_len_octets);
@@ -1056,8 +1070,22 @@ static void decode_user_data(struct hfdl_channel *c) {
 }
 
 static void dispatch_pdu(struct hfdl_channel *c, uint8_t *buf, size_t len) {
-	struct metadata *m = hfdl_pdu_metadata_create();
-	struct hfdl_pdu_metadata *hm = container_of(m, struct hfdl_pdu_metadata, metadata);
+	if(len > HFDL_PDU_LEN_MAX) {
+		debug_print(D_FRAME, "%d: PDU too long (%zu octets), dropped\n", c->chan_freq, len);
+		return;
+	}
+	if(c->decoder_shard < 0) {
+		c->decoder_shard = hfdl_pdu_decoder_shard_get(c->chan_freq);
+	}
+	// The frame is written directly into a preallocated queue slot
+	struct hfdl_pdu_slot *slot = pdu_decoder_slot_claim(c->decoder_shard);
+	if(slot == NULL) {
+		debug_print(D_FRAME, "%d: decoder queue full, frame dropped\n", c->chan_freq);
+		statsd_increment_per_channel(c->chan_freq, "frames.dropped");
+		return;
+	}
+	struct hfdl_pdu_metadata *hm = &slot->metadata;
+	struct metadata *m = &hm->metadata;
 	hm->version = 1;
 	hm->freq = c->chan_freq;
 	hm->freq_err_hz = c->freq_err_hz;
@@ -1073,33 +1101,28 @@ static void dispatch_pdu(struct hfdl_channel *c, uint8_t *buf, size_t len) {
 		DATA_FRAME_LEN / (DATA_FRAME_LEN + T_LEN);
 	hm->slot = p->data_segment_cnt == DATA_FRAME_CNT_SINGLE_SLOT ? 'S' : 'D';
 
-	uint32_t flags = 0;
-	uint8_t *copy = XCALLOC(len, sizeof(uint8_t));
-	memcpy(copy, buf, len);
-	pdu_decoder_queue_push(m, octet_string_new(copy, len), flags);
+	memcpy(slot->buf, buf, len);
+	slot->len = len;
+	pdu_decoder_slot_commit(slot);
 }
 
 static void *noise_floor_stats_thread(void *ctx) {
-	ASSERT(ctx != NULL);
-	struct nf_stats_thread_ctx *nfctx = ctx;
-	int32_t channel_cnt = nfctx->channel_cnt;
-	struct hfdl_channel *channels[channel_cnt];
-	for(int32_t i = 0; i < channel_cnt; i++) {
-		channels[i] = container_of(nfctx->channel_block_list[i], struct hfdl_channel, block);
-	}
+	UNUSED(ctx);
 	while(true) {
 		sleep(Config.nf_stats_interval);
-		for(int32_t i = 0; i < channel_cnt; i++) {
-			float nf = LEVEL_TO_DB(channels[i]->noise_floor);
+		pthread_mutex_lock(&Channel_list.lock);
+		for(struct hfdl_channel *c = Channel_list.head; c != NULL; c = c->next) {
+			float nf = LEVEL_TO_DB(c->noise_floor);
 			// Can't report float as a StatsD gauge - only integers are supported.
 			// What's more, submitting a negative value causes the gauge to be
 			// subtracted from the current value, rather than set to the given value.
 			// As a workaround, noise floor is report in tenths of dBFS, positive.
 			if(nf <= 0.f) {
-				statsd_set_per_channel(channels[i]->chan_freq, "noise_floor",
+				statsd_set_per_channel(c->chan_freq, "noise_floor",
 						(size_t)fabsf(roundf(nf * 10.f)));
 			}
 		}
+		pthread_mutex_unlock(&Channel_list.lock);
 	}
 	return NULL;
 }
@@ -5,11 +5,13 @@
 #include <libacars/libacars.h>      // la_type_descriptor, la_proto_node, LA_MSG_DIR_*
 #include <libacars/reassembly.h>    // la_reasm_ctx
 #include <libacars/dict.h>          // la_dict
-#include <libacars/json.h>          // la_json_append_*
 #include "pdu.h"                    // enum hfdl_pdu_direction
 #include "acars.h"                  // acars_parse
 #include "position.h"               // position_info
-#include "util.h"                   // ASSERT, NEW, XCALLOC, XFREE, freq_list_format_text, gs_id_format_text
+#include "util.h"                   // ASSERT, freq_list_format_text, gs_id_format_text
+#include "fmtr-writer.h"            // struct fmtr_writer, fw_*
+#include "arena.h"                  // FRAME_NEW, frame_arena_noop_destroy
+#include "filter.h"                 // struct msg_props
 
 // HFNPDU types
 #define SYSTEM_TABLE            0xD0
@@ -248,7 +250,7 @@ la_proto_node *hfnpdu_parse(uint8_t *buf, uint32_t len, enum hfdl_pdu_direction
 		return NULL;
 	}
 
-	NEW(struct hfdl_hfnpdu, hfnpdu);
+	FRAME_NEW(struct hfdl_hfnpdu, hfnpdu);
 	la_proto_node *node = la_proto_node_new();
 	node->td = &proto_DEF_hfdl_hfnpdu;
 	node->data = hfnpdu;
@@ -298,14 +300,6 @@ la_proto_node *hfnpdu_parse(uint8_t *buf, uint32_t len, enum hfdl_pdu_direction
 	return node;
 }
 
-static void hfnpdu_destroy(void *data) {
-	if(data == NULL) {
-		return;
-	}
-	struct hfdl_hfnpdu *hfnpdu = data;
-	XFREE(hfnpdu);
-}
-
 static void mpdu_stats_format_text(la_vstring *vstr, int32_t indent, struct mpdu_stats const *stats, char const *label) {
 	ASSERT(vstr);
 	ASSERT(stats);
@@ -315,16 +309,16 @@ static void mpdu_stats_format_text(la_vstring *vstr, int32_t indent, struct mpdu
 			label, stats->cnt_300bps, stats->cnt_600bps, stats->cnt_1200bps, stats->cnt_1800bps);
 }
 
-static void mpdu_stats_format_json(la_vstring *vstr, struct mpdu_stats const *stats, char const *label) {
-	ASSERT(vstr);
+static void mpdu_stats_serialize(struct fmtr_writer *w, struct mpdu_stats const *stats, char const *label) {
+	ASSERT(w);
 	ASSERT(stats);
 
-	la_json_object_start(vstr, label);
-	la_json_append_int64(vstr, "300bps", stats->cnt_300bps);
-	la_json_append_int64(vstr, "600bps", stats->cnt_600bps);
-	la_json_append_int64(vstr, "1200bps", stats->cnt_1200bps);
-	la_json_append_int64(vstr, "1800bps", stats->cnt_1800bps);
-	la_json_object_end(vstr);
+	fw_object_start(w, label);
+	fw_append_int64(w, "300bps", stats->cnt_300bps);
+	fw_append_int64(w, "600bps", stats->cnt_600bps);
+	fw_append_int64(w, "1200bps", stats->cnt_1200bps);
+	fw_append_int64(w, "1800bps", stats->cnt_1800bps);
+	fw_object_end(w);
 }
 
 static la_dict const freq_change_code_descriptions[] = {
@@ -370,61 +364,61 @@ static void performance_data_format_text(la_vstring *vstr, int32_t indent, struc
 			desc ? desc : "unknown");
 }
 
-static void performance_data_format_json(la_vstring *vstr, struct hfnpdu_perf_data const *pdu) {
-	ASSERT(vstr);
+static void performance_data_serialize(struct fmtr_writer *w, struct hfnpdu_perf_data const *pdu) {
+	ASSERT(w);
 	ASSERT(pdu);
 
-	la_json_append_int64(vstr, "version", pdu->version);
-	la_json_append_string(vstr, "flight_id", pdu->flight_id);
+	fw_append_int64(w, "version", pdu->version);
+	fw_append_string(w, "flight_id", pdu->flight_id);
 
-	la_json_object_start(vstr, "pos");
-	la_json_append_double(vstr, "lat", pdu->location.lat);
-	la_json_append_double(vstr, "lon", pdu->location.lon);
-	la_json_object_end(vstr);
+	fw_object_start(w, "pos");
+	fw_append_double(w, "lat", pdu->location.lat);
+	fw_append_double(w, "lon", pdu->location.lon);
+	fw_object_end(w);
 
-	la_json_object_start(vstr, "time");
-	la_json_append_int64(vstr, "hour", pdu->utc_time.hour);
-	la_json_append_int64(vstr, "min", pdu->utc_time.min);
-	la_json_append_int64(vstr, "sec", pdu->utc_time.sec);
-	la_json_object_end(vstr);
+	fw_object_start(w, "time");
+	fw_append_int64(w, "hour", pdu->utc_time.hour);
+	fw_append_int64(w, "min", pdu->utc_time.min);
+	fw_append_int64(w, "sec", pdu->utc_time.sec);
+	fw_object_end(w);
 
-	la_json_append_int64(vstr, "flight_leg_num", pdu->flight_leg);
-	gs_id_format_json(vstr, "gs", pdu->gs_id);
+	fw_append_int64(w, "flight_leg_num", pdu->flight_leg);
+	gs_id_serialize(w, "gs", pdu->gs_id);
 
-	la_json_object_start(vstr, "frequency");
-	la_json_append_int64(vstr, "id", 1u << pdu->freq_id);
+	fw_object_start(w, "frequency");
+	fw_append_int64(w, "id", 1u << pdu->freq_id);
 	Systable_lock();
 	double f = systable_get_station_frequency(Systable, pdu->gs_id, pdu->freq_id);
 	Systable_unlock();
 	if(f > 0.0) {
-	    la_json_append_double(vstr, "freq", f);
+	    fw_append_double(w, "freq", f);
 	}
-	la_json_object_end(vstr);
-
-	la_json_object_start(vstr, "freq_search_cnt");
-	la_json_append_int64(vstr, "cur_leg", pdu->cur_leg.freq_search_cnt);
-	la_json_append_int64(vstr, "prev_leg", pdu->prev_leg.freq_search_cnt);
-	la_json_object_end(vstr);
-
-	la_json_object_start(vstr, "hfdl_disabled_duration");
-	la_json_append_int64(vstr, "this_leg", pdu->cur_leg.hf_data_disabled_duration);
-	la_json_append_int64(vstr, "prev_leg", pdu->prev_leg.hf_data_disabled_duration);
-	la_json_object_end(vstr);
-
-	la_json_object_start(vstr, "pdu_stats");
-	mpdu_stats_format_json(vstr, &pdu->mpdus_rx,        "mpdus_rx_ok_cnt");
-	mpdu_stats_format_json(vstr, &pdu->mpdus_rx_errs,   "mpdus_rx_err_cnt");
-	mpdu_stats_format_json(vstr, &pdu->mpdus_tx,        "mpdus_tx_cnt");
-	mpdu_stats_format_json(vstr, &pdu->mpdus_delivered, "mpdus_delivered_cnt");
-	la_json_append_int64(vstr, "spdus_rx_ok_cnt", pdu->spdus_rx);
-	la_json_append_int64(vstr, "spdus_missed_cnt", pdu->spdus_rx_errs);
-	la_json_object_end(vstr);
-
-	la_json_object_start(vstr, "last_freq_change_cause");
-	la_json_append_int64(vstr, "code", pdu->freq_change_code);
+	fw_object_end(w);
+
+	fw_object_start(w, "freq_search_cnt");
+	fw_append_int64(w, "cur_leg", pdu->cur_leg.freq_search_cnt);
+	fw_append_int64(w, "prev_leg", pdu->prev_leg.freq_search_cnt);
+	fw_object_end(w);
+
+	fw_object_start(w, "hfdl_disabled_duration");
+	fw_append_int64(w, "this_leg", pdu->cur_leg.hf_data_disabled_duration);
+	fw_append_int64(w, "prev_leg", pdu->prev_leg.hf_data_disabled_duration);
+	fw_object_end(w);
+
+	fw_object_start(w, "pdu_stats");
+	mpdu_stats_serialize(w, &pdu->mpdus_rx,        "mpdus_rx_ok_cnt");
+	mpdu_stats_serialize(w, &pdu->mpdus_rx_errs,   "mpdus_rx_err_cnt");
+	mpdu_stats_serialize(w, &pdu->mpdus_tx,        "mpdus_tx_cnt");
+	mpdu_stats_serialize(w, &pdu->mpdus_delivered, "mpdus_delivered_cnt");
+	fw_append_int64(w, "spdus_rx_ok_cnt", pdu->spdus_rx);
+	fw_append_int64(w, "spdus_missed_cnt", pdu->spdus_rx_errs);
+	fw_object_end(w);
+
+	fw_object_start(w, "last_freq_change_cause");
+	fw_append_int64(w, "code", pdu->freq_change_code);
 	char const *descr = la_dict_search(freq_change_code_descriptions, pdu->freq_change_code);
-	la_json_append_string(vstr, "descr", descr ? descr : "unknown");
-	la_json_object_end(vstr);
+	fw_append_string(w, "descr", descr ? descr : "unknown");
+	fw_object_end(w);
 }
 
 
@@ -437,14 +431,14 @@ static void systable_format_text(la_vstring *vstr, int32_t indent, struct hfnpdu
 	LA_ISPRINTF(vstr, indent, "Part: %u of %hhu\n", data->pdu_seq_num + 1u, data->total_pdu_cnt);
 }
 
-static void systable_format_json(la_vstring *vstr, struct hfnpdu_systable_data const *data) {
-	ASSERT(vstr);
+static void systable_serialize(struct fmtr_writer *w, struct hfnpdu_systable_data const *data) {
+	ASSERT(w);
 	ASSERT(data);
-	la_json_append_int64(vstr, "version", data->systable_version);
-	la_json_object_start(vstr, "systable_partial");
-	la_json_append_int64(vstr, "part_num", data->pdu_seq_num + 1u);
-	la_json_append_int64(vstr, "parts_cnt", data->total_pdu_cnt);
-	la_json_object_end(vstr);
+	fw_append_int64(w, "version", data->systable_version);
+	fw_object_start(w, "systable_partial");
+	fw_append_int64(w, "part_num", data->pdu_seq_num + 1u);
+	fw_append_int64(w, "parts_cnt", data->total_pdu_cnt);
+	fw_object_end(w);
 }
 
 static void systable_request_format_text(la_vstring *vstr, int32_t indent, struct hfnpdu_systable_request_data const *data) {
@@ -455,11 +449,11 @@ static void systable_request_format_text(la_vstring *vstr, int32_t indent, struc
 	LA_ISPRINTF(vstr, indent, "Request data: 0x%hx\n", data->request_data);
 }
 
-static void systable_request_format_json(la_vstring *vstr, struct hfnpdu_systable_request_data const *data) {
-	ASSERT(vstr);
+static void systable_request_serialize(struct fmtr_writer *w, struct hfnpdu_systable_request_data const *data) {
+	ASSERT(w);
 	ASSERT(data);
 
-	la_json_append_int64(vstr, "request_data", data->request_data);
+	fw_append_int64(w, "request_data", data->request_data);
 }
 
 static void propagating_freqs_format_text(la_vstring *vstr, int32_t indent, struct prop_freqs_data const *data) {
@@ -473,15 +467,15 @@ static void propagating_freqs_format_text(la_vstring *vstr, int32_t indent, stru
 	freq_list_format_text(vstr, indent+1, "Heard on", data->gs_id, data->prop_freqs);
 }
 
-static void propagating_freqs_format_json(la_vstring *vstr, char const *label, struct prop_freqs_data const *data) {
-	ASSERT(vstr);
+static void propagating_freqs_serialize(struct fmtr_writer *w, char const *label, struct prop_freqs_data const *data) {
+	ASSERT(w);
 	ASSERT(data);
 
-	la_json_object_start(vstr, label);
-	gs_id_format_json(vstr, "gs", data->gs_id);
-	freq_list_format_json(vstr, "listening_on_freqs", data->gs_id, data->tuned_freqs);
-	freq_list_format_json(vstr, "heard_on_freqs", data->gs_id, data->prop_freqs);
-	la_json_object_end(vstr);
+	fw_object_start(w, label);
+	gs_id_serialize(w, "gs", data->gs_id);
+	freq_list_serialize(w, "listening_on_freqs", data->gs_id, data->tuned_freqs);
+	freq_list_serialize(w, "heard_on_freqs", data->gs_id, data->prop_freqs);
+	fw_object_end(w);
 }
 
 static void frequency_data_format_text(la_vstring *vstr, int32_t indent, struct hfnpdu_freq_data const *pdu) {
@@ -499,28 +493,28 @@ static void frequency_data_format_text(la_vstring *vstr, int32_t indent, struct
 	}
 }
 
-static void frequency_data_format_json(la_vstring *vstr, struct hfnpdu_freq_data const *pdu) {
-	ASSERT(vstr);
+static void frequency_data_serialize(struct fmtr_writer *w, struct hfnpdu_freq_data const *pdu) {
+	ASSERT(w);
 	ASSERT(pdu);
 
-	la_json_append_string(vstr, "flight_id", pdu->flight_id);
+	fw_append_string(w, "flight_id", pdu->flight_id);
 
-	la_json_object_start(vstr, "pos");
-	la_json_append_double(vstr, "lat", pdu->location.lat);
-	la_json_append_double(vstr, "lon", pdu->location.lon);
-	la_json_object_end(vstr);
+	fw_object_start(w, "pos");
+	fw_append_double(w, "lat", pdu->location.lat);
+	fw_append_double(w, "lon", pdu->location.lon);
+	fw_object_end(w);
 
-	la_json_object_start(vstr, "utc_time");
-	la_json_append_int64(vstr, "hour", pdu->utc_time.hour);
-	la_json_append_int64(vstr, "min", pdu->utc_time.min);
-	la_json_append_int64(vstr, "sec", pdu->utc_time.sec);
-	la_json_object_end(vstr);
+	fw_object_start(w, "utc_time");
+	fw_append_int64(w, "hour", pdu->utc_time.hour);
+	fw_append_int64(w, "min", pdu->utc_time.min);
+	fw_append_int64(w, "sec", pdu->utc_time.sec);
+	fw_object_end(w);
 
-	la_json_array_start(vstr, "freq_data");
+	fw_array_start(w, "freq_data");
 	for(uint32_t f = 0; f < pdu->propagating_freqs_cnt; f++) {
-		propagating_freqs_format_json(vstr, NULL, &pdu->propagating_freqs[f]);
+		propagating_freqs_serialize(w, NULL, &pdu->propagating_freqs[f]);
 	}
-	la_json_array_end(vstr);
+	fw_array_end(w);
 }
 
 static void hfnpdu_format_text(la_vstring *vstr, void const *data, int32_t indent) {
@@ -560,34 +554,34 @@ static void hfnpdu_format_text(la_vstring *vstr, void const *data, int32_t inden
 	}
 }
 
-static void hfnpdu_format_json(la_vstring *vstr, void const *data) {
-	ASSERT(vstr != NULL);
+void hfnpdu_serialize(struct fmtr_writer *w, void const *data) {
+	ASSERT(w != NULL);
 	ASSERT(data);
 
 	struct hfdl_hfnpdu const *hfnpdu = data;
-	la_json_append_bool(vstr, "err", hfnpdu->err);
+	fw_append_bool(w, "err", hfnpdu->err);
 	if(hfnpdu->err) {
 		return;
 	}
 
-	la_json_object_start(vstr, "type");
-	la_json_append_int64(vstr, "id", hfnpdu->type);
+	fw_object_start(w, "type");
+	fw_append_int64(w, "id", hfnpdu->type);
 	char const *hfnpdu_type = la_dict_search(hfnpdu_type_descriptions, hfnpdu->type);
-	la_json_append_string(vstr, "name", hfnpdu_type ? hfnpdu_type : "unknown");
-	la_json_object_end(vstr);
+	fw_append_string(w, "name", hfnpdu_type ? hfnpdu_type : "unknown");
+	fw_object_end(w);
 
 	switch(hfnpdu->type) {
 		case SYSTEM_TABLE:
-			systable_format_json(vstr, &hfnpdu->data.systable_data);
+			systable_serialize(w, &hfnpdu->data.systable_data);
 			break;
 		case PERFORMANCE_DATA:
-			performance_data_format_json(vstr, &hfnpdu->data.perf_data);
+			performance_data_serialize(w, &hfnpdu->data.perf_data);
 			break;
 		case SYSTEM_TABLE_REQUEST:
-			systable_request_format_json(vstr, &hfnpdu->data.systable_request_data);
+			systable_request_serialize(w, &hfnpdu->data.systable_request_data);
 			break;
 		case FREQUENCY_DATA:
-			frequency_data_format_json(vstr, &hfnpdu->data.freq_data);
+			frequency_data_serialize(w, &hfnpdu->data.freq_data);
 			break;
 		case DELAYED_ECHO:
 		case ENVELOPED_DATA:
@@ -653,9 +647,27 @@ struct position_info *hfnpdu_position_info_extract(la_proto_node *tree) {
 	return pos_info;
 }
 
+bool hfnpdu_msg_props_extract(la_proto_node *tree, struct msg_props *props) {
+	ASSERT(tree);
+	ASSERT(props);
+
+	la_proto_node *hfnpdu_node = la_proto_tree_find_protocol(tree, &proto_DEF_hfdl_hfnpdu);
+	if(hfnpdu_node == NULL) {
+		return false;
+	}
+	struct hfdl_hfnpdu const *hfnpdu = hfnpdu_node->data;
+	props->hfnpdu_type = hfnpdu->type;
+	props->present |= MSG_PROP_HFNPDU_TYPE;
+	return true;
+}
+
+static void hfnpdu_format_json(la_vstring *vstr, void const *data) {
+	fw_format_json(vstr, hfnpdu_serialize, data);
+}
+
 la_type_descriptor const proto_DEF_hfdl_hfnpdu = {
 	.format_text = hfnpdu_format_text,
 	.format_json = hfnpdu_format_json,
 	.json_key = "hfnpdu",
-	.destroy = hfnpdu_destroy
+	.destroy = frame_arena_noop_destroy
 };
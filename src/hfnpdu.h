@@ -6,7 +6,13 @@
 #include <libacars/reassembly.h>        // la_reasm_ctx
 #include "pdu.h"                        // enum hfdl_pdu_direction
 #include "position.h"                   // struct position_info
+#include "filter.h"                     // struct msg_props
 
 la_proto_node *hfnpdu_parse(uint8_t *buf, uint32_t len, enum hfdl_pdu_direction direction,
 		la_reasm_ctx *reasm_ctx, struct timeval rx_timestamp);
 struct position_info *hfnpdu_position_info_extract(la_proto_node *tree);
+bool hfnpdu_msg_props_extract(la_proto_node *tree, struct msg_props *props);
+
+struct fmtr_writer;
+extern la_type_descriptor const proto_DEF_hfdl_hfnpdu;
+void hfnpdu_serialize(struct fmtr_writer *w, void const *data);
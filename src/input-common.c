@@ -1,23 +1,62 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include <stdint.h>
 #include <stdio.h>              // fprintf
+#include <string.h>             // strcmp
 #include "config.h"
 #include "util.h"               // ASSERT, XCALLOC, NEW, container_of
 #include "input-common.h"
 #include "input-helpers.h"      // get_sample_converter
 #include "input-file.h"         // file_input_vtable
+#include "input-rtltcp.h"       // rtltcp_input_vtable
+#include "input-udp.h"          // udp_input_vtable
 #ifdef WITH_SOAPYSDR
 #include "input-soapysdr.h"     // soapysdr_input_vtable
 #endif
+#ifdef WITH_SHM_INPUT
+#include "input-shm.h"          // shm_input_vtable
+#endif
 
 static struct input_vtable *input_vtables[] = {
 	[INPUT_TYPE_FILE] = &file_input_vtable,
+	[INPUT_TYPE_RTLTCP] = &rtltcp_input_vtable,
+	[INPUT_TYPE_UDP] = &udp_input_vtable,
 #ifdef WITH_SOAPYSDR
 	[INPUT_TYPE_SOAPYSDR] = &soapysdr_input_vtable,
+#endif
+#ifdef WITH_SHM_INPUT
+	[INPUT_TYPE_SHM] = &shm_input_vtable,
 #endif
 	[INPUT_TYPE_UNDEF] = NULL
 };
 
+static struct {
+	char const *name;
+	input_type type;
+} const input_type_names[] = {
+	{ "iq_file",    INPUT_TYPE_FILE },
+	{ "rtltcp",     INPUT_TYPE_RTLTCP },
+	{ "udp_iq",     INPUT_TYPE_UDP },
+#ifdef WITH_SOAPYSDR
+	{ "soapysdr",   INPUT_TYPE_SOAPYSDR },
+#endif
+#ifdef WITH_SHM_INPUT
+	{ "shm",        INPUT_TYPE_SHM },
+#endif
+	{ NULL,         INPUT_TYPE_UNDEF }
+};
+
+input_type input_type_from_string(char const *str) {
+	if(str == NULL) {
+		return INPUT_TYPE_UNDEF;
+	}
+	for(int32_t i = 0; input_type_names[i].name != NULL; i++) {
+		if(strcmp(input_type_names[i].name, str) == 0) {
+			return input_type_names[i].type;
+		}
+	}
+	return INPUT_TYPE_UNDEF;
+}
+
 static struct input_vtable *input_vtable_get(input_type type) {
 	if(type < INPUT_TYPE_MAX) {
 		return input_vtables[type];
@@ -31,13 +70,20 @@ struct input_cfg *input_cfg_create() {
 	cfg->centerfreq= -1;
 	cfg->sample_rate = -1;
 	cfg->read_buffer_size = -1;
+	cfg->jitter_buffer_len = -1;
 	cfg->sfmt = SFMT_UNDEF;
 	cfg->gain = AUTO_GAIN;
 	return cfg;
 }
 
 void input_cfg_destroy(struct input_cfg *cfg) {
-	XFREE(cfg);
+	if(cfg != NULL) {
+		XFREE(cfg->source);
+		XFREE(cfg->gain_elements);
+		XFREE(cfg->antenna);
+		XFREE(cfg->device_settings);
+		XFREE(cfg);
+	}
 }
 
 struct block *input_create(struct input_cfg *cfg) {
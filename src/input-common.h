@@ -11,6 +11,11 @@ typedef enum {
 	INPUT_TYPE_SOAPYSDR,
 #endif
 	INPUT_TYPE_FILE,
+	INPUT_TYPE_RTLTCP,
+	INPUT_TYPE_UDP,
+#ifdef WITH_SHM_INPUT
+	INPUT_TYPE_SHM,
+#endif
 	INPUT_TYPE_MAX
 } input_type;
 
@@ -35,6 +40,7 @@ struct input_cfg {
 	int32_t centerfreq;
 	int32_t freq_offset;
 	int32_t read_buffer_size;
+	int32_t jitter_buffer_len;
 	input_type type;
 	sample_format sfmt;
 };
@@ -62,6 +68,7 @@ struct input {
 
 struct input_cfg *input_cfg_create();
 void input_cfg_destroy(struct input_cfg *cfg);
+input_type input_type_from_string(char const *str);
 struct block *input_create(struct input_cfg *cfg);
 int32_t input_init(struct block *block);
 void input_destroy(struct block *block);
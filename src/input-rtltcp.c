@@ -0,0 +1,310 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>             // strtol, EXIT_FAILURE
+#include <string.h>             // memcmp, memset, strdup, strrchr, strerror
+#include <unistd.h>             // close, read, write
+#include <errno.h>              // errno
+#include <math.h>               // lround
+#include <sys/time.h>           // struct timeval
+#include <sys/types.h>          // socket, connect
+#include <sys/socket.h>         // socket, connect, recv
+#include <netdb.h>              // getaddrinfo
+#include <arpa/inet.h>          // htonl, ntohl
+#include "block.h"              // block_*
+#include "input-common.h"       // input, sample_format, input_vtable
+#include "input-helpers.h"      // get_sample_full_scale_value, get_sample_size, complex_samples_produce
+#include "kvargs.h"             // kvargs_*
+#include "util.h"               // debug_print, ASSERT, XCALLOC, HZ_TO_KHZ
+#include "globals.h"            // do_exit, exitcode
+
+#define INPUT_RTLTCP_BUFSIZE_DEFAULT 65536U
+// Socket receive timeout - how often to check whether the shutdown
+// has been ordered while waiting for data
+#define INPUT_RTLTCP_RECV_TIMEOUT 1
+#define INPUT_RTLTCP_MAX_TIMEOUTS 10
+
+// rtl_tcp protocol
+#define RTLTCP_MAGIC "RTL0"
+#define RTLTCP_CMD_SET_FREQ 0x01
+#define RTLTCP_CMD_SET_SAMPLE_RATE 0x02
+#define RTLTCP_CMD_SET_GAIN_MODE 0x03
+#define RTLTCP_CMD_SET_GAIN 0x04
+#define RTLTCP_CMD_SET_FREQ_CORRECTION 0x05
+#define RTLTCP_CMD_SET_DIRECT_SAMPLING 0x09
+#define RTLTCP_CMD_SET_BIAS_TEE 0x0e
+
+struct rtltcp_dongle_info {
+	char magic[4];
+	uint32_t tuner_type;
+	uint32_t tuner_gain_cnt;
+} __attribute__((packed));
+
+struct rtltcp_cmd {
+	uint8_t cmd;
+	uint32_t param;
+} __attribute__((packed));
+
+static char const *rtltcp_tuner_names[] = {
+	"unknown", "E4000", "FC0012", "FC0013", "FC2580", "R820T", "R828D"
+};
+
+struct rtltcp_input {
+	struct input input;
+	char *host;
+	char *port;
+	int32_t sockfd;
+};
+
+struct input *rtltcp_input_create(struct input_cfg *cfg) {
+	ASSERT(cfg != NULL);
+	NEW(struct rtltcp_input, rtltcp_input);
+	rtltcp_input->sockfd = -1;
+	// rtl_tcp always sends 8-bit unsigned samples
+	if(cfg->sfmt != SFMT_UNDEF && cfg->sfmt != SFMT_CU8) {
+		fprintf(stderr, "%s: warning: ignoring --sample-format, rtl_tcp only supports CU8\n",
+				cfg->source);
+	}
+	cfg->sfmt = SFMT_CU8;
+	return &rtltcp_input->input;
+}
+
+void rtltcp_input_destroy(struct input *input) {
+	if(input != NULL) {
+		struct rtltcp_input *ri = container_of(input, struct rtltcp_input, input);
+		if(ri->sockfd >= 0) {
+			close(ri->sockfd);
+		}
+		XFREE(ri->host);
+		XFREE(ri->port);
+		XFREE(ri);
+	}
+}
+
+static bool rtltcp_send_cmd(struct rtltcp_input *ri, uint8_t cmd, uint32_t param) {
+	struct rtltcp_cmd c = { .cmd = cmd, .param = htonl(param) };
+	if(write(ri->sockfd, &c, sizeof(c)) != sizeof(c)) {
+		fprintf(stderr, "%s:%s: failed to send command 0x%02x: %s\n",
+				ri->host, ri->port, cmd, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+static bool rtltcp_connect(struct rtltcp_input *ri) {
+	struct addrinfo hints, *result, *rptr;
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	fprintf(stderr, "%s:%s: connecting...\n", ri->host, ri->port);
+	int32_t ret = getaddrinfo(ri->host, ri->port, &hints, &result);
+	if(ret != 0) {
+		fprintf(stderr, "%s:%s: could not resolve address: %s\n",
+				ri->host, ri->port, gai_strerror(ret));
+		return false;
+	}
+	for(rptr = result; rptr != NULL; rptr = rptr->ai_next) {
+		ri->sockfd = socket(rptr->ai_family, rptr->ai_socktype, rptr->ai_protocol);
+		if(ri->sockfd == -1) {
+			continue;
+		}
+		if(connect(ri->sockfd, rptr->ai_addr, rptr->ai_addrlen) != -1) {
+			break;
+		}
+		close(ri->sockfd);
+		ri->sockfd = -1;
+	}
+	freeaddrinfo(result);
+	if(rptr == NULL) {
+		fprintf(stderr, "%s:%s: could not connect: all addresses failed\n",
+				ri->host, ri->port);
+		return false;
+	}
+	static struct timeval const timeout = { .tv_sec = INPUT_RTLTCP_RECV_TIMEOUT, .tv_usec = 0 };
+	if(setsockopt(ri->sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+		fprintf(stderr, "%s:%s: could not set timeout on socket: %s\n",
+				ri->host, ri->port, strerror(errno));
+	}
+	return true;
+}
+
+static bool rtltcp_read_dongle_info(struct rtltcp_input *ri) {
+	struct rtltcp_dongle_info info;
+	size_t len = 0;
+	int32_t timeouts = 0;
+	while(len < sizeof(info)) {
+		ssize_t ret = recv(ri->sockfd, (uint8_t *)&info + len, sizeof(info) - len, 0);
+		if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+				++timeouts < INPUT_RTLTCP_MAX_TIMEOUTS) {
+			continue;
+		} else if(ret <= 0) {
+			fprintf(stderr, "%s:%s: failed to read dongle info: %s\n",
+					ri->host, ri->port, ret == 0 ? "connection closed" : strerror(errno));
+			return false;
+		}
+		len += ret;
+	}
+	if(memcmp(info.magic, RTLTCP_MAGIC, sizeof(info.magic)) != 0) {
+		fprintf(stderr, "%s:%s: not an rtl_tcp server (bad magic)\n", ri->host, ri->port);
+		return false;
+	}
+	uint32_t tuner_type = ntohl(info.tuner_type);
+	fprintf(stderr, "%s:%s: connected to rtl_tcp server, tuner: %s, gain steps: %u\n",
+			ri->host, ri->port,
+			rtltcp_tuner_names[tuner_type < sizeof(rtltcp_tuner_names) / sizeof(rtltcp_tuner_names[0]) ? tuner_type : 0],
+			ntohl(info.tuner_gain_cnt));
+	return true;
+}
+
+static bool rtltcp_apply_device_settings(struct rtltcp_input *ri, char *settings) {
+	kvargs_parse_result parsed = kvargs_from_string(settings);
+	if(parsed.err != 0) {
+		fprintf(stderr, "%s:%s: could not parse device settings: %s at position %td\n",
+				ri->host, ri->port, kvargs_get_errstr(parsed.err), parsed.err_pos + 1);
+		return false;
+	}
+	bool result = true;
+	char *val;
+	if((val = kvargs_get(parsed.result, "direct_samp")) != NULL) {
+		result &= rtltcp_send_cmd(ri, RTLTCP_CMD_SET_DIRECT_SAMPLING, strtol(val, NULL, 10));
+		fprintf(stderr, "%s:%s: direct sampling mode set to %s\n", ri->host, ri->port, val);
+	}
+	if((val = kvargs_get(parsed.result, "biastee")) != NULL) {
+		bool on = strcmp(val, "true") == 0 || strcmp(val, "1") == 0;
+		result &= rtltcp_send_cmd(ri, RTLTCP_CMD_SET_BIAS_TEE, on);
+		fprintf(stderr, "%s:%s: bias tee %s\n", ri->host, ri->port, on ? "enabled" : "disabled");
+	}
+	kvargs_destroy(parsed.result);
+	return result;
+}
+
+int32_t rtltcp_input_init(struct input *input) {
+	ASSERT(input != NULL);
+	struct rtltcp_input *ri = container_of(input, struct rtltcp_input, input);
+	struct input_cfg *cfg = input->config;
+
+	char *colon = strrchr(cfg->source, ':');
+	if(colon == NULL || colon == cfg->source || colon[1] == '\0') {
+		fprintf(stderr, "%s: invalid rtl_tcp server address (must be <host>:<port>)\n", cfg->source);
+		return -1;
+	}
+	ri->host = strndup(cfg->source, colon - cfg->source);
+	ri->port = strdup(colon + 1);
+
+	if(rtltcp_connect(ri) == false || rtltcp_read_dongle_info(ri) == false) {
+		return -1;
+	}
+	if(cfg->device_settings != NULL && rtltcp_apply_device_settings(ri, cfg->device_settings) == false) {
+		return -1;
+	}
+	if(rtltcp_send_cmd(ri, RTLTCP_CMD_SET_SAMPLE_RATE, cfg->sample_rate) == false) {
+		return -1;
+	}
+	fprintf(stderr, "%s: sample rate set to %d sps\n", cfg->source, cfg->sample_rate);
+	if(rtltcp_send_cmd(ri, RTLTCP_CMD_SET_FREQ, cfg->centerfreq + cfg->freq_offset) == false) {
+		return -1;
+	}
+	fprintf(stderr, "%s: center frequency set to %.3f kHz\n", cfg->source,
+			HZ_TO_KHZ(cfg->centerfreq + cfg->freq_offset));
+	if(cfg->correction != 0.0) {
+		if(rtltcp_send_cmd(ri, RTLTCP_CMD_SET_FREQ_CORRECTION, (uint32_t)lround(cfg->correction)) == false) {
+			return -1;
+		}
+		fprintf(stderr, "%s: frequency correction set to %ld ppm\n", cfg->source, lround(cfg->correction));
+	}
+	if(cfg->gain != AUTO_GAIN) {
+		// Gain is expressed in tenths of a dB
+		if(rtltcp_send_cmd(ri, RTLTCP_CMD_SET_GAIN_MODE, 1) == false ||
+				rtltcp_send_cmd(ri, RTLTCP_CMD_SET_GAIN, (uint32_t)lround(cfg->gain * 10.0)) == false) {
+			return -1;
+		}
+		fprintf(stderr, "%s: gain set to %.1f dB\n", cfg->source, cfg->gain);
+	} else {
+		if(rtltcp_send_cmd(ri, RTLTCP_CMD_SET_GAIN_MODE, 0) == false) {
+			return -1;
+		}
+		fprintf(stderr, "%s: auto gain enabled\n", cfg->source);
+	}
+
+	if(cfg->read_buffer_size <= 0) {
+		cfg->read_buffer_size = INPUT_RTLTCP_BUFSIZE_DEFAULT;
+	}
+	input->full_scale = get_sample_full_scale_value(cfg->sfmt);
+	input->bytes_per_sample = get_sample_size(cfg->sfmt);
+	ASSERT(input->bytes_per_sample > 0);
+	if(cfg->read_buffer_size % input->bytes_per_sample != 0) {
+		fprintf(stderr, "Invalid --read-buffer-size value "
+				"(must be a multiple of sample size, which is %d bytes)\n",
+				input->bytes_per_sample);
+		return -1;
+	}
+	input->block.producer.max_tu = cfg->read_buffer_size / input->bytes_per_sample;
+	debug_print(D_SDR, "%s: max_tu=%zu\n", cfg->source, input->block.producer.max_tu);
+	return 0;
+}
+
+void *rtltcp_input_thread(void *ctx) {
+	ASSERT(ctx);
+	struct block *block = ctx;
+	struct input *input = container_of(block, struct input, block);
+	struct rtltcp_input *ri = container_of(input, struct rtltcp_input, input);
+	struct circ_buffer *circ_buffer = &block->producer.out->circ_buffer;
+
+	size_t const bufsize = input->config->read_buffer_size;
+	uint8_t *inbuf = XCALLOC(bufsize, sizeof(uint8_t));
+	float complex *outbuf = XCALLOC(bufsize / input->bytes_per_sample, sizeof(float complex));
+	size_t leftover = 0;        // bytes of an incomplete sample carried over to the next read
+	int32_t timeouts = 0;
+	while(do_exit == 0) {
+		ssize_t len = recv(ri->sockfd, inbuf + leftover, bufsize - leftover, 0);
+		if(len < 0) {
+			if(errno == EINTR) {
+				continue;
+			} else if(errno == EAGAIN || errno == EWOULDBLOCK) {
+				if(++timeouts >= INPUT_RTLTCP_MAX_TIMEOUTS) {
+					fprintf(stderr, "%s: no data received for %d seconds\n",
+							input->config->source, timeouts * INPUT_RTLTCP_RECV_TIMEOUT);
+					do_exit = 1;
+					exitcode = EXIT_FAILURE;
+					break;
+				}
+				continue;
+			}
+			fprintf(stderr, "%s: read error: %s\n", input->config->source, strerror(errno));
+			do_exit = 1;
+			exitcode = EXIT_FAILURE;
+			break;
+		} else if(len == 0) {
+			fprintf(stderr, "%s: connection closed by the server\n", input->config->source);
+			do_exit = 1;
+			exitcode = EXIT_FAILURE;
+			break;
+		}
+		timeouts = 0;
+		size_t total = leftover + len;
+		size_t samples_read = total / input->bytes_per_sample;
+		size_t used = samples_read * input->bytes_per_sample;
+		input->convert_sample_buffer(input, inbuf, used, outbuf);
+		complex_samples_produce(circ_buffer, outbuf, samples_read);
+		leftover = total - used;
+		if(leftover > 0) {
+			memmove(inbuf, inbuf + used, leftover);
+		}
+	}
+	debug_print(D_MISC, "Shutdown ordered, signaling consumer shutdown\n");
+	close(ri->sockfd);
+	ri->sockfd = -1;
+	block_connection_one2one_shutdown(block->producer.out);
+	block->running = false;
+	XFREE(inbuf);
+	XFREE(outbuf);
+	return NULL;
+}
+
+struct input_vtable const rtltcp_input_vtable = {
+	.create = rtltcp_input_create,
+	.init = rtltcp_input_init,
+	.destroy = rtltcp_input_destroy,
+	.rx_thread_routine = rtltcp_input_thread
+};
@@ -0,0 +1,300 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>       // PRIu64
+#include <stdatomic.h>      // atomic_load_explicit
+#include <unistd.h>         // usleep, close
+#include <errno.h>          // errno
+#include <fcntl.h>          // O_RDONLY
+#include <sys/mman.h>       // shm_open, mmap, munmap
+#include <sys/stat.h>       // fstat
+#include "block.h"          // block_*
+#include "input-common.h"   // input, sample_format, input_vtable
+#include "input-helpers.h"  // get_sample_full_scale_value, get_sample_size, complex_samples_produce
+#include "shm-iq.h"         // struct shm_iq_header, SHM_IQ_*
+#include "util.h"           // debug_print, ASSERT, XCALLOC, HZ_TO_KHZ
+#include "globals.h"        // do_exit
+
+#define INPUT_SHM_BUFSIZE_DEFAULT 65536U
+#define INPUT_SHM_POLL_INTERVAL_US 5000U
+#define INPUT_SHM_ATTACH_TIMEOUT_US 5000000U
+
+struct shm_input {
+	struct input input;
+	struct shm_iq_header const *hdr;
+	uint8_t const *ring;
+	size_t map_len;
+	int32_t fd;
+};
+
+static sample_format shm_sample_format_to_sfmt(uint32_t shm_sfmt) {
+	switch(shm_sfmt) {
+		case SHM_IQ_SFMT_CU8:
+			return SFMT_CU8;
+		case SHM_IQ_SFMT_CS16:
+			return SFMT_CS16;
+		case SHM_IQ_SFMT_CF32:
+			return SFMT_CF32;
+		default:
+			return SFMT_UNDEF;
+	}
+}
+
+// Waits for the producer to complete a setup step, for at most
+// INPUT_SHM_ATTACH_TIMEOUT_US in total
+static bool shm_input_attach_wait(uint32_t *waited) {
+	if(*waited >= INPUT_SHM_ATTACH_TIMEOUT_US || do_exit) {
+		return false;
+	}
+	usleep(INPUT_SHM_POLL_INTERVAL_US);
+	*waited += INPUT_SHM_POLL_INTERVAL_US;
+	return true;
+}
+
+static bool shm_input_map(struct shm_input *si, char const *name, size_t len) {
+	if(si->hdr != NULL) {
+		munmap((void *)si->hdr, si->map_len);
+		si->hdr = NULL;
+	}
+	void *map = mmap(NULL, len, PROT_READ, MAP_SHARED, si->fd, 0);
+	if(map == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap failed: %s\n", name, strerror(errno));
+		return false;
+	}
+	si->map_len = len;
+	si->hdr = map;
+	return true;
+}
+
+// The producer might have just created the segment. It sets its size,
+// fills in the header and then changes the state from SHM_IQ_STATE_INIT.
+// Nothing in the header is valid before that, so the state is checked first.
+static bool shm_input_attach(struct shm_input *si, char const *name) {
+	si->fd = shm_open(name, O_RDONLY, 0);
+	if(si->fd < 0) {
+		fprintf(stderr, "%s: could not open shared memory segment: %s\n", name, strerror(errno));
+		return false;
+	}
+	uint32_t waited = 0;
+	struct stat st;
+	while(true) {
+		if(fstat(si->fd, &st) < 0) {
+			fprintf(stderr, "%s: fstat failed: %s\n", name, strerror(errno));
+			return false;
+		}
+		if((size_t)st.st_size >= sizeof(struct shm_iq_header)) {
+			break;
+		}
+		if(shm_input_attach_wait(&waited) == false) {
+			fprintf(stderr, "%s: shared memory segment too short (%jd bytes)\n",
+					name, (intmax_t)st.st_size);
+			return false;
+		}
+	}
+	if(shm_input_map(si, name, st.st_size) == false) {
+		return false;
+	}
+	while(atomic_load_explicit(&si->hdr->state, memory_order_acquire) == SHM_IQ_STATE_INIT) {
+		if(shm_input_attach_wait(&waited) == false) {
+			fprintf(stderr, "%s: producer has not initialized the ring\n", name);
+			return false;
+		}
+	}
+	struct shm_iq_header const *hdr = si->hdr;
+	if(hdr->magic != SHM_IQ_MAGIC) {
+		fprintf(stderr, "%s: not a dumphfdl I/Q ring (bad magic 0x%08x)\n", name, hdr->magic);
+		return false;
+	}
+	if(hdr->version != SHM_IQ_VERSION) {
+		fprintf(stderr, "%s: unsupported ring version %u (expected %u)\n",
+				name, hdr->version, SHM_IQ_VERSION);
+		return false;
+	}
+	// The segment might have been resized after it was mapped
+	if(fstat(si->fd, &st) < 0) {
+		fprintf(stderr, "%s: fstat failed: %s\n", name, strerror(errno));
+		return false;
+	}
+	if((size_t)st.st_size != si->map_len) {
+		if(shm_input_map(si, name, st.st_size) == false) {
+			return false;
+		}
+		hdr = si->hdr;
+	}
+	if(hdr->ring_len == 0 || hdr->sample_size == 0 ||
+			hdr->header_len < sizeof(struct shm_iq_header) ||
+			hdr->header_len + hdr->ring_len * hdr->sample_size > si->map_len) {
+		fprintf(stderr, "%s: ring header is inconsistent with the segment size\n", name);
+		return false;
+	}
+	si->ring = (uint8_t const *)si->hdr + hdr->header_len;
+	return true;
+}
+
+struct input *shm_input_create(struct input_cfg *cfg) {
+	ASSERT(cfg != NULL);
+	NEW(struct shm_input, shm_input);
+	shm_input->fd = -1;
+	if(shm_input_attach(shm_input, cfg->source) == false) {
+		goto fail;
+	}
+	struct shm_iq_header const *hdr = shm_input->hdr;
+
+	// Stream parameters are dictated by the producer. They have to be known
+	// before the input gets initialized, because the channelizer setup and
+	// the center frequency computation depend on them.
+	sample_format sfmt = shm_sample_format_to_sfmt(hdr->sample_format);
+	if(sfmt == SFMT_UNDEF || get_sample_size(sfmt) != hdr->sample_size) {
+		fprintf(stderr, "%s: unsupported sample format %u (sample size %u)\n",
+				cfg->source, hdr->sample_format, hdr->sample_size);
+		goto fail;
+	}
+	if(cfg->sfmt != SFMT_UNDEF && cfg->sfmt != sfmt) {
+		fprintf(stderr, "%s: warning: ignoring --sample-format, using the format of the ring\n",
+				cfg->source);
+	}
+	cfg->sfmt = sfmt;
+	if(cfg->sample_rate > 0 && cfg->sample_rate != hdr->sample_rate) {
+		fprintf(stderr, "%s: warning: ignoring --sample-rate, ring sample rate is %d\n",
+				cfg->source, hdr->sample_rate);
+	}
+	cfg->sample_rate = hdr->sample_rate;
+	if(hdr->centerfreq > 0) {
+		if(cfg->centerfreq >= 0 && cfg->centerfreq != hdr->centerfreq) {
+			fprintf(stderr, "%s: warning: ignoring --centerfreq, ring center frequency is %.3f kHz\n",
+					cfg->source, HZ_TO_KHZ(hdr->centerfreq));
+		}
+		cfg->centerfreq = hdr->centerfreq;
+	}
+	fprintf(stderr, "%s: attached to I/Q ring: %s, %d samples/sec, %" PRIu64 " samples long\n",
+			cfg->source, hdr->sample_format == SHM_IQ_SFMT_CU8 ? "CU8" :
+			hdr->sample_format == SHM_IQ_SFMT_CS16 ? "CS16" : "CF32",
+			hdr->sample_rate, hdr->ring_len);
+	return &shm_input->input;
+fail:
+	if(shm_input->hdr != NULL) {
+		munmap((void *)shm_input->hdr, shm_input->map_len);
+	}
+	if(shm_input->fd >= 0) {
+		close(shm_input->fd);
+	}
+	XFREE(shm_input);
+	return NULL;
+}
+
+void shm_input_destroy(struct input *input) {
+	if(input != NULL) {
+		struct shm_input *si = container_of(input, struct shm_input, input);
+		if(si->hdr != NULL) {
+			munmap((void *)si->hdr, si->map_len);
+		}
+		if(si->fd >= 0) {
+			close(si->fd);
+		}
+		XFREE(si);
+	}
+}
+
+void *shm_input_thread(void *ctx) {
+	ASSERT(ctx);
+	struct block *block = ctx;
+	struct input *input = container_of(block, struct input, block);
+	struct shm_input *shm_input = container_of(input, struct shm_input, input);
+	struct shm_iq_header const *hdr = shm_input->hdr;
+	struct circ_buffer *circ_buffer = &block->producer.out->circ_buffer;
+
+	uint64_t const ring_len = hdr->ring_len;
+	size_t const sample_size = input->bytes_per_sample;
+	size_t const max_tu = block->producer.max_tu;
+	float complex *outbuf = XCALLOC(max_tu, sizeof(float complex));
+
+	// Start from the current write position - this is a live stream and
+	// older samples might be overwritten at any time.
+	uint64_t rd = atomic_load_explicit(&hdr->sample_cnt, memory_order_acquire);
+	while(do_exit == 0) {
+		uint64_t wr = atomic_load_explicit(&hdr->sample_cnt, memory_order_acquire);
+		if(UNLIKELY(wr < rd)) {
+			debug_print(D_SDR, "%s: sample counter went backwards (%" PRIu64 " -> %" PRIu64 "), "
+					"producer restarted?\n", input->config->source, rd, wr);
+			rd = wr;
+		}
+		if(UNLIKELY(wr - rd >= ring_len)) {
+			// We've been lapped by the producer. Skip forward, leaving
+			// half of the ring as a safety margin.
+			uint64_t lost = wr - rd - ring_len / 2;
+			input->overflow_count += lost;
+			debug_print(D_SDR, "%s: ring overrun, %" PRIu64 " samples lost\n",
+					input->config->source, lost);
+			rd += lost;
+		}
+		size_t avail = wr - rd;
+		if(avail == 0) {
+			if(atomic_load_explicit(&hdr->state, memory_order_acquire) == SHM_IQ_STATE_FINISHED) {
+				fprintf(stderr, "%s: producer has finished\n", input->config->source);
+				do_exit = 1;
+				break;
+			}
+			usleep(INPUT_SHM_POLL_INTERVAL_US);
+			continue;
+		}
+		size_t n = avail < max_tu ? avail : max_tu;
+		size_t idx = rd % ring_len;
+		size_t first = n < ring_len - idx ? n : ring_len - idx;
+		// Convert straight from the shared ring into the output buffer -
+		// no intermediate copy.
+		input->convert_sample_buffer(input, (void *)(shm_input->ring + idx * sample_size),
+				first * sample_size, outbuf);
+		if(n > first) {
+			input->convert_sample_buffer(input, (void *)shm_input->ring,
+					(n - first) * sample_size, outbuf + first);
+		}
+		// If the producer has wrapped around while we were reading,
+		// some of the samples are garbage. Not much can be done about it
+		// except for accounting.
+		wr = atomic_load_explicit(&hdr->sample_cnt, memory_order_acquire);
+		if(UNLIKELY(wr - rd > ring_len)) {
+			input->overflow_count += n;
+		}
+		complex_samples_produce(circ_buffer, outbuf, n);
+		rd += n;
+	}
+	if(input->overflow_count > 0) {
+		fprintf(stderr, "%s: %zu samples lost due to ring overruns\n",
+				input->config->source, input->overflow_count);
+	}
+	debug_print(D_MISC, "Shutdown ordered, signaling consumer shutdown\n");
+	block_connection_one2one_shutdown(block->producer.out);
+	block->running = false;
+	XFREE(outbuf);
+	return NULL;
+}
+
+int32_t shm_input_init(struct input *input) {
+	ASSERT(input != NULL);
+
+	if(input->config->read_buffer_size <= 0) {
+		input->config->read_buffer_size = INPUT_SHM_BUFSIZE_DEFAULT;
+	}
+	input->full_scale = get_sample_full_scale_value(input->config->sfmt);
+	input->bytes_per_sample = get_sample_size(input->config->sfmt);
+	ASSERT(input->bytes_per_sample > 0);
+	if(input->config->read_buffer_size % input->bytes_per_sample != 0) {
+		fprintf(stderr, "Invalid --read-buffer-size value "
+				"(must be a multiple of sample size, which is %d bytes)\n",
+				input->bytes_per_sample);
+		return -1;
+	}
+	input->block.producer.max_tu = input->config->read_buffer_size / input->bytes_per_sample;
+	debug_print(D_SDR, "%s: max_tu=%zu\n",
+			input->config->source, input->block.producer.max_tu);
+	return 0;
+}
+
+struct input_vtable const shm_input_vtable = {
+	.create = shm_input_create,
+	.init = shm_input_init,
+	.destroy = shm_input_destroy,
+	.rx_thread_routine = shm_input_thread
+};
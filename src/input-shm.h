@@ -0,0 +1,6 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+
+#include "input-common.h"       // struct input_vtable
+
+extern struct input_vtable shm_input_vtable;
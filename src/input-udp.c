@@ -0,0 +1,366 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>             // EXIT_FAILURE
+#include <string.h>             // memcpy, memset, strdup, strrchr, strerror
+#include <inttypes.h>           // PRIu64
+#include <unistd.h>             // close
+#include <errno.h>              // errno
+#include <sys/time.h>           // struct timeval
+#include <sys/types.h>          // socket, bind
+#include <sys/socket.h>         // socket, bind, recv
+#include <netdb.h>              // getaddrinfo
+#include <arpa/inet.h>          // ntohl
+#include "block.h"              // block_*
+#include "input-common.h"       // input, sample_format, input_vtable
+#include "input-helpers.h"      // get_sample_full_scale_value, get_sample_size, complex_samples_produce
+#include "statsd.h"             // statsd_*
+#include "util.h"               // debug_print, ASSERT, XCALLOC, NEW
+#include "globals.h"            // do_exit, exitcode
+
+// Datagram format:
+// - 32-bit sequence number, big endian, incremented by one for each datagram
+//   (wraps around to 0 after 0xffffffff)
+// - I/Q samples in the format given with --sample-format
+//
+// Datagrams are held in a jitter buffer of jitter_buffer_len slots to allow
+// for reordering. A missing datagram is declared lost when a datagram with
+// a sequence number jitter_buffer_len or more ahead of it arrives, or when
+// nothing is received for a while. Lost datagrams are replaced with zeros
+// to keep the sample clock continuous.
+
+#define INPUT_UDP_SEQ_LEN 4
+#define INPUT_UDP_MAX_DATAGRAM_LEN 65536
+#define INPUT_UDP_MAX_PAYLOAD_LEN (INPUT_UDP_MAX_DATAGRAM_LEN - INPUT_UDP_SEQ_LEN)
+#define INPUT_UDP_JITTER_BUFFER_LEN_DEFAULT 16
+// Flush the jitter buffer when nothing has been received for this long
+#define INPUT_UDP_RECV_TIMEOUT_MS 200
+// Sequence number jumps larger than this many jitter buffer lengths are
+// treated as sender restarts rather than packet loss
+#define INPUT_UDP_RESYNC_FACTOR 64
+
+struct jb_slot {
+	uint8_t *buf;
+	size_t len;
+	uint32_t seq;
+	bool valid;
+};
+
+struct udp_input {
+	struct input input;
+	char *address;
+	char *port;
+	struct jb_slot *jb;
+	float complex *outbuf;
+	size_t samples_per_datagram;    // taken from the last datagram received
+	uint64_t datagrams_received;
+	uint64_t datagrams_lost;
+	uint64_t datagrams_late;
+	uint64_t datagrams_duplicate;
+	uint64_t samples_zero_filled;
+	uint32_t jb_len;
+	uint32_t next_seq;
+	uint32_t base_seq;              // sequence number stored in jb[0]; at most jb_len behind next_seq
+	int32_t sockfd;
+	bool synced;
+};
+
+#ifdef WITH_STATSD
+static char *udp_input_counters[] = {
+	"input.udp.datagrams.lost",
+	"input.udp.datagrams.late",
+	"input.udp.datagrams.duplicate",
+	"input.udp.resyncs",
+	NULL
+};
+#endif
+
+struct input *udp_input_create(struct input_cfg *cfg) {
+	UNUSED(cfg);
+	NEW(struct udp_input, udp_input);
+	udp_input->sockfd = -1;
+	return &udp_input->input;
+}
+
+void udp_input_destroy(struct input *input) {
+	if(input != NULL) {
+		struct udp_input *ui = container_of(input, struct udp_input, input);
+		if(ui->sockfd >= 0) {
+			close(ui->sockfd);
+		}
+		if(ui->jb != NULL) {
+			for(uint32_t i = 0; i < ui->jb_len; i++) {
+				XFREE(ui->jb[i].buf);
+			}
+			XFREE(ui->jb);
+		}
+		XFREE(ui->outbuf);
+		XFREE(ui->address);
+		XFREE(ui->port);
+		XFREE(ui);
+	}
+}
+
+static bool udp_input_bind(struct udp_input *ui) {
+	struct addrinfo hints, *result, *rptr;
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_PASSIVE;
+	int32_t ret = getaddrinfo(ui->address, ui->port, &hints, &result);
+	if(ret != 0) {
+		fprintf(stderr, "%s:%s: could not resolve address: %s\n",
+				ui->address ? ui->address : "*", ui->port, gai_strerror(ret));
+		return false;
+	}
+	for(rptr = result; rptr != NULL; rptr = rptr->ai_next) {
+		ui->sockfd = socket(rptr->ai_family, rptr->ai_socktype, rptr->ai_protocol);
+		if(ui->sockfd == -1) {
+			continue;
+		}
+		if(bind(ui->sockfd, rptr->ai_addr, rptr->ai_addrlen) == 0) {
+			break;
+		}
+		close(ui->sockfd);
+		ui->sockfd = -1;
+	}
+	freeaddrinfo(result);
+	if(rptr == NULL) {
+		fprintf(stderr, "%s:%s: could not bind UDP socket: %s\n",
+				ui->address ? ui->address : "*", ui->port, strerror(errno));
+		return false;
+	}
+	static struct timeval const timeout = { .tv_sec = 0, .tv_usec = INPUT_UDP_RECV_TIMEOUT_MS * 1000 };
+	if(setsockopt(ui->sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+		fprintf(stderr, "%s:%s: could not set timeout on socket: %s\n",
+				ui->address ? ui->address : "*", ui->port, strerror(errno));
+	}
+	// Give the kernel some room to absorb bursts. Failure is not fatal.
+	int32_t rcvbuf = 4 * 1024 * 1024;
+	setsockopt(ui->sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	return true;
+}
+
+int32_t udp_input_init(struct input *input) {
+	ASSERT(input != NULL);
+	struct udp_input *ui = container_of(input, struct udp_input, input);
+	struct input_cfg *cfg = input->config;
+
+	if(cfg->sfmt == SFMT_UNDEF) {
+		fprintf(stderr, "Sample format must be specified for UDP inputs\n");
+		return -1;
+	}
+	// Accept either <port> or <address>:<port>
+	char *colon = strrchr(cfg->source, ':');
+	if(colon != NULL) {
+		ui->address = strndup(cfg->source, colon - cfg->source);
+		ui->port = strdup(colon + 1);
+	} else {
+		ui->port = strdup(cfg->source);
+	}
+	if(udp_input_bind(ui) == false) {
+		return -1;
+	}
+
+	input->full_scale = get_sample_full_scale_value(cfg->sfmt);
+	input->bytes_per_sample = get_sample_size(cfg->sfmt);
+	ASSERT(input->bytes_per_sample > 0);
+	input->block.producer.max_tu = INPUT_UDP_MAX_PAYLOAD_LEN / input->bytes_per_sample;
+
+	ui->jb_len = cfg->jitter_buffer_len > 0 ? (uint32_t)cfg->jitter_buffer_len : INPUT_UDP_JITTER_BUFFER_LEN_DEFAULT;
+	ui->jb = XCALLOC(ui->jb_len, sizeof(struct jb_slot));
+	for(uint32_t i = 0; i < ui->jb_len; i++) {
+		ui->jb[i].buf = XCALLOC(INPUT_UDP_MAX_PAYLOAD_LEN, sizeof(uint8_t));
+	}
+	ui->outbuf = XCALLOC(input->block.producer.max_tu, sizeof(float complex));
+#ifdef WITH_STATSD
+	statsd_initialize_counter_set(udp_input_counters);
+#endif
+	fprintf(stderr, "%s: listening for I/Q datagrams, jitter buffer: %u datagrams\n",
+			cfg->source, ui->jb_len);
+	return 0;
+}
+
+static void udp_input_emit(struct udp_input *ui, struct jb_slot *slot) {
+	struct input *input = &ui->input;
+	struct circ_buffer *circ_buffer = &input->block.producer.out->circ_buffer;
+	if(slot != NULL) {
+		size_t samples = slot->len / input->bytes_per_sample;
+		input->convert_sample_buffer(input, slot->buf, slot->len, ui->outbuf);
+		complex_samples_produce(circ_buffer, ui->outbuf, samples);
+		slot->valid = false;
+	} else if(ui->samples_per_datagram > 0) {
+		// Lost datagram - substitute with silence of the same length
+		memset(ui->outbuf, 0, ui->samples_per_datagram * sizeof(float complex));
+		complex_samples_produce(circ_buffer, ui->outbuf, ui->samples_per_datagram);
+		ui->samples_zero_filled += ui->samples_per_datagram;
+	}
+}
+
+// Jitter buffer slot for the given sequence number. Slots are indexed
+// relative to base_seq, because seq % jb_len is not continuous across the
+// 2^32 wraparound, unless jb_len is a power of two. base_seq is kept close
+// to next_seq, so seq - base_seq never wraps for datagrams in the buffer.
+static struct jb_slot *udp_input_slot(struct udp_input *ui, uint32_t seq) {
+	return &ui->jb[(seq - ui->base_seq) % ui->jb_len];
+}
+
+static void udp_input_advance(struct udp_input *ui) {
+	ui->next_seq++;
+	if(ui->next_seq - ui->base_seq >= ui->jb_len) {
+		// Moving by a multiple of jb_len keeps the slots of buffered datagrams
+		ui->base_seq += ui->jb_len;
+	}
+}
+
+// Releases the datagram with the next expected sequence number,
+// or zeros if it hasn't arrived.
+static void udp_input_release_next(struct udp_input *ui) {
+	struct jb_slot *slot = udp_input_slot(ui, ui->next_seq);
+	if(slot->valid && slot->seq == ui->next_seq) {
+		udp_input_emit(ui, slot);
+	} else {
+		debug_print(D_SDR, "%s: datagram %u lost\n", ui->input.config->source, ui->next_seq);
+		ui->datagrams_lost++;
+		statsd_increment("input.udp.datagrams.lost");
+		udp_input_emit(ui, NULL);
+	}
+	udp_input_advance(ui);
+}
+
+// Releases all consecutive datagrams which are ready.
+static void udp_input_release_ready(struct udp_input *ui) {
+	while(true) {
+		struct jb_slot *slot = udp_input_slot(ui, ui->next_seq);
+		if(!slot->valid || slot->seq != ui->next_seq) {
+			break;
+		}
+		udp_input_emit(ui, slot);
+		udp_input_advance(ui);
+	}
+}
+
+// Releases everything held in the jitter buffer, filling the gaps with zeros.
+static void udp_input_flush(struct udp_input *ui) {
+	uint32_t highest = ui->next_seq;
+	bool any = false;
+	for(uint32_t i = 0; i < ui->jb_len; i++) {
+		struct jb_slot *slot = &ui->jb[i];
+		if(slot->valid && (!any || (int32_t)(slot->seq - highest) > 0)) {
+			highest = slot->seq;
+			any = true;
+		}
+	}
+	if(any) {
+		while((int32_t)(highest - ui->next_seq) >= 0) {
+			udp_input_release_next(ui);
+		}
+	}
+}
+
+static void udp_input_reset(struct udp_input *ui, uint32_t seq) {
+	for(uint32_t i = 0; i < ui->jb_len; i++) {
+		ui->jb[i].valid = false;
+	}
+	ui->next_seq = ui->base_seq = seq;
+}
+
+static void udp_input_process_datagram(struct udp_input *ui, uint8_t *buf, size_t len) {
+	struct input *input = &ui->input;
+	if(len < INPUT_UDP_SEQ_LEN + (size_t)input->bytes_per_sample) {
+		debug_print(D_SDR, "%s: datagram too short (%zu bytes)\n", input->config->source, len);
+		return;
+	}
+	uint32_t seq;
+	memcpy(&seq, buf, sizeof(seq));
+	seq = ntohl(seq);
+	size_t payload_len = len - INPUT_UDP_SEQ_LEN;
+	payload_len -= payload_len % input->bytes_per_sample;
+	ui->datagrams_received++;
+
+	if(!ui->synced) {
+		udp_input_reset(ui, seq);
+		ui->synced = true;
+	}
+	int32_t d = (int32_t)(seq - ui->next_seq);
+	if(d < 0) {
+		if(d < -(int32_t)(ui->jb_len * INPUT_UDP_RESYNC_FACTOR)) {
+			fprintf(stderr, "%s: sequence number went back from %u to %u, resynchronizing\n",
+					input->config->source, ui->next_seq, seq);
+			statsd_increment("input.udp.resyncs");
+			udp_input_flush(ui);
+			udp_input_reset(ui, seq);
+		} else {
+			// Arrived too late - its place has already been filled with zeros
+			ui->datagrams_late++;
+			statsd_increment("input.udp.datagrams.late");
+			return;
+		}
+	} else if(d > (int32_t)(ui->jb_len * INPUT_UDP_RESYNC_FACTOR)) {
+		fprintf(stderr, "%s: sequence number jumped from %u to %u, resynchronizing\n",
+				input->config->source, ui->next_seq, seq);
+		statsd_increment("input.udp.resyncs");
+		udp_input_flush(ui);
+		udp_input_reset(ui, seq);
+	}
+	// Make room in the jitter buffer by giving up on the oldest missing datagrams
+	while((int32_t)(seq - ui->next_seq) >= (int32_t)ui->jb_len) {
+		udp_input_release_next(ui);
+	}
+	struct jb_slot *slot = udp_input_slot(ui, seq);
+	if(slot->valid && slot->seq == seq) {
+		ui->datagrams_duplicate++;
+		statsd_increment("input.udp.datagrams.duplicate");
+		return;
+	}
+	memcpy(slot->buf, buf + INPUT_UDP_SEQ_LEN, payload_len);
+	slot->len = payload_len;
+	slot->seq = seq;
+	slot->valid = true;
+	ui->samples_per_datagram = payload_len / input->bytes_per_sample;
+	udp_input_release_ready(ui);
+}
+
+void *udp_input_thread(void *ctx) {
+	ASSERT(ctx);
+	struct block *block = ctx;
+	struct input *input = container_of(block, struct input, block);
+	struct udp_input *ui = container_of(input, struct udp_input, input);
+	uint8_t *buf = XCALLOC(INPUT_UDP_MAX_DATAGRAM_LEN, sizeof(uint8_t));
+	while(do_exit == 0) {
+		ssize_t len = recv(ui->sockfd, buf, INPUT_UDP_MAX_DATAGRAM_LEN, 0);
+		if(len < 0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK) {
+				// Sender went quiet - don't keep the buffered samples hostage
+				udp_input_flush(ui);
+				continue;
+			} else if(errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "%s: read error: %s\n", input->config->source, strerror(errno));
+			do_exit = 1;
+			exitcode = EXIT_FAILURE;
+			break;
+		}
+		udp_input_process_datagram(ui, buf, len);
+	}
+	fprintf(stderr, "%s: datagrams received: %" PRIu64 ", lost: %" PRIu64 ", late: %" PRIu64
+			", duplicate: %" PRIu64 ", zero-filled samples: %" PRIu64 "\n",
+			input->config->source, ui->datagrams_received, ui->datagrams_lost,
+			ui->datagrams_late, ui->datagrams_duplicate, ui->samples_zero_filled);
+	debug_print(D_MISC, "Shutdown ordered, signaling consumer shutdown\n");
+	close(ui->sockfd);
+	ui->sockfd = -1;
+	block_connection_one2one_shutdown(block->producer.out);
+	block->running = false;
+	XFREE(buf);
+	return NULL;
+}
+
+struct input_vtable const udp_input_vtable = {
+	.create = udp_input_create,
+	.init = udp_input_init,
+	.destroy = udp_input_destroy,
+	.rx_thread_routine = udp_input_thread
+};
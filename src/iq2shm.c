@@ -0,0 +1,241 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+// iq2shm - reference producer for the dumphfdl shared memory I/Q input.
+//
+// Reads raw I/Q samples from a file or standard input and writes them into
+// a POSIX shared memory ring described in shm-iq.h. Any number of dumphfdl
+// instances (started with --shm-input) may attach to the ring and consume
+// the same stream.
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>             // strtol, strtod, EXIT_*
+#include <string.h>             // strcmp, strerror
+#include <getopt.h>             // getopt_long
+#include <strings.h>            // strcasecmp
+#include <errno.h>              // errno
+#include <signal.h>             // sigaction, SIG*
+#include <inttypes.h>           // PRIu64
+#include <stdatomic.h>          // atomic_*
+#include <time.h>               // clock_gettime, nanosleep
+#include <fcntl.h>              // O_*
+#include <unistd.h>             // ftruncate, close
+#include <sys/mman.h>           // shm_open, shm_unlink, mmap
+#include "shm-iq.h"             // struct shm_iq_header, SHM_IQ_*
+
+#define RING_LEN_SECONDS_DEFAULT 2
+#define READ_CHUNK_SAMPLES 16384
+
+static volatile sig_atomic_t do_exit = 0;
+
+static void sighandler(int sig) {
+	(void)sig;
+	do_exit = 1;
+}
+
+static void setup_signals() {
+	struct sigaction sigact = {0};
+	sigact.sa_handler = &sighandler;
+	sigaction(SIGHUP, &sigact, NULL);
+	sigaction(SIGINT, &sigact, NULL);
+	sigaction(SIGQUIT, &sigact, NULL);
+	sigaction(SIGTERM, &sigact, NULL);
+}
+
+static struct {
+	char const *name;
+	uint32_t id;
+	uint32_t sample_size;
+} const sample_formats[] = {
+	{ "CU8",    SHM_IQ_SFMT_CU8,    2 * sizeof(uint8_t) },
+	{ "CS16",   SHM_IQ_SFMT_CS16,   2 * sizeof(int16_t) },
+	{ "CF32",   SHM_IQ_SFMT_CF32,   2 * sizeof(float) },
+	{ NULL,     0,                  0 }
+};
+
+static void usage() {
+	fprintf(stderr,
+			"Usage: iq2shm --shm-name <name> --sample-rate <integer> --sample-format <sample_format>\n"
+			"              [--centerfreq <float>] [--ring-size <integer>] [--no-throttle] [--keep]\n"
+			"              [<input_file>]\n\n"
+			"Writes raw I/Q samples read from <input_file> (default: standard input) into\n"
+			"a POSIX shared memory ring which can be consumed with dumphfdl --shm-input.\n\n"
+			"Options:\n"
+			"  --shm-name <name>              Name of the shared memory segment (eg. /hfdl_iq)\n"
+			"  --sample-rate <integer>        Sampling rate (samples per second)\n"
+			"  --sample-format <format>       Sample format: CU8, CS16 or CF32\n"
+			"  --centerfreq <float>           Center frequency of the input data, in kHz\n"
+			"  --ring-size <integer>          Ring length in samples (default: %d seconds worth of samples)\n"
+			"  --no-throttle                  Do not pace the output at the sample rate\n"
+			"                                 (readers will lose samples unless they keep up)\n"
+			"  --keep                         Do not remove the segment on exit\n",
+			RING_LEN_SECONDS_DEFAULT);
+}
+
+static double timespec_diff(struct timespec const *a, struct timespec const *b) {
+	return (double)(a->tv_sec - b->tv_sec) + (double)(a->tv_nsec - b->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv) {
+#define OPT_SHM_NAME 1
+#define OPT_SAMPLE_RATE 2
+#define OPT_SAMPLE_FORMAT 3
+#define OPT_CENTERFREQ 4
+#define OPT_RING_SIZE 5
+#define OPT_NO_THROTTLE 6
+#define OPT_KEEP 7
+#define OPT_HELP 8
+	static struct option const opts[] = {
+		{ "shm-name",       required_argument,  NULL,   OPT_SHM_NAME },
+		{ "sample-rate",    required_argument,  NULL,   OPT_SAMPLE_RATE },
+		{ "sample-format",  required_argument,  NULL,   OPT_SAMPLE_FORMAT },
+		{ "centerfreq",     required_argument,  NULL,   OPT_CENTERFREQ },
+		{ "ring-size",      required_argument,  NULL,   OPT_RING_SIZE },
+		{ "no-throttle",    no_argument,        NULL,   OPT_NO_THROTTLE },
+		{ "keep",           no_argument,        NULL,   OPT_KEEP },
+		{ "help",           no_argument,        NULL,   OPT_HELP },
+		{ 0,                0,                  0,      0 }
+	};
+
+	char const *shm_name = NULL;
+	long sample_rate = 0;
+	long long ring_len = 0;
+	double centerfreq_khz = 0.0;
+	int sfmt_idx = -1;
+	bool throttle = true, keep = false;
+
+	int c;
+	while((c = getopt_long(argc, argv, "", opts, NULL)) != -1) {
+		switch(c) {
+			case OPT_SHM_NAME:
+				shm_name = optarg;
+				break;
+			case OPT_SAMPLE_RATE:
+				sample_rate = strtol(optarg, NULL, 10);
+				break;
+			case OPT_SAMPLE_FORMAT:
+				for(int i = 0; sample_formats[i].name != NULL; i++) {
+					if(strcasecmp(sample_formats[i].name, optarg) == 0) {
+						sfmt_idx = i;
+						break;
+					}
+				}
+				if(sfmt_idx < 0) {
+					fprintf(stderr, "Sample format '%s' is unknown\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case OPT_CENTERFREQ:
+				centerfreq_khz = strtod(optarg, NULL);
+				break;
+			case OPT_RING_SIZE:
+				ring_len = strtoll(optarg, NULL, 10);
+				break;
+			case OPT_NO_THROTTLE:
+				throttle = false;
+				break;
+			case OPT_KEEP:
+				keep = true;
+				break;
+			case OPT_HELP:
+				usage();
+				return EXIT_SUCCESS;
+			default:
+				usage();
+				return EXIT_FAILURE;
+		}
+	}
+	if(shm_name == NULL || sample_rate <= 0 || sfmt_idx < 0) {
+		usage();
+		return EXIT_FAILURE;
+	}
+	if(ring_len <= 0) {
+		ring_len = (long long)sample_rate * RING_LEN_SECONDS_DEFAULT;
+	}
+	char const *infile = optind < argc ? argv[optind] : "-";
+	FILE *fh = strcmp(infile, "-") == 0 ? stdin : fopen(infile, "rb");
+	if(fh == NULL) {
+		fprintf(stderr, "Failed to open input file %s: %s\n", infile, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	uint32_t const sample_size = sample_formats[sfmt_idx].sample_size;
+	size_t const map_len = SHM_IQ_HEADER_LEN + (size_t)ring_len * sample_size;
+	int fd = shm_open(shm_name, O_RDWR | O_CREAT, 0644);
+	if(fd < 0) {
+		fprintf(stderr, "%s: could not create shared memory segment: %s\n", shm_name, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	if(ftruncate(fd, map_len) < 0) {
+		fprintf(stderr, "%s: ftruncate failed: %s\n", shm_name, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	void *map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap failed: %s\n", shm_name, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	struct shm_iq_header *hdr = map;
+	// Readers which have been attached to a previous incarnation of the ring
+	// will notice the sample counter going backwards and resynchronize.
+	atomic_store_explicit(&hdr->state, SHM_IQ_STATE_INIT, memory_order_release);
+	hdr->magic = SHM_IQ_MAGIC;
+	hdr->version = SHM_IQ_VERSION;
+	hdr->header_len = SHM_IQ_HEADER_LEN;
+	hdr->sample_format = sample_formats[sfmt_idx].id;
+	hdr->sample_size = sample_size;
+	hdr->sample_rate = sample_rate;
+	hdr->centerfreq = (int32_t)(centerfreq_khz * 1000.0 + 0.5);
+	hdr->reserved = 0;
+	hdr->ring_len = ring_len;
+	atomic_store_explicit(&hdr->sample_cnt, 0, memory_order_relaxed);
+	atomic_store_explicit(&hdr->state, SHM_IQ_STATE_RUNNING, memory_order_release);
+	uint8_t *ring = (uint8_t *)map + SHM_IQ_HEADER_LEN;
+
+	fprintf(stderr, "%s: ring created: %s, %ld samples/sec, %lld samples long\n",
+			shm_name, sample_formats[sfmt_idx].name, sample_rate, ring_len);
+	setup_signals();
+
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	uint64_t cnt = 0;
+	while(do_exit == 0) {
+		// Read directly into the ring, never across its end
+		size_t idx = cnt % (uint64_t)ring_len;
+		size_t n = (size_t)ring_len - idx;
+		if(n > READ_CHUNK_SAMPLES) {
+			n = READ_CHUNK_SAMPLES;
+		}
+		size_t len = fread(ring + idx * sample_size, sample_size, n, fh);
+		if(len == 0) {
+			break;
+		}
+		cnt += len;
+		atomic_store_explicit(&hdr->sample_cnt, cnt, memory_order_release);
+		if(throttle) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			double ahead = (double)cnt / (double)sample_rate - timespec_diff(&now, &start);
+			if(ahead > 0.0) {
+				struct timespec ts = {
+					.tv_sec = (time_t)ahead,
+					.tv_nsec = (long)((ahead - (double)(time_t)ahead) * 1e9)
+				};
+				nanosleep(&ts, NULL);
+			}
+		}
+	}
+	atomic_store_explicit(&hdr->state, SHM_IQ_STATE_FINISHED, memory_order_release);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	fprintf(stderr, "%s: %" PRIu64 " samples written in %.1f seconds\n",
+			shm_name, cnt, timespec_diff(&now, &start));
+
+	if(fh != stdin) {
+		fclose(fh);
+	}
+	munmap(map, map_len);
+	close(fd);
+	if(!keep) {
+		shm_unlink(shm_name);
+	}
+	return EXIT_SUCCESS;
+}
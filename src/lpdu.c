@@ -4,15 +4,16 @@
 #include <libacars/libacars.h>      // la_type_descriptor, la_proto_node
 #include <libacars/reassembly.h>    // la_reasm_ctx
 #include <libacars/dict.h>          // la_dict
-#include <libacars/json.h>          // la_json_append_*
 #include "pdu.h"                    // struct hfdl_pdu_hdr_data, hfdl_pdu_fcs_check
 #include "hfnpdu.h"                 // hfnpdu_parse
 #include "ac_cache.h"               // ac_cache_entry_create, ac_cache_entry_delete
 #include "globals.h"                // AC_cache, AC_cache_lock
 #include "lpdu.h"
 #include "statsd.h"                 // statsd_*
-#include "util.h"                   // ASSERT, NEW, XCALLOC, XFREE, gs_id_format_text,
+#include "util.h"                   // ASSERT, struct octet_string, gs_id_format_text,
                                     // ac_id_format_text
+#include "fmtr-writer.h"            // struct fmtr_writer, fw_*
+#include "arena.h"                  // FRAME_NEW, frame_arena_noop_destroy
 
 // LPDU types
 #define UNNUMBERED_DATA             0x0D
@@ -126,8 +127,12 @@ la_proto_node *lpdu_parse(uint8_t *buf, uint32_t len, struct hfdl_pdu_hdr_data
 	int32_t freq = mpdu_header.freq;
 	statsd_increment_per_channel(freq, "lpdus.processed");
 
-	NEW(struct hfdl_lpdu, lpdu);
-	lpdu->pdu = octet_string_new(buf, len);
+	FRAME_NEW(struct hfdl_lpdu, lpdu);
+	// pdu->buf is a pointer into an existing MPDU buffer
+	FRAME_NEW(struct octet_string, pdu);
+	pdu->buf = buf;
+	pdu->len = len;
+	lpdu->pdu = pdu;
 	lpdu->mpdu_header = mpdu_header;
 	la_proto_node *lpdu_node = la_proto_node_new();
 	lpdu_node->td = &proto_DEF_hfdl_lpdu;
@@ -261,56 +266,99 @@ static void lpdu_format_text(la_vstring *vstr, void const *data, int32_t indent)
 	}
 }
 
-static void lpdu_format_json(la_vstring *vstr, void const *data) {
-	ASSERT(vstr != NULL);
+void lpdu_serialize(struct fmtr_writer *w, void const *data) {
+	ASSERT(w != NULL);
 	ASSERT(data);
 
 	struct hfdl_lpdu const *lpdu = data;
-	la_json_append_bool(vstr, "err", lpdu->err);
+	fw_append_bool(w, "err", lpdu->err);
 	if(lpdu->err) {
 		return;
 	}
 	if(lpdu->mpdu_header.direction == UPLINK_PDU) {
-		gs_id_format_json(vstr, "src", lpdu->mpdu_header.src_id);
-		ac_id_format_json(vstr, "dst", lpdu->mpdu_header.freq, lpdu->mpdu_header.dst_id);
+		gs_id_serialize(w, "src", lpdu->mpdu_header.src_id);
+		ac_id_serialize(w, "dst", lpdu->mpdu_header.freq, lpdu->mpdu_header.dst_id);
 	} else {
-		ac_id_format_json(vstr, "src", lpdu->mpdu_header.freq, lpdu->mpdu_header.src_id);
-		gs_id_format_json(vstr, "dst", lpdu->mpdu_header.dst_id);
+		ac_id_serialize(w, "src", lpdu->mpdu_header.freq, lpdu->mpdu_header.src_id);
+		gs_id_serialize(w, "dst", lpdu->mpdu_header.dst_id);
 	}
-	la_json_object_start(vstr, "type");
-	la_json_append_int64(vstr, "id", lpdu->type);
+	fw_object_start(w, "type");
+	fw_append_int64(w, "id", lpdu->type);
 	char const *lpdu_type = la_dict_search(lpdu_type_descriptions, lpdu->type);
-	la_json_append_string(vstr, "name", lpdu_type ? lpdu_type : "unknown");
-	la_json_object_end(vstr);
+	fw_append_string(w, "name", lpdu_type ? lpdu_type : "unknown");
+	fw_object_end(w);
 	char *descr = NULL;
 	switch(lpdu->type) {
 		case LOGON_DENIED:
 		case LOGOFF_REQUEST:
-			ac_data_format_json(vstr, "ac_info", lpdu->data.logoff_request.icao_address);
+			ac_data_serialize(w, "ac_info", lpdu->data.logoff_request.icao_address);
 			descr = la_dict_search(
 					lpdu->type == LOGON_DENIED ? logon_denied_reason_codes : logoff_request_reason_codes,
 					lpdu->data.logoff_request.reason_code
 					);
-			la_json_object_start(vstr, "reason");
-			la_json_append_int64(vstr, "code", lpdu->data.logoff_request.reason_code);
-			la_json_append_string(vstr, "descr", descr ? descr : "Reserved");
-			la_json_object_end(vstr);
+			fw_object_start(w, "reason");
+			fw_append_int64(w, "code", lpdu->data.logoff_request.reason_code);
+			fw_append_string(w, "descr", descr ? descr : "Reserved");
+			fw_object_end(w);
 			break;
 		case LOGON_CONFIRM:
 		case LOGON_RESUME_CONFIRM:
-			ac_data_format_json(vstr, "ac_info", lpdu->data.logon_confirm.icao_address);
-			la_json_append_int64(vstr, "assigned_ac_id", lpdu->data.logon_confirm.ac_id);
+			ac_data_serialize(w, "ac_info", lpdu->data.logon_confirm.icao_address);
+			fw_append_int64(w, "assigned_ac_id", lpdu->data.logon_confirm.ac_id);
 			break;
 		case LOGON_RESUME:
 		case LOGON_REQUEST_NORMAL:
 		case LOGON_REQUEST_DLS:
-			ac_data_format_json(vstr, "ac_info", lpdu->data.logon_request.icao_address);
+			ac_data_serialize(w, "ac_info", lpdu->data.logon_request.icao_address);
 			break;
 		default:
 			return;
 	}
 }
 
+// Returns the ICAO address of the aircraft which has sent the LPDU (or is
+// the recipient of it). Some LPDU types have the address given directly.
+// For others it is looked up in the AC cache.
+static bool lpdu_icao_address_get(struct hfdl_lpdu const *lpdu, uint32_t *result) {
+	ASSERT(lpdu);
+	ASSERT(result);
+
+	switch(lpdu->type) {
+		case LOGON_RESUME:
+		case LOGON_REQUEST_NORMAL:
+		case LOGON_REQUEST_DLS:
+			*result = lpdu->data.logon_request.icao_address;
+			debug_print(D_MISC, "icao_address: %06X (from LPDU)\n", *result);
+			return true;
+		case LOGON_CONFIRM:
+		case LOGON_RESUME_CONFIRM:
+			*result = lpdu->data.logon_confirm.icao_address;
+			debug_print(D_MISC, "icao_address: %06X (from LPDU)\n", *result);
+			return true;
+		case LOGON_DENIED:
+		case LOGOFF_REQUEST:
+			*result = lpdu->data.logoff_request.icao_address;
+			debug_print(D_MISC, "icao_address: %06X (from LPDU)\n", *result);
+			return true;
+		default:
+			break;
+	}
+	// For other LPDU types we need to look up the ICAO in the AC cache
+	bool found = false;
+	AC_cache_lock();
+	uint8_t ac_id = lpdu->mpdu_header.direction == UPLINK_PDU ?
+		lpdu->mpdu_header.dst_id : lpdu->mpdu_header.src_id;
+	struct ac_cache_entry *entry = ac_cache_entry_lookup(AC_cache,
+			lpdu->mpdu_header.freq, ac_id);
+	if(entry != NULL) {
+		*result = entry->icao_address;
+		found = true;
+		debug_print(D_MISC, "icao_address: %06X (from cache)\n", *result);
+	}
+	AC_cache_unlock();
+	return found;
+}
+
 struct position_info *lpdu_position_info_extract(la_proto_node *tree) {
 	ASSERT(tree);
 
@@ -333,32 +381,8 @@ struct position_info *lpdu_position_info_extract(la_proto_node *tree) {
 	// Position information has been found. Check for any missing fields
 	// and fill them in, if possible.
 	if(pos_info->aircraft.icao_address_present == false) {
-		switch(lpdu->type) {
-			// These LPDU types have ICAO given directly
-			case LOGON_RESUME:
-			case LOGON_REQUEST_NORMAL:
-			case LOGON_REQUEST_DLS:
-				pos_info->aircraft.icao_address = lpdu->data.logon_request.icao_address;
-				pos_info->aircraft.icao_address_present = true;
-				debug_print(D_MISC, "icao_address: %06X (from LPDU)\n",
-						pos_info->aircraft.icao_address);
-				break;
-				// For other LPDU types we need to look up the ICAO in the AC cache
-			default:
-				AC_cache_lock();
-				uint8_t ac_id = lpdu->mpdu_header.direction == UPLINK_PDU ?
-					lpdu->mpdu_header.dst_id : lpdu->mpdu_header.src_id;
-				struct ac_cache_entry *entry = ac_cache_entry_lookup(AC_cache,
-						lpdu->mpdu_header.freq, ac_id);
-				if(entry != NULL) {
-					pos_info->aircraft.icao_address = entry->icao_address;
-					pos_info->aircraft.icao_address_present = true;
-					debug_print(D_MISC, "icao_address: %06X (from cache)\n",
-							pos_info->aircraft.icao_address);
-				}
-				AC_cache_unlock();
-				break;
-		}
+		pos_info->aircraft.icao_address_present =
+			lpdu_icao_address_get(lpdu, &pos_info->aircraft.icao_address);
 	}
 	if(pos_info->aircraft.icao_address_present == true) {
 		return pos_info;
@@ -370,20 +394,35 @@ struct position_info *lpdu_position_info_extract(la_proto_node *tree) {
 	return NULL;
 }
 
-static void lpdu_destroy(void *data) {
-	if(data == NULL) {
-		return;
+bool lpdu_msg_props_extract(la_proto_node *tree, struct msg_props *props, bool want_icao) {
+	ASSERT(tree);
+	ASSERT(props);
+
+	la_proto_node *lpdu_node = la_proto_tree_find_protocol(tree, &proto_DEF_hfdl_lpdu);
+	if(lpdu_node == NULL) {
+		return false;
+	}
+	struct hfdl_lpdu const *lpdu = lpdu_node->data;
+	msg_props_header_set(props, &lpdu->mpdu_header);
+	// The LPDU has its own FCS which takes precedence over the MPDU header FCS
+	props->crc_ok = lpdu->crc_ok;
+	if(lpdu->crc_ok) {
+		props->lpdu_type = lpdu->type;
+		props->present |= MSG_PROP_LPDU_TYPE;
+		if(want_icao && lpdu_icao_address_get(lpdu, &props->icao_address)) {
+			props->present |= MSG_PROP_ICAO_ADDRESS;
+		}
 	}
-	struct hfdl_lpdu *lpdu = data;
-	// No octet_string_destroy() here, because it frees the buffer, which is
-	// invalid here (pdu->buf is a pointer into an existing MPDU buffer)
-	XFREE(lpdu->pdu);
-	XFREE(lpdu);
+	return true;
+}
+
+static void lpdu_format_json(la_vstring *vstr, void const *data) {
+	fw_format_json(vstr, lpdu_serialize, data);
 }
 
 la_type_descriptor const proto_DEF_hfdl_lpdu = {
 	.format_text = lpdu_format_text,
 	.format_json = lpdu_format_json,
 	.json_key = "lpdu",
-	.destroy = lpdu_destroy
+	.destroy = frame_arena_noop_destroy
 };
@@ -7,7 +7,13 @@
 #include <libacars/reassembly.h>        // la_reasm_ctx
 #include "pdu.h"                        // struct hfdl_pdu_hdr_data
 #include "position.h"                   // struct position_info
+#include "filter.h"                     // struct msg_props
 
 la_proto_node *lpdu_parse(uint8_t *buf, uint32_t len, struct hfdl_pdu_hdr_data
 		mpdu_header, la_reasm_ctx *reasm_ctx, struct timeval rx_timestamp);
 struct position_info *lpdu_position_info_extract(la_proto_node *tree);
+bool lpdu_msg_props_extract(la_proto_node *tree, struct msg_props *props, bool want_icao);
+
+struct fmtr_writer;
+extern la_type_descriptor const proto_DEF_hfdl_lpdu;
+void lpdu_serialize(struct fmtr_writer *w, void const *data);
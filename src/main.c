@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include <stdint.h>
+#include <inttypes.h>           // PRIu64
 #include <stdio.h>
 #include <stdlib.h>             // strtol, strtof
 #define _GNU_SOURCE             // getopt_long
@@ -7,8 +8,8 @@
 #include <errno.h>              // errno, ERANGE
 #include <signal.h>             // sigaction, SIG*
 #include <string.h>             // strlen, strsep
-#include <math.h>               // roundf
 #include <unistd.h>             // usleep
+#include <time.h>               // clock_gettime
 #include <libacars/libacars.h>  // la_config_set_int
 #include <libacars/acars.h>     // LA_ACARS_BEARER_HFDL
 #include <libacars/list.h>      // la_list
@@ -19,19 +20,24 @@
 #include "options.h"            // IND(), describe_option
 #include "globals.h"            // do_exit, exitcode, Systable
 #include "block.h"              // block_*
-#include "libcsdr.h"            // compute_filter_relative_transition_bw
-#include "fft.h"                // csdr_fft_init, csdr_fft_destroy, fft_create, FFT_THREAD_CNT_DEFAULT
-#include "util.h"               // ASSERT
+#include "fft.h"                // csdr_fft_init, csdr_fft_destroy, FFT_THREAD_CNT_DEFAULT
+#include "util.h"               // ASSERT, max
 #include "ac_cache.h"           // ac_cache_create, ac_cache_destroy
 #include "ac_data.h"            // ac_data_create, ac_data_destroy
-#include "input-common.h"       // sample_format_t, input_create
+#include "input-common.h"       // input_cfg_create, INPUT_TYPE_*
 #include "input-helpers.h"      // sample_format_from_string
 #include "output-common.h"      // output_*, fmtr_*
+#include "output-spool.h"       // output_spool_create, OUTPUT_SPOOL_*
 #include "kvargs.h"             // kvargs
-#include "hfdl.h"               // hfdl_channel_create
-#include "pdu.h"                // hfdl_pdu_*
+#include "filter.h"             // msg_filter_create, msg_filter_initialize_counters
+#include "hfdl.h"               // hfdl_init_globals, hfdl_print_summary
+#include "frontend.h"           // frontend_*
+#include "auto-channels.h"      // auto_channels_*
+#include "control.h"            // control_socket_start, control_socket_stop
+#include "pdu.h"                // hfdl_pdu_*, PDU_DECODER_THREAD_CNT_*
 #include "systable.h"           // systable_*
 #include "statsd.h"             // statsd_*
+#include "replay.h"             // replay_*
 
 typedef struct {
 	char *output_spec_string;
@@ -61,6 +67,12 @@ static void sighandler(int32_t sig) {
 	do_exit++;
 }
 
+static double timespec_elapsed(struct timespec const *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
 static void setup_signals() {
 	struct sigaction sigact = {0}, pipeact = {0};
 
@@ -211,33 +223,6 @@ static bool parse_frequency(char const *str, int32_t *result) {
 	return true;
 }
 
-static bool check_frequency_span(int32_t *freqs, int32_t cnt, int32_t centerfreq, int32_t source_rate) {
-	ASSERT(freqs);
-	int32_t half_bandwidth = source_rate / 2;
-	for(int32_t i = 0; i < cnt; i++) {
-		if(abs(centerfreq - freqs[i]) >= half_bandwidth) {
-			fprintf(stderr, "Error: channel frequency %.3f kHz is too far away from the center frequency (%.3f kHz).\n",
-					HZ_TO_KHZ(freqs[i]), HZ_TO_KHZ(centerfreq));
-			fprintf(stderr, "Maximum distance from the center frequency for sampling rate %d sps is %.3f kHz.\n", source_rate, HZ_TO_KHZ(half_bandwidth));
-			return false;
-		}
-	}
-	return true;
-}
-
-static bool compute_centerfreq(int32_t *freqs, int32_t cnt, int32_t *result) {
-	ASSERT(result);
-	ASSERT(cnt > 0);
-	int32_t freq_min, freq_max;
-	freq_min = freq_max = freqs[0];
-	for(int32_t i = 0; i < cnt; i++) {
-		if(freqs[i] < freq_min) freq_min = freqs[i];
-		if(freqs[i] > freq_max) freq_max = freqs[i];
-	}
-	*result = freq_min + (freq_max - freq_min) / 2;
-	return true;
-}
-
 static void usage() {
 	fprintf(stderr, "Usage:\n");
 #ifdef WITH_SOAPYSDR
@@ -248,6 +233,23 @@ static void usage() {
 	fprintf(stderr, "\nRead I/Q samples from file:\n\n"
 			"%*sdumphfdl [output_options] --iq-file <input_iq_file> [iq_file_options] <freq_1> [<freq_2> [...]]\n",
 			IND(1), "");
+	fprintf(stderr, "\nReceive I/Q samples from an rtl_tcp server:\n\n"
+			"%*sdumphfdl [output_options] --rtltcp <host>:<port> [rtltcp_options] <freq_1> [<freq_2> [...]]\n",
+			IND(1), "");
+	fprintf(stderr, "\nReceive I/Q samples over UDP:\n\n"
+			"%*sdumphfdl [output_options] --udp-iq [<address>:]<port> [udp_iq_options] <freq_1> [<freq_2> [...]]\n",
+			IND(1), "");
+#ifdef WITH_SHM_INPUT
+	fprintf(stderr, "\nRead I/Q samples from a shared memory ring:\n\n"
+			"%*sdumphfdl [output_options] --shm-input <shm_name> [shm_options] <freq_1> [<freq_2> [...]]\n",
+			IND(1), "");
+#endif
+	fprintf(stderr, "\nReplay HFDL frames recorded with \"frame\" output format (no DSP, for reprocessing and benchmarking):\n\n"
+			"%*sdumphfdl [output_options] --replay <frame_file>\n",
+			IND(1), "");
+	fprintf(stderr, "\nRead input and channel definitions from a configuration file (multiple inputs):\n\n"
+			"%*sdumphfdl [output_options] --input-config <input_config_file>\n",
+			IND(1), "");
 	fprintf(stderr, "\nGeneral options:\n");
 	describe_option("--help", "Displays this text", 1);
 	describe_option("--version", "Displays program version number", 1);
@@ -255,11 +257,19 @@ static void usage() {
 	describe_option("--debug <filter_spec>", "Debug message classes to display (default: none) (\"--debug help\" for details)", 1);
 #endif
 	describe_option("--fft-threads <integer>", "Number of FFT threads to start (default: " STR(FFT_THREAD_CNT_DEFAULT) ")", 1);
+	describe_option("--decoder-threads <integer>", "Number of PDU decoder threads to start (default: " STR(PDU_DECODER_THREAD_CNT_DEFAULT) ")", 1);
+	describe_option("--ordered-output", "Output messages in the order of reception when using multiple decoder threads", 1);
+	describe_option("--dedup-window <integer>", "Decode only the best copy of frames received again (on any channel) within this many seconds (default: 0 - disabled)", 1);
+	describe_option("--control-socket <path>", "Accept commands adding and removing channels on this Unix socket", 1);
 #ifdef DATADUMPS
 	describe_option("--datadumps", "Dump sample data to cf32/cr32 files in current directory (one channel only!)", 1);
 #endif
 	fprintf(stderr, "common options:\n");
 	describe_option("<freq_1> [<freq_2> [...]]", "HFDL channel frequencies, in kHz, as floating point numbers", 1);
+	describe_option("--input-config <string>", "Read the list of inputs and their channels from the given file", 1);
+	describe_option("", "(can't be used together with other input options and channel frequencies)", 1);
+	describe_option("--replay <string>", "Decode frames read from the given file (use \"-\" to read from standard input)", 1);
+	describe_option("", "(can't be used together with other input options and channel frequencies)", 1);
 #ifdef WITH_SOAPYSDR
 	fprintf(stderr, "\nsoapysdr_options:\n");
 	describe_option("--soapysdr <device_string>", "Use SoapySDR compatible device identified with the given string", 1);
@@ -281,6 +291,30 @@ static void usage() {
 	describe_option("CS16", "16-bit signed, little-endian (eg. recorded with sdrplay)", 2);
 	describe_option("CF32", "32-bit float, little-endian (eg. Airspy HF+)", 2);
 	describe_option("--read-buffer-size <integer>", "Number of bytes to read from file in one batch", 1);
+	fprintf(stderr, "\nrtltcp_options:\n");
+	describe_option("--rtltcp <host>:<port>", "Receive CU8 I/Q samples from the given rtl_tcp server", 1);
+	describe_option("--sample-rate <integer>", "Set sampling rate (samples per second)", 1);
+	describe_option("--centerfreq <float>", "Center frequency of the receiver, in kHz (default: auto)", 1);
+	describe_option("--gain <float>", "Set gain (decibels) (default: auto)", 1);
+	describe_option("--freq-correction <float>", "Set freq correction (ppm)", 1);
+	describe_option("--freq-offset <float>", "Frequency offset in kHz (to be used with upconverters)", 1);
+	describe_option("--device-settings <key1=val1,key2=val2,...>", "Supported keys: direct_samp=0|1|2, biastee=true|false", 1);
+	describe_option("--read-buffer-size <integer>", "Max number of bytes to read from the socket in one batch", 1);
+
+	fprintf(stderr, "\nudp_iq_options:\n");
+	describe_option("--udp-iq [<address>:]<port>", "Receive I/Q samples in UDP datagrams on the given address and port", 1);
+	describe_option("", "(each datagram starts with a 32-bit big-endian sequence number)", 1);
+	describe_option("--sample-rate <integer>", "Set sampling rate (samples per second)", 1);
+	describe_option("--centerfreq <float>", "Center frequency of the input data, in kHz (default: auto)", 1);
+	describe_option("--sample-format <sample_format>", "Input sample format (CU8, CS16 or CF32)", 1);
+	describe_option("--jitter-buffer <integer>", "Jitter buffer length in datagrams (default: 16)", 1);
+
+#ifdef WITH_SHM_INPUT
+	fprintf(stderr, "\nshm_options:\n");
+	describe_option("--shm-input <string>", "Read I/Q samples from the given POSIX shared memory ring (eg. /hfdl_iq)", 1);
+	describe_option("", "(sample format, rate and center frequency are taken from the ring header)", 1);
+	describe_option("--read-buffer-size <integer>", "Max number of bytes to consume from the ring in one batch", 1);
+#endif
 
 	fprintf(stderr, "\nOutput options:\n");
 	describe_option("--output <output_specifier>", "Output specification (default: " DEFAULT_OUTPUT ")", 1);
@@ -311,6 +345,10 @@ static void usage() {
 	fprintf(stderr, "\nSystem table options:\n");
 	describe_option("--system-table <string>", "Load system table from the given file", 1);
 	describe_option("--system-table-save <string>", "Save updated system table to the given file", 1);
+	describe_option("--auto-channels", "Set up channels on all system table frequencies within the input band", 1);
+	describe_option("", "(instead of a channel list; requires --system-table and --centerfreq)", 1);
+	describe_option("--auto-channels-include <list>", "Use only these frequencies (comma-separated, in kHz, ranges allowed, eg. 8900-9100,10081)", 1);
+	describe_option("--auto-channels-exclude <list>", "Skip these frequencies (same syntax as above)", 1);
 
 #ifdef WITH_STATSD
 	fprintf(stderr, "\nEtsy StatsD options:\n");
@@ -329,11 +367,19 @@ int32_t main(int32_t argc, char **argv) {
 #ifdef DATADUMPS
 #define OPT_DATADUMPS 4
 #endif
+#define OPT_CONTROL_SOCKET 5
 
 #define OPT_IQ_FILE 10
 #ifdef WITH_SOAPYSDR
 #define OPT_SOAPYSDR 11
 #endif
+#ifdef WITH_SHM_INPUT
+#define OPT_SHM_INPUT 12
+#endif
+#define OPT_RTLTCP 13
+#define OPT_UDP_IQ 14
+#define OPT_INPUT_CONFIG 15
+#define OPT_REPLAY 16
 
 #define OPT_SAMPLE_FORMAT 20
 #define OPT_SAMPLE_RATE 21
@@ -346,6 +392,10 @@ int32_t main(int32_t argc, char **argv) {
 #define OPT_FREQ_OFFSET 28
 #define OPT_READ_BUFFER_SIZE 29
 #define OPT_FFT_THREAD_CNT 30
+#define OPT_JITTER_BUFFER 31
+#define OPT_DECODER_THREAD_CNT 32
+#define OPT_ORDERED_OUTPUT 33
+#define OPT_DEDUP_WINDOW 34
 
 #define OPT_OUTPUT 40
 #define OPT_OUTPUT_QUEUE_HWM 41
@@ -362,6 +412,9 @@ int32_t main(int32_t argc, char **argv) {
 
 #define OPT_SYSTABLE_FILE 60
 #define OPT_SYSTABLE_SAVE_FILE 61
+#define OPT_AUTO_CHANNELS 62
+#define OPT_AUTO_CHANNELS_INCLUDE 63
+#define OPT_AUTO_CHANNELS_EXCLUDE 64
 
 #ifdef WITH_STATSD
 #define OPT_STATSD 70
@@ -384,10 +437,18 @@ int32_t main(int32_t argc, char **argv) {
 #ifdef DATADUMPS
 		{ "datadumps",          no_argument,        NULL,   OPT_DATADUMPS },
 #endif
+		{ "control-socket",     required_argument,  NULL,   OPT_CONTROL_SOCKET },
 		{ "iq-file",            required_argument,  NULL,   OPT_IQ_FILE },
 #ifdef WITH_SOAPYSDR
 		{ "soapysdr",           required_argument,  NULL,   OPT_SOAPYSDR },
 #endif
+#ifdef WITH_SHM_INPUT
+		{ "shm-input",          required_argument,  NULL,   OPT_SHM_INPUT },
+#endif
+		{ "rtltcp",             required_argument,  NULL,   OPT_RTLTCP },
+		{ "udp-iq",             required_argument,  NULL,   OPT_UDP_IQ },
+		{ "input-config",       required_argument,  NULL,   OPT_INPUT_CONFIG },
+		{ "replay",             required_argument,  NULL,   OPT_REPLAY },
 		{ "sample-format",      required_argument,  NULL,   OPT_SAMPLE_FORMAT },
 		{ "sample-rate",        required_argument,  NULL,   OPT_SAMPLE_RATE },
 		{ "centerfreq",         required_argument,  NULL,   OPT_CENTERFREQ },
@@ -399,6 +460,10 @@ int32_t main(int32_t argc, char **argv) {
 		{ "freq-offset",        required_argument,  NULL,   OPT_FREQ_OFFSET },
 		{ "read-buffer-size",   required_argument,  NULL,   OPT_READ_BUFFER_SIZE },
 		{ "fft-threads",        required_argument,  NULL,   OPT_FFT_THREAD_CNT },
+		{ "jitter-buffer",      required_argument,  NULL,   OPT_JITTER_BUFFER },
+		{ "decoder-threads",    required_argument,  NULL,   OPT_DECODER_THREAD_CNT },
+		{ "ordered-output",     no_argument,        NULL,   OPT_ORDERED_OUTPUT },
+		{ "dedup-window",       required_argument,  NULL,   OPT_DEDUP_WINDOW },
 		{ "output",             required_argument,  NULL,   OPT_OUTPUT },
 		{ "output-queue-hwm",   required_argument,  NULL,   OPT_OUTPUT_QUEUE_HWM },
 		{ "utc",                no_argument,        NULL,   OPT_UTC },
@@ -417,6 +482,9 @@ int32_t main(int32_t argc, char **argv) {
 #endif
 		{ "system-table",       required_argument,  NULL,   OPT_SYSTABLE_FILE },
 		{ "system-table-save",  required_argument,  NULL,   OPT_SYSTABLE_SAVE_FILE },
+		{ "auto-channels",      no_argument,        NULL,   OPT_AUTO_CHANNELS },
+		{ "auto-channels-include", required_argument, NULL, OPT_AUTO_CHANNELS_INCLUDE },
+		{ "auto-channels-exclude", required_argument, NULL, OPT_AUTO_CHANNELS_EXCLUDE },
 #ifdef WITH_STATSD
 		{ "statsd",             required_argument,  NULL,   OPT_STATSD },
 		{ "noise-floor-stats-interval", required_argument,  NULL,   OPT_NF_STATS_INTERVAL },
@@ -435,7 +503,19 @@ int32_t main(int32_t argc, char **argv) {
 	la_list *outputs = NULL;
 	char const *systable_file = NULL;
 	char const *systable_save_file = NULL;
+	char const *input_config_file = NULL;
+	char const *replay_file = NULL;
+	struct replay *replay = NULL;
+	char const *control_socket_path = NULL;
+	char const *auto_channels_include = NULL;
+	char const *auto_channels_exclude = NULL;
+	struct auto_channels *auto_channels = NULL;
+	bool auto_channels_enabled = false;
 	int32_t fft_thread_cnt = FFT_THREAD_CNT_DEFAULT;
+	int32_t decoder_thread_cnt = PDU_DECODER_THREAD_CNT_DEFAULT;
+	bool ordered_output = false;
+	bool output_queue_hwm_set = false;
+	int32_t dedup_window = 0;
 #ifdef WITH_STATSD
 	char *statsd_addr = NULL;
 #endif
@@ -450,14 +530,37 @@ int32_t main(int32_t argc, char **argv) {
 		switch(c) {
 			case OPT_IQ_FILE:
 				Config.output_queue_hwm = OUTPUT_QUEUE_HWM_NONE;
-				input_cfg->source = optarg;
+				input_cfg->source = strdup(optarg);
 				input_cfg->type = INPUT_TYPE_FILE;
 				break;
 #ifdef WITH_SOAPYSDR
 			case OPT_SOAPYSDR:
-				input_cfg->source = optarg;
+				input_cfg->source = strdup(optarg);
 				input_cfg->type = INPUT_TYPE_SOAPYSDR;
 				break;
+#endif
+			case OPT_RTLTCP:
+				input_cfg->source = strdup(optarg);
+				input_cfg->type = INPUT_TYPE_RTLTCP;
+				break;
+			case OPT_UDP_IQ:
+				input_cfg->source = strdup(optarg);
+				input_cfg->type = INPUT_TYPE_UDP;
+				break;
+			case OPT_INPUT_CONFIG:
+				input_config_file = optarg;
+				break;
+			case OPT_REPLAY:
+				replay_file = optarg;
+				break;
+			case OPT_CONTROL_SOCKET:
+				control_socket_path = optarg;
+				break;
+#ifdef WITH_SHM_INPUT
+			case OPT_SHM_INPUT:
+				input_cfg->source = strdup(optarg);
+				input_cfg->type = INPUT_TYPE_SHM;
+				break;
 #endif
 			case OPT_SAMPLE_FORMAT:
 				input_cfg->sfmt = sample_format_from_string(optarg);
@@ -486,7 +589,7 @@ int32_t main(int32_t argc, char **argv) {
 				}
 				break;
 			case OPT_GAIN_ELEMENTS:
-				input_cfg->gain_elements = optarg;
+				input_cfg->gain_elements = strdup(optarg);
 				break;
 			case OPT_FREQ_CORRECTION:
 				if(parse_double(optarg, &input_cfg->correction) == false) {
@@ -494,10 +597,10 @@ int32_t main(int32_t argc, char **argv) {
 				}
 				break;
 			case OPT_ANTENNA:
-				input_cfg->antenna = optarg;
+				input_cfg->antenna = strdup(optarg);
 				break;
 			case OPT_DEVICE_SETTINGS:
-				input_cfg->device_settings = optarg;
+				input_cfg->device_settings = strdup(optarg);
 				break;
 			case OPT_FREQ_OFFSET:
 				if(parse_frequency(optarg, &input_cfg->freq_offset) == false) {
@@ -509,6 +612,15 @@ int32_t main(int32_t argc, char **argv) {
 					return 1;
 				}
 				break;
+			case OPT_JITTER_BUFFER:
+				if(parse_int32(optarg, &input_cfg->jitter_buffer_len) == false) {
+					return 1;
+				}
+				if(input_cfg->jitter_buffer_len < 1) {
+					fprintf(stderr, "Parameter error: jitter buffer length must be a positive number\n");
+					return 1;
+				}
+				break;
 			case OPT_FFT_THREAD_CNT:
 				if(parse_int32(optarg, &fft_thread_cnt) == false) {
 					return 1;
@@ -517,6 +629,28 @@ int32_t main(int32_t argc, char **argv) {
 					fft_thread_cnt = 1;
 				}
 				break;
+			case OPT_DECODER_THREAD_CNT:
+				if(parse_int32(optarg, &decoder_thread_cnt) == false) {
+					return 1;
+				}
+				if(decoder_thread_cnt < 1 || decoder_thread_cnt > PDU_DECODER_THREAD_CNT_MAX) {
+					fprintf(stderr, "Parameter error: decoder thread count must be between 1 and %d\n",
+							PDU_DECODER_THREAD_CNT_MAX);
+					return 1;
+				}
+				break;
+			case OPT_ORDERED_OUTPUT:
+				ordered_output = true;
+				break;
+			case OPT_DEDUP_WINDOW:
+				if(parse_int32(optarg, &dedup_window) == false) {
+					return 1;
+				}
+				if(dedup_window < 0) {
+					fprintf(stderr, "Parameter error: dedup window must not be negative\n");
+					return 1;
+				}
+				break;
 			case OPT_OUTPUT:
 				outputs = output_add(outputs, optarg);
 				break;
@@ -524,6 +658,7 @@ int32_t main(int32_t argc, char **argv) {
 				if(parse_int32(optarg, &Config.output_queue_hwm) == false) {
 					return 1;
 				}
+				output_queue_hwm_set = true;
 				break;
 			case OPT_UTC:
 				Config.utc = true;
@@ -571,6 +706,15 @@ int32_t main(int32_t argc, char **argv) {
 			case OPT_SYSTABLE_SAVE_FILE:
 				systable_save_file = optarg;
 				break;
+			case OPT_AUTO_CHANNELS:
+				auto_channels_enabled = true;
+				break;
+			case OPT_AUTO_CHANNELS_INCLUDE:
+				auto_channels_include = optarg;
+				break;
+			case OPT_AUTO_CHANNELS_EXCLUDE:
+				auto_channels_exclude = optarg;
+				break;
 #ifdef WITH_SQLITE
 			case OPT_BS_DB:
 				bs_db_file = optarg;
@@ -619,37 +763,65 @@ int32_t main(int32_t argc, char **argv) {
 				return 1;
 		}
 	}
-	if(input_cfg->source == NULL) {
-		fprintf(stderr, "No input specified\n");
-		return 1;
-	}
-	int32_t channel_cnt = argc - optind;
-	if(channel_cnt < 1) {
-		fprintf(stderr, "No channel frequencies given\n");
+	if(!auto_channels_enabled && (auto_channels_include != NULL || auto_channels_exclude != NULL)) {
+		fprintf(stderr, "--auto-channels-include and --auto-channels-exclude require --auto-channels option\n");
 		return 1;
 	}
-	int32_t frequencies[channel_cnt];
-	for(int32_t i = 0; i < channel_cnt; i++) {
-		if(parse_frequency(argv[optind + i], &frequencies[i]) == false) {
+	la_list *frontend_params_list = NULL;
+	if(replay_file != NULL) {
+		if(input_cfg->source != NULL || input_config_file != NULL || optind < argc ||
+				auto_channels_enabled) {
+			fprintf(stderr, "--replay can't be used together with other input options, "
+					"channel frequencies or --auto-channels\n");
 			return 1;
 		}
-	}
-
-	if(input_cfg->sample_rate < HFDL_SYMBOL_RATE * SPS) {
-		fprintf(stderr, "Sample rate must be greater or equal to %d\n", HFDL_SYMBOL_RATE * SPS);
-		return 1;
-	}
-
-	if(input_cfg->centerfreq < 0) {
-		if(compute_centerfreq(frequencies, channel_cnt, &input_cfg->centerfreq) == true) {
-			fprintf(stderr, "%s: computed center frequency: %.3f kHz\n", input_cfg->source, HZ_TO_KHZ(input_cfg->centerfreq));
-		} else {
-			fprintf(stderr, "%s: failed to compute center frequency\n", input_cfg->source);
-			return 2;
+		input_cfg_destroy(input_cfg);
+		if((replay = replay_create(replay_file)) == NULL) {
+			return 1;
 		}
-	}
-	if(check_frequency_span(frequencies, channel_cnt, input_cfg->centerfreq, input_cfg->sample_rate) == false) {
-		return 1;
+		// Frames are read as fast as they can be decoded, so don't drop
+		// messages unless asked to
+		if(!output_queue_hwm_set) {
+			Config.output_queue_hwm = OUTPUT_QUEUE_HWM_NONE;
+		}
+	} else if(input_config_file != NULL) {
+		if(input_cfg->source != NULL || optind < argc) {
+			fprintf(stderr, "--input-config can't be used together with other input options "
+					"or channel frequencies\n");
+			return 1;
+		}
+		input_cfg_destroy(input_cfg);
+		if((frontend_params_list = frontend_params_read_from_file(input_config_file,
+						auto_channels_enabled)) == NULL) {
+			return 1;
+		}
+		for(la_list *p = frontend_params_list; p != NULL; p = la_list_next(p)) {
+			struct frontend_params *params = p->data;
+			if(params->input_cfg->type == INPUT_TYPE_FILE) {
+				Config.output_queue_hwm = OUTPUT_QUEUE_HWM_NONE;
+			}
+		}
+	} else {
+		if(input_cfg->source == NULL) {
+			fprintf(stderr, "No input specified\n");
+			return 1;
+		}
+		int32_t channel_cnt = argc - optind;
+		if(auto_channels_enabled && channel_cnt > 0) {
+			fprintf(stderr, "Channel frequencies can't be given when using --auto-channels option\n");
+			return 1;
+		} else if(!auto_channels_enabled && channel_cnt < 1) {
+			fprintf(stderr, "No channel frequencies given\n");
+			return 1;
+		}
+		int32_t frequencies[max(channel_cnt, 1)];
+		for(int32_t i = 0; i < channel_cnt; i++) {
+			if(parse_frequency(argv[optind + i], &frequencies[i]) == false) {
+				return 1;
+			}
+		}
+		frontend_params_list = la_list_append(frontend_params_list,
+				frontend_params_create(input_cfg, frequencies, channel_cnt));
 	}
 	if(Config.output_queue_hwm < 0) {
 		fprintf(stderr, "Invalid --output-queue-hwm value: must be a non-negative integer\n");
@@ -671,6 +843,19 @@ int32_t main(int32_t argc, char **argv) {
 		Systable_unlock();
 		fprintf(stderr, "System table loaded from %s\n", systable_file);
 	}
+	if(auto_channels_enabled) {
+		if(!systable_is_available(Systable)) {
+			fprintf(stderr, "--auto-channels requires a system table (use --system-table option)\n");
+			return 1;
+		}
+		if((auto_channels = auto_channels_create(auto_channels_include, auto_channels_exclude)) == NULL) {
+			return 1;
+		}
+		for(la_list *p = frontend_params_list; p != NULL; p = la_list_next(p)) {
+			struct frontend_params *params = p->data;
+			params->auto_channels = auto_channels;
+		}
+	}
 
 	if((AC_cache = ac_cache_create()) == NULL) {
 		fprintf(stderr, "Unable to initialize aircraft address cache\n");
@@ -684,40 +869,14 @@ int32_t main(int32_t argc, char **argv) {
 	}
 	ASSERT(outputs != NULL);
 
-	struct block *input = input_create(input_cfg);
-	if(input == NULL) {
-		fprintf(stderr, "Invalid input specified\n");
-		return 1;
-	}
-	if(input_init(input) < 0) {
-		fprintf(stderr, "Unable to initialize input\n");
-		return 1;
-	}
-
-	csdr_fft_init(fft_thread_cnt);
-
-	int32_t fft_decimation_rate = compute_fft_decimation_rate(input_cfg->sample_rate, HFDL_SYMBOL_RATE * SPS);
-	ASSERT(fft_decimation_rate > 0);
-#ifdef DEBUG
-	int32_t sample_rate_post_fft = roundf((float)input_cfg->sample_rate / (float)fft_decimation_rate);
-#endif
-	float fftfilt_transition_bw = compute_filter_relative_transition_bw(input_cfg->sample_rate, HFDL_CHANNEL_TRANSITION_BW_HZ);
-	debug_print(D_DSP, "fft_decimation_rate: %d sample_rate_post_fft: %d transition_bw: %.f\n",
-			fft_decimation_rate, sample_rate_post_fft, fftfilt_transition_bw);
-
-	struct block *fft = fft_create(fft_decimation_rate, fftfilt_transition_bw);
-	if(fft == NULL) {
-		return 1;
-	}
-
 #ifdef WITH_STATSD
 	if(statsd_addr != NULL) {
+		// Initialize the client before the frontends, so that inputs can
+		// register their own counters during initialization.
 		if(statsd_initialize(statsd_addr) < 0) {
 			fprintf(stderr, "Failed to initialize StatsD client - disabling\n");
+			statsd_addr = NULL;
 		} else {
-			for(int32_t i = 0; i < channel_cnt; i++) {
-				statsd_initialize_counters_per_channel(frequencies[i]);
-			}
 			statsd_initialize_counters_per_msgdir();
 		}
 	}
@@ -737,25 +896,35 @@ int32_t main(int32_t argc, char **argv) {
 
 	la_config_set_int("acars_bearer", LA_ACARS_BEARER_HFDL);
 	hfdl_init_globals();
+	csdr_fft_init(fft_thread_cnt);
 
-	struct block *channel_blocks[channel_cnt];
-	for(int32_t i = 0; i < channel_cnt; i++) {
-		channel_blocks[i] = hfdl_channel_create(input_cfg->sample_rate, fft_decimation_rate,
-				fftfilt_transition_bw, input_cfg->centerfreq, frequencies[i]);
-		if(channel_blocks[i] == NULL) {
-			fprintf(stderr, "Failed to initialize channel %s\n",
-					argv[optind + i]);
+	int32_t frontend_cnt = la_list_length(frontend_params_list);
+	struct frontend *frontends[max(frontend_cnt, 1)];
+	int32_t total_channel_cnt = 0;
+	int32_t fe_idx = 0;
+	for(la_list *p = frontend_params_list; p != NULL; p = la_list_next(p), fe_idx++) {
+		struct frontend *fe = frontends[fe_idx] = frontend_create(fe_idx, p->data);
+		if(fe == NULL) {
 			return 1;
 		}
+#ifdef WITH_STATSD
+		for(int32_t i = 0; i < fe->channel_cnt; i++) {
+			statsd_initialize_counters_per_channel(fe->frequencies[i]);
+		}
+#endif
+		total_channel_cnt += fe->channel_cnt;
 	}
-
-	if(block_connect_one2one(input, fft) != 1 ||
-			block_connect_one2many(fft, channel_cnt, channel_blocks) != channel_cnt) {
-		return 1;
+	// Frontends have taken over the input configs and frequency lists
+	la_list_free_full(frontend_params_list, frontend_params_destroy);
+	if(frontend_cnt > 1) {
+		fprintf(stderr, "Started %d inputs, %d channels total\n", frontend_cnt, total_channel_cnt);
 	}
 
 	start_all_output_threads(outputs);
-	hfdl_pdu_decoder_init();
+	hfdl_pdu_decoder_init(decoder_thread_cnt, ordered_output, dedup_window, replay == NULL);
+	if(replay != NULL) {
+		hfdl_pdu_decoder_timing_enable();
+	}
 	if(hfdl_pdu_decoder_start(outputs) != 0) {
 	    fprintf(stderr, "Failed to start decoder thread, aborting\n");
 	    return 1;
@@ -767,16 +936,19 @@ int32_t main(int32_t argc, char **argv) {
 	ProfilerStart("dumphfdl.prof");
 #endif
 
-	if(block_set_start(channel_cnt, channel_blocks) != channel_cnt ||
-		block_start(fft) != 1 ||
-		block_start(input) != 1) {
+	for(int32_t i = 0; i < frontend_cnt; i++) {
+		if(frontend_start(frontends[i]) < 0) {
+			return 1;
+		}
+	}
+	if(replay != NULL && replay_start(replay) < 0) {
 		return 1;
 	}
 
 #ifdef WITH_STATSD
 	if(Config.nf_stats_interval > 0) {
 		if(statsd_addr != NULL) {
-			if(hfdl_nf_stats_thread_start(channel_blocks, channel_cnt) < 0) {
+			if(hfdl_nf_stats_thread_start() < 0) {
 				return 1;
 			}
 		} else {
@@ -786,37 +958,77 @@ int32_t main(int32_t argc, char **argv) {
 	}
 #endif
 
+	if(control_socket_path != NULL) {
+		if(control_socket_start(control_socket_path, frontend_cnt, frontends) < 0) {
+			return 1;
+		}
+	}
+
+	struct timespec start_time;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	double last_report = 0.0;
 	while(!do_exit) {
 		sleep(1);
+		double now = timespec_elapsed(&start_time);
+		bool report = now - last_report >= FRONTEND_STATS_INTERVAL;
+		for(int32_t i = 0; i < frontend_cnt; i++) {
+			if(report) {
+				frontend_report_stats(frontends[i], now - last_report);
+			} else {
+				frontend_update_cpu_time(frontends[i]);
+			}
+		}
+		if(report) {
+			hfdl_pdu_decoder_report_stats();
+			last_report = now;
+		}
+		if(auto_channels != NULL) {
+			auto_channels_update(auto_channels, frontend_cnt, frontends);
+		}
 	}
 	hfdl_pdu_decoder_stop();
 	fprintf(stderr, "Waiting for all threads to finish\n");
 	while(do_exit < 2 && (
-			block_is_running(input) ||
-			block_is_running(fft) ||
-			block_set_is_any_running(channel_cnt, channel_blocks) ||
+			frontend_set_is_any_running(frontend_cnt, frontends) ||
+			replay_is_running(replay) ||
 			hfdl_pdu_decoder_is_running() ||
 			output_thread_is_any_running(outputs)
 			)) {
+		for(int32_t i = 0; i < frontend_cnt; i++) {
+			frontend_update_cpu_time(frontends[i]);
+		}
 		usleep(500000);
 	}
+	double run_time = timespec_elapsed(&start_time);
+	control_socket_stop();
 
 #ifdef WITH_PROFILING
 	ProfilerStop();
 #endif
 
 	hfdl_print_summary();
-
-	block_disconnect_one2many(fft, channel_cnt, channel_blocks);
-	block_disconnect_one2one(input, fft);
-	for(int32_t i = 0; i < channel_cnt; i++) {
-		hfdl_channel_destroy(channel_blocks[i]);
+	for(int32_t i = 0; i < frontend_cnt; i++) {
+		frontend_print_stats(frontends[i], run_time);
+	}
+	if(replay != NULL) {
+		replay_print_stats(replay);
+		hfdl_pdu_decoder_print_timing();
+	}
+	uint64_t dropped_cnt = hfdl_pdu_decoder_dropped_frame_count();
+	if(dropped_cnt > 0) {
+		fprintf(stderr, "%" PRIu64 " frame(s) dropped due to decoder queue overflow\n", dropped_cnt);
+	}
+	uint64_t duplicate_cnt = hfdl_pdu_decoder_duplicate_frame_count();
+	if(duplicate_cnt > 0) {
+		fprintf(stderr, "%" PRIu64 " duplicate frame(s) dropped\n", duplicate_cnt);
 	}
-	input_destroy(input);
-	input_cfg_destroy(input_cfg);
 
-	fft_destroy(fft);
+	for(int32_t i = 0; i < frontend_cnt; i++) {
+		frontend_destroy(frontends[i]);
+	}
+	replay_destroy(replay);
 	csdr_fft_destroy();
+	auto_channels_destroy(auto_channels);
 
 	outputs_destroy(outputs);
 
@@ -886,7 +1098,12 @@ static la_list *output_add(la_list *outputs, char *output_spec) {
 		_exit(1);
 	}
 
-	void *output_cfg = otd->configure(oparams.outopts);
+	// Outputs are numbered in the order of appearance on the command line
+	int32_t output_id = 0;
+	for(la_list *p = outputs; p != NULL; p = la_list_next(p)) {
+		output_id += la_list_length(((fmtr_instance_t *)p->data)->outputs);
+	}
+	void *output_cfg = otd->configure(oparams.outopts, output_id);
 	if(output_cfg == NULL) {
 		fprintf(stderr, "Invalid output configuration\n");
 		_exit(1);
@@ -894,6 +1111,56 @@ static la_list *output_add(la_list *outputs, char *output_spec) {
 
 	output_instance_t *output = output_instance_new(otd, outfmt, output_cfg);
 	ASSERT(output != NULL);
+	output->id = output_id;
+	if(otd->props_wanted != NULL) {
+		output->props_wanted = otd->props_wanted(output_cfg);
+	}
+	char *filter_expr = kvargs_get(oparams.outopts, "filter");
+	if(filter_expr != NULL) {
+		output->filter = msg_filter_create(filter_expr, output->id);
+		if(output->filter == NULL) {
+			_exit(1);
+		}
+	}
+	char *batch_size = kvargs_get(oparams.outopts, "batch_size");
+	char *batch_linger = kvargs_get(oparams.outopts, "batch_linger");
+	if(otd->produce_batch == NULL) {
+		if(batch_size != NULL || batch_linger != NULL) {
+			fprintf(stderr, "Warning: output type '%s' does not support batching, "
+					"batch_size and batch_linger parameters ignored\n", oparams.outtype);
+		}
+	} else {
+		if(batch_size != NULL && (parse_int32(batch_size, &output->ctx->batch_size) == false ||
+					output->ctx->batch_size < 1 || output->ctx->batch_size > OUTPUT_BATCH_SIZE_MAX)) {
+			fprintf(stderr, "Invalid batch_size value: must be between 1 and %d\n", OUTPUT_BATCH_SIZE_MAX);
+			_exit(1);
+		}
+		if(batch_linger != NULL && (parse_int32(batch_linger, &output->ctx->batch_linger) == false ||
+					output->ctx->batch_linger < 0)) {
+			fprintf(stderr, "Invalid batch_linger value: must be a non-negative integer\n");
+			_exit(1);
+		}
+	}
+	char *spool_dir = kvargs_get(oparams.outopts, "spool_dir");
+	char *spool_size = kvargs_get(oparams.outopts, "spool_size");
+	char *spool_hwm = kvargs_get(oparams.outopts, "spool_hwm");
+	if(spool_dir != NULL) {
+		int32_t size = OUTPUT_SPOOL_SIZE_DEFAULT, hwm = OUTPUT_SPOOL_HWM_DEFAULT;
+		if(spool_size != NULL && (parse_int32(spool_size, &size) == false ||
+					size < 1 || size > OUTPUT_SPOOL_SIZE_MAX)) {
+			fprintf(stderr, "Invalid spool_size value: must be between 1 and %d\n", OUTPUT_SPOOL_SIZE_MAX);
+			_exit(1);
+		}
+		if(spool_hwm != NULL && (parse_int32(spool_hwm, &hwm) == false || hwm < 1)) {
+			fprintf(stderr, "Invalid spool_hwm value: must be a positive integer\n");
+			_exit(1);
+		}
+		if((output->ctx->spool = output_spool_create(spool_dir, size, hwm, output->id)) == NULL) {
+			_exit(1);
+		}
+	} else if(spool_size != NULL || spool_hwm != NULL) {
+		fprintf(stderr, "Warning: spool_dir not set, spool_size and spool_hwm parameters ignored\n");
+	}
 	fmtr->outputs = la_list_append(fmtr->outputs, output);
 
 	// oparams is no longer needed after this point.
@@ -987,6 +1254,9 @@ static void start_output_thread(void *p, void *ctx) {
 	UNUSED(ctx);
 	ASSERT(p != NULL);
 	output_instance_t *output = p;
+	if(output->filter != NULL) {
+		msg_filter_initialize_counters(output->filter);
+	}
 	debug_print(D_OUTPUT, "starting thread for output %s\n", output->td->name);
 	start_thread(output->output_thread, output_thread, output);
 }
@@ -2,14 +2,26 @@
 #include "metadata.h"
 #include "util.h"               // ASSERT
 
+// Returns a new copy of m with a reference count of 1.
 struct metadata *metadata_copy(struct metadata const *m) {
 	ASSERT(m);
-	return m->vtable->copy(m);
+	struct metadata *copy = m->vtable->copy(m);
+	atomic_init(&copy->refcnt, 1);
+	return copy;
 }
 
-void metadata_destroy(struct metadata *m) {
+struct metadata *metadata_ref(struct metadata *m) {
+	ASSERT(m);
+	atomic_fetch_add(&m->refcnt, 1);
+	return m;
+}
+
+void metadata_unref(struct metadata *m) {
 	if(m == NULL) {
 		return;
 	}
+	if(atomic_fetch_sub(&m->refcnt, 1) > 1) {
+		return;
+	}
 	m->vtable->destroy(m);
 }
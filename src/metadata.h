@@ -1,10 +1,15 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #pragma once
+#include <stdint.h>
+#include <stdatomic.h>              // _Atomic
 #include <sys/time.h>               // struct timeval
 
+// Metadata objects created with metadata_copy() are reference counted,
+// so that all messages produced from the same frame can share one copy.
 struct metadata {
 	struct metadata_vtable *vtable;
 	struct timeval rx_timestamp;
+	_Atomic int32_t refcnt;
 };
 
 struct metadata_vtable {
@@ -13,4 +18,5 @@ struct metadata_vtable {
 };
 
 struct metadata *metadata_copy(struct metadata const *m);
-void metadata_destroy(struct metadata *m);
+struct metadata *metadata_ref(struct metadata *m);
+void metadata_unref(struct metadata *m);
@@ -4,11 +4,13 @@
 #include <libacars/libacars.h>              // la_type_descriptor, la_proto_node
 #include <libacars/reassembly.h>            // la_reasm_ctx
 #include <libacars/list.h>                  // la_list
-#include <libacars/json.h>                  // la_json_append_*
 #include "pdu.h"                            // struct hfdl_pdu_hdr_data, hfdl_pdu_fcs_check
 #include "lpdu.h"                           // lpdu_parse
 #include "statsd.h"                         // statsd_*
-#include "util.h"                           // NEW, ASSERT, struct octet_string, {ac,gs}_id_format_text
+#include "util.h"                           // ASSERT, struct octet_string, {ac,gs}_id_format_text
+#include "fmtr-writer.h"                    // struct fmtr_writer, fw_*
+#include "arena.h"                          // FRAME_NEW, frame_arena_alloc
+#include "filter.h"                         // struct msg_props, msg_props_header_set
 
 struct hfdl_mpdu {
 	struct octet_string *pdu;
@@ -39,7 +41,7 @@ la_list *mpdu_parse(struct octet_string *pdu, la_reasm_ctx *reasm_ctx,
 	la_proto_node *mpdu_node = NULL;
 	struct hfdl_mpdu *mpdu = NULL;
 	if(Config.output_mpdus) {
-		mpdu = XCALLOC(1, sizeof(struct hfdl_mpdu));
+		mpdu = frame_arena_alloc(sizeof(struct hfdl_mpdu));
 		mpdu->pdu = pdu;
 		mpdu_node = la_proto_node_new();
 		mpdu_node->data = mpdu;
@@ -108,7 +110,7 @@ la_list *mpdu_parse(struct octet_string *pdu, la_reasm_ctx *reasm_ctx,
 			mpdu_header.dst_id = *hdrptr++;
 			lpdu_cnt = (*hdrptr++ >> 4) & 0xF;
 			if(Config.output_mpdus == true) {
-				NEW(struct mpdu_dst, dst_ac);
+				FRAME_NEW(struct mpdu_dst, dst_ac);
 				dst_ac->dst_id = mpdu_header.dst_id;
 				dst_ac->lpdu_cnt = lpdu_cnt;
 				mpdu->dst_aircraft = la_list_append(mpdu->dst_aircraft, dst_ac);
@@ -190,29 +192,29 @@ static void mpdu_format_text(la_vstring *vstr, void const *data, int32_t indent)
 	}
 }
 
-static void mpdu_format_json(la_vstring *vstr, void const *data) {
-	ASSERT(vstr != NULL);
+void mpdu_serialize(struct fmtr_writer *w, void const *data) {
+	ASSERT(w != NULL);
 	ASSERT(data);
 
 	struct hfdl_mpdu const *mpdu = data;
-	la_json_append_bool(vstr, "err", !mpdu->header.crc_ok);
+	fw_append_bool(w, "err", !mpdu->header.crc_ok);
 	if(!mpdu->header.crc_ok) {
 		return;
 	}
 	if(mpdu->header.direction == UPLINK_PDU) {
-		gs_id_format_json(vstr, "src", mpdu->header.src_id);
-		la_json_array_start(vstr, "dsts");
+		gs_id_serialize(w, "src", mpdu->header.src_id);
+		fw_array_start(w, "dsts");
 		for(la_list *ac = mpdu->dst_aircraft; ac != NULL; ac = la_list_next(ac)) {
 			struct mpdu_dst *dst = ac->data;
-			la_json_object_start(vstr, NULL);
-			ac_id_format_json(vstr, "dst", mpdu->header.freq, dst->dst_id);
-			la_json_append_int64(vstr, "lpdu_cnt", dst->lpdu_cnt);
-			la_json_object_end(vstr);
+			fw_object_start(w, NULL);
+			ac_id_serialize(w, "dst", mpdu->header.freq, dst->dst_id);
+			fw_append_int64(w, "lpdu_cnt", dst->lpdu_cnt);
+			fw_object_end(w);
 		}
-		la_json_array_end(vstr);
+		fw_array_end(w);
 	} else {
-		ac_id_format_json(vstr, "src", mpdu->header.freq, mpdu->header.src_id);
-		gs_id_format_json(vstr, "dst", mpdu->header.dst_id);
+		ac_id_serialize(w, "src", mpdu->header.freq, mpdu->header.src_id);
+		gs_id_serialize(w, "dst", mpdu->header.dst_id);
 	}
 }
 
@@ -221,8 +223,25 @@ static void mpdu_destroy(void *data) {
 		return;
 	}
 	struct hfdl_mpdu *mpdu = data;
+	// List elements are in the frame arena, only the list itself needs freeing
 	la_list_free(mpdu->dst_aircraft);
-	XFREE(mpdu);
+}
+
+bool mpdu_msg_props_extract(la_proto_node *tree, struct msg_props *props) {
+	ASSERT(tree);
+	ASSERT(props);
+
+	la_proto_node *mpdu_node = la_proto_tree_find_protocol(tree, &proto_DEF_hfdl_mpdu);
+	if(mpdu_node == NULL) {
+		return false;
+	}
+	struct hfdl_mpdu const *mpdu = mpdu_node->data;
+	msg_props_header_set(props, &mpdu->header);
+	return true;
+}
+
+static void mpdu_format_json(la_vstring *vstr, void const *data) {
+	fw_format_json(vstr, mpdu_serialize, data);
 }
 
 la_type_descriptor const proto_DEF_hfdl_mpdu = {
@@ -4,7 +4,14 @@
 #include <sys/time.h>               // struct timeval
 #include <libacars/reassembly.h>    // la_reasm_ctx
 #include <libacars/list.h>          // la_list
+#include <libacars/libacars.h>      // la_proto_node
 #include "util.h"                   // struct octet_string
+#include "filter.h"                 // struct msg_props
 
 la_list *mpdu_parse(struct octet_string *pdu, la_reasm_ctx *reasm_ctx, struct
 		timeval rx_timestamp, int32_t freq);
+bool mpdu_msg_props_extract(la_proto_node *tree, struct msg_props *props);
+
+struct fmtr_writer;
+extern la_type_descriptor const proto_DEF_hfdl_mpdu;
+void mpdu_serialize(struct fmtr_writer *w, void const *data);
@@ -1,4 +1,5 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdio.h>              // fprintf, snprintf
 #include <string.h>             // memset, strcmp, strdup
 #include <unistd.h>             // sleep
 #include <glib.h>               // g_async_queue_new
@@ -6,16 +7,25 @@
 #include "config.h"             // WITH_*
 #include "util.h"               // NEW, ASSERT
 #include "options.h"            // describe_option
-#include "metadata.h"           // struct metadata, metadata_copy, metadata_destroy
+#include "metadata.h"           // struct metadata, metadata_unref
+#include "filter.h"             // msg_filter_*, msg_props_extract
+#include "statsd.h"             // statsd_timer
 #include "output-common.h"
+#include "output-spool.h"       // output_spool_*
 
 #include "fmtr-text.h"          // fmtr_DEF_text
 #include "fmtr-basestation.h"   // fmtr_DEF_basestation
 #include "fmtr-json.h"          // fmtr_DEF_json
+#include "fmtr-cbor.h"          // fmtr_DEF_cbor
+#include "fmtr-frame.h"         // fmtr_DEF_frame
 
 #include "output-file.h"        // out_DEF_file
 #include "output-tcp.h"         // out_DEF_tcp
+#include "output-tcp-server.h"  // out_DEF_tcp_server
 #include "output-udp.h"         // out_DEF_udp
+#ifdef WITH_SHM_OUTPUT
+#include "output-shm.h"         // out_DEF_shm
+#endif
 #ifdef WITH_ZMQ
 #include "output-zmq.h"         // out_DEF_zmq
 #endif
@@ -48,13 +58,19 @@ static la_dict const fmtr_descriptors[] = {
 	{ .id = OFMT_TEXT,                  .val = &fmtr_DEF_text },
 	{ .id = OFMT_BASESTATION,           .val = &fmtr_DEF_basestation },
 	{ .id = OFMT_JSON,                  .val = &fmtr_DEF_json },
+	{ .id = OFMT_CBOR,                  .val = &fmtr_DEF_cbor },
+	{ .id = OFMT_FRAME,                 .val = &fmtr_DEF_frame },
 	{ .id = OFMT_UNKNOWN,               .val = NULL }
 };
 
 static output_descriptor_t * output_descriptors[] = {
 	&out_DEF_file,
 	&out_DEF_tcp,
+	&out_DEF_tcp_server,
 	&out_DEF_udp,
+#ifdef WITH_SHM_OUTPUT
+	&out_DEF_shm,
+#endif
 #ifdef WITH_ZMQ
 	&out_DEF_zmq,
 #endif
@@ -93,6 +109,74 @@ void fmtr_instance_destroy(fmtr_instance_t *fmtr) {
 	}
 }
 
+// Returns true if at least one output of the formatter would accept
+// a message now. Used to avoid formatting messages which would be dropped
+// anyway.
+bool fmtr_instance_is_accepting(fmtr_instance_t *fmtr) {
+	ASSERT(fmtr != NULL);
+	for(la_list *p = fmtr->outputs; p != NULL; p = la_list_next(p)) {
+		if(output_is_accepting(p->data, false)) {
+			return true;
+		}
+	}
+	// Nothing will be pushed, so report the reason here
+	for(la_list *p = fmtr->outputs; p != NULL; p = la_list_next(p)) {
+		output_is_accepting(p->data, true);
+	}
+	return false;
+}
+
+// Returns the list of outputs of the formatter which should receive the
+// message, according to their filters. If none of the outputs has a filter,
+// fmtr->outputs is returned. Otherwise a new list is returned (NULL if all
+// outputs rejected the message) which must be freed with la_list_free().
+// Evaluating filters before formatting avoids serializing messages which
+// nobody wants.
+// If any of the outputs needs message properties, they are returned in
+// *props (to be stored in the queue entry), otherwise *props is set to NULL.
+la_list *fmtr_instance_outputs_select(fmtr_instance_t *fmtr, struct metadata const *metadata,
+		la_proto_node *tree, struct msg_props **props) {
+	ASSERT(fmtr != NULL);
+	ASSERT(props != NULL);
+	*props = NULL;
+	uint32_t wanted = 0, stored = 0;
+	for(la_list *p = fmtr->outputs; p != NULL; p = la_list_next(p)) {
+		output_instance_t *output = p->data;
+		if(output->filter != NULL) {
+			wanted |= msg_filter_props_used(output->filter);
+		}
+		stored |= output->props_wanted;
+	}
+	if(wanted == 0 && stored == 0) {
+		return fmtr->outputs;
+	}
+	struct msg_props local_props;
+	struct msg_props *mp = &local_props;
+	if(stored != 0) {
+		mp = XCALLOC(1, sizeof(struct msg_props));
+	}
+	msg_props_extract(mp, metadata, tree, wanted | stored);
+	if(wanted == 0) {
+		*props = mp;
+		return fmtr->outputs;
+	}
+	la_list *selected = NULL;
+	for(la_list *p = fmtr->outputs; p != NULL; p = la_list_next(p)) {
+		output_instance_t *output = p->data;
+		if(output->filter == NULL || msg_filter_match(output->filter, mp)) {
+			selected = la_list_append(selected, output);
+		}
+	}
+	if(stored != 0) {
+		if(selected != NULL) {
+			*props = mp;
+		} else {
+			XFREE(mp);
+		}
+	}
+	return selected;
+}
+
 output_format_t output_format_from_string(char const *str) {
 	for (la_dict const *d = fmtr_descriptors; d->val != NULL; d++) {
 		if (!strcmp(str, ((fmtr_descriptor_t *)d->val)->name)) {
@@ -120,6 +204,8 @@ output_instance_t *output_instance_new(output_descriptor_t *outtd, output_format
 	ctx->q = g_async_queue_new();
 	ctx->format = format;
 	ctx->priv = priv;
+	ctx->batch_size = outtd->produce_batch != NULL ? OUTPUT_BATCH_SIZE_DEFAULT : 1;
+	ctx->batch_linger = 0;
 	ctx->active = true;
 	NEW(output_instance_t, output);
 	output->td = outtd;
@@ -132,6 +218,7 @@ void output_instance_destroy(output_instance_t *output) {
 	if(output) {
 		if(output->ctx) {
 			g_async_queue_unref(output->ctx->q);
+			output_spool_destroy(output->ctx->spool);
 			if(output->td->ctx_destroy) {
 				output->td->ctx_destroy(output->ctx->priv);
 			} else {
@@ -139,32 +226,41 @@ void output_instance_destroy(output_instance_t *output) {
 			}
 			XFREE(output->ctx);
 		}
+		msg_filter_destroy(output->filter);
 		XFREE(output->output_thread);
 		XFREE(output);
 	}
 }
 
-output_qentry_t *output_qentry_copy(output_qentry_t const *q) {
-	ASSERT(q != NULL);
+// Creates a new queue entry with a reference count of 1.
+// Takes over msg and a reference to metadata (both may be NULL).
+output_qentry_t *output_qentry_new(struct octet_string *msg, struct metadata *metadata,
+		output_format_t format, uint32_t flags) {
+	NEW(output_qentry_t, q);
+	q->msg = msg;
+	q->metadata = metadata;
+	q->format = format;
+	q->flags = flags;
+	atomic_init(&q->refcnt, 1);
+	return q;
+}
 
-	NEW(output_qentry_t, copy);
-	if(q->msg != NULL) {
-		copy->msg = octet_string_copy(q->msg);
-	}
-	if(q->metadata != NULL) {
-		copy->metadata = metadata_copy(q->metadata);
-	}
-	copy->format = q->format;
-	copy->flags = q->flags;
-	return copy;
+output_qentry_t *output_qentry_ref(output_qentry_t *q) {
+	ASSERT(q != NULL);
+	atomic_fetch_add(&q->refcnt, 1);
+	return q;
 }
 
-void output_qentry_destroy(output_qentry_t *q) {
+void output_qentry_unref(output_qentry_t *q) {
 	if(q == NULL) {
 		return;
 	}
+	if(atomic_fetch_sub(&q->refcnt, 1) > 1) {
+		return;
+	}
 	octet_string_destroy(q->msg);
-	metadata_destroy(q->metadata);
+	metadata_unref(q->metadata);
+	XFREE(q->props);
 	XFREE(q);
 }
 
@@ -173,7 +269,7 @@ void output_queue_drain(GAsyncQueue *q) {
 	g_async_queue_lock(q);
 	while(g_async_queue_length_unlocked(q) > 0) {
 		output_qentry_t *qentry = g_async_queue_pop_unlocked(q);
-		output_qentry_destroy(qentry);
+		output_qentry_unref(qentry);
 	}
 	g_async_queue_unlock(q);
 }
@@ -208,9 +304,78 @@ void output_usage() {
 			}
 		}
 	}
+	fprintf(stderr, "\nParameters common to all output types:\n\n");
+	describe_option("batch_size", "Max number of queued messages to deliver in one go", 2);
+	describe_option("", "(default: " STR(OUTPUT_BATCH_SIZE_DEFAULT) ", max: " STR(OUTPUT_BATCH_SIZE_MAX)
+			"; only for output types which support batching: file, tcp, tcp_server, udp, shm, zmq, rdkafka)", 2);
+	describe_option("batch_linger", "How long to wait for more messages before delivering a batch, in ms (default: 0)", 2);
+	describe_option("spool_dir", "Directory where messages are spooled when the output does not keep up (default: none)", 2);
+	describe_option("spool_size", "Max size of the spool, in MB (default: " STR(OUTPUT_SPOOL_SIZE_DEFAULT) ")", 2);
+	describe_option("spool_hwm", "Number of messages queued in memory above which messages are spooled", 2);
+	describe_option("", "(default: " STR(OUTPUT_SPOOL_HWM_DEFAULT) ")", 2);
+	msg_filter_usage();
 	fprintf(stderr, "\n");
 }
 
+// Waits for at least one entry and then takes whatever else is queued, up
+// to batch_size entries, in a single lock hold. If the queue runs empty
+// before the batch is full, waits for more entries for up to batch_linger
+// milliseconds. A shutdown request terminates the batch - it is not added
+// to the batch, but returned in *shutdown. The time spent on collecting the
+// batch (counted from the arrival of the first entry) is returned in *linger.
+// If idle_timeout is non-zero and nothing arrives within idle_timeout ms,
+// returns 0 without a shutdown request.
+static int32_t output_queue_pop_batch(output_ctx_t *ctx, output_qentry_t **batch,
+		output_qentry_t **shutdown, gint64 *linger, int32_t idle_timeout) {
+	int32_t cnt = 0;
+	output_qentry_t *q = idle_timeout > 0 ?
+		g_async_queue_timeout_pop(ctx->q, (guint64)idle_timeout * 1000) : g_async_queue_pop(ctx->q);
+	if(q == NULL) {
+		*linger = 0;
+		return 0;
+	}
+	gint64 start = g_get_monotonic_time();
+	gint64 deadline = start + (gint64)ctx->batch_linger * 1000;
+	g_async_queue_lock(ctx->q);
+	while(true) {
+		ASSERT(q != NULL);
+		if(q->flags & OUT_FLAG_ORDERED_SHUTDOWN) {
+			*shutdown = q;
+			break;
+		}
+		batch[cnt++] = q;
+		if(cnt == ctx->batch_size) {
+			break;
+		}
+		if((q = g_async_queue_try_pop_unlocked(ctx->q)) == NULL) {
+			gint64 remaining = deadline - g_get_monotonic_time();
+			if(remaining <= 0 || (q = g_async_queue_timeout_pop_unlocked(ctx->q, remaining)) == NULL) {
+				break;
+			}
+		}
+	}
+	g_async_queue_unlock(ctx->q);
+	*linger = g_get_monotonic_time() - start;
+	return cnt;
+}
+
+// Returns the number of entries delivered. Entries are delivered in order,
+// so the undelivered ones are always at the end of the batch.
+static int32_t output_produce_batch(output_instance_t *oi, output_qentry_t **batch, int32_t cnt) {
+	if(oi->td->produce_batch != NULL) {
+		int32_t result = oi->td->produce_batch(oi->ctx->priv, batch, cnt);
+		return result < 0 ? 0 : (result > cnt ? cnt : result);
+	}
+	int32_t i = 0;
+	for(; i < cnt; i++) {
+		output_qentry_t *q = batch[i];
+		if(oi->td->produce(oi->ctx->priv, q->format, q->metadata, q->msg) < 0) {
+			break;
+		}
+	}
+	return i;
+}
+
 void *output_thread(void *arg) {
 	ASSERT(arg != NULL);
 	output_instance_t *oi = arg;
@@ -223,27 +388,104 @@ void *output_thread(void *arg) {
 		}
 	}
 
+	output_qentry_t **batch = XCALLOC(ctx->batch_size, sizeof(output_qentry_t *));
+#ifdef WITH_STATSD
+	char batch_size_metric[64], batch_linger_metric[64];
+	snprintf(batch_size_metric, sizeof(batch_size_metric), "outputs.%d.batch.size", oi->id);
+	snprintf(batch_linger_metric, sizeof(batch_linger_metric), "outputs.%d.batch.linger", oi->id);
+#endif
+	int32_t flush_timeout = 0;
+	output_qentry_t *shutdown = NULL;
+	gint64 shutdown_deadline = 0;          // set when delivery fails after a shutdown request
 	while(1) {
-		output_qentry_t *q = g_async_queue_pop(ctx->q);
-		ASSERT(q != NULL);
-		if(q->flags & OUT_FLAG_ORDERED_SHUTDOWN) {
-			output_qentry_destroy(q);
+		gint64 linger = 0;
+		int32_t cnt = 0, idle_timeout = flush_timeout;
+		// Messages in the RAM queue are older than those in the spool.
+		// After a shutdown request, the spool is drained before terminating.
+		bool spooled = false;
+		if(ctx->spool != NULL) {
+			int32_t report_timeout = output_spool_report(ctx->spool);
+			if(idle_timeout == 0 || report_timeout < idle_timeout) {
+				idle_timeout = report_timeout;
+			}
+			cnt = output_spool_peek(ctx->spool, ctx->q, batch, ctx->batch_size);
+			spooled = cnt > 0;
+		}
+		if(shutdown != NULL && !spooled) {
 			break;
 		}
-		int32_t result = oi->td->produce(ctx->priv, q->format, q->metadata, q->msg);
-		if(result < 0) {
-			debug_print(D_OUTPUT, "output %p: msg %p (ts %ld %ld): delivery failure\n", oi, q,
-					q->metadata->rx_timestamp.tv_sec, q->metadata->rx_timestamp.tv_usec);
-			g_async_queue_push_front(ctx->q, q);
-			// Delay further processing a bit to give the output a change to resolve
-			// the problem (eg. to reconnect)
-			sleep(2);
-		} else {
-			debug_print(D_OUTPUT, "output %p: msg %p (ts %ld %ld): delivery ok\n", oi, q,
-					q->metadata->rx_timestamp.tv_sec, q->metadata->rx_timestamp.tv_usec);
-			output_qentry_destroy(q);
+		if(!spooled) {
+			cnt = output_queue_pop_batch(ctx, batch, &shutdown, &linger, idle_timeout);
+		}
+#ifdef WITH_STATSD
+		if(cnt > 0 && oi->td->produce_batch != NULL) {
+			statsd_timer(batch_size_metric, cnt);
+			statsd_timer(batch_linger_metric, linger / 1000);
+		}
+#endif
+		int32_t delivered = cnt > 0 ? output_produce_batch(oi, batch, cnt) : 0;
+		for(int32_t i = 0; i < delivered; i++) {
+			debug_print(D_OUTPUT, "output %p: msg %p (ts %ld %ld): delivery ok\n", oi, batch[i],
+					batch[i]->metadata->rx_timestamp.tv_sec, batch[i]->metadata->rx_timestamp.tv_usec);
+			output_qentry_unref(batch[i]);
+		}
+		if(spooled) {
+			output_spool_commit(ctx->spool, delivered);
+		}
+		if(delivered < cnt) {
+			debug_print(D_OUTPUT, "output %p: msg %p (ts %ld %ld): not delivered, %d msgs pending\n",
+					oi, batch[delivered], batch[delivered]->metadata->rx_timestamp.tv_sec,
+					batch[delivered]->metadata->rx_timestamp.tv_usec, cnt - delivered);
+			if(shutdown != NULL && shutdown_deadline == 0) {
+				shutdown_deadline = g_get_monotonic_time() + OUTPUT_SHUTDOWN_TIMEOUT * G_TIME_SPAN_SECOND;
+			}
+			// If the output is merely busy (its send queue is full), retry as soon
+			// as it makes room. Otherwise delay further processing a bit to give
+			// the output a chance to resolve the problem (eg. to reconnect).
+			bool busy = oi->td->wait_ready != NULL && oi->td->wait_ready(ctx->priv, OUTPUT_WAIT_READY_TIMEOUT);
+			if(shutdown_deadline != 0 && (!busy || g_get_monotonic_time() >= shutdown_deadline)) {
+				// Don't wait for the output to recover while shutting down.
+				// Spooled messages are kept on disk and delivered after a restart.
+				for(int32_t i = delivered; i < cnt; i++) {
+					output_qentry_unref(batch[i]);
+				}
+				if(!spooled) {
+					// The shutdown request might have been put back in the queue
+					int32_t discarded = cnt - delivered + g_async_queue_length(ctx->q) - (shutdown == NULL ? 1 : 0);
+					fprintf(stderr, "%s output: %d undelivered message(s) discarded on shutdown\n",
+							oi->td->name, discarded);
+					output_queue_drain(ctx->q);
+				}
+				break;
+			}
+			for(int32_t i = cnt - 1; i >= delivered; i--) {
+				if(spooled) {
+					// Still in the spool - will be read again
+					output_qentry_unref(batch[i]);
+				} else {
+					// Put the undelivered tail back in front of the queue, preserving the order
+					g_async_queue_push_front(ctx->q, batch[i]);
+				}
+			}
+			if(shutdown != NULL && !spooled) {
+				// Messages queued before the shutdown request must be delivered first
+				g_async_queue_push(ctx->q, shutdown);
+				shutdown = NULL;
+			}
+			if(!busy) {
+				sleep(2);
+			}
+		}
+		// Give the output a chance to write out buffered data, also when the queue is idle
+		if(oi->td->flush != NULL) {
+			flush_timeout = oi->td->flush(ctx->priv);
+		}
+		if(shutdown != NULL && ctx->spool == NULL) {
+			break;
 		}
 	}
+	output_qentry_unref(shutdown);
+	XFREE(batch);
 
 	if(oi->td->handle_shutdown != NULL) {
 		oi->td->handle_shutdown(ctx->priv);
@@ -260,25 +502,44 @@ fail:
 	return NULL;
 }
 
+// Returns true if the output is running and its queue is below the high
+// water mark. If verbose is true, the reason of rejection is reported.
+// With a spool, the queue does not overflow until the spool is full.
+bool output_is_accepting(output_instance_t *output, bool verbose) {
+	ASSERT(output != NULL);
+	struct output_spool *spool = output->ctx->spool;
+	bool overflow = spool != NULL ? output_spool_is_full(spool) :
+		(Config.output_queue_hwm != OUTPUT_QUEUE_HWM_NONE &&
+		 g_async_queue_length(output->ctx->q) >= Config.output_queue_hwm);
+	bool active = output->ctx->active;
+	if(active && !overflow) {
+		return true;
+	}
+	if(verbose) {
+		if(overflow) {
+			fprintf(stderr, "%s output %s overflow, throttling\n", output->td->name,
+					spool != NULL ? "spool" : "queue");
+		} else if(!active) {
+			debug_print(D_OUTPUT, "%s output %p is inactive, skipping\n", output->td->name, output);
+		}
+	}
+	return false;
+}
+
 void output_queue_push(void *data, void *ctx) {
 	ASSERT(data);
 	ASSERT(ctx);
 	output_instance_t *output = data;
 	output_qentry_t *qentry = ctx;
 
-	bool overflow = (Config.output_queue_hwm != OUTPUT_QUEUE_HWM_NONE &&
-			g_async_queue_length(output->ctx->q) >= Config.output_queue_hwm);
-	bool active = output->ctx->active;
-	if(qentry->flags & OUT_FLAG_ORDERED_SHUTDOWN || (active && !overflow)) {
-		output_qentry_t *copy = output_qentry_copy(qentry);
-		g_async_queue_push(output->ctx->q, copy);
-		debug_print(D_OUTPUT, "dispatched %s output %p\n", output->td->name, output);
-	} else {
-		if(overflow) {
-			fprintf(stderr, "%s output queue overflow, throttling\n", output->td->name);
-		} else if(!active) {
-			debug_print(D_OUTPUT, "%s output %p is inactive, skipping\n", output->td->name, output);
+	if(qentry->flags & OUT_FLAG_ORDERED_SHUTDOWN || output_is_accepting(output, true)) {
+		// No copy - all outputs share the same entry
+		if(output->ctx->spool != NULL && !(qentry->flags & OUT_FLAG_ORDERED_SHUTDOWN)) {
+			output_spool_enqueue(output->ctx->spool, output->ctx->q, qentry);
+		} else {
+			g_async_queue_push(output->ctx->q, output_qentry_ref(qentry));
 		}
+		debug_print(D_OUTPUT, "dispatched %s output %p\n", output->td->name, output);
 	}
 }
 
@@ -286,13 +547,9 @@ void shutdown_outputs(la_list *fmtr_list) {
 	fmtr_instance_t *fmtr = NULL;
 	for(la_list *p = fmtr_list; p != NULL; p = la_list_next(p)) {
 		fmtr = (fmtr_instance_t *)(p->data);
-		output_qentry_t qentry = {
-			.msg = NULL,
-			.metadata = NULL,
-			.format = OFMT_UNKNOWN,
-			.flags = OUT_FLAG_ORDERED_SHUTDOWN
-		};
-		la_list_foreach(fmtr->outputs, output_queue_push, &qentry);
+		output_qentry_t *qentry = output_qentry_new(NULL, NULL, OFMT_UNKNOWN, OUT_FLAG_ORDERED_SHUTDOWN);
+		la_list_foreach(fmtr->outputs, output_queue_push, qentry);
+		output_qentry_unref(qentry);
 	}
 }
 
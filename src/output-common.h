@@ -2,6 +2,7 @@
 #pragma once
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>                  // _Atomic
 #include <pthread.h>                    // pthread_t
 #include <glib.h>                       // GAsyncQueue
 #include <libacars/libacars.h>          // la_proto_node
@@ -9,6 +10,7 @@
 #include "kvargs.h"                     // kvargs
 #include "options.h"                    // options_descr_t
 #include "metadata.h"                   // struct metadata
+#include "filter.h"                     // struct msg_filter
 
 // default output specification - decoded text output to stdout
 #define DEFAULT_OUTPUT "decoded:text:file:path=-"
@@ -18,6 +20,17 @@
 // high water mark disabled
 #define OUTPUT_QUEUE_HWM_NONE 0
 
+// Max number of messages passed to produce_batch() in one call
+#define OUTPUT_BATCH_SIZE_DEFAULT 64
+#define OUTPUT_BATCH_SIZE_MAX 1024
+
+// How long wait_ready() may block when the output does not keep up (ms)
+#define OUTPUT_WAIT_READY_TIMEOUT 100
+
+// How long to keep retrying delivery of queued messages after a shutdown
+// request, if the output is busy (seconds)
+#define OUTPUT_SHUTDOWN_TIMEOUT 5
+
 // Data type on formatter input
 typedef enum {
 	FMTR_INTYPE_UNKNOWN           = 0,
@@ -30,7 +43,9 @@ typedef enum {
 	OFMT_UNKNOWN    = 0,
 	OFMT_TEXT       = 1,
 	OFMT_BASESTATION = 2,
-	OFMT_JSON       = 3
+	OFMT_JSON       = 3,
+	OFMT_CBOR       = 4,
+	OFMT_FRAME      = 5
 } output_format_t;
 
 typedef struct octet_string* (fmt_decoded_fun_t)(struct metadata *, la_proto_node *);
@@ -55,10 +70,15 @@ typedef struct {
 } fmtr_instance_t;
 
 typedef bool (output_format_check_fun_t)(output_format_t);
-typedef void* (output_configure_fun_t)(kvargs *);
+typedef void* (output_configure_fun_t)(kvargs *, int32_t);
 typedef void (output_ctx_destroy_fun_t)(void *);
 typedef int32_t (output_init_fun_t)(void *);
-typedef int32_t (output_produce_msg_fun_t)(void *, output_format_t, struct metadata *, struct octet_string *);
+typedef int32_t (output_produce_msg_fun_t)(void *, output_format_t, struct metadata const *, struct octet_string const *);
+typedef struct output_qentry output_qentry_t;
+typedef int32_t (output_produce_batch_fun_t)(void *, output_qentry_t * const *, int32_t);
+typedef int32_t (output_flush_fun_t)(void *);
+typedef uint32_t (output_props_wanted_fun_t)(void *);
+typedef bool (output_wait_ready_fun_t)(void *, int32_t);
 typedef void (output_shutdown_handler_fun_t)(void *);
 typedef void (output_failure_handler_fun_t)(void *);
 
@@ -71,16 +91,30 @@ typedef struct {
 	output_configure_fun_t *configure;
 	output_ctx_destroy_fun_t *ctx_destroy;
 	output_init_fun_t *init;
-	output_produce_msg_fun_t *produce;
+	output_produce_msg_fun_t *produce;          // may be NULL if produce_batch is provided
+	output_produce_batch_fun_t *produce_batch;  // optional; returns the number of messages delivered
+	output_flush_fun_t *flush;                  // optional; writes out buffered data if it's due and returns
+	                                            // the number of ms until the next flush (0 - nothing buffered)
+	output_props_wanted_fun_t *props_wanted;    // optional; returns MSG_PROP_* flags of message properties
+	                                            // which the output needs in output_qentry_t->props
+	output_wait_ready_fun_t *wait_ready;        // optional; called when produce_batch() has not consumed
+	                                            // the whole batch. Returns true if the output is just busy
+	                                            // (after waiting up to the given number of ms until it accepts
+	                                            // more messages) or false if the delivery has failed
 	output_shutdown_handler_fun_t *handle_shutdown;
 	output_failure_handler_fun_t *handle_failure;
 } output_descriptor_t;
 
+struct output_spool;
+
 // Output instance context (passed to the thread routine)
 typedef struct {
 	GAsyncQueue *q;                         // input queue
+	struct output_spool *spool;             // disk spool for messages above the queue HWM (NULL - disabled)
 	void *priv;                             // output instance context (private)
 	output_format_t format;                 // format of the data fed into the output
+	int32_t batch_size;                     // max number of messages per produce_batch() call
+	int32_t batch_linger;                   // how long to wait for a batch to fill up (ms)
 	bool active;                            // output thread is running
 } output_ctx_t;
 
@@ -89,15 +123,23 @@ typedef struct {
 	output_descriptor_t *td;                // type descriptor of the output
 	pthread_t *output_thread;               // thread of this output instance
 	output_ctx_t *ctx;                      // context data for the thread
+	struct msg_filter *filter;              // messages to send (NULL - all)
+	uint32_t props_wanted;                  // message properties needed by the output (MSG_PROP_*)
+	int32_t id;                             // sequence number on the command line (for StatsD metrics)
 } output_instance_t;
 
-// Messages passed via output queues
-typedef struct {
+// Messages passed via output queues.
+// A message is immutable once created. The same entry is put in the queues
+// of all outputs it is destined to. Each queue holds a reference and the
+// entry is freed when the last reference is dropped.
+struct output_qentry {
 	struct octet_string *msg;               // formatted message
 	struct metadata *metadata;              // opaque message metadata
+	struct msg_props *props;                // message properties (NULL if no output needs them)
 	output_format_t format;                 // format of the data stored in msg
 	uint32_t flags;                         // flags
-} output_qentry_t;
+	_Atomic int32_t refcnt;                 // reference count
+};
 
 // output queue entry flags
 #define OUT_FLAG_ORDERED_SHUTDOWN (1 << 0)
@@ -106,14 +148,20 @@ fmtr_input_type_t fmtr_input_type_from_string(char const *str);
 fmtr_descriptor_t *fmtr_descriptor_get(output_format_t fmt);
 fmtr_instance_t *fmtr_instance_new(fmtr_descriptor_t *fmttd, fmtr_input_type_t intype);
 void fmtr_instance_destroy(fmtr_instance_t *fmtr);
+bool fmtr_instance_is_accepting(fmtr_instance_t *fmtr);
+la_list *fmtr_instance_outputs_select(fmtr_instance_t *fmtr, struct metadata const *metadata,
+		la_proto_node *tree, struct msg_props **props);
 
 output_format_t output_format_from_string(char const *str);
 output_descriptor_t *output_descriptor_get(char const *output_name);
 output_instance_t *output_instance_new(output_descriptor_t *outtd, output_format_t format, void *priv);
 void output_instance_destroy(output_instance_t *output);
-output_qentry_t *output_qentry_copy(output_qentry_t const *q);
-void output_qentry_destroy(output_qentry_t *q);
+output_qentry_t *output_qentry_new(struct octet_string *msg, struct metadata *metadata,
+		output_format_t format, uint32_t flags);
+output_qentry_t *output_qentry_ref(output_qentry_t *q);
+void output_qentry_unref(output_qentry_t *q);
 void output_queue_drain(GAsyncQueue *q);
+bool output_is_accepting(output_instance_t *output, bool verbose);
 void *output_thread(void *arg);
 void output_queue_push(void *data, void *ctx);
 void shutdown_outputs(la_list *fmtr_list);
@@ -1,35 +1,62 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
-#include <stdio.h>                      // FILE, fprintf, fwrite
+#include <stdio.h>                      // FILE, fprintf, fwrite, setvbuf, fileno
+#include <inttypes.h>                   // PRIu64
+#include <stdlib.h>                     // strtol
 #include <string.h>                     // strcmp, strdup, strerror
-#include <time.h>                       // gmtime_r, localtime_r, strftime
+#include <time.h>                       // gmtime_r, localtime_r, strftime, timegm, mktime
 #include <errno.h>                      // errno
+#include <unistd.h>                     // fdatasync, fsync
 #include <arpa/inet.h>                  // htons
 #include "output-common.h"              // output_descriptor_t, output_qentry_t, output_queue_drain
 #include "output-file.h"                // OUT_BINARY_FRAME_LEN_OCTETS, OUT_BINARY_FRAME_LEN_MAX
 #include "kvargs.h"                     // kvargs
 #include "options.h"                    // option_descr_t
+#include "compressor.h"                 // compressor_*
 #include "util.h"                       // ASSERT, NEW
 
+// Default interval between flushes in buffered mode (ms)
+#define OUT_FILE_FLUSH_INTERVAL_DEFAULT 1000
+#define OUT_FILE_BUFFER_SIZE_MIN 1024
+#define OUT_FILE_BUFFER_SIZE_MAX (64 * 1024 * 1024)
+
 typedef enum {
 	ROT_NONE,
 	ROT_HOURLY,
 	ROT_DAILY
 } out_file_rotation_mode;
 
+typedef enum {
+	SYNC_NONE,
+	SYNC_FLUSH,
+	SYNC_CLOSE
+} out_file_sync_mode;
+
 typedef struct {
 	FILE *fh;
 	char *filename_prefix;
 	char *extension;
 	size_t prefix_len;
-	struct tm current_tm;
+	time_t period_start;                // current file holds messages with timestamps
+	time_t period_end;                  // in the range of [period_start, period_end)
 	out_file_rotation_mode rotate;
+	size_t buffer_size;                 // 0 - no buffering, flush after each batch
+	uint8_t *buffer;                    // write buffer (shared by all files, as only one is open at a time)
+	int32_t flush_interval;             // max time between flushes in buffered mode (ms)
+	out_file_sync_mode sync;
+	int64_t flush_deadline;             // when buffered data must be written out (ms, monotonic clock; 0 - nothing buffered)
+	compressor_type compress;
+	int32_t compress_level;             // 0 - library default
+	struct compressor *compressor;      // compressor of the current file
+	int64_t compress_cpu_time;          // CPU time spent on writing to the current file (us)
 } out_file_ctx_t;
 
 static bool out_file_supports_format(output_format_t format) {
-	return(format == OFMT_TEXT || format == OFMT_BASESTATION || format == OFMT_JSON);
+	return(format == OFMT_TEXT || format == OFMT_BASESTATION || format == OFMT_JSON ||
+			format == OFMT_CBOR || format == OFMT_FRAME);
 }
 
-static void *out_file_configure(kvargs *kv) {
+static void *out_file_configure(kvargs *kv, int32_t id) {
+	UNUSED(id);
 	ASSERT(kv != NULL);
 	NEW(out_file_ctx_t, cfg);
 	if(kvargs_get(kv, "path") == NULL) {
@@ -51,8 +78,70 @@ static void *out_file_configure(kvargs *kv) {
 	} else {
 		cfg->rotate = ROT_NONE;
 	}
+	char *val = NULL;
+	char *endptr = NULL;
+	if((val = kvargs_get(kv, "buffer_size")) != NULL) {
+		long size = strtol(val, &endptr, 10);
+		if(endptr == val || *endptr != '\0' || size < OUT_FILE_BUFFER_SIZE_MIN || size > OUT_FILE_BUFFER_SIZE_MAX) {
+			fprintf(stderr, "output_file: buffer_size: invalid value '%s' (must be in range %d-%d)\n",
+					val, OUT_FILE_BUFFER_SIZE_MIN, OUT_FILE_BUFFER_SIZE_MAX);
+			goto fail;
+		}
+		cfg->buffer_size = (size_t)size;
+		cfg->buffer = XCALLOC(cfg->buffer_size, sizeof(uint8_t));
+	}
+	cfg->flush_interval = OUT_FILE_FLUSH_INTERVAL_DEFAULT;
+	if((val = kvargs_get(kv, "flush_interval")) != NULL) {
+		long interval = strtol(val, &endptr, 10);
+		if(endptr == val || *endptr != '\0' || interval < 1 || interval > INT32_MAX) {
+			fprintf(stderr, "output_file: flush_interval: invalid value '%s' (must be a positive integer)\n", val);
+			goto fail;
+		}
+		cfg->flush_interval = (int32_t)interval;
+	}
+	char *sync = kvargs_get(kv, "sync");
+	if(sync == NULL || !strcmp(sync, "none")) {
+		cfg->sync = SYNC_NONE;
+	} else if(!strcmp(sync, "flush")) {
+		cfg->sync = SYNC_FLUSH;
+	} else if(!strcmp(sync, "close")) {
+		cfg->sync = SYNC_CLOSE;
+	} else {
+		fprintf(stderr, "output_file: invalid sync mode: %s\n", sync);
+		goto fail;
+	}
+	if((val = kvargs_get(kv, "compress")) != NULL) {
+		cfg->compress = compressor_type_from_string(val);
+		if(cfg->compress == COMPRESSOR_UNKNOWN) {
+			fprintf(stderr, "output_file: invalid compression method: %s\n", val);
+			goto fail;
+		} else if(!compressor_is_available(cfg->compress)) {
+			fprintf(stderr, "output_file: %s compression is not supported in this build\n", val);
+			goto fail;
+		}
+		// The suffix is appended when the file is opened
+		char const *suffix = compressor_file_suffix(cfg->compress);
+		size_t path_len = strlen(cfg->filename_prefix), suffix_len = strlen(suffix);
+		if(path_len > suffix_len && !strcmp(cfg->filename_prefix + path_len - suffix_len, suffix)) {
+			cfg->filename_prefix[path_len - suffix_len] = '\0';
+		}
+	}
+	if((val = kvargs_get(kv, "compress_level")) != NULL) {
+		long level = strtol(val, &endptr, 10);
+		int32_t level_max = compressor_level_max(cfg->compress);
+		if(cfg->compress == COMPRESSOR_NONE) {
+			fprintf(stderr, "output_file: compress_level requires compress parameter\n");
+			goto fail;
+		} else if(endptr == val || *endptr != '\0' || level < 1 || level > level_max) {
+			fprintf(stderr, "output_file: compress_level: invalid value '%s' (must be in range 1-%d)\n",
+					val, level_max);
+			goto fail;
+		}
+		cfg->compress_level = (int32_t)level;
+	}
 	return cfg;
 fail:
+	XFREE(cfg->filename_prefix);
 	XFREE(cfg);
 	return NULL;
 }
@@ -61,22 +150,111 @@ static void out_file_ctx_destroy(void *ctxptr) {
 	if(ctxptr != NULL) {
 		out_file_ctx_t *ctx = ctxptr;
 		XFREE(ctx->filename_prefix);
+		XFREE(ctx->extension);
+		XFREE(ctx->buffer);
 		XFREE(ctx);
 	}
 }
 
-static int32_t out_file_open(out_file_ctx_t *self) {
+static int64_t out_file_clock_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void out_file_sync(out_file_ctx_t *self) {
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+	int32_t ret = fdatasync(fileno(self->fh));
+#else
+	int32_t ret = fsync(fileno(self->fh));
+#endif
+	if(ret < 0 && errno != EINVAL) {        // EINVAL - not a regular file (eg. stdout redirected to a pipe)
+		fprintf(stderr, "output_file(%s): sync failed: %s\n", self->filename_prefix, strerror(errno));
+	}
+}
+
+static int64_t out_file_cpu_time_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void out_file_flush(out_file_ctx_t *self) {
+	if(self->compressor != NULL) {
+		compressor_flush(self->compressor);
+	}
+	fflush(self->fh);
+	if(self->sync == SYNC_FLUSH) {
+		out_file_sync(self);
+	}
+	self->flush_deadline = 0;
+}
+
+static void out_file_close(out_file_ctx_t *self) {
+	if(self->fh == NULL) {
+		return;
+	}
+	if(self->compressor != NULL) {
+		compressor_finish(self->compressor);
+		struct compressor_stats const *st = compressor_stats(self->compressor);
+		if(st->bytes_in > 0 && st->bytes_out > 0) {
+			fprintf(stderr, "output_file(%s): %" PRIu64 " bytes compressed to %" PRIu64
+					" (ratio %.1f), CPU time: %.1f ms per MB\n", self->filename_prefix,
+					st->bytes_in, st->bytes_out, (double)st->bytes_in / st->bytes_out,
+					self->compress_cpu_time / 1e3 / (st->bytes_in / 1048576.0));
+		}
+		compressor_destroy(self->compressor);
+		self->compressor = NULL;
+		self->compress_cpu_time = 0;
+	}
+	if(self->sync != SYNC_NONE) {
+		fflush(self->fh);
+		out_file_sync(self);
+	}
+	fclose(self->fh);
+	self->fh = NULL;
+	self->flush_deadline = 0;
+}
+
+// Finds the rotation period which contains the given timestamp.
+// Its boundaries are computed once, so that rotation checks do not
+// require any calendar computations.
+static void out_file_period_compute(out_file_ctx_t *self, time_t t, struct tm *tm) {
+	if(Config.utc == true) {
+		gmtime_r(&t, tm);
+	} else {
+		localtime_r(&t, tm);
+	}
+	struct tm start = *tm;
+	start.tm_sec = start.tm_min = 0;
+	if(self->rotate == ROT_DAILY) {
+		start.tm_hour = 0;
+	}
+	struct tm end = start;
+	if(self->rotate == ROT_HOURLY) {
+		end.tm_hour++;
+	} else {
+		end.tm_mday++;
+	}
+	start.tm_isdst = end.tm_isdst = -1;
+	if(Config.utc == true) {
+		self->period_start = timegm(&start);
+		self->period_end = timegm(&end);
+	} else {
+		self->period_start = mktime(&start);
+		self->period_end = mktime(&end);
+	}
+}
+
+static int32_t out_file_open(out_file_ctx_t *self, time_t t) {
 	char *filename = NULL;
 	char *fmt = NULL;
 	size_t tlen = 0;
+	char const *csuffix = compressor_file_suffix(self->compress);
 
 	if(self->rotate != ROT_NONE) {
-		time_t t = time(NULL);
-		if(Config.utc == true) {
-			gmtime_r(&t, &self->current_tm);
-		} else {
-			localtime_r(&t, &self->current_tm);
-		}
+		struct tm tm;
+		out_file_period_compute(self, t, &tm);
 		char suffix[16];
 		if(self->rotate == ROT_HOURLY) {
 			fmt = "_%Y%m%d_%H";
@@ -84,15 +262,16 @@ static int32_t out_file_open(out_file_ctx_t *self) {
 			fmt = "_%Y%m%d";
 		}
 		ASSERT(fmt != NULL);
-		tlen = strftime(suffix, sizeof(suffix), fmt, &self->current_tm);
+		tlen = strftime(suffix, sizeof(suffix), fmt, &tm);
 		if(tlen == 0) {
 			fprintf(stderr, "open_outfile(): strfime returned 0\n");
 			return -1;
 		}
-		filename = XCALLOC(self->prefix_len + tlen + 2, sizeof(uint8_t));
-		sprintf(filename, "%s%s%s", self->filename_prefix, suffix, self->extension);
+		filename = XCALLOC(self->prefix_len + tlen + strlen(csuffix) + 2, sizeof(uint8_t));
+		sprintf(filename, "%s%s%s%s", self->filename_prefix, suffix, self->extension, csuffix);
 	} else {
-		filename = strdup(self->filename_prefix);
+		filename = XCALLOC(self->prefix_len + strlen(csuffix) + 1, sizeof(uint8_t));
+		sprintf(filename, "%s%s", self->filename_prefix, csuffix);
 	}
 
 	if((self->fh = fopen(filename, "a+")) == NULL) {
@@ -100,6 +279,17 @@ static int32_t out_file_open(out_file_ctx_t *self) {
 		XFREE(filename);
 		return -1;
 	}
+	if(self->buffer_size > 0) {
+		setvbuf(self->fh, (char *)self->buffer, _IOFBF, self->buffer_size);
+	}
+	if(self->compress != COMPRESSOR_NONE &&
+			(self->compressor = compressor_create(self->compress, self->compress_level, self->fh)) == NULL) {
+		fprintf(stderr, "Could not initialize compression for output file %s\n", filename);
+		fclose(self->fh);
+		self->fh = NULL;
+		XFREE(filename);
+		return -1;
+	}
 	XFREE(filename);
 	return 0;
 }
@@ -110,6 +300,13 @@ static int32_t out_file_init(void *selfptr) {
 	if(!strcmp(self->filename_prefix, "-")) {
 		self->fh = stdout;
 		self->rotate = ROT_NONE;
+		if(self->buffer_size > 0) {
+			setvbuf(self->fh, (char *)self->buffer, _IOFBF, self->buffer_size);
+		}
+		if(self->compress != COMPRESSOR_NONE &&
+				(self->compressor = compressor_create(self->compress, self->compress_level, self->fh)) == NULL) {
+			return -1;
+		}
 	} else {
 		self->prefix_len = strlen(self->filename_prefix);
 		if(self->rotate != ROT_NONE) {
@@ -130,48 +327,69 @@ static int32_t out_file_init(void *selfptr) {
 				self->extension = strdup("");
 			}
 		}
-		return out_file_open(self);
+		// No message has arrived yet, so use the current time to pick the initial file.
+		// This also verifies early that the file can be created.
+		return out_file_open(self, time(NULL));
 	}
 	return 0;
 }
 
-static int32_t out_file_rotate(out_file_ctx_t *self) {
-	// FIXME: rotation should be driven by message timestamp, not the current timestamp
-	struct tm new_tm;
-	time_t t = time(NULL);
-	if(Config.utc == true) {
-		gmtime_r(&t, &new_tm);
-	} else {
-		localtime_r(&t, &new_tm);
+// Switches to another file if the message timestamp falls outside of the
+// period covered by the current file. Messages arriving slightly out of
+// order around the boundary go to the file where they belong.
+static int32_t out_file_rotate(out_file_ctx_t *self, struct metadata const *metadata) {
+	time_t t = metadata != NULL ? metadata->rx_timestamp.tv_sec : time(NULL);
+	if(self->fh != NULL && t >= self->period_start && t < self->period_end) {
+		return 0;
 	}
-	if((self->rotate == ROT_HOURLY && new_tm.tm_hour != self->current_tm.tm_hour) ||
-			(self->rotate == ROT_DAILY && new_tm.tm_mday != self->current_tm.tm_mday)) {
-		if(self->fh != NULL) {
-			fclose(self->fh);
-			self->fh = NULL;
-		}
-		return out_file_open(self);
-	}
-	return 0;
+	out_file_close(self);
+	return out_file_open(self, t);
 }
 
-static void out_file_produce_text(out_file_ctx_t *self, struct metadata *metadata, struct octet_string *msg) {
-	ASSERT(msg != NULL);
-	ASSERT(self->fh != NULL);
-	UNUSED(metadata);
-	fwrite(msg->buf, sizeof(uint8_t), msg->len, self->fh);
-	fflush(self->fh);
+// Writes all messages. Without buffering, the file is flushed once per batch.
+// In buffered mode, data is written out when the buffer fills up or when
+// flush_interval has elapsed since the oldest unflushed message was written,
+// whichever comes first. Compressed files are always flushed on flush_interval,
+// as each flush makes the compressed stream slightly larger.
+static int32_t out_file_produce_batch(void *selfptr, output_qentry_t * const *batch, int32_t cnt) {
+	ASSERT(selfptr != NULL);
+	out_file_ctx_t *self = selfptr;
+	int64_t cpu_time_start = self->compress != COMPRESSOR_NONE ? out_file_cpu_time_us() : 0;
+	for(int32_t i = 0; i < cnt; i++) {
+		if(self->rotate != ROT_NONE && out_file_rotate(self, batch[i]->metadata) < 0) {
+			return i;
+		}
+		ASSERT(self->fh != NULL);
+		struct octet_string const *msg = batch[i]->msg;
+		ASSERT(msg != NULL);
+		if(self->compressor != NULL) {
+			compressor_write(self->compressor, msg->buf, msg->len);
+		} else {
+			fwrite(msg->buf, sizeof(uint8_t), msg->len, self->fh);
+		}
+	}
+	if(self->compressor != NULL) {
+		self->compress_cpu_time += out_file_cpu_time_us() - cpu_time_start;
+	}
+	if(self->buffer_size == 0 && self->compressor == NULL) {
+		out_file_flush(self);
+	} else if(self->flush_deadline == 0 && cnt > 0) {
+		self->flush_deadline = out_file_clock_ms() + self->flush_interval;
+	}
+	return cnt;
 }
 
-static int32_t out_file_produce(void *selfptr, output_format_t format, struct metadata *metadata, struct octet_string *msg) {
+static int32_t out_file_flush_if_due(void *selfptr) {
 	ASSERT(selfptr != NULL);
 	out_file_ctx_t *self = selfptr;
-	if(self->rotate != ROT_NONE && out_file_rotate(self) < 0) {
-		return -1;
+	if(self->flush_deadline == 0 || self->fh == NULL) {
+		return 0;
 	}
-	if(format == OFMT_TEXT || format == OFMT_JSON || format == OFMT_BASESTATION) {
-		out_file_produce_text(self, metadata, msg);
+	int64_t remaining = self->flush_deadline - out_file_clock_ms();
+	if(remaining > 0) {
+		return (int32_t)remaining;
 	}
+	out_file_flush(self);
 	return 0;
 }
 
@@ -179,10 +397,7 @@ static void out_file_handle_shutdown(void *selfptr) {
 	ASSERT(selfptr != NULL);
 	out_file_ctx_t *self = selfptr;
 	fprintf(stderr, "output_file(%s): shutting down\n", self->filename_prefix);
-	if(self->fh != NULL) {
-		fclose(self->fh);
-		self->fh = NULL;
-	}
+	out_file_close(self);
 }
 
 static void out_file_handle_failure(void *selfptr) {
@@ -190,10 +405,7 @@ static void out_file_handle_failure(void *selfptr) {
 	out_file_ctx_t *self = selfptr;
 	fprintf(stderr, "output_file: could not write to '%s', deactivating output\n",
 			self->filename_prefix);
-	if(self->fh != NULL) {
-		fclose(self->fh);
-		self->fh = NULL;
-	}
+	out_file_close(self);
 }
 
 static option_descr_t const out_file_options[] = {
@@ -205,6 +417,26 @@ static option_descr_t const out_file_options[] = {
 		.name = "rotate",
 		.description = "How often to start a new file: Accepted values: daily, hourly"
 	},
+	{
+		.name = "buffer_size",
+		.description = "Size of the write buffer in bytes (default: no buffering, flush after each batch of messages)"
+	},
+	{
+		.name = "flush_interval",
+		.description = "Max time between flushes when buffer_size or compress is set, in ms (default: " STR(OUT_FILE_FLUSH_INTERVAL_DEFAULT) ")"
+	},
+	{
+		.name = "compress",
+		.description = "Compress the file on the fly. Accepted values: gzip, zstd (default: no compression)"
+	},
+	{
+		.name = "compress_level",
+		.description = "Compression level (gzip: 1-9, zstd: 1-19, default: library default)"
+	},
+	{
+		.name = "sync",
+		.description = "When to sync data to disk: none, flush (after each flush), close (before closing the file) (default: none)"
+	},
 	{
 		.name = NULL,
 		.description = NULL
@@ -219,7 +451,9 @@ output_descriptor_t out_DEF_file = {
 	.configure = out_file_configure,
 	.ctx_destroy = out_file_ctx_destroy,
 	.init = out_file_init,
-	.produce = out_file_produce,
+	.produce = NULL,
+	.produce_batch = out_file_produce_batch,
+	.flush = out_file_flush_if_due,
 	.handle_shutdown = out_file_handle_shutdown,
 	.handle_failure = out_file_handle_failure
 };
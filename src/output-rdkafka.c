@@ -1,11 +1,30 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
-#include <stdio.h>                      // fprintf
+#include <stdio.h>                      // fprintf, snprintf
+#include <stdlib.h>                     // strtol
+#include <inttypes.h>                   // PRIu64
 #include <string.h>                     // strdup, strerror
+#include <stdatomic.h>                  // _Atomic, atomic_*
+#include <pthread.h>                    // pthread_create
 #include <librdkafka/rdkafka.h>
-#include "output-common.h"              // output_descriptor_t, output_qentry_t, output_queue_drain
+#include "config.h"                     // WITH_STATSD
+#include "output-common.h"              // output_descriptor_t, output_qentry_t, output_qentry_*
+#include "filter.h"                     // struct msg_props, MSG_PROP_*
 #include "kvargs.h"                     // kvargs
 #include "options.h"                    // option_descr_t
-#include "util.h"                       // ASSERT, NEW
+#include "statsd.h"                     // statsd_increment
+#include "util.h"                       // ASSERT, NEW, stop_thread
+
+// How long the poll thread waits for events in a single rd_kafka_poll() call
+#define RDKAFKA_POLL_INTERVAL_MS 100
+// How long to wait for outstanding messages to be delivered on shutdown
+#define RDKAFKA_SHUTDOWN_FLUSH_TIMEOUT_MS 5000
+
+typedef enum {
+	RDKAFKA_KEY_NONE,
+	RDKAFKA_KEY_ICAO,
+	RDKAFKA_KEY_FREQ,
+	RDKAFKA_KEY_GS
+} out_rdkafka_key_t;
 
 typedef struct {
 	char *brokers;
@@ -18,13 +37,40 @@ typedef struct {
 	void *rk;
 	int kafka_metadata_timeout_ms;
 	char *ssl_ca_location;
+	char *linger_ms;
+	char *batch_num_messages;
+	char *batch_bytes;
+	out_rdkafka_key_t key;
+	bool spool;                         // output has a disk spool (spool_dir is set)
+	pthread_t poll_thread;
+	_Atomic bool poll_thread_stop;
+	bool poll_thread_running;
+	_Atomic uint64_t msgs_delivered;
+	_Atomic uint64_t msgs_failed;
+	bool queue_full;                    // last produce attempt failed due to producer queue full
+#ifdef WITH_STATSD
+	char delivered_metric[64];
+	char failed_metric[64];
+#endif
 } out_rdkafka_ctx_t;
 
 static bool out_rdkafka_supports_format(output_format_t format) {
-	return(format == OFMT_TEXT || format == OFMT_BASESTATION || format == OFMT_JSON);
+	return(format == OFMT_TEXT || format == OFMT_BASESTATION || format == OFMT_JSON ||
+			format == OFMT_CBOR || format == OFMT_FRAME);
+}
+
+// Checks if the value is a positive integer which can be passed to librdkafka as is
+static bool out_rdkafka_numeric_param_valid(char const *name, char const *val) {
+	char *endptr = NULL;
+	long v = strtol(val, &endptr, 10);
+	if(endptr == val || *endptr != '\0' || v < 0) {
+		fprintf(stderr, "output_rdkafka: %s: invalid value '%s' (must be a non-negative integer)\n", name, val);
+		return false;
+	}
+	return true;
 }
 
-static void *out_rdkafka_configure(kvargs *kv) {
+static void *out_rdkafka_configure(kvargs *kv, int32_t id) {
 	ASSERT(kv != NULL);
 	NEW(out_rdkafka_ctx_t, cfg);
 
@@ -70,6 +116,46 @@ static void *out_rdkafka_configure(kvargs *kv) {
 		cfg->kafka_metadata_timeout_ms = 10 * 1000;
 	}
 
+	char *val = NULL;
+	if((val = kvargs_get(kv, "key")) != NULL) {
+		if(!strcmp(val, "none")) {
+			cfg->key = RDKAFKA_KEY_NONE;
+		} else if(!strcmp(val, "icao")) {
+			cfg->key = RDKAFKA_KEY_ICAO;
+		} else if(!strcmp(val, "freq")) {
+			cfg->key = RDKAFKA_KEY_FREQ;
+		} else if(!strcmp(val, "gs")) {
+			cfg->key = RDKAFKA_KEY_GS;
+		} else {
+			fprintf(stderr, "output_rdkafka: key: invalid value '%s' (must be one of: none, icao, freq, gs)\n", val);
+			goto fail;
+		}
+	}
+	if((val = kvargs_get(kv, "linger_ms")) != NULL) {
+		if(!out_rdkafka_numeric_param_valid("linger_ms", val)) {
+			goto fail;
+		}
+		cfg->linger_ms = strdup(val);
+	}
+	if((val = kvargs_get(kv, "batch_num_messages")) != NULL) {
+		if(!out_rdkafka_numeric_param_valid("batch_num_messages", val)) {
+			goto fail;
+		}
+		cfg->batch_num_messages = strdup(val);
+	}
+	if((val = kvargs_get(kv, "batch_bytes")) != NULL) {
+		if(!out_rdkafka_numeric_param_valid("batch_bytes", val)) {
+			goto fail;
+		}
+		cfg->batch_bytes = strdup(val);
+	}
+	cfg->spool = kvargs_get(kv, "spool_dir") != NULL;
+#ifdef WITH_STATSD
+	snprintf(cfg->delivered_metric, sizeof(cfg->delivered_metric), "outputs.%d.kafka.delivered", id);
+	snprintf(cfg->failed_metric, sizeof(cfg->failed_metric), "outputs.%d.kafka.failed", id);
+#else
+	UNUSED(id);
+#endif
 	return cfg;
 fail:
 	XFREE(cfg);
@@ -88,7 +174,11 @@ static int rdkafka_conf_set(rd_kafka_conf_t *conf, char *key, char *val) {
 	return 0;
 }
 
-// Delivery report callback handler
+// Delivery report callback handler.
+// Called from the poll thread (or from the output thread, while it waits
+// for room in the producer queue). Message payloads are not copied by librdkafka,
+// so the queue entry holding the payload is released here, when librdkafka
+// is done with it.
 static void rdkafka_delivery_report_cb(rd_kafka_t *rk, const rd_kafka_message_t *rkmessage, void *opaque) {
 	UNUSED(rk);
 	out_rdkafka_ctx_t *self = opaque;
@@ -97,7 +187,13 @@ static void rdkafka_delivery_report_cb(rd_kafka_t *rk, const rd_kafka_message_t
 		fprintf(stderr, "output_rdkafka(%s): ERROR: message delivery failed: %s\n",
 			self->brokers,
 			rd_kafka_err2str(rkmessage->err));
+		atomic_fetch_add(&self->msgs_failed, 1);
+		statsd_increment(self->failed_metric);
+	} else {
+		atomic_fetch_add(&self->msgs_delivered, 1);
+		statsd_increment(self->delivered_metric);
 	}
+	output_qentry_unref(rkmessage->_private);
 }
 
 // Error callback handler
@@ -118,6 +214,15 @@ static void rdkafka_error_cb(rd_kafka_t *rk, int err, const char *reason, void *
 	}
 }
 
+static void *out_rdkafka_poll_thread(void *arg) {
+	ASSERT(arg != NULL);
+	out_rdkafka_ctx_t *self = arg;
+	while(!atomic_load(&self->poll_thread_stop)) {
+		rd_kafka_poll(self->rk, RDKAFKA_POLL_INTERVAL_MS);
+	}
+	return NULL;
+}
+
 static int out_rdkafka_init(void *selfptr) {
 	ASSERT(selfptr != NULL);
 	out_rdkafka_ctx_t *self = selfptr;
@@ -141,6 +246,23 @@ static int out_rdkafka_init(void *selfptr) {
 	if (rdkafka_conf_set(conf, "acks", self->acks) < 0) {
 		return -1;
 	}
+	if (self->linger_ms != NULL && rdkafka_conf_set(conf, "linger.ms", self->linger_ms) < 0) {
+		return -1;
+	}
+	if (self->batch_num_messages != NULL &&
+			rdkafka_conf_set(conf, "batch.num.messages", self->batch_num_messages) < 0) {
+		return -1;
+	}
+	if (self->batch_bytes != NULL && rdkafka_conf_set(conf, "batch.size", self->batch_bytes) < 0) {
+		return -1;
+	}
+	// By default librdkafka gives up on messages which could not be delivered
+	// within 5 minutes. With a spool, messages should rather wait for the
+	// broker to come back - the producer queue fills up and further messages
+	// go to the spool.
+	if (self->spool && rdkafka_conf_set(conf, "message.timeout.ms", "0") < 0) {
+		return -1;
+	}
 
 	// Optionally configure a custom SSL CA certificate to verify the servers certificate
 	// against. If this file path is wrong or inaccessible, librdkafka will return an error.
@@ -189,54 +311,131 @@ static int out_rdkafka_init(void *selfptr) {
 	}
 	rd_kafka_metadata_destroy(metadata);
 
+	// Delivery reports and errors are served by a separate thread, so that
+	// the output thread does not have to poll after every message.
+	int32_t ret = pthread_create(&self->poll_thread, NULL, out_rdkafka_poll_thread, self);
+	if(ret != 0) {
+		fprintf(stderr, "output_rdkafka(%s): could not start poll thread: %s\n",
+				self->brokers, strerror(ret));
+		rd_kafka_destroy(self->rk);
+		return -1;
+	}
+	self->poll_thread_running = true;
 	return 0;
 }
 
-static int out_rdkafka_produce_text(out_rdkafka_ctx_t *self, struct metadata *metadata, struct octet_string *msg) {
-	UNUSED(metadata);
-	ASSERT(msg != NULL);
+static uint32_t out_rdkafka_props_wanted(void *selfptr) {
+	ASSERT(selfptr != NULL);
+	out_rdkafka_ctx_t *self = selfptr;
+	switch(self->key) {
+		case RDKAFKA_KEY_ICAO:
+			return MSG_PROP_ICAO_ADDRESS;
+		case RDKAFKA_KEY_FREQ:
+			return MSG_PROP_FREQ;
+		case RDKAFKA_KEY_GS:
+			return MSG_PROP_GS_ID;
+		default:
+			return 0;
+	}
+}
 
-	long delivery_counter;
+// Formats the message key. Returns its length or 0 if the message does not
+// have the property used as a key (it's then produced without a key and
+// the partition is chosen by the partitioner).
+static size_t out_rdkafka_key_format(out_rdkafka_ctx_t *self, struct msg_props const *props,
+		char *buf, size_t len) {
+	if(props == NULL) {
+		return 0;
+	}
+	int ret = 0;
+	if(self->key == RDKAFKA_KEY_ICAO && (props->present & MSG_PROP_ICAO_ADDRESS)) {
+		ret = snprintf(buf, len, "%06X", props->icao_address);
+	} else if(self->key == RDKAFKA_KEY_FREQ && (props->present & MSG_PROP_FREQ)) {
+		ret = snprintf(buf, len, "%d", props->freq / 1000);
+	} else if(self->key == RDKAFKA_KEY_GS && (props->present & MSG_PROP_GS_ID)) {
+		ret = snprintf(buf, len, "%u", props->gs_id);
+	}
+	return ret > 0 ? (size_t)ret : 0;
+}
+
+// Produces a message without copying the payload. librdkafka gets a new
+// reference to the queue entry as the message opaque, which is dropped in the
+// delivery report callback.
+static int32_t out_rdkafka_produce_msg(out_rdkafka_ctx_t *self, output_qentry_t *q) {
+	struct octet_string const *msg = q->msg;
+	ASSERT(msg != NULL);
 
 	if(msg->len < 2) {
 		return 0;
 	}
 
+	char key[16];
+	size_t key_len = out_rdkafka_key_format(self, q->props, key, sizeof(key));
+	char const *keyptr = key_len > 0 ? key : NULL;      // the key is always copied by librdkafka
 	rd_kafka_resp_err_t err = rd_kafka_producev(
 		self->rk,
 		RD_KAFKA_V_TOPIC(self->topic),
-		RD_KAFKA_V_KEY(NULL, 0),
+		RD_KAFKA_V_KEY(keyptr, key_len),
 		RD_KAFKA_V_VALUE(msg->buf, msg->len),
-		RD_KAFKA_V_MSGFLAGS(RD_KAFKA_MSG_F_COPY),
-		RD_KAFKA_V_OPAQUE(&delivery_counter),
+		RD_KAFKA_V_MSGFLAGS(0),
+		RD_KAFKA_V_OPAQUE(output_qentry_ref(q)),
 		RD_KAFKA_V_END);
+	self->queue_full = err == RD_KAFKA_RESP_ERR__QUEUE_FULL;
 	if (err != RD_KAFKA_RESP_ERR_NO_ERROR) {
-		fprintf(stderr, "output_rdkafka(%s): Produce message failed: %s\n", self->brokers, rd_kafka_err2str(err));
+		output_qentry_unref(q);
+		// Producer queue full - the message will be retried when some
+		// delivery reports have been served (see out_rdkafka_wait_ready)
+		if(!self->queue_full) {
+			fprintf(stderr, "output_rdkafka(%s): Produce message failed: %s\n", self->brokers, rd_kafka_err2str(err));
+		}
 		return -1;
 	}
-
-	/* Poll for delivery report callbacks to know the final
-	 * delivery status of previously produced messages. */
-	rd_kafka_poll(self->rk, 0);
-
 	return 0;
 }
 
-static int out_rdkafka_produce(void *selfptr, output_format_t format, struct metadata *metadata, struct octet_string *msg) {
+static int32_t out_rdkafka_produce_batch(void *selfptr, output_qentry_t * const *batch, int32_t cnt) {
 	ASSERT(selfptr != NULL);
 	out_rdkafka_ctx_t *self = selfptr;
-	if(format == OFMT_TEXT || format == OFMT_JSON || format == OFMT_BASESTATION) {
-		if (out_rdkafka_produce_text(self, metadata, msg) < 0) {
-			return -1;
+	for(int32_t i = 0; i < cnt; i++) {
+		if(out_rdkafka_produce_msg(self, batch[i]) < 0) {
+			return i;
 		}
 	}
-	return 0;
+	return cnt;
+}
+
+// Producer queue full is backpressure, not a failure. Serve delivery reports
+// (which frees up room in the queue) and let the output thread retry
+// straight away. Other produce errors are reported as failures.
+static bool out_rdkafka_wait_ready(void *selfptr, int32_t timeout_ms) {
+	ASSERT(selfptr != NULL);
+	out_rdkafka_ctx_t *self = selfptr;
+	if(!self->queue_full) {
+		return false;
+	}
+	rd_kafka_poll(self->rk, timeout_ms);
+	return true;
 }
 
 static void out_rdkafka_handle_shutdown(void *selfptr) {
 	ASSERT(selfptr != NULL);
 	out_rdkafka_ctx_t *self = selfptr;
 	fprintf(stderr, "output_rdkafka(%s): shutting down\n", self->brokers);
+	if(self->poll_thread_running) {
+		atomic_store(&self->poll_thread_stop, true);
+		stop_thread(self->poll_thread);
+		self->poll_thread_running = false;
+	}
+	// Serves remaining delivery reports
+	if(rd_kafka_flush(self->rk, RDKAFKA_SHUTDOWN_FLUSH_TIMEOUT_MS) != RD_KAFKA_RESP_ERR_NO_ERROR) {
+		fprintf(stderr, "output_rdkafka(%s): %d message(s) not delivered before shutdown\n",
+				self->brokers, rd_kafka_outq_len(self->rk));
+		// Purged messages get delivery reports too, which release the queue entries
+		rd_kafka_purge(self->rk, RD_KAFKA_PURGE_F_QUEUE | RD_KAFKA_PURGE_F_INFLIGHT);
+		rd_kafka_flush(self->rk, RDKAFKA_SHUTDOWN_FLUSH_TIMEOUT_MS);
+	}
+	fprintf(stderr, "output_rdkafka(%s): %" PRIu64 " message(s) delivered, %" PRIu64 " failed\n",
+			self->brokers, atomic_load(&self->msgs_delivered), atomic_load(&self->msgs_failed));
 	rd_kafka_destroy(self->rk);
 }
 
@@ -283,6 +482,22 @@ static const option_descr_t out_rdkafka_options[] = {
 		.name= "kafka_connect_timeout_secs",
 		.description = "Seconds to wait for metadata query on connect - Default: 10 (seconds)"
 	},
+	{
+		.name= "key",
+		.description = "Message key (determines the partition) - Accepted values: none, icao, freq, gs - Default: none"
+	},
+	{
+		.name= "linger_ms",
+		.description = "Time to wait for more messages before sending a batch to the broker (librdkafka linger.ms)"
+	},
+	{
+		.name= "batch_num_messages",
+		.description = "Max number of messages in a batch sent to the broker (librdkafka batch.num.messages)"
+	},
+	{
+		.name= "batch_bytes",
+		.description = "Max size of a batch sent to the broker in bytes (librdkafka batch.size)"
+	},
 	{
 		.name = NULL,
 		.description = NULL
@@ -296,7 +511,10 @@ output_descriptor_t out_DEF_rdkafka = {
 	.supports_format = out_rdkafka_supports_format,
 	.configure = out_rdkafka_configure,
 	.init = out_rdkafka_init,
-	.produce = out_rdkafka_produce,
+	.produce = NULL,
+	.produce_batch = out_rdkafka_produce_batch,
+	.props_wanted = out_rdkafka_props_wanted,
+	.wait_ready = out_rdkafka_wait_ready,
 	.handle_shutdown = out_rdkafka_handle_shutdown,
 	.handle_failure = out_rdkafka_handle_failure
 };
@@ -0,0 +1,288 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdio.h>                      // fprintf
+#include <stdlib.h>                     // strtol
+#include <string.h>                     // memcpy, strchr, strcmp, strdup, strerror
+#include <inttypes.h>                   // PRIu64
+#include <stdatomic.h>                  // atomic_*
+#include <errno.h>                      // errno
+#include <fcntl.h>                      // O_*
+#include <unistd.h>                     // ftruncate, close
+#include <sys/mman.h>                   // shm_open, shm_unlink, mmap, munmap
+#include "output-common.h"              // output_descriptor_t, output_qentry_t
+#include "kvargs.h"                     // kvargs, option_descr_t
+#include "metadata.h"                   // struct metadata
+#include "shm-msg.h"                    // struct shm_msg_header, struct shm_msg_record, SHM_MSG_*
+#include "util.h"                       // ASSERT, NEW, XFREE, STR
+
+#define SHM_RING_SIZE_DEFAULT 4194304
+#define SHM_RING_SIZE_MIN 65536
+#define SHM_RING_SIZE_MAX 1073741824
+// Longer messages are skipped, so that a reader always has a chance
+// to copy a message before it gets overwritten.
+#define SHM_MSG_LEN_MAX(data_len) ((data_len) / 4)
+
+typedef struct {
+	char *name;
+	uint64_t data_len;                  // length of the data area (multiple of SHM_MSG_ALIGN)
+	bool keep;                          // don't remove the segment on shutdown
+	int fd;
+	size_t map_len;
+	struct shm_msg_header *hdr;         // NULL if not mapped
+	uint8_t *data;
+	uint64_t write_pos;                 // private copies of the header counters
+	uint64_t tail_pos;
+	uint64_t msg_cnt;
+	uint64_t skipped_cnt;               // messages too long for the ring
+} out_shm_ctx_t;
+
+static bool out_shm_supports_format(output_format_t format) {
+	return(format == OFMT_TEXT || format == OFMT_BASESTATION || format == OFMT_JSON ||
+			format == OFMT_CBOR || format == OFMT_FRAME);
+}
+
+static void *out_shm_configure(kvargs *kv, int32_t id) {
+	ASSERT(kv != NULL);
+	UNUSED(id);
+	NEW(out_shm_ctx_t, cfg);
+	cfg->fd = -1;
+	char *val = NULL;
+	if((val = kvargs_get(kv, "name")) == NULL) {
+		fprintf(stderr, "output_shm: shared memory segment name not specified\n");
+		goto fail;
+	}
+	if(val[0] != '/' || strchr(val + 1, '/') != NULL) {
+		fprintf(stderr, "output_shm: name: invalid value '%s' (must start with a slash and "
+				"contain no other slashes)\n", val);
+		goto fail;
+	}
+	cfg->name = strdup(val);
+	long size = SHM_RING_SIZE_DEFAULT;
+	if((val = kvargs_get(kv, "size")) != NULL) {
+		char *endptr = NULL;
+		size = strtol(val, &endptr, 10);
+		if(endptr == val || *endptr != '\0' || size < SHM_RING_SIZE_MIN || size > SHM_RING_SIZE_MAX) {
+			fprintf(stderr, "output_shm: size: invalid value '%s' (must be in range %d-%d)\n",
+					val, SHM_RING_SIZE_MIN, SHM_RING_SIZE_MAX);
+			goto fail;
+		}
+	}
+	cfg->data_len = (uint64_t)size & ~(uint64_t)(SHM_MSG_ALIGN - 1);
+	if((val = kvargs_get(kv, "keep")) != NULL) {
+		if(strcmp(val, "true") == 0 || strcmp(val, "1") == 0) {
+			cfg->keep = true;
+		} else if(strcmp(val, "false") == 0 || strcmp(val, "0") == 0) {
+			cfg->keep = false;
+		} else {
+			fprintf(stderr, "output_shm: keep: invalid value '%s' (must be true or false)\n", val);
+			goto fail;
+		}
+	}
+	return cfg;
+fail:
+	XFREE(cfg->name);
+	XFREE(cfg);
+	return NULL;
+}
+
+static void out_shm_ctx_destroy(void *ctxptr) {
+	if(ctxptr != NULL) {
+		out_shm_ctx_t *ctx = ctxptr;
+		XFREE(ctx->name);
+		XFREE(ctx);
+	}
+}
+
+static int32_t out_shm_init(void *selfptr) {
+	ASSERT(selfptr != NULL);
+	out_shm_ctx_t *self = selfptr;
+
+	// Always start with a fresh segment. Readers attached to the segment
+	// left by a previous instance keep their mapping, see it finished
+	// and may then reattach to the new one.
+	shm_unlink(self->name);
+	self->fd = shm_open(self->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if(self->fd < 0) {
+		fprintf(stderr, "output_shm(%s): could not create shared memory segment: %s\n",
+				self->name, strerror(errno));
+		return -1;
+	}
+	self->map_len = SHM_MSG_HEADER_LEN + self->data_len;
+	if(ftruncate(self->fd, self->map_len) < 0) {
+		fprintf(stderr, "output_shm(%s): ftruncate failed: %s\n", self->name, strerror(errno));
+		goto fail;
+	}
+	void *map = mmap(NULL, self->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
+	if(map == MAP_FAILED) {
+		fprintf(stderr, "output_shm(%s): mmap failed: %s\n", self->name, strerror(errno));
+		goto fail;
+	}
+	self->hdr = map;
+	self->data = (uint8_t *)map + SHM_MSG_HEADER_LEN;
+	struct shm_msg_header *hdr = self->hdr;
+	atomic_store_explicit(&hdr->state, SHM_MSG_STATE_INIT, memory_order_release);
+	hdr->magic = SHM_MSG_MAGIC;
+	hdr->version = SHM_MSG_VERSION;
+	hdr->header_len = SHM_MSG_HEADER_LEN;
+	hdr->reserved = 0;
+	hdr->data_len = self->data_len;
+	atomic_store_explicit(&hdr->write_pos, 0, memory_order_relaxed);
+	atomic_store_explicit(&hdr->tail_pos, 0, memory_order_relaxed);
+	atomic_store_explicit(&hdr->msg_cnt, 0, memory_order_relaxed);
+	atomic_store_explicit(&hdr->state, SHM_MSG_STATE_RUNNING, memory_order_release);
+	fprintf(stderr, "output_shm(%s): ring created, %" PRIu64 " bytes long\n", self->name, self->data_len);
+	return 0;
+fail:
+	close(self->fd);
+	self->fd = -1;
+	shm_unlink(self->name);
+	return -1;
+}
+
+// Returns the length of the record at the given position, including
+// the space skipped implicitly at the end of the data area.
+static uint64_t out_shm_record_len_at(out_shm_ctx_t const *self, uint64_t pos) {
+	uint64_t off = pos % self->data_len;
+	if(self->data_len - off < sizeof(struct shm_msg_record)) {
+		return self->data_len - off;
+	}
+	struct shm_msg_record const *rec = (struct shm_msg_record const *)(self->data + off);
+	return SHM_MSG_RECORD_LEN(rec->len);
+}
+
+// Makes room for writing up to the given position by moving the tail
+// past the oldest records. The new tail is made visible to readers
+// before any of its preceding records gets overwritten.
+static void out_shm_reserve(out_shm_ctx_t *self, uint64_t end_pos) {
+	if(self->tail_pos + self->data_len >= end_pos) {
+		return;
+	}
+	do {
+		self->tail_pos += out_shm_record_len_at(self, self->tail_pos);
+	} while(self->tail_pos + self->data_len < end_pos);
+	atomic_store_explicit(&self->hdr->tail_pos, self->tail_pos, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+static void out_shm_write_record(out_shm_ctx_t *self, uint32_t type, uint64_t seq,
+		int64_t timestamp, uint8_t const *buf, uint32_t len) {
+	struct shm_msg_record *rec = (struct shm_msg_record *)(self->data + self->write_pos % self->data_len);
+	rec->len = len;
+	rec->type = type;
+	rec->seq = seq;
+	rec->timestamp = timestamp;
+	if(len > 0 && buf != NULL) {
+		memcpy(rec + 1, buf, len);
+	}
+}
+
+// Copies the whole batch into the ring and publishes it with a single
+// update of the write position. Nothing here blocks nor makes system calls.
+// Readers which fall behind lose the oldest messages - the writer never
+// waits for them.
+static int32_t out_shm_produce_batch(void *selfptr, output_qentry_t * const *batch, int32_t cnt) {
+	ASSERT(selfptr != NULL);
+	out_shm_ctx_t *self = selfptr;
+	ASSERT(self->hdr != NULL);
+
+	uint64_t const hdrlen = sizeof(struct shm_msg_record);
+	for(int32_t i = 0; i < cnt; i++) {
+		struct octet_string const *msg = batch[i]->msg;
+		ASSERT(msg != NULL);
+		if(msg->len < 2) {
+			continue;
+		}
+		if(msg->len > SHM_MSG_LEN_MAX(self->data_len)) {
+			self->skipped_cnt++;
+			continue;
+		}
+		uint64_t const rec_len = SHM_MSG_RECORD_LEN(msg->len);
+		uint64_t off = self->write_pos % self->data_len;
+		uint64_t pad_len = off + rec_len > self->data_len ? self->data_len - off : 0;
+		out_shm_reserve(self, self->write_pos + pad_len + rec_len);
+		if(pad_len > 0) {
+			if(pad_len >= hdrlen) {
+				out_shm_write_record(self, SHM_MSG_REC_PAD, 0, 0, NULL, pad_len - hdrlen);
+			}
+			self->write_pos += pad_len;
+		}
+		int64_t timestamp = 0;
+		if(batch[i]->metadata != NULL) {
+			struct timeval const *tv = &batch[i]->metadata->rx_timestamp;
+			timestamp = (int64_t)tv->tv_sec * 1000000LL + tv->tv_usec;
+		}
+		out_shm_write_record(self, SHM_MSG_REC_DATA, self->msg_cnt, timestamp, msg->buf, msg->len);
+		self->write_pos += rec_len;
+		self->msg_cnt++;
+	}
+	atomic_store_explicit(&self->hdr->msg_cnt, self->msg_cnt, memory_order_relaxed);
+	atomic_store_explicit(&self->hdr->write_pos, self->write_pos, memory_order_release);
+	return cnt;
+}
+
+static void out_shm_close(out_shm_ctx_t *self) {
+	if(self->hdr != NULL) {
+		atomic_store_explicit(&self->hdr->state, SHM_MSG_STATE_FINISHED, memory_order_release);
+		munmap(self->hdr, self->map_len);
+		self->hdr = NULL;
+	}
+	if(self->fd >= 0) {
+		close(self->fd);
+		self->fd = -1;
+		// Readers which are still attached keep their mappings
+		// and may drain the remaining messages.
+		if(!self->keep) {
+			shm_unlink(self->name);
+		}
+	}
+}
+
+static void out_shm_handle_shutdown(void *selfptr) {
+	ASSERT(selfptr != NULL);
+	out_shm_ctx_t *self = selfptr;
+	fprintf(stderr, "output_shm(%s): shutting down, %" PRIu64 " messages written", self->name, self->msg_cnt);
+	if(self->skipped_cnt > 0) {
+		fprintf(stderr, ", %" PRIu64 " skipped (too long)", self->skipped_cnt);
+	}
+	fprintf(stderr, "\n");
+	out_shm_close(self);
+}
+
+static void out_shm_handle_failure(void *selfptr) {
+	ASSERT(selfptr != NULL);
+	out_shm_ctx_t *self = selfptr;
+	fprintf(stderr, "output_shm(%s): could not initialize, deactivating output\n", self->name);
+	out_shm_close(self);
+}
+
+static const option_descr_t out_shm_options[] = {
+	{
+		.name = "name",
+		.description = "Name of the shared memory segment, eg. /hfdl_msgs (required)"
+	},
+	{
+		.name = "size",
+		.description = "Length of the message ring in bytes (default: " STR(SHM_RING_SIZE_DEFAULT) ")"
+	},
+	{
+		.name = "keep",
+		.description = "Do not remove the segment on exit (true or false, default: false)"
+	},
+	{
+		.name = NULL,
+		.description = NULL
+	}
+};
+
+output_descriptor_t out_DEF_shm = {
+	.name = "shm",
+	.description = "Output to a POSIX shared memory ring for local readers",
+	.options = out_shm_options,
+	.supports_format = out_shm_supports_format,
+	.configure = out_shm_configure,
+	.ctx_destroy = out_shm_ctx_destroy,
+	.init = out_shm_init,
+	.produce = NULL,
+	.produce_batch = out_shm_produce_batch,
+	.handle_shutdown = out_shm_handle_shutdown,
+	.handle_failure = out_shm_handle_failure
+};
@@ -0,0 +1,6 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+
+#include "output-common.h"          // output_descriptor_t
+
+extern output_descriptor_t out_DEF_shm;
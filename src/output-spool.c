@@ -0,0 +1,580 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>                      // FILE, fopen, fread, fwrite, fseeko, fileno, fprintf
+#include <stdlib.h>                     // free
+#include <string.h>                     // strcmp, strdup, strerror, strlen, strspn
+#include <inttypes.h>                   // PRIu64, PRIx64, SCNx64
+#include <errno.h>                      // errno
+#include <limits.h>                     // PATH_MAX
+#include <pthread.h>                    // pthread_mutex_*
+#include <dirent.h>                     // opendir, readdir
+#include <fcntl.h>                      // open, O_*
+#include <unistd.h>                     // unlink, close
+#include <sys/file.h>                   // flock
+#include <sys/stat.h>                   // mkdir, fstat
+#include <sys/types.h>                  // off_t
+#include <glib.h>                       // GQueue, GAsyncQueue, g_get_monotonic_time
+#include "config.h"                     // WITH_STATSD
+#include "output-common.h"              // output_qentry_t, OUTPUT_BATCH_SIZE_MAX
+#include "metadata.h"                   // struct metadata, struct metadata_vtable
+#include "filter.h"                     // struct msg_props
+#include "statsd.h"                     // statsd_set
+#include "util.h"                       // ASSERT, NEW, XCALLOC, XFREE, octet_string_new
+#include "output-spool.h"
+
+// Append-only queue of output messages, stored in a directory as a sequence
+// of segment files. The RAM queue of the output is used as long as the
+// output keeps up. When the number of messages waiting in the RAM queue
+// reaches the high water mark, new messages are appended to the spool
+// instead, and they keep going there until the spool has been drained
+// completely, so that the original order of messages is preserved.
+// The output thread drains the spool only when the RAM queue is empty.
+// Messages are read from the spool without removing them first and are
+// removed only after a successful delivery, so a message which could not
+// be delivered stays in the spool. Segment files are deleted when all
+// messages stored in them have been delivered. Segments left over by a
+// previous run are recovered on startup and delivered first. Read offsets
+// are kept in memory only, so after a restart the messages from the first
+// segment which had already been delivered are delivered again.
+
+#define SPOOL_SEGMENT_SIZE (16 * 1024 * 1024)
+#define SPOOL_RECORD_MAGIC 0x4c4f5053u  // "SPOL" in little endian
+#define SPOOL_MSG_LEN_MAX (16 * 1024 * 1024)
+#define SPOOL_PROPS_LEN_MAX 4096
+// The spool is reported as full when there is less free space than this,
+// so that producers are throttled before messages start to get dropped
+#define SPOOL_FULL_MARGIN 65536
+#define SPOOL_REPORT_INTERVAL 10000     // ms
+#define SPOOL_SEGMENT_SUFFIX ".spool"
+#define SPOOL_LOCK_FILE "lock"
+
+// Written in front of each message
+struct spool_record {
+	uint32_t magic;
+	uint32_t len;                       // message length
+	uint32_t format;                    // output_format_t
+	uint32_t props_len;                 // length of struct msg_props following the header (0 - none)
+	int64_t rx_sec;                     // message reception time
+	int64_t rx_usec;
+};
+
+struct spool_segment {
+	uint64_t seq;                       // number of the segment file
+	uint64_t msg_cnt;                   // messages stored in the segment and not delivered yet
+	uint64_t bytes;                     // length of these messages
+};
+
+struct output_spool {
+	char *dir;
+	int32_t id;                         // output ID
+	int32_t hwm;                        // RAM queue length above which messages are spooled
+	uint64_t max_size;                  // bytes
+	int lock_fd;
+	pthread_mutex_t mutex;
+	// Protected by the mutex
+	GQueue *segments;                   // struct spool_segment, oldest first
+	FILE *wfh;                          // last segment, open for writing
+	uint64_t wseg_len;
+	uint64_t msg_cnt;                   // messages in all segments
+	uint64_t bytes;
+	uint64_t dropped_cnt;               // messages dropped because the spool was full or due to errors
+	bool write_failed;
+	// Used by the output thread only
+	FILE *rfh;                          // first segment, open for reading
+	off_t roff;                         // read offset of the first undelivered message
+	off_t peek_end[OUTPUT_BATCH_SIZE_MAX];  // offsets past the messages returned by the last peek
+	int32_t peek_cnt;
+	uint64_t drained_cnt;               // messages delivered from the spool
+	uint64_t drained_cnt_reported;      // value of drained_cnt at the last report
+	gint64 spooling_start;              // when the spool last became non-empty
+	gint64 last_report;
+};
+
+/******************************
+ * Forward declarations
+ ******************************/
+
+static void spool_segment_path(struct output_spool const *s, uint64_t seq, char *buf, size_t len);
+static int32_t spool_recover(struct output_spool *s);
+static int32_t spool_segment_create(struct output_spool *s);
+static int32_t spool_append(struct output_spool *s, output_qentry_t const *qentry);
+static bool spool_record_header_read(FILE *fh, struct spool_record *rec);
+static output_qentry_t *spool_record_read(FILE *fh, struct spool_record const *rec);
+static void spool_segment_remove_first(struct output_spool *s);
+
+/******************************
+ * Public methods
+ ******************************/
+
+struct output_spool *output_spool_create(char const *dir, int32_t max_size_mb, int32_t hwm, int32_t id) {
+	ASSERT(dir != NULL);
+	ASSERT(max_size_mb > 0);
+	ASSERT(hwm > 0);
+	NEW(struct output_spool, s);
+	s->dir = strdup(dir);
+	s->id = id;
+	s->hwm = hwm;
+	s->max_size = (uint64_t)max_size_mb * 1024 * 1024;
+	s->lock_fd = -1;
+	s->segments = g_queue_new();
+	pthread_mutex_initialize(&s->mutex);
+
+	if(mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "output_spool(%s): could not create directory: %s\n", dir, strerror(errno));
+		goto fail;
+	}
+	// Two outputs writing to the same spool would corrupt each other's data
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", dir, SPOOL_LOCK_FILE);
+	if((s->lock_fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+		fprintf(stderr, "output_spool(%s): could not open lock file: %s\n", dir, strerror(errno));
+		goto fail;
+	}
+	if(flock(s->lock_fd, LOCK_EX | LOCK_NB) < 0) {
+		fprintf(stderr, "output_spool(%s): directory is in use by another output or program\n", dir);
+		goto fail;
+	}
+	if(spool_recover(s) < 0 || spool_segment_create(s) < 0) {
+		goto fail;
+	}
+	s->last_report = g_get_monotonic_time();
+	return s;
+fail:
+	output_spool_destroy(s);
+	return NULL;
+}
+
+// Puts the entry in the RAM queue q or, if the output does not keep up,
+// in the spool. Once the spool is in use, all entries go there until it's
+// empty, so that the output receives them in the original order.
+void output_spool_enqueue(struct output_spool *s, GAsyncQueue *q, output_qentry_t *qentry) {
+	ASSERT(s != NULL);
+	ASSERT(q != NULL);
+	ASSERT(qentry != NULL);
+	pthread_mutex_lock(&s->mutex);
+	if(s->msg_cnt > 0 || g_async_queue_length(q) >= s->hwm) {
+		if(s->msg_cnt == 0) {
+			s->spooling_start = g_get_monotonic_time();
+			fprintf(stderr, "output_spool(%s): output is not keeping up, spooling messages to disk\n", s->dir);
+		}
+		spool_append(s, qentry);
+	} else {
+		g_async_queue_push(q, output_qentry_ref(qentry));
+	}
+	pthread_mutex_unlock(&s->mutex);
+}
+
+bool output_spool_is_full(struct output_spool *s) {
+	ASSERT(s != NULL);
+	pthread_mutex_lock(&s->mutex);
+	bool result = s->bytes + SPOOL_FULL_MARGIN > s->max_size;
+	pthread_mutex_unlock(&s->mutex);
+	return result;
+}
+
+// Reads up to max oldest messages from the spool, without removing them.
+// Returns the number of messages read or 0 if the RAM queue q is not empty
+// (its messages are older and must be delivered first). The caller owns
+// the entries returned in batch and must call output_spool_commit() with
+// the number of messages which have been delivered before peeking again.
+int32_t output_spool_peek(struct output_spool *s, GAsyncQueue *q, output_qentry_t **batch, int32_t max) {
+	ASSERT(s != NULL);
+	ASSERT(q != NULL);
+	ASSERT(batch != NULL);
+	ASSERT(max <= OUTPUT_BATCH_SIZE_MAX);
+	s->peek_cnt = 0;
+	while(true) {
+		pthread_mutex_lock(&s->mutex);
+		// Checked with the mutex held, so that a message which has just been
+		// pushed to the RAM queue is not overtaken by a newer one from the spool
+		if(g_async_queue_length(q) > 0) {
+			pthread_mutex_unlock(&s->mutex);
+			return 0;
+		}
+		struct spool_segment *seg = g_queue_peek_head(s->segments);
+		bool const active = (seg == g_queue_peek_tail(s->segments));
+		// Make everything written so far readable
+		if(active && s->wfh != NULL && fflush(s->wfh) != 0 && !s->write_failed) {
+			fprintf(stderr, "output_spool(%s): write error: %s\n", s->dir, strerror(errno));
+			s->write_failed = true;
+		}
+		uint64_t const seq = seg->seq;
+		uint64_t const remaining = seg->msg_cnt;
+		pthread_mutex_unlock(&s->mutex);
+
+		if(remaining == 0) {
+			if(active) {
+				return 0;
+			}
+			spool_segment_remove_first(s);
+			continue;
+		}
+		if(s->rfh == NULL) {
+			char path[PATH_MAX];
+			spool_segment_path(s, seq, path, sizeof(path));
+			if((s->rfh = fopen(path, "rb")) == NULL) {
+				fprintf(stderr, "output_spool(%s): could not open %s: %s\n", s->dir, path, strerror(errno));
+				goto corrupted;
+			}
+			s->roff = 0;
+		}
+		if(ftello(s->rfh) != s->roff && fseeko(s->rfh, s->roff, SEEK_SET) < 0) {
+			goto corrupted;
+		}
+		int32_t cnt = 0;
+		struct spool_record rec;
+		while(cnt < max && (uint64_t)cnt < remaining) {
+			if(!spool_record_header_read(s->rfh, &rec) || (batch[cnt] = spool_record_read(s->rfh, &rec)) == NULL) {
+				break;
+			}
+			s->peek_end[cnt++] = ftello(s->rfh);
+		}
+		if(cnt == 0) {
+			goto corrupted;
+		}
+		s->peek_cnt = cnt;
+		return cnt;
+corrupted:
+		// Messages which can't be read back are lost. If this happens to the
+		// segment being written, start a new one, so that the writer does not
+		// append more messages after the damaged part.
+		fprintf(stderr, "output_spool(%s): segment %016" PRIx64 " is unreadable, %" PRIu64
+				" messages lost\n", s->dir, seq, remaining);
+		pthread_mutex_lock(&s->mutex);
+		s->dropped_cnt += remaining;
+		s->msg_cnt -= remaining;
+		s->bytes -= seg->bytes;
+		seg->msg_cnt = 0;
+		seg->bytes = 0;
+		if(active) {
+			spool_segment_create(s);
+		}
+		pthread_mutex_unlock(&s->mutex);
+	}
+}
+
+// Removes the first cnt messages returned by the last output_spool_peek()
+// call from the spool.
+void output_spool_commit(struct output_spool *s, int32_t cnt) {
+	ASSERT(s != NULL);
+	ASSERT(cnt <= s->peek_cnt);
+	if(cnt <= 0) {
+		return;
+	}
+	uint64_t const bytes = s->peek_end[cnt - 1] - s->roff;
+	s->roff = s->peek_end[cnt - 1];
+	s->peek_cnt = 0;
+	s->drained_cnt += cnt;
+	pthread_mutex_lock(&s->mutex);
+	struct spool_segment *seg = g_queue_peek_head(s->segments);
+	seg->msg_cnt -= cnt;
+	seg->bytes -= bytes;
+	s->msg_cnt -= cnt;
+	s->bytes -= bytes;
+	if(s->msg_cnt == 0) {
+		fprintf(stderr, "output_spool(%s): spool drained after %.1f seconds\n", s->dir,
+				(double)(g_get_monotonic_time() - s->spooling_start) / 1e6);
+		// Read offsets are not stored on disk, so delivered messages would be
+		// recovered again after a restart. Switch to a new segment, so that
+		// the drained one gets deleted.
+		if(seg == g_queue_peek_tail(s->segments)) {
+			spool_segment_create(s);
+		}
+	}
+	pthread_mutex_unlock(&s->mutex);
+}
+
+// Reports spool metrics if they are due. Returns the number of ms
+// until the next report.
+int32_t output_spool_report(struct output_spool *s) {
+	ASSERT(s != NULL);
+	gint64 const now = g_get_monotonic_time();
+	gint64 const elapsed = now - s->last_report;
+	if(elapsed < SPOOL_REPORT_INTERVAL * 1000) {
+		return SPOOL_REPORT_INTERVAL - elapsed / 1000;
+	}
+#ifdef WITH_STATSD
+	pthread_mutex_lock(&s->mutex);
+	uint64_t const msg_cnt = s->msg_cnt, bytes = s->bytes, dropped_cnt = s->dropped_cnt;
+	pthread_mutex_unlock(&s->mutex);
+	char metric[64];
+	snprintf(metric, sizeof(metric), "outputs.%d.spool.messages", s->id);
+	statsd_set(metric, msg_cnt);
+	snprintf(metric, sizeof(metric), "outputs.%d.spool.bytes", s->id);
+	statsd_set(metric, bytes);
+	snprintf(metric, sizeof(metric), "outputs.%d.spool.dropped", s->id);
+	statsd_set(metric, dropped_cnt);
+	snprintf(metric, sizeof(metric), "outputs.%d.spool.drain_rate", s->id);
+	statsd_set(metric, (s->drained_cnt - s->drained_cnt_reported) * 1000000 / (uint64_t)elapsed);
+#endif
+	s->drained_cnt_reported = s->drained_cnt;
+	s->last_report = now;
+	return SPOOL_REPORT_INTERVAL;
+}
+
+// Closes the spool. Messages which are still in there are kept on disk
+// and will be delivered after a restart.
+void output_spool_destroy(struct output_spool *s) {
+	if(s == NULL) {
+		return;
+	}
+	if(s->msg_cnt > 0) {
+		fprintf(stderr, "output_spool(%s): %" PRIu64 " messages (%" PRIu64 " bytes) left in the spool\n",
+				s->dir, s->msg_cnt, s->bytes);
+	}
+	if(s->dropped_cnt > 0) {
+		fprintf(stderr, "output_spool(%s): %" PRIu64 " messages dropped\n", s->dir, s->dropped_cnt);
+	}
+	if(s->rfh != NULL) {
+		fclose(s->rfh);
+	}
+	if(s->wfh != NULL) {
+		fclose(s->wfh);
+	}
+	// Don't leave drained segments behind
+	char path[PATH_MAX];
+	for(GList *l = s->segments->head; l != NULL; l = l->next) {
+		struct spool_segment *seg = l->data;
+		if(seg->msg_cnt == 0) {
+			spool_segment_path(s, seg->seq, path, sizeof(path));
+			unlink(path);
+		}
+	}
+	g_queue_free_full(s->segments, free);
+	if(s->lock_fd >= 0) {
+		close(s->lock_fd);
+	}
+	pthread_mutex_destroy(&s->mutex);
+	XFREE(s->dir);
+	XFREE(s);
+}
+
+/****************************************
+ * Private variables and methods
+ ****************************************/
+
+// Messages read back from the spool carry only the reception time,
+// which is the only part of the metadata used by outputs
+static struct metadata *spool_metadata_copy(struct metadata const *m) {
+	NEW(struct metadata, copy);
+	copy->vtable = m->vtable;
+	copy->rx_timestamp = m->rx_timestamp;
+	return copy;
+}
+
+static void spool_metadata_destroy(struct metadata *m) {
+	XFREE(m);
+}
+
+static struct metadata_vtable spool_metadata_vtable = {
+	.copy = spool_metadata_copy,
+	.destroy = spool_metadata_destroy
+};
+
+static void spool_segment_path(struct output_spool const *s, uint64_t seq, char *buf, size_t len) {
+	snprintf(buf, len, "%s/%016" PRIx64 SPOOL_SEGMENT_SUFFIX, s->dir, seq);
+}
+
+static bool spool_segment_name_parse(char const *name, uint64_t *seq) {
+	if(strlen(name) != 16 + strlen(SPOOL_SEGMENT_SUFFIX) || strspn(name, "0123456789abcdef") != 16 ||
+			strcmp(name + 16, SPOOL_SEGMENT_SUFFIX) != 0) {
+		return false;
+	}
+	return sscanf(name, "%16" SCNx64, seq) == 1;
+}
+
+static gint spool_segment_compare(gconstpointer a, gconstpointer b, gpointer data) {
+	UNUSED(data);
+	uint64_t const sa = ((struct spool_segment const *)a)->seq;
+	uint64_t const sb = ((struct spool_segment const *)b)->seq;
+	return sa < sb ? -1 : (sa > sb ? 1 : 0);
+}
+
+// Counts messages in segments left over by a previous run. Anything
+// following the first damaged record of a segment (eg. a message which
+// was being written when the program crashed) is ignored.
+static int32_t spool_recover(struct output_spool *s) {
+	DIR *d = opendir(s->dir);
+	if(d == NULL) {
+		fprintf(stderr, "output_spool(%s): could not open directory: %s\n", s->dir, strerror(errno));
+		return -1;
+	}
+	struct dirent *de;
+	uint64_t seq;
+	while((de = readdir(d)) != NULL) {
+		if(spool_segment_name_parse(de->d_name, &seq)) {
+			NEW(struct spool_segment, seg);
+			seg->seq = seq;
+			g_queue_insert_sorted(s->segments, seg, spool_segment_compare, NULL);
+		}
+	}
+	closedir(d);
+
+	char path[PATH_MAX];
+	for(GList *l = s->segments->head; l != NULL; ) {
+		GList *next = l->next;
+		struct spool_segment *seg = l->data;
+		spool_segment_path(s, seg->seq, path, sizeof(path));
+		FILE *fh = fopen(path, "rb");
+		struct stat st;
+		if(fh != NULL && fstat(fileno(fh), &st) == 0) {
+			struct spool_record rec;
+			while(spool_record_header_read(fh, &rec)) {
+				uint64_t const rec_len = sizeof(rec) + rec.props_len + rec.len;
+				if(seg->bytes + rec_len > (uint64_t)st.st_size ||
+						fseeko(fh, (off_t)rec.props_len + rec.len, SEEK_CUR) < 0) {
+					break;
+				}
+				seg->msg_cnt++;
+				seg->bytes += rec_len;
+			}
+		}
+		if(fh != NULL) {
+			fclose(fh);
+		}
+		if(seg->msg_cnt == 0) {
+			unlink(path);
+			g_queue_delete_link(s->segments, l);
+			XFREE(seg);
+		} else {
+			s->msg_cnt += seg->msg_cnt;
+			s->bytes += seg->bytes;
+		}
+		l = next;
+	}
+	if(s->msg_cnt > 0) {
+		s->spooling_start = g_get_monotonic_time();
+		fprintf(stderr, "output_spool(%s): %" PRIu64 " messages (%" PRIu64 " bytes) recovered\n",
+				s->dir, s->msg_cnt, s->bytes);
+	}
+	return 0;
+}
+
+// Starts a new segment for writing. Called with the mutex held
+// (or before the spool is shared with other threads).
+static int32_t spool_segment_create(struct output_spool *s) {
+	if(s->wfh != NULL) {
+		if(fclose(s->wfh) != 0 && !s->write_failed) {
+			fprintf(stderr, "output_spool(%s): write error: %s\n", s->dir, strerror(errno));
+			s->write_failed = true;
+		}
+		s->wfh = NULL;
+	}
+	struct spool_segment *last = g_queue_peek_tail(s->segments);
+	NEW(struct spool_segment, seg);
+	seg->seq = last != NULL ? last->seq + 1 : 0;
+	char path[PATH_MAX];
+	spool_segment_path(s, seg->seq, path, sizeof(path));
+	if((s->wfh = fopen(path, "wb")) == NULL) {
+		if(!s->write_failed) {
+			fprintf(stderr, "output_spool(%s): could not create %s: %s\n", s->dir, path, strerror(errno));
+			s->write_failed = true;
+		}
+		XFREE(seg);
+		return -1;
+	}
+	g_queue_push_tail(s->segments, seg);
+	s->wseg_len = 0;
+	return 0;
+}
+
+// Called with the mutex held
+static int32_t spool_append(struct output_spool *s, output_qentry_t const *qentry) {
+	ASSERT(qentry->msg != NULL);
+	struct octet_string const *msg = qentry->msg;
+	uint32_t const props_len = qentry->props != NULL ? sizeof(struct msg_props) : 0;
+	uint64_t const rec_len = sizeof(struct spool_record) + props_len + msg->len;
+	if(msg->len == 0 || msg->len > SPOOL_MSG_LEN_MAX || s->bytes + rec_len > s->max_size) {
+		goto drop;
+	}
+	if((s->wseg_len > 0 && s->wseg_len + rec_len > SPOOL_SEGMENT_SIZE) || s->wfh == NULL) {
+		if(spool_segment_create(s) < 0) {
+			goto drop;
+		}
+	}
+	struct timeval const *ts = qentry->metadata != NULL ? &qentry->metadata->rx_timestamp : NULL;
+	struct spool_record rec = {
+		.magic = SPOOL_RECORD_MAGIC,
+		.len = msg->len,
+		.format = qentry->format,
+		.props_len = props_len,
+		.rx_sec = ts != NULL ? ts->tv_sec : 0,
+		.rx_usec = ts != NULL ? ts->tv_usec : 0
+	};
+	if(fwrite(&rec, sizeof(rec), 1, s->wfh) != 1 ||
+			(props_len > 0 && fwrite(qentry->props, props_len, 1, s->wfh) != 1) ||
+			fwrite(msg->buf, msg->len, 1, s->wfh) != 1) {
+		if(!s->write_failed) {
+			fprintf(stderr, "output_spool(%s): write error: %s\n", s->dir, strerror(errno));
+			s->write_failed = true;
+		}
+		// The record might have been written partially. Don't append
+		// anything after it.
+		spool_segment_create(s);
+		goto drop;
+	}
+	struct spool_segment *seg = g_queue_peek_tail(s->segments);
+	seg->msg_cnt++;
+	seg->bytes += rec_len;
+	s->wseg_len += rec_len;
+	s->msg_cnt++;
+	s->bytes += rec_len;
+	s->write_failed = false;
+	return 0;
+drop:
+	s->dropped_cnt++;
+	return -1;
+}
+
+static bool spool_record_header_read(FILE *fh, struct spool_record *rec) {
+	return fread(rec, sizeof(*rec), 1, fh) == 1 && rec->magic == SPOOL_RECORD_MAGIC &&
+		rec->len > 0 && rec->len <= SPOOL_MSG_LEN_MAX && rec->props_len <= SPOOL_PROPS_LEN_MAX;
+}
+
+static output_qentry_t *spool_record_read(FILE *fh, struct spool_record const *rec) {
+	struct msg_props *props = NULL;
+	if(rec->props_len == sizeof(struct msg_props)) {
+		props = XCALLOC(1, sizeof(struct msg_props));
+		if(fread(props, sizeof(struct msg_props), 1, fh) != 1) {
+			goto fail;
+		}
+	} else if(rec->props_len > 0) {
+		// Written by a different build - properties are not usable
+		if(fseeko(fh, rec->props_len, SEEK_CUR) < 0) {
+			goto fail;
+		}
+	}
+	uint8_t *buf = XCALLOC(rec->len, sizeof(uint8_t));
+	if(fread(buf, rec->len, 1, fh) != 1) {
+		XFREE(buf);
+		goto fail;
+	}
+	NEW(struct metadata, m);
+	m->vtable = &spool_metadata_vtable;
+	m->rx_timestamp.tv_sec = rec->rx_sec;
+	m->rx_timestamp.tv_usec = rec->rx_usec;
+	atomic_init(&m->refcnt, 1);
+	output_qentry_t *q = output_qentry_new(octet_string_new(buf, rec->len), m, rec->format, 0);
+	q->props = props;
+	return q;
+fail:
+	XFREE(props);
+	return NULL;
+}
+
+// Deletes the first segment after all of its messages have been delivered
+static void spool_segment_remove_first(struct output_spool *s) {
+	if(s->rfh != NULL) {
+		fclose(s->rfh);
+		s->rfh = NULL;
+	}
+	s->roff = 0;
+	pthread_mutex_lock(&s->mutex);
+	struct spool_segment *seg = g_queue_pop_head(s->segments);
+	pthread_mutex_unlock(&s->mutex);
+	char path[PATH_MAX];
+	spool_segment_path(s, seg->seq, path, sizeof(path));
+	unlink(path);
+	XFREE(seg);
+}
@@ -0,0 +1,23 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>                       // GAsyncQueue
+#include "output-common.h"              // output_qentry_t
+
+// Default number of messages waiting in the RAM queue, above which new
+// messages are written to the spool
+#define OUTPUT_SPOOL_HWM_DEFAULT 1000
+// Default and max spool size, in megabytes
+#define OUTPUT_SPOOL_SIZE_DEFAULT 1024
+#define OUTPUT_SPOOL_SIZE_MAX 1048576
+
+struct output_spool;
+
+struct output_spool *output_spool_create(char const *dir, int32_t max_size_mb, int32_t hwm, int32_t id);
+void output_spool_enqueue(struct output_spool *s, GAsyncQueue *q, output_qentry_t *qentry);
+bool output_spool_is_full(struct output_spool *s);
+int32_t output_spool_peek(struct output_spool *s, GAsyncQueue *q, output_qentry_t **batch, int32_t max);
+void output_spool_commit(struct output_spool *s, int32_t cnt);
+int32_t output_spool_report(struct output_spool *s);
+void output_spool_destroy(struct output_spool *s);
@@ -0,0 +1,777 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdio.h>                      // fprintf, snprintf
+#include <inttypes.h>                   // PRIu64
+#include <stdlib.h>                     // strtol
+#include <string.h>                     // memset, strdup, strerror
+#include <unistd.h>                     // close, pipe, read, write
+#include <errno.h>                      // errno
+#include <fcntl.h>                      // fcntl, O_NONBLOCK
+#include <poll.h>                       // poll, struct pollfd
+#include <pthread.h>                    // pthread_*
+#include <time.h>                       // time_t, clock_gettime
+#include <sys/types.h>                  // socket, bind, accept
+#include <sys/socket.h>                 // socket, bind, listen, accept, setsockopt, recv
+#include <sys/uio.h>                    // writev, struct iovec
+#include <netinet/in.h>                 // IPPROTO_TCP
+#include <netinet/tcp.h>                // TCP_NODELAY
+#include <netdb.h>                      // getaddrinfo, getnameinfo
+#include "config.h"                     // WITH_STATSD
+#include "output-common.h"              // output_descriptor_t, output_qentry_t, output_qentry_ref/unref
+#include "kvargs.h"                     // kvargs, option_descr_t
+#include "statsd.h"                     // statsd_set
+#include "util.h"                       // ASSERT, NEW, XCALLOC, XFREE, stop_thread, pthread_cond_*
+
+// TCP server output.
+// Listens on a TCP port and sends all messages to every connected client.
+// The output thread only appends references to messages to an inbox ring.
+// A dedicated I/O thread moves them to per-client send rings (without
+// copying - all clients share the same queue entries), accepts new clients
+// and sends data over non-blocking sockets. A client which does not keep up
+// with the message rate has its ring filled up. Depending on the configured
+// policy, either the oldest messages queued for it are dropped, or the
+// client is disconnected. Either way, a slow client never holds up the
+// output thread nor the other clients.
+
+// Default and max number of messages queued for a single client
+#define TCP_SERVER_RING_SIZE_DEFAULT 1024
+#define TCP_SERVER_RING_SIZE_MAX 65536
+// Default and max number of simultaneously connected clients
+#define TCP_SERVER_MAX_CLIENTS_DEFAULT 32
+#define TCP_SERVER_MAX_CLIENTS_MAX 1024
+// Max number of recent messages sent to newly connected clients
+#define TCP_SERVER_REPLAY_MAX 65536
+// Max number of messages sent with a single writev() call
+#define TCP_SERVER_IOV_CNT_MAX 256
+// How long to wait for client rings to drain on shutdown (seconds)
+#define TCP_SERVER_SHUTDOWN_FLUSH_TIMEOUT 5
+// How often to report client statistics (seconds)
+#define TCP_SERVER_STATS_INTERVAL 10
+// I/O thread wakeup interval when idle (ms)
+#define TCP_SERVER_POLL_INTERVAL 1000
+
+typedef enum {
+	SLOW_CLIENT_DROP_OLDEST,
+	SLOW_CLIENT_DROP_CLIENT
+} out_tcp_server_slow_client_policy_t;
+
+// Bounded FIFO of message references
+struct msg_ring {
+	output_qentry_t **entries;
+	int32_t size;
+	int32_t head;                       // index of the oldest message
+	int32_t cnt;                        // number of messages in the ring
+};
+
+struct tcp_client {
+	int32_t fd;                         // -1 - slot unused
+	char name[64];                      // address:port of the peer (for logging)
+	struct msg_ring ring;
+	size_t head_offset;                 // number of bytes of the oldest message already sent
+	uint64_t sent_cnt;                  // messages sent to the client
+	uint64_t dropped_cnt;               // messages dropped due to ring overflow
+};
+
+typedef struct {
+	char *address;
+	char *port;
+	int32_t ring_size;
+	int32_t max_clients;
+	int32_t replay_cnt;
+	out_tcp_server_slow_client_policy_t slow_client_policy;
+	bool nodelay;
+	int32_t id;
+// Shared between the output thread and the I/O thread (protected by mutex)
+	pthread_mutex_t mutex;
+	struct msg_ring inbox;              // messages not yet distributed to clients
+	pthread_cond_t inbox_space;         // signaled when the inbox gets emptied or the I/O thread fails
+	bool shutdown;                      // output thread requested shutdown
+	bool io_failed;                     // I/O thread has terminated due to an error
+// Private to the I/O thread
+	pthread_t io_thread;
+	bool io_thread_running;
+	int32_t wakeup_pipe[2];
+	int32_t listen_fd;
+	struct msg_ring history;            // most recent messages, for replay to new clients
+	struct tcp_client *clients;         // max_clients slots
+	int32_t client_cnt;
+	output_qentry_t **work;             // messages taken from the inbox
+	struct pollfd *pfds;
+	time_t next_stats_time;
+} out_tcp_server_ctx_t;
+
+static time_t out_tcp_server_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static void out_tcp_server_wakeup(out_tcp_server_ctx_t *self) {
+	char c = 0;
+	// The pipe is non-blocking; if it's full, the I/O thread has a wakeup pending anyway
+	if(write(self->wakeup_pipe[1], &c, 1) < 0) {
+		debug_print(D_OUTPUT, "output_tcp_server(%s): wakeup failed: %s\n",
+				self->port, strerror(errno));
+	}
+}
+
+static int32_t set_nonblocking(int32_t fd) {
+	int32_t flags = fcntl(fd, F_GETFL, 0);
+	if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+static void msg_ring_init(struct msg_ring *r, int32_t size) {
+	r->entries = XCALLOC(size, sizeof(output_qentry_t *));
+	r->size = size;
+	r->head = r->cnt = 0;
+}
+
+static output_qentry_t *msg_ring_get(struct msg_ring const *r, int32_t i) {
+	return r->entries[(r->head + i) % r->size];
+}
+
+// Appends a message to the ring, which must not be full. Takes over the reference.
+static void msg_ring_push(struct msg_ring *r, output_qentry_t *q) {
+	ASSERT(r->cnt < r->size);
+	r->entries[(r->head + r->cnt) % r->size] = q;
+	r->cnt++;
+}
+
+// Releases cnt oldest messages
+static void msg_ring_release(struct msg_ring *r, int32_t cnt) {
+	ASSERT(cnt <= r->cnt);
+	for(int32_t i = 0; i < cnt; i++) {
+		output_qentry_unref(msg_ring_get(r, i));
+	}
+	r->head = (r->head + cnt) % r->size;
+	r->cnt -= cnt;
+}
+
+static void msg_ring_destroy(struct msg_ring *r) {
+	if(r->entries != NULL) {
+		msg_ring_release(r, r->cnt);
+		XFREE(r->entries);
+	}
+}
+
+static bool out_tcp_server_supports_format(output_format_t format) {
+	return(format == OFMT_TEXT || format == OFMT_BASESTATION || format == OFMT_JSON ||
+			format == OFMT_CBOR || format == OFMT_FRAME);
+}
+
+static bool out_tcp_server_int_param_parse(char const *name, char const *val,
+		int32_t min, int32_t max, int32_t *result) {
+	char *endptr = NULL;
+	long v = strtol(val, &endptr, 10);
+	if(endptr == val || *endptr != '\0' || v < min || v > max) {
+		fprintf(stderr, "output_tcp_server: %s: invalid value '%s' (must be in range %d-%d)\n",
+				name, val, min, max);
+		return false;
+	}
+	*result = (int32_t)v;
+	return true;
+}
+
+static void *out_tcp_server_configure(kvargs *kv, int32_t id) {
+	ASSERT(kv != NULL);
+	NEW(out_tcp_server_ctx_t, cfg);
+	cfg->ring_size = TCP_SERVER_RING_SIZE_DEFAULT;
+	cfg->max_clients = TCP_SERVER_MAX_CLIENTS_DEFAULT;
+	cfg->slow_client_policy = SLOW_CLIENT_DROP_OLDEST;
+	cfg->nodelay = true;
+	cfg->id = id;
+	cfg->listen_fd = -1;
+	cfg->wakeup_pipe[0] = cfg->wakeup_pipe[1] = -1;
+	if(kvargs_get(kv, "port") == NULL) {
+		fprintf(stderr, "output_tcp_server: port not specified\n");
+		goto fail;
+	}
+	cfg->port = strdup(kvargs_get(kv, "port"));
+	char *val = NULL;
+	if((val = kvargs_get(kv, "address")) != NULL) {
+		cfg->address = strdup(val);
+	}
+	if((val = kvargs_get(kv, "queue_size")) != NULL &&
+			!out_tcp_server_int_param_parse("queue_size", val, 1, TCP_SERVER_RING_SIZE_MAX, &cfg->ring_size)) {
+		goto fail;
+	}
+	if((val = kvargs_get(kv, "max_clients")) != NULL &&
+			!out_tcp_server_int_param_parse("max_clients", val, 1, TCP_SERVER_MAX_CLIENTS_MAX, &cfg->max_clients)) {
+		goto fail;
+	}
+	if((val = kvargs_get(kv, "replay")) != NULL &&
+			!out_tcp_server_int_param_parse("replay", val, 0, TCP_SERVER_REPLAY_MAX, &cfg->replay_cnt)) {
+		goto fail;
+	}
+	if(cfg->replay_cnt > cfg->ring_size) {
+		fprintf(stderr, "output_tcp_server: replay must not be greater than queue_size (%d)\n", cfg->ring_size);
+		goto fail;
+	}
+	if((val = kvargs_get(kv, "slow_client")) != NULL) {
+		if(!strcmp(val, "drop_oldest")) {
+			cfg->slow_client_policy = SLOW_CLIENT_DROP_OLDEST;
+		} else if(!strcmp(val, "drop_client")) {
+			cfg->slow_client_policy = SLOW_CLIENT_DROP_CLIENT;
+		} else {
+			fprintf(stderr, "output_tcp_server: slow_client: invalid value '%s' "
+					"(must be drop_oldest or drop_client)\n", val);
+			goto fail;
+		}
+	}
+	if((val = kvargs_get(kv, "nodelay")) != NULL) {
+		if(strcmp(val, "true") == 0 || strcmp(val, "1") == 0) {
+			cfg->nodelay = true;
+		} else if(strcmp(val, "false") == 0 || strcmp(val, "0") == 0) {
+			cfg->nodelay = false;
+		} else {
+			fprintf(stderr, "output_tcp_server: nodelay: invalid value '%s' (must be true or false)\n", val);
+			goto fail;
+		}
+	}
+	if(pthread_mutex_initialize(&cfg->mutex) != 0 || pthread_cond_initialize(&cfg->inbox_space) != 0) {
+		goto fail;
+	}
+	msg_ring_init(&cfg->inbox, cfg->ring_size);
+	if(cfg->replay_cnt > 0) {
+		msg_ring_init(&cfg->history, cfg->replay_cnt);
+	}
+	cfg->work = XCALLOC(cfg->ring_size, sizeof(output_qentry_t *));
+	cfg->clients = XCALLOC(cfg->max_clients, sizeof(struct tcp_client));
+	for(int32_t i = 0; i < cfg->max_clients; i++) {
+		cfg->clients[i].fd = -1;
+	}
+	// wakeup pipe + listening socket + clients
+	cfg->pfds = XCALLOC(cfg->max_clients + 2, sizeof(struct pollfd));
+	return cfg;
+fail:
+	XFREE(cfg->address);
+	XFREE(cfg->port);
+	XFREE(cfg);
+	return NULL;
+}
+
+static void out_tcp_server_ctx_destroy(void *ctxptr) {
+	if(ctxptr != NULL) {
+		out_tcp_server_ctx_t *ctx = ctxptr;
+		if(ctx->clients != NULL) {
+			for(int32_t i = 0; i < ctx->max_clients; i++) {
+				if(ctx->clients[i].fd >= 0) {
+					close(ctx->clients[i].fd);
+				}
+				msg_ring_destroy(&ctx->clients[i].ring);
+			}
+		}
+		msg_ring_destroy(&ctx->inbox);
+		msg_ring_destroy(&ctx->history);
+		if(ctx->listen_fd >= 0) {
+			close(ctx->listen_fd);
+		}
+		if(ctx->wakeup_pipe[0] >= 0) {
+			close(ctx->wakeup_pipe[0]);
+			close(ctx->wakeup_pipe[1]);
+		}
+		pthread_mutex_destroy(&ctx->mutex);
+		pthread_cond_destroy(&ctx->inbox_space);
+		XFREE(ctx->work);
+		XFREE(ctx->clients);
+		XFREE(ctx->pfds);
+		XFREE(ctx->address);
+		XFREE(ctx->port);
+		XFREE(ctx);
+	}
+}
+
+/**********************************
+ * I/O thread
+ **********************************/
+
+static void out_tcp_server_client_stats_report(out_tcp_server_ctx_t *self, int32_t slot) {
+#ifdef WITH_STATSD
+	struct tcp_client const *c = &self->clients[slot];
+	char metric[80];
+	snprintf(metric, sizeof(metric), "outputs.%d.clients.%d.lag", self->id, slot);
+	statsd_set(metric, c->fd >= 0 ? (size_t)c->ring.cnt : 0);
+	snprintf(metric, sizeof(metric), "outputs.%d.clients.%d.dropped", self->id, slot);
+	statsd_set(metric, c->fd >= 0 ? c->dropped_cnt : 0);
+#else
+	UNUSED(self);
+	UNUSED(slot);
+#endif
+}
+
+static void out_tcp_server_stats_report(out_tcp_server_ctx_t *self) {
+#ifdef WITH_STATSD
+	char metric[64];
+	snprintf(metric, sizeof(metric), "outputs.%d.clients.connected", self->id);
+	statsd_set(metric, self->client_cnt);
+	for(int32_t i = 0; i < self->max_clients; i++) {
+		if(self->clients[i].fd >= 0) {
+			out_tcp_server_client_stats_report(self, i);
+		}
+	}
+#else
+	UNUSED(self);
+#endif
+}
+
+static void out_tcp_server_client_close(out_tcp_server_ctx_t *self, int32_t slot, char const *reason) {
+	struct tcp_client *c = &self->clients[slot];
+	ASSERT(c->fd >= 0);
+	fprintf(stderr, "output_tcp_server(%s): client %s disconnected (%s), "
+			"%" PRIu64 " messages sent, %" PRIu64 " dropped, %d unsent\n",
+			self->port, c->name, reason, c->sent_cnt, c->dropped_cnt, c->ring.cnt);
+	close(c->fd);
+	c->fd = -1;
+	msg_ring_release(&c->ring, c->ring.cnt);
+	self->client_cnt--;
+	// Reset the gauges, so that the slot does not look stuck
+	out_tcp_server_client_stats_report(self, slot);
+}
+
+static void out_tcp_server_accept(out_tcp_server_ctx_t *self) {
+	while(true) {
+		struct sockaddr_storage addr;
+		socklen_t addrlen = sizeof(addr);
+		int32_t fd = accept(self->listen_fd, (struct sockaddr *)&addr, &addrlen);
+		if(fd < 0) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+				fprintf(stderr, "output_tcp_server(%s): accept failed: %s\n", self->port, strerror(errno));
+			}
+			return;
+		}
+		char host[NI_MAXHOST], serv[NI_MAXSERV];
+		if(getnameinfo((struct sockaddr *)&addr, addrlen, host, sizeof(host), serv, sizeof(serv),
+					NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+			strcpy(host, "?");
+			strcpy(serv, "?");
+		}
+		if(self->client_cnt >= self->max_clients) {
+			fprintf(stderr, "output_tcp_server(%s): too many clients, rejecting connection from %s:%s\n",
+					self->port, host, serv);
+			close(fd);
+			continue;
+		}
+		if(set_nonblocking(fd) < 0) {
+			fprintf(stderr, "output_tcp_server(%s): could not set socket to non-blocking mode: %s\n",
+					self->port, strerror(errno));
+			close(fd);
+			continue;
+		}
+		if(self->nodelay) {
+			int32_t on = 1;
+			if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0) {
+				fprintf(stderr, "output_tcp_server(%s): could not set TCP_NODELAY: %s\n",
+						self->port, strerror(errno));
+			}
+		}
+		int32_t slot = 0;
+		while(self->clients[slot].fd >= 0) {
+			slot++;
+		}
+		struct tcp_client *c = &self->clients[slot];
+		c->fd = fd;
+		snprintf(c->name, sizeof(c->name), "%s:%s", host, serv);
+		c->head_offset = 0;
+		c->sent_cnt = c->dropped_cnt = 0;
+		if(c->ring.entries == NULL) {
+			msg_ring_init(&c->ring, self->ring_size);
+		}
+		// Start with the most recent messages, if requested
+		for(int32_t i = 0; i < self->history.cnt; i++) {
+			msg_ring_push(&c->ring, output_qentry_ref(msg_ring_get(&self->history, i)));
+		}
+		self->client_cnt++;
+		fprintf(stderr, "output_tcp_server(%s): client %s connected (%d messages replayed)\n",
+				self->port, c->name, self->history.cnt);
+	}
+}
+
+// Appends a message to the client's ring, applying the slow client policy
+// if the ring is full. Returns -1 if the client has to be disconnected.
+static int32_t out_tcp_server_client_enqueue(out_tcp_server_ctx_t *self, struct tcp_client *c,
+		output_qentry_t *q) {
+	struct msg_ring *r = &c->ring;
+	if(r->cnt == r->size) {
+		if(self->slow_client_policy == SLOW_CLIENT_DROP_CLIENT) {
+			return -1;
+		}
+		if(c->dropped_cnt == 0) {
+			fprintf(stderr, "output_tcp_server(%s): client %s is too slow, dropping messages\n",
+					self->port, c->name);
+		}
+		c->dropped_cnt++;
+		if(c->head_offset > 0 && r->cnt > 1) {
+			// The oldest message has been partially sent and it must be completed,
+			// otherwise the stream would be corrupted. Drop the next one instead.
+			int32_t second = (r->head + 1) % r->size;
+			output_qentry_unref(r->entries[second]);
+			r->entries[second] = r->entries[r->head];
+			r->head = second;
+			r->cnt--;
+		} else if(c->head_offset == 0) {
+			msg_ring_release(r, 1);
+		} else {
+			// A single-entry ring is busy with a partially sent message
+			return 0;
+		}
+	}
+	msg_ring_push(r, output_qentry_ref(q));
+	return 0;
+}
+
+// Distributes messages taken from the inbox to all clients and to the history
+// ring. Consumes the references held by the work array.
+static void out_tcp_server_distribute(out_tcp_server_ctx_t *self, int32_t cnt) {
+	for(int32_t i = 0; i < cnt; i++) {
+		output_qentry_t *q = self->work[i];
+		for(int32_t slot = 0; slot < self->max_clients; slot++) {
+			struct tcp_client *c = &self->clients[slot];
+			if(c->fd >= 0 && out_tcp_server_client_enqueue(self, c, q) < 0) {
+				out_tcp_server_client_close(self, slot, "too slow");
+			}
+		}
+		if(self->replay_cnt > 0) {
+			if(self->history.cnt == self->history.size) {
+				msg_ring_release(&self->history, 1);
+			}
+			msg_ring_push(&self->history, q);
+		} else {
+			output_qentry_unref(q);
+		}
+	}
+}
+
+// Sends as much of the client's ring contents as the socket accepts without
+// blocking. Returns 0 on success (including partial sends) or -1 on socket error.
+static int32_t out_tcp_server_client_flush(out_tcp_server_ctx_t *self, struct tcp_client *c) {
+	struct iovec iov[TCP_SERVER_IOV_CNT_MAX];
+	struct msg_ring *r = &c->ring;
+	while(r->cnt > 0) {
+		int32_t iov_cnt = r->cnt < TCP_SERVER_IOV_CNT_MAX ? r->cnt : TCP_SERVER_IOV_CNT_MAX;
+		for(int32_t i = 0; i < iov_cnt; i++) {
+			struct octet_string const *msg = msg_ring_get(r, i)->msg;
+			size_t offset = i == 0 ? c->head_offset : 0;
+			iov[i].iov_base = (uint8_t *)msg->buf + offset;
+			iov[i].iov_len = msg->len - offset;
+		}
+		ssize_t sent = writev(c->fd, iov, iov_cnt);
+		if(sent < 0) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				debug_print(D_OUTPUT, "output_tcp_server(%s): client %s: send error: %s\n",
+						self->port, c->name, strerror(errno));
+				return -1;
+			}
+			return 0;
+		}
+		size_t left = (size_t)sent;
+		int32_t done = 0;
+		while(done < iov_cnt && left >= iov[done].iov_len) {
+			left -= iov[done].iov_len;
+			done++;
+		}
+		c->head_offset = done < iov_cnt ? (done == 0 ? c->head_offset : 0) + left : 0;
+		msg_ring_release(r, done);
+		c->sent_cnt += done;
+		if(done < iov_cnt) {
+			// Socket buffer is full
+			break;
+		}
+	}
+	return 0;
+}
+
+// Clients are not supposed to send anything, so any incoming data is discarded.
+// Returns -1 if the connection has been closed by the peer or has failed.
+static int32_t out_tcp_server_client_read_discard(struct tcp_client *c) {
+	uint8_t buf[1024];
+	ssize_t len;
+	while((len = recv(c->fd, buf, sizeof(buf), 0)) > 0)
+		;
+	if(len == 0) {
+		return -1;
+	}
+	return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+}
+
+static int32_t out_tcp_server_pending_cnt(out_tcp_server_ctx_t *self) {
+	int32_t pending = 0;
+	for(int32_t i = 0; i < self->max_clients; i++) {
+		if(self->clients[i].fd >= 0) {
+			pending += self->clients[i].ring.cnt;
+		}
+	}
+	return pending;
+}
+
+static void *out_tcp_server_io_thread(void *arg) {
+	ASSERT(arg != NULL);
+	out_tcp_server_ctx_t *self = arg;
+	time_t shutdown_deadline = 0;
+	self->next_stats_time = out_tcp_server_now() + TCP_SERVER_STATS_INTERVAL;
+	while(true) {
+		pthread_mutex_lock(&self->mutex);
+		int32_t cnt = self->inbox.cnt;
+		for(int32_t i = 0; i < cnt; i++) {
+			self->work[i] = msg_ring_get(&self->inbox, i);
+		}
+		self->inbox.head = self->inbox.cnt = 0;
+		pthread_cond_broadcast(&self->inbox_space);
+		bool shutdown = self->shutdown;
+		pthread_mutex_unlock(&self->mutex);
+		out_tcp_server_distribute(self, cnt);
+		// Try sending straight away - usually the socket has room for the data
+		for(int32_t slot = 0; slot < self->max_clients; slot++) {
+			struct tcp_client *c = &self->clients[slot];
+			if(c->fd >= 0 && c->ring.cnt > 0 && out_tcp_server_client_flush(self, c) < 0) {
+				out_tcp_server_client_close(self, slot, "send error");
+			}
+		}
+
+		time_t now = out_tcp_server_now();
+		if(shutdown) {
+			if(shutdown_deadline == 0) {
+				shutdown_deadline = now + TCP_SERVER_SHUTDOWN_FLUSH_TIMEOUT;
+			}
+			if(out_tcp_server_pending_cnt(self) == 0 || now >= shutdown_deadline) {
+				break;
+			}
+		}
+		if(now >= self->next_stats_time) {
+			out_tcp_server_stats_report(self);
+			self->next_stats_time = now + TCP_SERVER_STATS_INTERVAL;
+		}
+
+		struct pollfd *fds = self->pfds;
+		int32_t nfds = 0;
+		fds[nfds++] = (struct pollfd){ .fd = self->wakeup_pipe[0], .events = POLLIN };
+		// Don't accept new clients during shutdown
+		fds[nfds++] = (struct pollfd){ .fd = shutdown ? -1 : self->listen_fd, .events = POLLIN };
+		for(int32_t slot = 0; slot < self->max_clients; slot++) {
+			struct tcp_client const *c = &self->clients[slot];
+			// Unused slots have fd == -1 and are ignored by poll()
+			fds[nfds++] = (struct pollfd){
+				.fd = c->fd,
+				.events = POLLIN | (c->ring.cnt > 0 ? POLLOUT : 0)
+			};
+		}
+		int32_t ret = poll(fds, nfds, TCP_SERVER_POLL_INTERVAL);
+		if(ret < 0 && errno != EINTR) {
+			fprintf(stderr, "output_tcp_server(%s): poll failed: %s\n", self->port, strerror(errno));
+			pthread_mutex_lock(&self->mutex);
+			self->io_failed = true;
+			pthread_cond_broadcast(&self->inbox_space);
+			pthread_mutex_unlock(&self->mutex);
+			break;
+		} else if(ret <= 0) {
+			continue;
+		}
+		if(fds[0].revents & POLLIN) {
+			char buf[64];
+			while(read(self->wakeup_pipe[0], buf, sizeof(buf)) > 0)
+				;
+		}
+		for(int32_t slot = 0; slot < self->max_clients; slot++) {
+			struct tcp_client *c = &self->clients[slot];
+			short revents = fds[slot + 2].revents;
+			if(c->fd < 0 || revents == 0) {
+				continue;
+			}
+			if((revents & (POLLIN | POLLERR | POLLHUP)) && out_tcp_server_client_read_discard(c) < 0) {
+				out_tcp_server_client_close(self, slot, "connection closed");
+				continue;
+			}
+			if((revents & POLLOUT) && out_tcp_server_client_flush(self, c) < 0) {
+				out_tcp_server_client_close(self, slot, "send error");
+			}
+		}
+		if(fds[1].revents & POLLIN) {
+			out_tcp_server_accept(self);
+		}
+	}
+	for(int32_t slot = 0; slot < self->max_clients; slot++) {
+		if(self->clients[slot].fd >= 0) {
+			out_tcp_server_client_close(self, slot, "shutting down");
+		}
+	}
+	return NULL;
+}
+
+/**********************************
+ * Output thread
+ **********************************/
+
+static int32_t out_tcp_server_listen(out_tcp_server_ctx_t *self) {
+	struct addrinfo hints, *result, *rptr;
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	hints.ai_protocol = 0;
+	int32_t ret = getaddrinfo(self->address, self->port, &hints, &result);
+	if(ret != 0) {
+		fprintf(stderr, "output_tcp_server(%s): could not resolve address: %s\n",
+				self->port, gai_strerror(ret));
+		return -1;
+	}
+	for(rptr = result; rptr != NULL; rptr = rptr->ai_next) {
+		int32_t fd = socket(rptr->ai_family, rptr->ai_socktype, rptr->ai_protocol);
+		if(fd == -1) {
+			continue;
+		}
+		int32_t on = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if(bind(fd, rptr->ai_addr, rptr->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0 &&
+				set_nonblocking(fd) == 0) {
+			self->listen_fd = fd;
+			break;
+		}
+		close(fd);
+	}
+	freeaddrinfo(result);
+	if(self->listen_fd < 0) {
+		fprintf(stderr, "output_tcp_server(%s): could not listen on %s:%s: %s\n",
+				self->port, self->address != NULL ? self->address : "*", self->port, strerror(errno));
+		return -1;
+	}
+	fprintf(stderr, "output_tcp_server(%s): listening for connections\n", self->port);
+	return 0;
+}
+
+static int32_t out_tcp_server_init(void *selfptr) {
+	ASSERT(selfptr != NULL);
+	out_tcp_server_ctx_t *self = selfptr;
+	if(pipe(self->wakeup_pipe) < 0) {
+		fprintf(stderr, "output_tcp_server(%s): could not create pipe: %s\n",
+				self->port, strerror(errno));
+		self->wakeup_pipe[0] = self->wakeup_pipe[1] = -1;
+		return -1;
+	}
+	if(set_nonblocking(self->wakeup_pipe[0]) < 0 || set_nonblocking(self->wakeup_pipe[1]) < 0) {
+		fprintf(stderr, "output_tcp_server(%s): could not set pipe to non-blocking mode: %s\n",
+				self->port, strerror(errno));
+		return -1;
+	}
+	if(out_tcp_server_listen(self) < 0) {
+		return -1;
+	}
+	int32_t ret = pthread_create(&self->io_thread, NULL, out_tcp_server_io_thread, self);
+	if(ret != 0) {
+		fprintf(stderr, "output_tcp_server(%s): could not start I/O thread: %s\n",
+				self->port, strerror(ret));
+		return -1;
+	}
+	self->io_thread_running = true;
+	return 0;
+}
+
+// Appends messages to the inbox. Returns the number of messages consumed.
+// The I/O thread empties the inbox on every wakeup, so it fills up only if
+// the I/O thread is lagging behind. The remaining messages then stay in the
+// output queue until it catches up.
+static int32_t out_tcp_server_produce_batch(void *selfptr, output_qentry_t * const *batch, int32_t cnt) {
+	ASSERT(selfptr != NULL);
+	out_tcp_server_ctx_t *self = selfptr;
+	pthread_mutex_lock(&self->mutex);
+	if(self->io_failed) {
+		pthread_mutex_unlock(&self->mutex);
+		return cnt;
+	}
+	int32_t free_cnt = self->inbox.size - self->inbox.cnt;
+	int32_t accepted = cnt < free_cnt ? cnt : free_cnt;
+	for(int32_t i = 0; i < accepted; i++) {
+		ASSERT(batch[i]->msg != NULL);
+		msg_ring_push(&self->inbox, output_qentry_ref(batch[i]));
+	}
+	pthread_mutex_unlock(&self->mutex);
+	if(accepted > 0) {
+		out_tcp_server_wakeup(self);
+	}
+	return accepted;
+}
+
+// Called when the inbox was full. Waits until the I/O thread takes the
+// messages from it. A full inbox is backpressure, not a failure, so the
+// output thread retries straight away.
+static bool out_tcp_server_wait_ready(void *selfptr, int32_t timeout_ms) {
+	ASSERT(selfptr != NULL);
+	out_tcp_server_ctx_t *self = selfptr;
+	pthread_mutex_lock(&self->mutex);
+	if(self->inbox.cnt == self->inbox.size && !self->io_failed) {
+		pthread_cond_wait_ms(&self->inbox_space, &self->mutex, timeout_ms);
+	}
+	pthread_mutex_unlock(&self->mutex);
+	return true;
+}
+
+static void out_tcp_server_handle_shutdown(void *selfptr) {
+	ASSERT(selfptr != NULL);
+	out_tcp_server_ctx_t *self = selfptr;
+	if(self->io_thread_running) {
+		pthread_mutex_lock(&self->mutex);
+		self->shutdown = true;
+		pthread_mutex_unlock(&self->mutex);
+		out_tcp_server_wakeup(self);
+		stop_thread(self->io_thread);
+		self->io_thread_running = false;
+	}
+	fprintf(stderr, "output_tcp_server(%s): shutting down\n", self->port);
+}
+
+static void out_tcp_server_handle_failure(void *selfptr) {
+	ASSERT(selfptr != NULL);
+	out_tcp_server_ctx_t *self = selfptr;
+	fprintf(stderr, "output_tcp_server(%s): could not initialize, deactivating output\n", self->port);
+	out_tcp_server_handle_shutdown(selfptr);
+}
+
+static const option_descr_t out_tcp_server_options[] = {
+	{
+		.name = "address",
+		.description = "Local address to listen on (default: all addresses)"
+	},
+	{
+		.name = "port",
+		.description = "TCP port to listen on (required)"
+	},
+	{
+		.name = "max_clients",
+		.description = "Max number of connected clients (default: " STR(TCP_SERVER_MAX_CLIENTS_DEFAULT) ")"
+	},
+	{
+		.name = "queue_size",
+		.description = "Max number of messages queued for a single client (default: " STR(TCP_SERVER_RING_SIZE_DEFAULT) ")"
+	},
+	{
+		.name = "slow_client",
+		.description = "What to do when the client's queue is full: drop_oldest, drop_client (default: drop_oldest)"
+	},
+	{
+		.name = "replay",
+		.description = "Number of most recent messages sent to newly connected clients (default: 0)"
+	},
+	{
+		.name = "nodelay",
+		.description = "Disable Nagle's algorithm on client connections (true or false, default: true)"
+	},
+	{
+		.name = NULL,
+		.description = NULL
+	}
+};
+
+output_descriptor_t out_DEF_tcp_server = {
+	.name = "tcp_server",
+	.description = "Output to TCP clients connecting to a local port",
+	.options = out_tcp_server_options,
+	.supports_format = out_tcp_server_supports_format,
+	.configure = out_tcp_server_configure,
+	.ctx_destroy = out_tcp_server_ctx_destroy,
+	.init = out_tcp_server_init,
+	.produce = NULL,
+	.produce_batch = out_tcp_server_produce_batch,
+	.wait_ready = out_tcp_server_wait_ready,
+	.handle_shutdown = out_tcp_server_handle_shutdown,
+	.handle_failure = out_tcp_server_handle_failure
+};
@@ -1,40 +1,140 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include <stdio.h>                      // fprintf
+#include <stdlib.h>                     // strtol
 #include <string.h>                     // strdup, strerror
-#include <unistd.h>                     // close
+#include <unistd.h>                     // close, pipe, read, write
 #include <errno.h>                      // errno
-#include <sys/time.h>                   // struct timeval
-#include <time.h>                       // time_t, time
+#include <fcntl.h>                      // fcntl, O_NONBLOCK
+#include <poll.h>                       // poll, struct pollfd
+#include <pthread.h>                    // pthread_*
+#include <time.h>                       // time_t, clock_gettime
 #include <sys/types.h>                  // socket, connect
-#include <sys/socket.h>                 // socket, connect
+#include <sys/socket.h>                 // socket, connect, getsockopt, setsockopt, recv
+#include <sys/uio.h>                    // writev, struct iovec
+#include <netinet/in.h>                 // IPPROTO_TCP
+#include <netinet/tcp.h>                // TCP_NODELAY, TCP_CORK
 #include <netdb.h>                      // getaddrinfo
-#include "output-common.h"              // output_descriptor_t, output_qentry_t, output_queue_drain
+#include "output-common.h"              // output_descriptor_t, output_qentry_t, output_qentry_ref/unref
 #include "kvargs.h"                     // kvargs, option_descr_t
-#include "util.h"                       // ASSERT
+#include "util.h"                       // ASSERT, NEW, XCALLOC, XFREE, stop_thread, pthread_cond_*
 
-// Number of seconds to wait before re-establishing the connection
-// after the last error.
-#define MIN_RECONNECT_INTERVAL 10
-// Send socket operations timeout
-#define SOCKET_SEND_TIMEOUT 5
+// TCP output.
+// Messages are not written to the socket directly by the output thread.
+// Instead, they are appended to a bounded send ring (without copying - the
+// ring holds references to output queue entries) and a dedicated I/O thread
+// sends them over a non-blocking socket, as many at once as the socket accepts
+// (with writev). The I/O thread also takes care of (re)connecting, so neither
+// a slow collector nor a lengthy name resolution or connection attempt blocks
+// the output thread.
 
-// Forward declarations
-static void out_tcp_handle_shutdown(void *selfptr);
+// Delay before the next connection attempt after a failure. It starts at
+// TCP_RECONNECT_INTERVAL_MIN and doubles after each subsequent failure,
+// up to TCP_RECONNECT_INTERVAL_MAX (seconds).
+#define TCP_RECONNECT_INTERVAL_MIN 1
+#define TCP_RECONNECT_INTERVAL_MAX 60
+// Connection attempt timeout (seconds)
+#define TCP_CONNECT_TIMEOUT 10
+// If there is data to send and the peer has not accepted anything for
+// this many seconds, the connection is considered dead
+#define TCP_SEND_TIMEOUT 5
+// How long to wait for the send ring to drain on shutdown (seconds)
+#define TCP_SHUTDOWN_FLUSH_TIMEOUT 5
+// Send ring capacity (number of messages)
+#define TCP_RING_SIZE_DEFAULT 1024
+#define TCP_RING_SIZE_MAX 65536
+// Max number of messages sent with a single writev() call
+#define TCP_IOV_CNT_MAX 256
+// I/O thread wakeup interval when idle (ms)
+#define TCP_POLL_INTERVAL 1000
+
+typedef enum {
+	TCP_DISCONNECTED,
+	TCP_CONNECTING,
+	TCP_CONNECTED
+} out_tcp_state_t;
 
 typedef struct {
 	char *address;
 	char *port;
-	time_t next_reconnect_time;
+	int32_t ring_size;
+	bool nodelay;
+// Shared between the output thread and the I/O thread (protected by mutex)
+	pthread_mutex_t mutex;
+	pthread_cond_t ring_space;          // signaled when messages are released from the ring or the state changes
+	output_qentry_t **ring;             // send ring
+	int32_t ring_head;                  // index of the oldest message in the ring
+	int32_t ring_cnt;                   // number of messages in the ring
+	out_tcp_state_t state;
+	bool shutdown;                      // output thread requested shutdown
+// Private to the I/O thread
+	pthread_t io_thread;
+	bool io_thread_running;
+	int32_t wakeup_pipe[2];
 	int32_t sockfd;
+	struct addrinfo *ai_result;         // resolved addresses of the peer
+	struct addrinfo *ai_next;           // next address to try
+	size_t head_offset;                 // number of bytes of the oldest message already sent
+	time_t connect_start_time;
+	time_t next_reconnect_time;
+	time_t last_progress_time;          // last time when the ring was empty or some data got sent
+	int32_t reconnect_interval;
 } out_tcp_ctx_t;
 
+static time_t out_tcp_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static void out_tcp_set_state(out_tcp_ctx_t *self, out_tcp_state_t state) {
+	pthread_mutex_lock(&self->mutex);
+	self->state = state;
+	pthread_cond_broadcast(&self->ring_space);
+	pthread_mutex_unlock(&self->mutex);
+}
+
+static void out_tcp_wakeup(out_tcp_ctx_t *self) {
+	char c = 0;
+	// The pipe is non-blocking; if it's full, the I/O thread has a wakeup pending anyway
+	if(write(self->wakeup_pipe[1], &c, 1) < 0) {
+		debug_print(D_OUTPUT, "output_tcp(%s:%s): wakeup failed: %s\n",
+				self->address, self->port, strerror(errno));
+	}
+}
+
+static int32_t set_nonblocking(int32_t fd) {
+	int32_t flags = fcntl(fd, F_GETFL, 0);
+	if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+static void out_tcp_set_cork(out_tcp_ctx_t *self, int32_t on) {
+#ifdef TCP_CORK
+	if(setsockopt(self->sockfd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)) < 0) {
+		debug_print(D_OUTPUT, "output_tcp(%s:%s): could not set TCP_CORK: %s\n",
+				self->address, self->port, strerror(errno));
+	}
+#else
+	UNUSED(self);
+	UNUSED(on);
+#endif
+}
+
 static bool out_tcp_supports_format(output_format_t format) {
-	return(format == OFMT_TEXT || format == OFMT_BASESTATION || format == OFMT_JSON);
+	return(format == OFMT_TEXT || format == OFMT_BASESTATION || format == OFMT_JSON ||
+			format == OFMT_CBOR || format == OFMT_FRAME);
 }
 
-static void *out_tcp_configure(kvargs *kv) {
+static void *out_tcp_configure(kvargs *kv, int32_t id) {
+	UNUSED(id);
 	ASSERT(kv != NULL);
 	NEW(out_tcp_ctx_t, cfg);
+	cfg->ring_size = TCP_RING_SIZE_DEFAULT;
+	cfg->nodelay = true;
+	cfg->sockfd = -1;
+	cfg->wakeup_pipe[0] = cfg->wakeup_pipe[1] = -1;
 	if(kvargs_get(kv, "address") == NULL) {
 		fprintf(stderr, "output_tcp: address not specified\n");
 		goto fail;
@@ -45,8 +145,35 @@ static void *out_tcp_configure(kvargs *kv) {
 		goto fail;
 	}
 	cfg->port = strdup(kvargs_get(kv, "port"));
+	char *val = NULL;
+	if((val = kvargs_get(kv, "queue_size")) != NULL) {
+		char *endptr = NULL;
+		long size = strtol(val, &endptr, 10);
+		if(endptr == val || *endptr != '\0' || size < 1 || size > TCP_RING_SIZE_MAX) {
+			fprintf(stderr, "output_tcp: queue_size: invalid value '%s' (must be in range 1-%d)\n",
+					val, TCP_RING_SIZE_MAX);
+			goto fail;
+		}
+		cfg->ring_size = (int32_t)size;
+	}
+	if((val = kvargs_get(kv, "nodelay")) != NULL) {
+		if(strcmp(val, "true") == 0 || strcmp(val, "1") == 0) {
+			cfg->nodelay = true;
+		} else if(strcmp(val, "false") == 0 || strcmp(val, "0") == 0) {
+			cfg->nodelay = false;
+		} else {
+			fprintf(stderr, "output_tcp: nodelay: invalid value '%s' (must be true or false)\n", val);
+			goto fail;
+		}
+	}
+	if(pthread_mutex_initialize(&cfg->mutex) != 0 || pthread_cond_initialize(&cfg->ring_space) != 0) {
+		goto fail;
+	}
+	cfg->ring = XCALLOC(cfg->ring_size, sizeof(output_qentry_t *));
 	return cfg;
 fail:
+	XFREE(cfg->address);
+	XFREE(cfg->port);
 	XFREE(cfg);
 	return NULL;
 }
@@ -54,133 +181,404 @@ fail:
 static void out_tcp_ctx_destroy(void *ctxptr) {
 	if(ctxptr != NULL) {
 		out_tcp_ctx_t *ctx = ctxptr;
+		if(ctx->ring != NULL) {
+			for(int32_t i = 0; i < ctx->ring_cnt; i++) {
+				output_qentry_unref(ctx->ring[(ctx->ring_head + i) % ctx->ring_size]);
+			}
+		}
+		if(ctx->ai_result != NULL) {
+			freeaddrinfo(ctx->ai_result);
+		}
+		if(ctx->wakeup_pipe[0] >= 0) {
+			close(ctx->wakeup_pipe[0]);
+			close(ctx->wakeup_pipe[1]);
+		}
+		pthread_mutex_destroy(&ctx->mutex);
+		pthread_cond_destroy(&ctx->ring_space);
+		XFREE(ctx->ring);
 		XFREE(ctx->address);
 		XFREE(ctx->port);
 		XFREE(ctx);
 	}
 }
 
-static int32_t out_tcp_reconnect(void *selfptr) {
-	ASSERT(selfptr != NULL);
-	out_tcp_ctx_t *self = selfptr;
+/**********************************
+ * I/O thread
+ **********************************/
 
-	if(self->next_reconnect_time > time(NULL)) {
-		return -1;
+static void out_tcp_schedule_reconnect(out_tcp_ctx_t *self) {
+	self->next_reconnect_time = out_tcp_now() + self->reconnect_interval;
+	self->reconnect_interval *= 2;
+	if(self->reconnect_interval > TCP_RECONNECT_INTERVAL_MAX) {
+		self->reconnect_interval = TCP_RECONNECT_INTERVAL_MAX;
 	}
-	static struct timeval const timeout = { .tv_sec = SOCKET_SEND_TIMEOUT, .tv_usec = 0 };
-	struct addrinfo hints, *result, *rptr;
+}
+
+static void out_tcp_disconnect(out_tcp_ctx_t *self) {
+	if(self->sockfd < 0) {
+		return;
+	}
+	close(self->sockfd);
+	self->sockfd = -1;
+	if(self->state == TCP_CONNECTED) {
+		fprintf(stderr, "output_tcp(%s:%s): connection closed\n", self->address, self->port);
+		// The peer might have received a part of the oldest message. There is
+		// no way to tell how much of it has actually made it, so send it again
+		// as a whole on the next connection.
+		self->head_offset = 0;
+		out_tcp_schedule_reconnect(self);
+	}
+	out_tcp_set_state(self, TCP_DISCONNECTED);
+}
+
+static void out_tcp_connection_established(out_tcp_ctx_t *self) {
+	fprintf(stderr, "output_tcp(%s:%s): connection established\n", self->address, self->port);
+	if(self->nodelay) {
+		int32_t on = 1;
+		if(setsockopt(self->sockfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0) {
+			fprintf(stderr, "output_tcp(%s:%s): could not set TCP_NODELAY: %s\n",
+					self->address, self->port, strerror(errno));
+		}
+	}
+	freeaddrinfo(self->ai_result);
+	self->ai_result = self->ai_next = NULL;
+	self->reconnect_interval = TCP_RECONNECT_INTERVAL_MIN;
+	self->last_progress_time = out_tcp_now();
+
+	pthread_mutex_lock(&self->mutex);
+	self->state = TCP_CONNECTED;
+	pthread_cond_broadcast(&self->ring_space);
+	pthread_mutex_unlock(&self->mutex);
+}
+
+// Starts a non-blocking connection attempt to the next address on the list.
+// If there are no more addresses to try, schedules a reconnection.
+static void out_tcp_connect_next(out_tcp_ctx_t *self) {
+	while(self->ai_next != NULL) {
+		struct addrinfo *ai = self->ai_next;
+		self->ai_next = ai->ai_next;
+		int32_t fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if(fd == -1) {
+			continue;
+		}
+		if(set_nonblocking(fd) < 0) {
+			fprintf(stderr, "output_tcp(%s:%s): could not set socket to non-blocking mode: %s\n",
+					self->address, self->port, strerror(errno));
+			close(fd);
+			continue;
+		}
+		self->sockfd = fd;
+		if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			out_tcp_connection_established(self);
+			return;
+		} else if(errno == EINPROGRESS) {
+			self->connect_start_time = out_tcp_now();
+			out_tcp_set_state(self, TCP_CONNECTING);
+			return;
+		}
+		close(fd);
+		self->sockfd = -1;
+	}
+	fprintf(stderr, "output_tcp(%s:%s): could not connect: all addresses failed\n",
+			self->address, self->port);
+	freeaddrinfo(self->ai_result);
+	self->ai_result = NULL;
+	out_tcp_set_state(self, TCP_DISCONNECTED);
+	out_tcp_schedule_reconnect(self);
+}
+
+static void out_tcp_connect_start(out_tcp_ctx_t *self) {
+	struct addrinfo hints;
 	memset(&hints, 0, sizeof(struct addrinfo));
 	hints.ai_family = AF_UNSPEC;
 	hints.ai_socktype = SOCK_STREAM;
 	hints.ai_flags = 0;
 	hints.ai_protocol = 0;
 	fprintf(stderr, "output_tcp(%s:%s): connecting...\n", self->address, self->port);
-	int32_t ret = getaddrinfo(self->address, self->port, &hints, &result);
+	int32_t ret = getaddrinfo(self->address, self->port, &hints, &self->ai_result);
 	if(ret != 0) {
 		fprintf(stderr, "output_tcp(%s:%s): could not resolve address: %s\n",
 				self->address, self->port, gai_strerror(ret));
-		goto fail;
+		self->ai_result = NULL;
+		out_tcp_schedule_reconnect(self);
+		return;
 	}
-	for (rptr = result; rptr != NULL; rptr = rptr->ai_next) {
-		self->sockfd = socket(rptr->ai_family, rptr->ai_socktype, rptr->ai_protocol);
-		if(self->sockfd == -1) {
-			continue;
+	self->ai_next = self->ai_result;
+	out_tcp_connect_next(self);
+}
+
+static void out_tcp_connect_finish(out_tcp_ctx_t *self) {
+	int32_t err = 0;
+	socklen_t len = sizeof(err);
+	if(getsockopt(self->sockfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+		err = errno;
+	}
+	if(err == 0) {
+		out_tcp_connection_established(self);
+		return;
+	}
+	debug_print(D_OUTPUT, "output_tcp(%s:%s): connection attempt failed: %s\n",
+			self->address, self->port, strerror(err));
+	close(self->sockfd);
+	self->sockfd = -1;
+	out_tcp_connect_next(self);
+}
+
+// Sends as much of the ring contents as the socket accepts without blocking.
+// Returns 0 on success (including partial sends) or -1 on socket error.
+static int32_t out_tcp_flush(out_tcp_ctx_t *self) {
+	struct iovec iov[TCP_IOV_CNT_MAX];
+	bool corked = false;
+	int32_t result = 0;
+	while(true) {
+		pthread_mutex_lock(&self->mutex);
+		int32_t head = self->ring_head;
+		int32_t cnt = self->ring_cnt;
+		pthread_mutex_unlock(&self->mutex);
+		if(cnt == 0) {
+			break;
 		}
-		if(setsockopt(self->sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0) {
-			fprintf(stderr, "output_tcp(%s:%s): could not set timeout on socket: %s\n",
-					self->address, self->port, strerror(errno));
+		// Entries between head and head + cnt belong to the I/O thread until
+		// they are released below, so they can be accessed without locking.
+		int32_t iov_cnt = cnt < TCP_IOV_CNT_MAX ? cnt : TCP_IOV_CNT_MAX;
+		for(int32_t i = 0; i < iov_cnt; i++) {
+			struct octet_string const *msg = self->ring[(head + i) % self->ring_size]->msg;
+			size_t offset = i == 0 ? self->head_offset : 0;
+			iov[i].iov_base = (uint8_t *)msg->buf + offset;
+			iov[i].iov_len = msg->len - offset;
+		}
+		// If everything does not fit into a single writev, hold off sending
+		// partial frames until the last chunk is written.
+		if(cnt > iov_cnt && self->nodelay && !corked) {
+			out_tcp_set_cork(self, 1);
+			corked = true;
+		}
+		ssize_t sent = writev(self->sockfd, iov, iov_cnt);
+		if(sent < 0) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				fprintf(stderr, "output_tcp(%s:%s): send error: %s\n",
+						self->address, self->port, strerror(errno));
+				result = -1;
+			}
+			break;
+		}
+		self->last_progress_time = out_tcp_now();
+		size_t left = (size_t)sent;
+		int32_t done = 0;
+		while(done < iov_cnt && left >= iov[done].iov_len) {
+			left -= iov[done].iov_len;
+			output_qentry_unref(self->ring[(head + done) % self->ring_size]);
+			done++;
 		}
+		self->head_offset = done < iov_cnt ? (done == 0 ? self->head_offset : 0) + left : 0;
+		pthread_mutex_lock(&self->mutex);
+		self->ring_head = (head + done) % self->ring_size;
+		self->ring_cnt -= done;
+		if(done > 0) {
+			pthread_cond_broadcast(&self->ring_space);
+		}
+		pthread_mutex_unlock(&self->mutex);
+		if(done < iov_cnt) {
+			// Socket buffer is full
+			break;
+		}
+	}
+	if(corked && result == 0) {
+		out_tcp_set_cork(self, 0);
+	}
+	return result;
+}
 
-		if(connect(self->sockfd, rptr->ai_addr, rptr->ai_addrlen) != -1) {
-			fprintf(stderr, "output_tcp(%s:%s): connection established\n",
+// The peer is not supposed to send anything, so any incoming data is discarded.
+// Returns -1 if the connection has been closed by the peer or has failed.
+static int32_t out_tcp_read_discard(out_tcp_ctx_t *self) {
+	uint8_t buf[1024];
+	ssize_t len;
+	while((len = recv(self->sockfd, buf, sizeof(buf), 0)) > 0)
+		;
+	if(len == 0) {
+		return -1;
+	}
+	return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+}
+
+static void *out_tcp_io_thread(void *arg) {
+	ASSERT(arg != NULL);
+	out_tcp_ctx_t *self = arg;
+	time_t shutdown_deadline = 0;
+	while(true) {
+		pthread_mutex_lock(&self->mutex);
+		int32_t pending = self->ring_cnt;
+		bool shutdown = self->shutdown;
+		pthread_mutex_unlock(&self->mutex);
+		time_t now = out_tcp_now();
+
+		if(shutdown) {
+			if(shutdown_deadline == 0) {
+				shutdown_deadline = now + TCP_SHUTDOWN_FLUSH_TIMEOUT;
+			}
+			if(pending == 0 || self->state != TCP_CONNECTED || now >= shutdown_deadline) {
+				if(pending > 0) {
+					fprintf(stderr, "output_tcp(%s:%s): %d unsent messages discarded on shutdown\n",
+							self->address, self->port, pending);
+				}
+				break;
+			}
+		}
+		if(self->state == TCP_DISCONNECTED && now >= self->next_reconnect_time) {
+			out_tcp_connect_start(self);
+		} else if(self->state == TCP_CONNECTING && now - self->connect_start_time >= TCP_CONNECT_TIMEOUT) {
+			debug_print(D_OUTPUT, "output_tcp(%s:%s): connection attempt timed out\n",
 					self->address, self->port);
+			close(self->sockfd);
+			self->sockfd = -1;
+			out_tcp_connect_next(self);
+		} else if(self->state == TCP_CONNECTED) {
+			if(pending == 0) {
+				self->last_progress_time = now;
+			} else if(now - self->last_progress_time >= TCP_SEND_TIMEOUT) {
+				fprintf(stderr, "output_tcp(%s:%s): send timeout\n", self->address, self->port);
+				out_tcp_disconnect(self);
+			}
+		}
+
+		struct pollfd fds[2] = {
+			{ .fd = self->wakeup_pipe[0], .events = POLLIN },
+			{ .fd = self->sockfd, .events = 0 }
+		};
+		int32_t nfds = 1;
+		if(self->state == TCP_CONNECTING) {
+			fds[1].events = POLLOUT;
+			nfds = 2;
+		} else if(self->state == TCP_CONNECTED) {
+			fds[1].events = POLLIN | (pending > 0 ? POLLOUT : 0);
+			nfds = 2;
+		}
+		int32_t ret = poll(fds, nfds, TCP_POLL_INTERVAL);
+		if(ret < 0 && errno != EINTR) {
+			fprintf(stderr, "output_tcp(%s:%s): poll failed: %s\n",
+					self->address, self->port, strerror(errno));
 			break;
+		} else if(ret <= 0) {
+			continue;
+		}
+		if(fds[0].revents & POLLIN) {
+			char buf[64];
+			while(read(self->wakeup_pipe[0], buf, sizeof(buf)) > 0)
+				;
+		}
+		if(nfds < 2 || fds[1].revents == 0) {
+			continue;
+		}
+		if(self->state == TCP_CONNECTING) {
+			out_tcp_connect_finish(self);
+			continue;
+		}
+		if((fds[1].revents & (POLLIN | POLLERR | POLLHUP)) && out_tcp_read_discard(self) < 0) {
+			out_tcp_disconnect(self);
+			continue;
+		}
+		if((fds[1].revents & POLLOUT) && out_tcp_flush(self) < 0) {
+			out_tcp_disconnect(self);
 		}
-		close(self->sockfd);
-		self->sockfd = 0;
-	}
-	if (rptr == NULL) {
-		fprintf(stderr, "output_tcp(%s:%s): could not connect: all addresses failed\n",
-				self->address, self->port);
-		self->sockfd = 0;
-		goto fail;
 	}
-	freeaddrinfo(result);
-	self->next_reconnect_time = 0;
-	return 0;
-fail:
-	freeaddrinfo(result);
-	self->next_reconnect_time = time(NULL) + MIN_RECONNECT_INTERVAL;
-	return -1;
+	out_tcp_disconnect(self);
+	return NULL;
 }
 
+/**********************************
+ * Output thread
+ **********************************/
+
 static int32_t out_tcp_init(void *selfptr) {
 	ASSERT(selfptr != NULL);
 	out_tcp_ctx_t *self = selfptr;
-	self->next_reconnect_time = 0;      // Force reconnection now
-	out_tcp_reconnect(selfptr);
-	// Always return success, even when connection failed - otherwise the output thread would
-	// declare the error as fatal and disable the output without giving us a change to reestablish
-	// the connection.
+	if(pipe(self->wakeup_pipe) < 0) {
+		fprintf(stderr, "output_tcp(%s:%s): could not create pipe: %s\n",
+				self->address, self->port, strerror(errno));
+		self->wakeup_pipe[0] = self->wakeup_pipe[1] = -1;
+		return -1;
+	}
+	if(set_nonblocking(self->wakeup_pipe[0]) < 0 || set_nonblocking(self->wakeup_pipe[1]) < 0) {
+		fprintf(stderr, "output_tcp(%s:%s): could not set pipe to non-blocking mode: %s\n",
+				self->address, self->port, strerror(errno));
+		return -1;
+	}
+	self->state = TCP_DISCONNECTED;
+	self->next_reconnect_time = 0;      // Force connection now
+	self->reconnect_interval = TCP_RECONNECT_INTERVAL_MIN;
+	int32_t ret = pthread_create(&self->io_thread, NULL, out_tcp_io_thread, self);
+	if(ret != 0) {
+		fprintf(stderr, "output_tcp(%s:%s): could not start I/O thread: %s\n",
+				self->address, self->port, strerror(ret));
+		return -1;
+	}
+	self->io_thread_running = true;
+	// Connection failures are not reported here - otherwise the output thread would
+	// declare the error as fatal and disable the output without giving us a chance
+	// to reestablish the connection.
 	return 0;
 }
 
-static int32_t out_tcp_produce_text(out_tcp_ctx_t *self, struct metadata *metadata, struct octet_string *msg) {
-	UNUSED(metadata);
-	ASSERT(msg != NULL);
-	ASSERT(self->sockfd != 0);
-	if(msg->len < 1) {
-		return 0;
+// Appends messages to the send ring. Returns the number of messages consumed.
+// If the ring is full, returns a short count, so that the remaining messages stay
+// in the output queue (or go to the spool, if enabled) until the I/O thread makes
+// room. This applies also when there is no connection - the output thread gives
+// up on them only when it is shutting down.
+static int32_t out_tcp_produce_batch(void *selfptr, output_qentry_t * const *batch, int32_t cnt) {
+	ASSERT(selfptr != NULL);
+	out_tcp_ctx_t *self = selfptr;
+	pthread_mutex_lock(&self->mutex);
+	int32_t free_cnt = self->ring_size - self->ring_cnt;
+	int32_t accepted = cnt < free_cnt ? cnt : free_cnt;
+	for(int32_t i = 0; i < accepted; i++) {
+		ASSERT(batch[i]->msg != NULL);
+		self->ring[(self->ring_head + self->ring_cnt) % self->ring_size] = output_qentry_ref(batch[i]);
+		self->ring_cnt++;
 	}
-	if(write(self->sockfd, msg->buf, msg->len) < 0) {
-		return -1;
+	pthread_mutex_unlock(&self->mutex);
+
+	if(accepted > 0) {
+		out_tcp_wakeup(self);
 	}
-	return 0;
+	return accepted;
 }
 
-static int32_t out_tcp_produce(void *selfptr, output_format_t format, struct metadata *metadata, struct octet_string *msg) {
+// Called when the ring was full. If connected, waits until the I/O thread
+// sends something - a full ring is backpressure, not a failure, so the output
+// thread retries straight away. Without a connection, a full ring is a
+// delivery failure and the output thread applies its usual retry delay.
+static bool out_tcp_wait_ready(void *selfptr, int32_t timeout_ms) {
 	ASSERT(selfptr != NULL);
 	out_tcp_ctx_t *self = selfptr;
-	int32_t result = 0;
-	if(self->sockfd == 0) {         // No connection?
-		if(out_tcp_reconnect(selfptr) < 0) {
-			// Return success - this causes the message to be dropped silently.
-			// Can't requeue it here, because if the problem is permanent, then
-			// it would prevent the program from shutting down cleanly (shutdown
-			// message in the output queue would never be processed).
-			return 0;
-		}
-	}
-	if(format == OFMT_TEXT || format == OFMT_JSON || format == OFMT_BASESTATION) {
-		result = out_tcp_produce_text(self, metadata, msg);
-	}
-	if(result < 0) {
-		// Possible connection failure. Close it and reschedule an immediate reconnection.
-		fprintf(stderr, "output_tcp(%s:%s): send error: %s\n", self->address,
-			self->port,	strerror(errno));
-		out_tcp_handle_shutdown(selfptr);
-		self->next_reconnect_time = 0;
-		// Declare a failure, so that the message gets requeued
-		return -1;
+	pthread_mutex_lock(&self->mutex);
+	if(self->ring_cnt == self->ring_size && self->state == TCP_CONNECTED) {
+		pthread_cond_wait_ms(&self->ring_space, &self->mutex, timeout_ms);
 	}
-	return 0;
+	bool connected = self->state == TCP_CONNECTED;
+	pthread_mutex_unlock(&self->mutex);
+	return connected;
 }
 
 static void out_tcp_handle_shutdown(void *selfptr) {
 	ASSERT(selfptr != NULL);
 	out_tcp_ctx_t *self = selfptr;
-	close(self->sockfd);
-	self->sockfd = 0;
-	fprintf(stderr, "output_tcp(%s:%s): connection closed\n", self->address, self->port);
+	if(self->io_thread_running) {
+		pthread_mutex_lock(&self->mutex);
+		self->shutdown = true;
+		pthread_mutex_unlock(&self->mutex);
+		out_tcp_wakeup(self);
+		stop_thread(self->io_thread);
+		self->io_thread_running = false;
+	}
 }
 
 static void out_tcp_handle_failure(void *selfptr) {
 	ASSERT(selfptr != NULL);
 	out_tcp_ctx_t *self = selfptr;
-	fprintf(stderr, "output_tcp(%s:%s): could not connect, deactivating output\n",
+	fprintf(stderr, "output_tcp(%s:%s): could not initialize, deactivating output\n",
 			self->address, self->port);
-	close(self->sockfd);
-	self->sockfd = 0;
+	out_tcp_handle_shutdown(selfptr);
 }
 
 static const option_descr_t out_tcp_options[] = {
@@ -192,6 +590,14 @@ static const option_descr_t out_tcp_options[] = {
 		.name = "port",
 		.description = "Destination TCP port (required)"
 	},
+	{
+		.name = "queue_size",
+		.description = "Max number of messages waiting to be sent to the socket (default: " STR(TCP_RING_SIZE_DEFAULT) ")"
+	},
+	{
+		.name = "nodelay",
+		.description = "Disable Nagle's algorithm on the connection (true or false, default: true)"
+	},
 	{
 		.name = NULL,
 		.description = NULL
@@ -206,7 +612,9 @@ output_descriptor_t out_DEF_tcp = {
 	.configure = out_tcp_configure,
 	.ctx_destroy = out_tcp_ctx_destroy,
 	.init = out_tcp_init,
-	.produce = out_tcp_produce,
+	.produce = NULL,
+	.produce_batch = out_tcp_produce_batch,
+	.wait_ready = out_tcp_wait_ready,
 	.handle_shutdown = out_tcp_handle_shutdown,
 	.handle_failure = out_tcp_handle_failure
 };
@@ -1,28 +1,55 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
-#include <stdio.h>                      // fprintf
+#define _GNU_SOURCE                     // sendmmsg, struct mmsghdr
+#include <stdio.h>                      // fprintf, snprintf
+#include <stdlib.h>                     // strtol
 #include <string.h>                     // strdup, strerror
 #include <unistd.h>                     // close
 #include <errno.h>                      // errno
 #include <sys/types.h>                  // socket, connect
-#include <sys/socket.h>                 // socket, connect
+#include <sys/socket.h>                 // socket, connect, sendmmsg, sendmsg
+#include <sys/uio.h>                    // struct iovec
 #include <netdb.h>                      // getaddrinfo
-#include "output-common.h"              // output_descriptor_t, output_qentry_t, output_queue_drain
+#include "config.h"                     // HAVE_SENDMMSG, WITH_STATSD
+#include "output-common.h"              // output_descriptor_t, output_qentry_t, OUTPUT_BATCH_SIZE_MAX
 #include "kvargs.h"                     // kvargs, option_descr_t
-#include "util.h"                       // ASSERT
+#include "statsd.h"                     // statsd_timer
+#include "util.h"                       // ASSERT, NEW, XCALLOC, XFREE
+
+// Max datagram length in packing mode (Ethernet MTU minus IPv4 and UDP headers)
+#define UDP_PACKED_LEN_DEFAULT 1472
+#define UDP_PACKED_LEN_MIN 64
+#define UDP_PACKED_LEN_MAX 65507
+
+#ifndef HAVE_SENDMMSG
+struct mmsghdr {
+	struct msghdr msg_hdr;
+	unsigned int msg_len;
+};
+#endif
 
 typedef struct {
 	char *address;
 	char *port;
 	int sockfd;
+	bool pack;                          // combine several messages into a single datagram
+	int32_t max_packed_len;             // max datagram length in packing mode
+	struct iovec *iov;                  // one entry per message
+	struct mmsghdr *msgs;               // one entry per datagram
+#ifdef WITH_STATSD
+	char datagrams_metric[64];
+	char messages_metric[64];
+#endif
 } out_udp_ctx_t;
 
 static bool out_udp_supports_format(output_format_t format) {
-	return(format == OFMT_TEXT || format == OFMT_BASESTATION || format == OFMT_JSON);
+	return(format == OFMT_TEXT || format == OFMT_BASESTATION || format == OFMT_JSON ||
+			format == OFMT_CBOR || format == OFMT_FRAME);
 }
 
-static void *out_udp_configure(kvargs *kv) {
+static void *out_udp_configure(kvargs *kv, int32_t id) {
 	ASSERT(kv != NULL);
 	NEW(out_udp_ctx_t, cfg);
+	cfg->max_packed_len = UDP_PACKED_LEN_DEFAULT;
 	if(kvargs_get(kv, "address") == NULL) {
 		fprintf(stderr, "output_udp: IP address not specified\n");
 		goto fail;
@@ -33,12 +60,54 @@ static void *out_udp_configure(kvargs *kv) {
 		goto fail;
 	}
 	cfg->port = strdup(kvargs_get(kv, "port"));
+	char *val = NULL;
+	if((val = kvargs_get(kv, "pack")) != NULL) {
+		if(strcmp(val, "true") == 0 || strcmp(val, "1") == 0) {
+			cfg->pack = true;
+		} else if(strcmp(val, "false") == 0 || strcmp(val, "0") == 0) {
+			cfg->pack = false;
+		} else {
+			fprintf(stderr, "output_udp: pack: invalid value '%s' (must be true or false)\n", val);
+			goto fail;
+		}
+	}
+	if((val = kvargs_get(kv, "mtu")) != NULL) {
+		char *endptr = NULL;
+		long len = strtol(val, &endptr, 10);
+		if(endptr == val || *endptr != '\0' || len < UDP_PACKED_LEN_MIN || len > UDP_PACKED_LEN_MAX) {
+			fprintf(stderr, "output_udp: mtu: invalid value '%s' (must be in range %d-%d)\n",
+					val, UDP_PACKED_LEN_MIN, UDP_PACKED_LEN_MAX);
+			goto fail;
+		}
+		cfg->max_packed_len = (int32_t)len;
+	}
+	cfg->iov = XCALLOC(OUTPUT_BATCH_SIZE_MAX, sizeof(struct iovec));
+	cfg->msgs = XCALLOC(OUTPUT_BATCH_SIZE_MAX, sizeof(struct mmsghdr));
+#ifdef WITH_STATSD
+	snprintf(cfg->datagrams_metric, sizeof(cfg->datagrams_metric), "outputs.%d.syscall.datagrams", id);
+	snprintf(cfg->messages_metric, sizeof(cfg->messages_metric), "outputs.%d.syscall.messages", id);
+#else
+	UNUSED(id);
+#endif
 	return cfg;
 fail:
+	XFREE(cfg->address);
+	XFREE(cfg->port);
 	XFREE(cfg);
 	return NULL;
 }
 
+static void out_udp_ctx_destroy(void *ctxptr) {
+	if(ctxptr != NULL) {
+		out_udp_ctx_t *ctx = ctxptr;
+		XFREE(ctx->iov);
+		XFREE(ctx->msgs);
+		XFREE(ctx->address);
+		XFREE(ctx->port);
+		XFREE(ctx);
+	}
+}
+
 static int out_udp_init(void *selfptr) {
 	ASSERT(selfptr != NULL);
 	out_udp_ctx_t *self = selfptr;
@@ -75,35 +144,75 @@ static int out_udp_init(void *selfptr) {
 	return 0;
 }
 
-static int out_udp_produce_text(out_udp_ctx_t *self, struct metadata *metadata, struct octet_string *msg) {
-	UNUSED(metadata);
-	ASSERT(msg != NULL);
-	ASSERT(self->sockfd != 0);
-	if(msg->len < 2) {
-		return 0;
-	}
-	if(write(self->sockfd, msg->buf, msg->len) < 0) {
-		return -1;
-	}
-	return 0;
+// Sends datagrams starting from msgs. Returns the number of datagrams sent
+// (possibly less than cnt) or -1 if the first one could not be sent.
+static int out_udp_send(out_udp_ctx_t *self, struct mmsghdr *msgs, int32_t cnt) {
+#ifdef HAVE_SENDMMSG
+	return sendmmsg(self->sockfd, msgs, cnt, 0);
+#else
+	UNUSED(cnt);
+	return sendmsg(self->sockfd, &msgs->msg_hdr, 0) < 0 ? -1 : 1;
+#endif
 }
 
-static int out_udp_produce(void *selfptr, output_format_t format, struct metadata *metadata, struct octet_string *msg) {
+// Sends the batch with as few syscalls as possible. In packing mode,
+// consecutive messages are combined into a single datagram, as long as it
+// does not grow beyond max_packed_len. A message which is longer than that
+// is sent in a datagram of its own. No data is copied - each datagram is
+// gathered from message buffers.
+static int32_t out_udp_produce_batch(void *selfptr, output_qentry_t * const *batch, int32_t cnt) {
 	ASSERT(selfptr != NULL);
+	ASSERT(cnt <= OUTPUT_BATCH_SIZE_MAX);
 	out_udp_ctx_t *self = selfptr;
-	int32_t result = 0;
-	if(format == OFMT_TEXT || format == OFMT_JSON || format == OFMT_BASESTATION) {
-		result = out_udp_produce_text(self, metadata, msg);
+	ASSERT(self->sockfd != 0);
+
+	int32_t dgram_cnt = 0, iov_cnt = 0;
+	size_t dgram_len = 0;
+	for(int32_t i = 0; i < cnt; i++) {
+		struct octet_string const *msg = batch[i]->msg;
+		ASSERT(msg != NULL);
+		if(msg->len < 2) {
+			continue;
+		}
+		if(dgram_cnt == 0 || self->pack == false || dgram_len + msg->len > (size_t)self->max_packed_len) {
+			struct msghdr *hdr = &self->msgs[dgram_cnt++].msg_hdr;
+			memset(hdr, 0, sizeof(*hdr));
+			hdr->msg_iov = &self->iov[iov_cnt];
+			dgram_len = 0;
+		}
+		self->iov[iov_cnt].iov_base = msg->buf;
+		self->iov[iov_cnt].iov_len = msg->len;
+		iov_cnt++;
+		self->msgs[dgram_cnt - 1].msg_hdr.msg_iovlen++;
+		dgram_len += msg->len;
 	}
-	if(result < 0) {
-		// UDP output is fire-and-forget by definition.
-		// Return 0 regardless of whether the send succeeded or not,
-		// but print an error to help with diagnosing common issues,
-		// (eg. nothing listening on the receiver port).
-		fprintf(stderr, "output_udp(%s:%s): send error: %s\n", self->address,
-			self->port,	strerror(errno));
+
+	for(int32_t sent = 0; sent < dgram_cnt; ) {
+		int ret = out_udp_send(self, self->msgs + sent, dgram_cnt - sent);
+		if(ret < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			// UDP output is fire-and-forget by definition.
+			// Skip the datagram regardless of whether the send succeeded or not,
+			// but print an error to help with diagnosing common issues,
+			// (eg. nothing listening on the receiver port).
+			fprintf(stderr, "output_udp(%s:%s): send error: %s\n", self->address,
+					self->port, strerror(errno));
+			sent++;
+			continue;
+		}
+#ifdef WITH_STATSD
+		int32_t msg_cnt = 0;
+		for(int32_t i = sent; i < sent + ret; i++) {
+			msg_cnt += self->msgs[i].msg_hdr.msg_iovlen;
+		}
+		statsd_timer(self->datagrams_metric, ret);
+		statsd_timer(self->messages_metric, msg_cnt);
+#endif
+		sent += ret;
 	}
-	return 0;
+	return cnt;
 }
 
 static void out_udp_handle_shutdown(void *selfptr) {
@@ -130,6 +239,14 @@ static const option_descr_t out_udp_options[] = {
 		.name = "port",
 		.description = "Destination UDP port (required)"
 	},
+	{
+		.name = "pack",
+		.description = "Combine several messages into one datagram (true or false, default: false)"
+	},
+	{
+		.name = "mtu",
+		.description = "Max length of a combined datagram (default: " STR(UDP_PACKED_LEN_DEFAULT) ")"
+	},
 	{
 		.name = NULL,
 		.description = NULL
@@ -142,8 +259,10 @@ output_descriptor_t out_DEF_udp = {
 	.options = out_udp_options,
 	.supports_format = out_udp_supports_format,
 	.configure = out_udp_configure,
+	.ctx_destroy = out_udp_ctx_destroy,
 	.init = out_udp_init,
-	.produce = out_udp_produce,
+	.produce = NULL,
+	.produce_batch = out_udp_produce_batch,
 	.handle_shutdown = out_udp_handle_shutdown,
 	.handle_failure = out_udp_handle_failure
 };
@@ -4,7 +4,8 @@
 #include <errno.h>                      // errno
 #include <zmq.h>                        // zmq_*
 #include "config.h"                     // LIBZMQ_VER_*
-#include "output-common.h"              // output_descriptor_t, output_qentry_t, output_queue_drain
+#include "output-common.h"              // output_descriptor_t, output_qentry_t, output_qentry_*
+#include "filter.h"                     // struct msg_props, msg_props_topic_format, MSG_PROPS_TOPIC
 #include "kvargs.h"                     // kvargs
 #include "options.h"                    // option_descr_t
 #include "util.h"                       // ASSERT, NEW
@@ -19,13 +20,17 @@ typedef struct {
 	void *zmq_ctx;
 	void *zmq_sock;
 	out_zmq_mode_t mode;
+	bool topic;                         // send a topic frame before each message
+	output_qentry_t *partial;           // message whose topic frame has been sent, but the payload has not
 } out_zmq_ctx_t;
 
 static bool out_zmq_supports_format(output_format_t format) {
-	return(format == OFMT_TEXT || format == OFMT_BASESTATION || format == OFMT_JSON);
+	return(format == OFMT_TEXT || format == OFMT_BASESTATION || format == OFMT_JSON ||
+			format == OFMT_CBOR || format == OFMT_FRAME);
 }
 
-static void *out_zmq_configure(kvargs *kv) {
+static void *out_zmq_configure(kvargs *kv, int32_t id) {
+	UNUSED(id);
 	ASSERT(kv != NULL);
 	NEW(out_zmq_ctx_t, cfg);
 
@@ -55,8 +60,20 @@ static void *out_zmq_configure(kvargs *kv) {
 		fprintf(stderr, "output_zmq: mode '%s' is invalid; must be either 'client' or 'server'\n", mode);
 		goto fail;
 	}
+	char *val = NULL;
+	if((val = kvargs_get(kv, "topic")) != NULL) {
+		if(strcmp(val, "true") == 0 || strcmp(val, "1") == 0) {
+			cfg->topic = true;
+		} else if(strcmp(val, "false") == 0 || strcmp(val, "0") == 0) {
+			cfg->topic = false;
+		} else {
+			fprintf(stderr, "output_zmq: topic: invalid value '%s' (must be true or false)\n", val);
+			goto fail;
+		}
+	}
 	return cfg;
 fail:
+	XFREE(cfg->endpoint);
 	XFREE(cfg);
 	return NULL;
 }
@@ -93,37 +110,94 @@ static int out_zmq_init(void *selfptr) {
 	return 0;
 }
 
-static int out_zmq_produce_text(out_zmq_ctx_t *self, struct metadata *metadata, struct octet_string *msg) {
-	UNUSED(metadata);
+static uint32_t out_zmq_props_wanted(void *selfptr) {
+	ASSERT(selfptr != NULL);
+	out_zmq_ctx_t *self = selfptr;
+	return self->topic ? MSG_PROPS_TOPIC : 0;
+}
+
+// Called by libzmq (possibly from its I/O thread) when the message has been sent
+static void out_zmq_msg_free(void *data, void *hint) {
+	UNUSED(data);
+	output_qentry_unref(hint);
+}
+
+// Sends the payload frame without copying it. The frame points directly to
+// the serialized message buffer. The queue entry is kept alive by an additional
+// reference which is dropped by libzmq once the frame has been sent.
+static int32_t out_zmq_send_payload(out_zmq_ctx_t *self, output_qentry_t *q) {
+	struct octet_string const *msg = q->msg;
+	zmq_msg_t frame;
+	if(zmq_msg_init_data(&frame, msg->buf, msg->len, out_zmq_msg_free, output_qentry_ref(q)) < 0) {
+		output_qentry_unref(q);
+		return -1;
+	}
+	if(zmq_msg_send(&frame, self->zmq_sock, ZMQ_DONTWAIT) < 0) {
+		zmq_msg_close(&frame);      // drops the reference
+		return -1;
+	}
+	return 0;
+}
+
+static int32_t out_zmq_send(out_zmq_ctx_t *self, output_qentry_t *q) {
+	struct octet_string const *msg = q->msg;
 	ASSERT(msg != NULL);
-	ASSERT(self->zmq_sock != 0);
+	// A multipart message is only sent when its last frame is. If the payload
+	// of the previous message could not be sent after its topic frame, the
+	// multipart is still open - complete it before sending anything else.
+	// Sending the topic again would add a frame to the pending message.
+	if(self->partial != NULL) {
+		if(out_zmq_send_payload(self, self->partial) < 0) {
+			return -1;
+		}
+		bool same = self->partial == q;
+		output_qentry_unref(self->partial);
+		self->partial = NULL;
+		if(same) {
+			return 0;
+		}
+	}
 	if(msg->len < 2) {
 		return 0;
 	}
-	if(zmq_send(self->zmq_sock, msg->buf, msg->len, 0) < 0) {
-		return -1;
+	if(self->topic) {
+		char topic[32] = "";
+		int32_t topic_len = 0;
+		if(q->props != NULL) {
+			topic_len = msg_props_topic_format(q->props, topic, sizeof(topic));
+		}
+		// The topic is short, so it's cheaper to copy it than to allocate it
+		if(zmq_send(self->zmq_sock, topic, topic_len, ZMQ_SNDMORE) < 0) {
+			return -1;
+		}
+		if(out_zmq_send_payload(self, q) < 0) {
+			self->partial = output_qentry_ref(q);
+			return -1;
+		}
+		return 0;
 	}
-	return 0;
+	return out_zmq_send_payload(self, q);
 }
 
-static int out_zmq_produce(void *selfptr, output_format_t format, struct metadata *metadata, struct octet_string *msg) {
+static int32_t out_zmq_produce_batch(void *selfptr, output_qentry_t * const *batch, int32_t cnt) {
 	ASSERT(selfptr != NULL);
 	out_zmq_ctx_t *self = selfptr;
-	int32_t result = 0;
-	if(format == OFMT_TEXT || format == OFMT_JSON || format == OFMT_BASESTATION) {
-		result = out_zmq_produce_text(self, metadata, msg);
-	}
-	if(result < 0) {
-		fprintf(stderr, "output_zmq(%s): zmq_send error: %s\n", self->endpoint, zmq_strerror(errno));
-		return -1;
+	ASSERT(self->zmq_sock != 0);
+	for(int32_t i = 0; i < cnt; i++) {
+		if(out_zmq_send(self, batch[i]) < 0) {
+			fprintf(stderr, "output_zmq(%s): zmq_send error: %s\n", self->endpoint, zmq_strerror(errno));
+			return i;
+		}
 	}
-	return 0;
+	return cnt;
 }
 
 static void out_zmq_handle_shutdown(void *selfptr) {
 	ASSERT(selfptr != NULL);
 	out_zmq_ctx_t *self = selfptr;
 	fprintf(stderr, "output_zmq(%s): shutting down\n", self->endpoint);
+	output_qentry_unref(self->partial);
+	self->partial = NULL;
 	zmq_close(self->zmq_sock);
 	zmq_ctx_destroy(self->zmq_ctx);
 }
@@ -144,6 +218,10 @@ static const option_descr_t out_zmq_options[] = {
 		.name= "endpoint",
 		.description = "Socket endpoint: tcp://address:port (required)"
 	},
+	{
+		.name = "topic",
+		.description = "Precede each message with a topic frame: <freq_khz>/<gs_id>/<msg_type> (true or false, default: false)"
+	},
 	{
 		.name = NULL,
 		.description = NULL
@@ -157,7 +235,9 @@ output_descriptor_t out_DEF_zmq = {
 	.supports_format = out_zmq_supports_format,
 	.configure = out_zmq_configure,
 	.init = out_zmq_init,
-	.produce = out_zmq_produce,
+	.produce = NULL,
+	.produce_batch = out_zmq_produce_batch,
+	.props_wanted = out_zmq_props_wanted,
 	.handle_shutdown = out_zmq_handle_shutdown,
 	.handle_failure = out_zmq_handle_failure
 };
@@ -1,66 +1,317 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdatomic.h>              // atomic_*
+#include <inttypes.h>               // PRIu64
 #include <string.h>                 // memcpy
-#include <glib.h>                   // GAsyncQueue, g_async_queue_*
+#include <stdio.h>                  // fprintf, snprintf
+#include <time.h>                   // clock_gettime
+#include <unistd.h>                 // usleep
+#include <pthread.h>                // pthread_mutex_*, pthread_cond_*
+#include <glib.h>                   // GAsyncQueue, g_async_queue_*, GHashTable, g_hash_table_*
 #include <libacars/libacars.h>      // la_proto_tree_destroy()
 #include <libacars/list.h>          // la_list_*
 #include <libacars/reassembly.h>    // la_reasm_ctx, la_reasm_ctx_new()
-#include "util.h"                   // NEW, ASSERT, struct octet_string
-#include "output-common.h"          // output_queue_push, shutdown_outputs
+#include "util.h"                   // NEW, ASSERT, XCALLOC, XREALLOC, max, start_thread, struct octet_string
+#include "output-common.h"          // output_queue_push, output_qentry_*, shutdown_outputs,
+                                    // fmtr_instance_outputs_select
+#include "metadata.h"               // metadata_copy, metadata_ref, metadata_unref
 #include "crc.h"                    // crc16_ccitt
 #include "mpdu.h"                   // mpdu_parse
 #include "spdu.h"                   // spdu_parse
 #include "statsd.h"                 // statsd_*
+#include "arena.h"                  // arena_*, frame_arena_set
+#include "dedup.h"                  // dedup_*
 #include "pdu.h"                    // struct hfdl_pdu_metadata
 
-struct hfdl_pdu_qentry {
-	struct metadata *metadata;
-	struct octet_string *pdu;
-	uint32_t flags;
+// Chunk size of the per-thread frame arena. This is enough for all
+// protocol structures of a typical frame. The arena grows if necessary.
+#define FRAME_ARENA_CHUNK_SIZE 4096
+
+// How often the deduplicator thread checks for held frames to be released
+// when no new frames arrive (milliseconds)
+#define PDU_DEDUP_POLL_INTERVAL_MS 100
+
+// Slot flag - the frame has been held by the deduplicator and it is now
+// passed to the decoder (must not collide with OUT_FLAG_* values)
+#define PDU_SLOT_DEDUP_RELEASED (1 << 1)
+
+// Bounded multi-producer, single-consumer ring of preallocated frame slots.
+// Channel threads claim a slot, fill it in place and commit it. The decoder
+// thread processes committed slots in place, in the order they have been
+// claimed, and then hands them back. Each slot carries a turn counter which
+// tells whether it is free for the producer claiming position pos
+// (turn == pos), or filled and ready for the consumer (turn == pos + 1).
+// The consumer only takes the lock when it has to sleep.
+struct pdu_ring {
+	struct hfdl_pdu_slot *slots;
+	uint32_t mask;                  // slot count - 1
+	_Atomic uint32_t head;          // next position to be claimed
+	_Atomic uint32_t tail;          // next position to be consumed (written by the consumer only)
+	_Atomic bool waiting;           // consumer is sleeping on cond
+	_Atomic uint64_t overflow_cnt;  // frames dropped because the ring was full
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+// Frames are distributed between decoder threads (shards) by channel
+// frequency, so that all frames from a given channel are processed by the
+// same thread in the order of arrival. This keeps ACARS reassembly (which is
+// per-shard) and aircraft cache updates (which are per-channel) consistent.
+struct pdu_decoder_shard {
+	struct pdu_ring ring;
+	la_list *fmtr_list;
+	struct pdu_merge_ctx *merge;    // NULL if ordered output is disabled
+	int32_t id;
+	bool active;
+	// Processing time statistics (collected when timing is enabled)
+	uint64_t frame_cnt;             // frames processed
+	uint64_t parsed_cnt;            // frames passed to mpdu_parse() or spdu_parse()
+	double parse_time;              // seconds spent in mpdu_parse() and spdu_parse()
+	double format_time;             // seconds spent in formatters (and output filters)
+	double first_frame_time;        // monotonic clock reading before the first frame
+	double last_frame_time;         // monotonic clock reading after the last frame
+};
+
+// Output messages produced from a single frame. When ordered output is
+// enabled, shards pass these to the merge thread which sends them to outputs
+// in the order in which frames have been received from the channels.
+struct pdu_merge_entry {
+	la_list *msgs;                  // list of struct pdu_merge_msg
+	uint32_t seq;
+	bool shard_done;                // shard has terminated, no more entries will follow
+};
+
+struct pdu_merge_msg {
+	la_list *outputs;
+	output_qentry_t *qentry;
+	bool free_outputs;              // outputs is a list selected by output filters
 };
 
-static GAsyncQueue *pdu_decoder_queue;
-static bool pdu_decoder_thread_active = false;
+struct pdu_merge_ctx {
+	GAsyncQueue *q;
+	la_list *fmtr_list;
+	int32_t shard_cnt;
+	bool active;
+};
+
+struct freq_shard_map_entry {
+	int32_t freq;
+	int32_t shard;
+};
+
+#ifdef WITH_STATSD
+static char *pdu_decoder_counters[] = {
+	"decoder.formats.skipped",
+	"decoder.msgs.filtered",
+	NULL
+};
+#endif
+
+static struct pdu_decoder_shard *pdu_decoder_shards;
+static int32_t pdu_decoder_shard_cnt;
+static struct pdu_merge_ctx *pdu_merge;
+static struct dedup *pdu_dedup;                 // NULL if deduplication is disabled
+static bool pdu_dedup_active;                   // deduplicator thread is running
+static int32_t pdu_decoder_running_cnt;         // shards which have not terminated yet
+static _Atomic uint32_t pdu_decoder_seq;        // sequence number of the next frame
+static struct freq_shard_map_entry *freq_shard_map;
+static int32_t freq_shard_map_len;
+static pthread_mutex_t pdu_decoder_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool pdu_decoder_timing;                 // collect processing time statistics
 
 /******************************
  * Forward declarations
  ******************************/
 
 static void *pdu_decoder_thread(void *ctx);
+static void *pdu_merge_thread(void *ctx);
+static void *pdu_dedup_thread(void *ctx);
 static struct metadata_vtable hfdl_pdu_metadata_vtable;
+static struct dedup_vtable pdu_dedup_vtable;
+static void pdu_ring_init(struct pdu_ring *r, uint32_t len);
+static struct hfdl_pdu_slot *pdu_ring_claim(struct pdu_ring *r);
+static void pdu_ring_commit(struct pdu_ring *r, struct hfdl_pdu_slot *slot);
+static struct hfdl_pdu_slot *pdu_ring_consume(struct pdu_ring *r);
+static void pdu_ring_release(struct pdu_ring *r, struct hfdl_pdu_slot *slot);
+static uint32_t pdu_ring_length(struct pdu_ring *r);
 
 /******************************
  * Public methods
  ******************************/
 
-void pdu_decoder_queue_push(struct metadata *metadata, struct octet_string *pdu, uint32_t flags) {
-	NEW(struct hfdl_pdu_qentry, qentry);
-	qentry->metadata = metadata;
-	qentry->pdu = pdu;
-	qentry->flags = flags;
-	g_async_queue_push(pdu_decoder_queue, qentry);
+// Returns the decoder thread which handles frames from the given channel.
+// Shards are assigned to channel frequencies in a round-robin fashion, as
+// they appear, so that the load is spread evenly. Channels call this once
+// and cache the result.
+int32_t hfdl_pdu_decoder_shard_get(int32_t freq) {
+	pthread_mutex_lock(&pdu_decoder_lock);
+	for(int32_t i = 0; i < freq_shard_map_len; i++) {
+		if(freq_shard_map[i].freq == freq) {
+			int32_t shard = freq_shard_map[i].shard;
+			pthread_mutex_unlock(&pdu_decoder_lock);
+			return shard;
+		}
+	}
+	freq_shard_map = XREALLOC(freq_shard_map, (freq_shard_map_len + 1) * sizeof(struct freq_shard_map_entry));
+	int32_t shard = freq_shard_map_len % pdu_decoder_shard_cnt;
+	freq_shard_map[freq_shard_map_len].freq = freq;
+	freq_shard_map[freq_shard_map_len].shard = shard;
+	freq_shard_map_len++;
+	pthread_mutex_unlock(&pdu_decoder_lock);
+	debug_print(D_MISC, "%d Hz: assigned to decoder shard %d\n", freq, shard);
+	return shard;
+}
+
+// Claims a free frame slot in the input queue of the given decoder thread.
+// The caller fills in the metadata and the PDU and passes the slot to
+// pdu_decoder_slot_commit(). Returns NULL if the queue is full - the frame
+// is then counted as dropped.
+struct hfdl_pdu_slot *pdu_decoder_slot_claim(int32_t shard) {
+	struct hfdl_pdu_slot *slot = pdu_decoder_slot_try_claim(shard);
+	if(slot == NULL) {
+		atomic_fetch_add(&pdu_decoder_shards[shard].ring.overflow_cnt, 1);
+	}
+	return slot;
+}
+
+// Same as pdu_decoder_slot_claim(), but a full queue is not counted as a
+// dropped frame. For producers which are able to wait and retry (replay).
+struct hfdl_pdu_slot *pdu_decoder_slot_try_claim(int32_t shard) {
+	ASSERT(shard >= 0 && shard < pdu_decoder_shard_cnt);
+	struct hfdl_pdu_slot *slot = pdu_ring_claim(&pdu_decoder_shards[shard].ring);
+	if(slot == NULL) {
+		return NULL;
+	}
+	slot->shard = shard;
+	slot->flags = 0;
+	slot->len = 0;
+	slot->seq = atomic_fetch_add(&pdu_decoder_seq, 1);
+	return slot;
 }
 
-void hfdl_pdu_decoder_init(void) {
-	pdu_decoder_queue = g_async_queue_new();
+void pdu_decoder_slot_commit(struct hfdl_pdu_slot *slot) {
+	ASSERT(slot != NULL);
+	ASSERT(slot->len <= HFDL_PDU_LEN_MAX);
+	pdu_ring_commit(&pdu_decoder_shards[slot->shard].ring, slot);
+}
+
+// shard_cnt is the number of decoder threads to start. If ordered is true,
+// then decoded messages are sent to outputs in the same order in which
+// frames have been received from the channels (which is always the case
+// when there is only one decoder thread). If dedup_window is non-zero,
+// copies of a frame received again within this many seconds (on any
+// channel) are dropped and only the copy with the best signal is decoded.
+// realtime is true when frames are received live (and not replayed).
+void hfdl_pdu_decoder_init(int32_t shard_cnt, bool ordered, int32_t dedup_window, bool realtime) {
+	ASSERT(shard_cnt > 0);
+#ifdef WITH_STATSD
+	statsd_initialize_counter_set(pdu_decoder_counters);
+#endif
+	if(dedup_window > 0) {
+		pdu_dedup = dedup_create(dedup_window, realtime, &pdu_dedup_vtable);
+	}
+	pdu_decoder_shard_cnt = shard_cnt;
+	pdu_decoder_shards = XCALLOC(shard_cnt, sizeof(struct pdu_decoder_shard));
+	for(int32_t i = 0; i < shard_cnt; i++) {
+		pdu_ring_init(&pdu_decoder_shards[i].ring, PDU_DECODER_QUEUE_LEN);
+		pdu_decoder_shards[i].id = i;
+	}
+	if(ordered && shard_cnt > 1) {
+		NEW(struct pdu_merge_ctx, merge);
+		merge->q = g_async_queue_new();
+		merge->shard_cnt = shard_cnt;
+		pdu_merge = merge;
+		for(int32_t i = 0; i < shard_cnt; i++) {
+			pdu_decoder_shards[i].merge = merge;
+		}
+	}
 }
 
 int32_t hfdl_pdu_decoder_start(void *ctx) {
-	pthread_t pdu_th;
-	int32_t ret = start_thread(&pdu_th, pdu_decoder_thread, ctx);
-	if(ret == 0) {
-		pdu_decoder_thread_active = true;
+	pthread_t th;
+	if(pdu_dedup != NULL) {
+		pdu_dedup_active = true;
+		if(start_thread(&th, pdu_dedup_thread, NULL) != 0) {
+			pdu_dedup_active = false;
+			return -1;
+		}
+	}
+	if(pdu_merge != NULL) {
+		pdu_merge->fmtr_list = ctx;
+		pdu_merge->active = true;
+		if(start_thread(&th, pdu_merge_thread, pdu_merge) != 0) {
+			pdu_merge->active = false;
+			return -1;
+		}
 	}
-	return ret;
+	for(int32_t i = 0; i < pdu_decoder_shard_cnt; i++) {
+		struct pdu_decoder_shard *shard = &pdu_decoder_shards[i];
+		shard->fmtr_list = ctx;
+		shard->active = true;
+		pthread_mutex_lock(&pdu_decoder_lock);
+		pdu_decoder_running_cnt++;
+		pthread_mutex_unlock(&pdu_decoder_lock);
+		if(start_thread(&th, pdu_decoder_thread, shard) != 0) {
+			shard->active = false;
+			return -1;
+		}
+	}
+	if(pdu_decoder_shard_cnt > 1) {
+		fprintf(stderr, "Started %d decoder threads%s\n", pdu_decoder_shard_cnt,
+				pdu_merge != NULL ? " with ordered output" : "");
+	}
+	return 0;
 }
 
 void hfdl_pdu_decoder_stop(void) {
-	pdu_decoder_queue_push(NULL, NULL, OUT_FLAG_ORDERED_SHUTDOWN);
+	// Frames held by the deduplicator must be decoded before the shutdown
+	// request reaches decoder threads
+	if(pdu_dedup != NULL) {
+		dedup_close(pdu_dedup);
+		while(pdu_dedup_active) {
+			usleep(10000);
+		}
+	}
+	for(int32_t i = 0; i < pdu_decoder_shard_cnt; i++) {
+		struct hfdl_pdu_slot *slot;
+		// Wait for a free slot - the shutdown request must not be dropped
+		while((slot = pdu_ring_claim(&pdu_decoder_shards[i].ring)) == NULL) {
+			usleep(10000);
+		}
+		slot->shard = i;
+		slot->flags = OUT_FLAG_ORDERED_SHUTDOWN;
+		pdu_ring_commit(&pdu_decoder_shards[i].ring, slot);
+	}
+}
+
+// Enables collection of processing time statistics printed with
+// hfdl_pdu_decoder_print_timing(). Must be called before the decoder is started.
+void hfdl_pdu_decoder_timing_enable(void) {
+	pdu_decoder_timing = true;
 }
 
 bool hfdl_pdu_decoder_is_running(void) {
-	return pdu_decoder_thread_active;
+	for(int32_t i = 0; i < pdu_decoder_shard_cnt; i++) {
+		if(pdu_decoder_shards[i].active) {
+			return true;
+		}
+	}
+	return pdu_merge != NULL && pdu_merge->active;
+}
+
+// Reports decoder queue lengths via StatsD
+void hfdl_pdu_decoder_report_stats(void) {
+#ifdef WITH_STATSD
+	char metric[64];
+	for(int32_t i = 0; i < pdu_decoder_shard_cnt; i++) {
+		snprintf(metric, sizeof(metric), "decoder.shards.%d.queue_depth", i);
+		statsd_set(metric, pdu_ring_length(&pdu_decoder_shards[i].ring));
+	}
+	if(pdu_merge != NULL) {
+		statsd_set("decoder.merge.queue_depth", (size_t)max(g_async_queue_length(pdu_merge->q), 0));
+	}
+#endif
 }
 
 // Compute FCS over the first hdr_len octets of buf.
@@ -78,22 +329,188 @@ bool hfdl_pdu_fcs_check(uint8_t *buf, uint32_t hdr_len) {
 	return true;
 }
 
-struct metadata *hfdl_pdu_metadata_create() {
-	NEW(struct hfdl_pdu_metadata, m);
-	m->metadata.vtable = &hfdl_pdu_metadata_vtable;
-	return &m->metadata;
+// Returns the number of frames dropped so far as duplicates.
+uint64_t hfdl_pdu_decoder_duplicate_frame_count(void) {
+	return pdu_dedup != NULL ? dedup_duplicate_count(pdu_dedup) : 0;
+}
+
+// Returns the number of frames dropped so far because decoder queues were full.
+uint64_t hfdl_pdu_decoder_dropped_frame_count(void) {
+	uint64_t cnt = 0;
+	for(int32_t i = 0; i < pdu_decoder_shard_cnt; i++) {
+		cnt += atomic_load(&pdu_decoder_shards[i].ring.overflow_cnt);
+	}
+	return cnt;
+}
+
+// Prints the frame rate of the protocol layer. Must be called after all
+// decoder threads have terminated.
+void hfdl_pdu_decoder_print_timing(void) {
+	if(!pdu_decoder_timing) {
+		return;
+	}
+	uint64_t frame_cnt = 0, parsed_cnt = 0;
+	double parse_time = 0.0, format_time = 0.0;
+	double first = 0.0, last = 0.0;
+	for(int32_t i = 0; i < pdu_decoder_shard_cnt; i++) {
+		struct pdu_decoder_shard *shard = &pdu_decoder_shards[i];
+		if(shard->frame_cnt == 0) {
+			continue;
+		}
+		if(frame_cnt == 0 || shard->first_frame_time < first) {
+			first = shard->first_frame_time;
+		}
+		if(shard->last_frame_time > last) {
+			last = shard->last_frame_time;
+		}
+		frame_cnt += shard->frame_cnt;
+		parsed_cnt += shard->parsed_cnt;
+		parse_time += shard->parse_time;
+		format_time += shard->format_time;
+	}
+	#define RATE(cnt, t) ((t) > 0.0 ? (double)(cnt) / (t) : 0.0)
+	fprintf(stderr, "Decoder: %" PRIu64 " frames in %.3f s (%.0f frames/s)\n",
+			frame_cnt, last - first, RATE(frame_cnt, last - first));
+	fprintf(stderr, "Decoder: parsing: %" PRIu64 " frames in %.3f s (%.0f frames/s), "
+			"formatting: %" PRIu64 " frames in %.3f s (%.0f frames/s)\n",
+			parsed_cnt, parse_time, RATE(parsed_cnt, parse_time),
+			frame_cnt, format_time, RATE(frame_cnt, format_time));
+	#undef RATE
 }
 
 /****************************************
  * Private variables and methods
  ****************************************/
 
+static double pdu_decoder_clock(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void pdu_ring_init(struct pdu_ring *r, uint32_t len) {
+	ASSERT(len > 0 && (len & (len - 1)) == 0);
+	r->slots = XCALLOC(len, sizeof(struct hfdl_pdu_slot));
+	r->mask = len - 1;
+	for(uint32_t i = 0; i < len; i++) {
+		atomic_init(&r->slots[i].turn, i);
+		r->slots[i].metadata.metadata.vtable = &hfdl_pdu_metadata_vtable;
+	}
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	atomic_init(&r->waiting, false);
+	atomic_init(&r->overflow_cnt, 0);
+	ASSERT(pthread_mutex_initialize(&r->lock) == 0);
+	ASSERT(pthread_cond_initialize(&r->cond) == 0);
+}
+
+// Returns NULL if the ring is full.
+static struct hfdl_pdu_slot *pdu_ring_claim(struct pdu_ring *r) {
+	uint32_t pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+	while(true) {
+		struct hfdl_pdu_slot *slot = &r->slots[pos & r->mask];
+		uint32_t turn = atomic_load_explicit(&slot->turn, memory_order_acquire);
+		int32_t diff = (int32_t)(turn - pos);
+		if(diff == 0) {
+			if(atomic_compare_exchange_weak_explicit(&r->head, &pos, pos + 1,
+						memory_order_relaxed, memory_order_relaxed)) {
+				slot->pos = pos;
+				return slot;
+			}
+		} else if(diff < 0) {
+			// The slot has not been consumed yet since the last round
+			return NULL;
+		} else {
+			pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+		}
+	}
+}
+
+static void pdu_ring_commit(struct pdu_ring *r, struct hfdl_pdu_slot *slot) {
+	atomic_store(&slot->turn, slot->pos + 1);
+	if(atomic_load(&r->waiting)) {
+		pthread_mutex_lock(&r->lock);
+		pthread_cond_signal(&r->cond);
+		pthread_mutex_unlock(&r->lock);
+	}
+}
+
+static bool pdu_ring_is_ready(struct pdu_ring *r) {
+	return atomic_load(&r->slots[r->tail & r->mask].turn) == r->tail + 1;
+}
+
+// Waits for the next slot to be committed and returns it.
+static struct hfdl_pdu_slot *pdu_ring_consume(struct pdu_ring *r) {
+	if(!pdu_ring_is_ready(r)) {
+		pthread_mutex_lock(&r->lock);
+		atomic_store(&r->waiting, true);
+		while(!pdu_ring_is_ready(r)) {
+			pthread_cond_wait(&r->cond, &r->lock);
+		}
+		atomic_store(&r->waiting, false);
+		pthread_mutex_unlock(&r->lock);
+	}
+	return &r->slots[r->tail & r->mask];
+}
+
+// Hands the slot returned by pdu_ring_consume() back to producers.
+static void pdu_ring_release(struct pdu_ring *r, struct hfdl_pdu_slot *slot) {
+	atomic_store_explicit(&slot->turn, r->tail + r->mask + 1, memory_order_release);
+	r->tail++;
+}
+
+static uint32_t pdu_ring_length(struct pdu_ring *r) {
+	// Approximate, as the consumer may be advancing concurrently
+	return atomic_load(&r->head) - r->tail;
+}
+
+// Sends a formatted message to outputs directly or, if ordered output is
+// enabled, adds it to the list of messages to be passed to the merge thread.
+// Takes over msg, props and a reference to metadata. All outputs share a single
+// queue entry, so msg and metadata are not copied. If free_outputs is true,
+// the list of outputs is taken over as well.
+static void pdu_decoder_output(la_list *outputs, bool free_outputs, struct octet_string *msg_text,
+		struct metadata *metadata, struct msg_props *props, output_format_t format, la_list **merge_msgs) {
+	output_qentry_t *qentry = output_qentry_new(msg_text, metadata_ref(metadata), format, 0);
+	qentry->props = props;
+	if(merge_msgs == NULL) {
+		la_list_foreach(outputs, output_queue_push, qentry);
+		output_qentry_unref(qentry);
+		if(free_outputs) {
+			la_list_free(outputs);
+		}
+	} else {
+		NEW(struct pdu_merge_msg, msg);
+		msg->outputs = outputs;
+		msg->qentry = qentry;
+		msg->free_outputs = free_outputs;
+		*merge_msgs = la_list_append(*merge_msgs, msg);
+	}
+}
+
+static void pdu_merge_msg_destroy(void *data) {
+	if(data != NULL) {
+		struct pdu_merge_msg *msg = data;
+		output_qentry_unref(msg->qentry);
+		if(msg->free_outputs) {
+			la_list_free(msg->outputs);
+		}
+		XFREE(msg);
+	}
+}
+
 static void *pdu_decoder_thread(void *ctx) {
 	ASSERT(ctx != NULL);
-	la_list *fmtr_list = ctx;
-	struct hfdl_pdu_qentry *q = NULL;
+	struct pdu_decoder_shard *shard = ctx;
+	la_list *fmtr_list = shard->fmtr_list;
+	struct hfdl_pdu_slot *slot = NULL;
+	struct metadata *metadata = NULL;
+	struct metadata *msg_metadata = NULL;   // metadata copy shared by all messages of a frame
 	la_list *lpdu_list = NULL;
 	la_reasm_ctx *reasm_ctx = la_reasm_ctx_new();
+	// Protocol structures of the frame being decoded are allocated from here
+	struct arena *arena = arena_create(FRAME_ARENA_CHUNK_SIZE);
+	frame_arena_set(arena);
 	enum {
 		DECODING_NOT_DONE,
 		DECODING_SUCCESS,
@@ -102,81 +519,279 @@ static void *pdu_decoder_thread(void *ctx) {
 	#define IS_MPDU(buf) ((buf)[0] & 1)
 
 	while(true) {
-		q = g_async_queue_pop(pdu_decoder_queue);
-		if(q->flags & OUT_FLAG_ORDERED_SHUTDOWN) {
-			fprintf(stderr, "Shutting down decoder thread\n");
-			shutdown_outputs(fmtr_list);
-			XFREE(q);
+		slot = pdu_ring_consume(&shard->ring);
+		if(slot->flags & OUT_FLAG_ORDERED_SHUTDOWN) {
+			pdu_ring_release(&shard->ring, slot);
 			break;
 		}
-		ASSERT(q->metadata != NULL);
+		// The frame is processed in place - the slot is handed back when done
+		metadata = &slot->metadata.metadata;
+		struct octet_string pdu = { .buf = slot->buf, .len = slot->len };
 
+		double t_start = 0.0, t_parse = 0.0;
+		if(pdu_decoder_timing) {
+			t_start = pdu_decoder_clock();
+			if(shard->frame_cnt == 0) {
+				shard->first_frame_time = t_start;
+			}
+		}
+		la_list *merge_msgs = NULL;
+		la_list **mm = shard->merge != NULL ? &merge_msgs : NULL;
 		fmtr_instance_t *fmtr = NULL;
 		decoding_status = DECODING_NOT_DONE;
-		for(la_list *p = fmtr_list; p != NULL; p = la_list_next(p)) {
+		// The first copy of a frame is held by the deduplicator and it is
+		// skipped here, as well as its duplicates. The best copy comes back
+		// when the dedup window elapses and it is decoded then. Ground stations
+		// transmit identical squitters on all of their frequencies, so SPDUs
+		// are deduplicated only within a channel.
+		la_list *fmtrs = fmtr_list;
+		if(pdu_dedup != NULL && (slot->flags & PDU_SLOT_DEDUP_RELEASED) == 0) {
+			int32_t dropped_freq = 0;
+			switch(dedup_check(pdu_dedup, pdu.buf, pdu.len, metadata->rx_timestamp,
+						slot->metadata.freq, slot->metadata.rssi - slot->metadata.noise_floor,
+						!IS_MPDU(pdu.buf), slot, &dropped_freq)) {
+				case DEDUP_DUPLICATE:
+					statsd_increment_per_channel(dropped_freq, "frames.duplicate");
+					fmtrs = NULL;
+					break;
+				case DEDUP_HELD:
+					fmtrs = NULL;
+					break;
+				case DEDUP_PASS:
+					break;
+			}
+		}
+		// Decoding updates the state kept across frames (system table
+		// reassembly, aircraft cache, ACARS reassembly), so the pdu is
+		// decoded if there is any decoded-frame formatter, even when none
+		// of them would accept the result. Only formatting is skipped then.
+		for(la_list *p = fmtrs; p != NULL; p = la_list_next(p)) {
 			fmtr = p->data;
 			if(fmtr->intype == FMTR_INTYPE_DECODED_FRAME) {
-				// Decode the pdu unless we've done it before
-				if(decoding_status == DECODING_NOT_DONE) {
-					struct hfdl_pdu_metadata *hm = container_of(q->metadata,
-							struct hfdl_pdu_metadata, metadata);
-					statsd_increment_per_channel(hm->freq, "frames.processed");
-					if(IS_MPDU(q->pdu->buf)) {
-						lpdu_list = mpdu_parse(q->pdu, reasm_ctx, q->metadata->rx_timestamp, hm->freq);
-					} else {
-						lpdu_list = spdu_parse(q->pdu, hm->freq);
-					}
-					if(lpdu_list != NULL) {
-						decoding_status = DECODING_SUCCESS;
-					} else {
-						decoding_status = DECODING_FAILURE;
-					}
+				struct hfdl_pdu_metadata *hm = &slot->metadata;
+				statsd_increment_per_channel(hm->freq, "frames.processed");
+				double t0 = pdu_decoder_timing ? pdu_decoder_clock() : 0.0;
+				if(IS_MPDU(pdu.buf)) {
+					lpdu_list = mpdu_parse(&pdu, reasm_ctx, metadata->rx_timestamp, hm->freq);
+				} else {
+					lpdu_list = spdu_parse(&pdu, hm->freq);
 				}
+				if(pdu_decoder_timing) {
+					t_parse = pdu_decoder_clock() - t0;
+					shard->parse_time += t_parse;
+					shard->parsed_cnt++;
+				}
+				if(lpdu_list != NULL) {
+					decoding_status = DECODING_SUCCESS;
+				} else {
+					decoding_status = DECODING_FAILURE;
+				}
+				break;
+			}
+		}
+		for(la_list *p = fmtrs; p != NULL; p = la_list_next(p)) {
+			fmtr = p->data;
+			// Don't waste time on formatting if all outputs of this
+			// formatter are down or throttled
+			if(!fmtr_instance_is_accepting(fmtr)) {
+				statsd_increment("decoder.formats.skipped");
+				continue;
+			}
+			if(fmtr->intype == FMTR_INTYPE_DECODED_FRAME) {
 				if(decoding_status == DECODING_SUCCESS) {
 					for(la_list *lpdu = lpdu_list; lpdu != NULL; lpdu = la_list_next(lpdu)) {
 						ASSERT(lpdu->data != NULL);
-						struct octet_string *serialized_msg = fmtr->td->format_decoded_msg(q->metadata, lpdu->data);
+						// Apply output filters before formatting
+						struct msg_props *props = NULL;
+						la_list *outputs = fmtr_instance_outputs_select(fmtr, metadata, lpdu->data, &props);
+						if(outputs == NULL) {
+							statsd_increment("decoder.msgs.filtered");
+							continue;
+						}
+						bool free_outputs = (outputs != fmtr->outputs);
+						struct octet_string *serialized_msg = fmtr->td->format_decoded_msg(metadata, lpdu->data);
 						// First check if the formatter actually returned something.
 						// A formatter might be suitable only for a particular message type. If this is the case.
 						// it will return NULL for all messages it cannot handle.
 						// An example is pp_acars which only deals with ACARS messages.
 						if(serialized_msg != NULL) {
-							output_qentry_t qentry = {
-								.msg = serialized_msg,
-								.metadata = q->metadata,
-								.format = fmtr->td->output_format
-							};
-							la_list_foreach(fmtr->outputs, output_queue_push, &qentry);
-							// output_queue_push makes a copy of serialized_msg, so it's safe to free it now
-							octet_string_destroy(serialized_msg);
+							if(msg_metadata == NULL) {
+								msg_metadata = metadata_copy(metadata);
+							}
+							pdu_decoder_output(outputs, free_outputs, serialized_msg, msg_metadata,
+									props, fmtr->td->output_format, mm);
+						} else {
+							XFREE(props);
+							if(free_outputs) {
+								la_list_free(outputs);
+							}
 						}
 					}
 				}
 			} else if(fmtr->intype == FMTR_INTYPE_RAW_FRAME) {
-				struct octet_string *serialized_msg = fmtr->td->format_raw_msg(q->metadata, q->pdu);
+				struct msg_props *props = NULL;
+				la_list *outputs = fmtr_instance_outputs_select(fmtr, metadata, NULL, &props);
+				if(outputs == NULL) {
+					statsd_increment("decoder.msgs.filtered");
+					continue;
+				}
+				bool free_outputs = (outputs != fmtr->outputs);
+				struct octet_string *serialized_msg = fmtr->td->format_raw_msg(metadata, &pdu);
 				if(serialized_msg != NULL) {
-					output_qentry_t qentry = {
-						.msg = serialized_msg,
-						.metadata = q->metadata,
-						.format = fmtr->td->output_format
-					};
-					la_list_foreach(fmtr->outputs, output_queue_push, &qentry);
-					// output_queue_push makes a copy of serialized_msg, so it's safe to free it now
-					octet_string_destroy(serialized_msg);
+					if(msg_metadata == NULL) {
+						msg_metadata = metadata_copy(metadata);
+					}
+					pdu_decoder_output(outputs, free_outputs, serialized_msg, msg_metadata,
+							props, fmtr->td->output_format, mm);
+				} else {
+					XFREE(props);
+					if(free_outputs) {
+						la_list_free(outputs);
+					}
 				}
 			}
 		}
+		if(pdu_decoder_timing) {
+			shard->last_frame_time = pdu_decoder_clock();
+			shard->format_time += shard->last_frame_time - t_start - t_parse;
+			shard->frame_cnt++;
+		}
+		if(shard->merge != NULL) {
+			// An entry is passed even if there are no messages, otherwise
+			// the merge thread would wait for this sequence number forever.
+			NEW(struct pdu_merge_entry, entry);
+			entry->seq = slot->seq;
+			entry->msgs = merge_msgs;
+			g_async_queue_push(shard->merge->q, entry);
+		}
 		la_list_free_full(lpdu_list, la_proto_tree_destroy);
 		lpdu_list = NULL;
-		octet_string_destroy(q->pdu);
-		XFREE(q->metadata);
-		XFREE(q);
+		// Messages hold their own references
+		metadata_unref(msg_metadata);
+		msg_metadata = NULL;
+		debug_print(D_STATS, "shard %d: frame arena: %u allocations, %zu bytes\n",
+				shard->id, arena_alloc_count(arena), arena_bytes_used(arena));
+		arena_reset(arena);
+		pdu_ring_release(&shard->ring, slot);
 	}
 	la_reasm_ctx_destroy(reasm_ctx);
-	pdu_decoder_thread_active = false;
+	arena_destroy(arena);
+	debug_print(D_MISC, "decoder shard %d terminated\n", shard->id);
+
+	if(shard->merge != NULL) {
+		NEW(struct pdu_merge_entry, entry);
+		entry->shard_done = true;
+		g_async_queue_push(shard->merge->q, entry);
+	} else {
+		// The last shard to terminate shuts down the outputs
+		pthread_mutex_lock(&pdu_decoder_lock);
+		bool last = --pdu_decoder_running_cnt == 0;
+		pthread_mutex_unlock(&pdu_decoder_lock);
+		if(last) {
+			fprintf(stderr, "Shutting down decoder thread\n");
+			shutdown_outputs(fmtr_list);
+		}
+	}
+	shard->active = false;
 	return NULL;
 }
 
+static void pdu_merge_entry_output(struct pdu_merge_entry *entry) {
+	for(la_list *p = entry->msgs; p != NULL; p = la_list_next(p)) {
+		struct pdu_merge_msg *msg = p->data;
+		la_list_foreach(msg->outputs, output_queue_push, msg->qentry);
+	}
+	la_list_free_full(entry->msgs, pdu_merge_msg_destroy);
+	XFREE(entry);
+}
+
+static void *pdu_merge_thread(void *ctx) {
+	ASSERT(ctx != NULL);
+	struct pdu_merge_ctx *merge = ctx;
+	// Entries which arrived ahead of their turn, keyed by sequence number
+	GHashTable *pending = g_hash_table_new(g_direct_hash, g_direct_equal);
+	uint32_t next_seq = 0;
+	int32_t shards_done = 0;
+	while(shards_done < merge->shard_cnt) {
+		struct pdu_merge_entry *entry = g_async_queue_pop(merge->q);
+		if(entry->shard_done) {
+			shards_done++;
+			XFREE(entry);
+			continue;
+		}
+		g_hash_table_insert(pending, GUINT_TO_POINTER(entry->seq), entry);
+		while((entry = g_hash_table_lookup(pending, GUINT_TO_POINTER(next_seq))) != NULL) {
+			g_hash_table_remove(pending, GUINT_TO_POINTER(next_seq));
+			pdu_merge_entry_output(entry);
+			next_seq++;
+		}
+	}
+	// Frames pushed after the shutdown request have not been decoded, so
+	// there might be gaps in the sequence. Flush whatever is left.
+	while(g_hash_table_size(pending) > 0) {
+		struct pdu_merge_entry *entry = g_hash_table_lookup(pending, GUINT_TO_POINTER(next_seq));
+		if(entry != NULL) {
+			g_hash_table_remove(pending, GUINT_TO_POINTER(next_seq));
+			pdu_merge_entry_output(entry);
+		}
+		next_seq++;
+	}
+	g_hash_table_destroy(pending);
+	fprintf(stderr, "Shutting down decoder thread\n");
+	shutdown_outputs(merge->fmtr_list);
+	merge->active = false;
+	return NULL;
+}
+
+// Passes a frame released by the deduplicator to the decoder thread handling
+// its channel. Waits for a free slot, as the frame has been accepted already.
+static void pdu_dedup_frame_dispatch(struct hfdl_pdu_slot *frame) {
+	int32_t shard = hfdl_pdu_decoder_shard_get(frame->metadata.freq);
+	struct hfdl_pdu_slot *slot;
+	while((slot = pdu_decoder_slot_try_claim(shard)) == NULL) {
+		usleep(10000);
+	}
+	// Metadata header is the same in all slots, so it can be copied as a whole
+	memcpy(&slot->metadata, &frame->metadata, sizeof(struct hfdl_pdu_metadata));
+	memcpy(slot->buf, frame->buf, frame->len);
+	slot->len = frame->len;
+	slot->flags = PDU_SLOT_DEDUP_RELEASED;
+	pdu_decoder_slot_commit(slot);
+}
+
+static void *pdu_dedup_thread(void *ctx) {
+	UNUSED(ctx);
+	void *frame = NULL;
+	while(dedup_release(pdu_dedup, PDU_DEDUP_POLL_INTERVAL_MS, &frame)) {
+		if(frame != NULL) {
+			pdu_dedup_frame_dispatch(frame);
+			XFREE(frame);
+		}
+	}
+	debug_print(D_MISC, "deduplicator thread terminated\n");
+	pdu_dedup_active = false;
+	return NULL;
+}
+
+static void *pdu_dedup_frame_copy(void const *frame) {
+	ASSERT(frame != NULL);
+	struct hfdl_pdu_slot const *slot = frame;
+	NEW(struct hfdl_pdu_slot, copy);
+	memcpy(&copy->metadata, &slot->metadata, sizeof(struct hfdl_pdu_metadata));
+	memcpy(copy->buf, slot->buf, slot->len);
+	copy->len = slot->len;
+	return copy;
+}
+
+static void pdu_dedup_frame_destroy(void *frame) {
+	XFREE(frame);
+}
+
+static struct dedup_vtable pdu_dedup_vtable = {
+	.frame_copy = pdu_dedup_frame_copy,
+	.frame_destroy = pdu_dedup_frame_destroy
+};
+
 static struct metadata *hfdl_pdu_metadata_copy(struct metadata const *m) {
 	ASSERT(m != NULL);
 	struct hfdl_pdu_metadata *hm = container_of(m, struct hfdl_pdu_metadata, metadata);
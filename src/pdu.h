@@ -2,6 +2,7 @@
 #pragma once
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>              // _Atomic
 #include "metadata.h"               // struct metadata
 #include "util.h"                   // struct octet string
 
@@ -31,10 +32,39 @@ struct hfdl_pdu_hdr_data {
 	bool crc_ok;
 };
 
-void hfdl_pdu_decoder_init(void);
+#define PDU_DECODER_THREAD_CNT_DEFAULT 1
+#define PDU_DECODER_THREAD_CNT_MAX 64
+// Number of frame slots in the input queue of each decoder thread (must be a power of 2)
+#define PDU_DECODER_QUEUE_LEN 1024
+// The longest frame (1800 bps, double slot) carries 945 octets
+#define HFDL_PDU_LEN_MAX 945
+
+// A preallocated frame slot in the decoder input queue.
+// Claimed with pdu_decoder_slot_claim(), filled in place by the caller
+// (metadata, buf, len) and passed to the decoder with pdu_decoder_slot_commit().
+struct hfdl_pdu_slot {
+	struct hfdl_pdu_metadata metadata;
+	uint32_t len;
+	uint8_t buf[HFDL_PDU_LEN_MAX];
+	// Private fields, managed by the decoder
+	_Atomic uint32_t turn;
+	uint32_t pos;
+	uint32_t seq;
+	uint32_t flags;
+	int32_t shard;
+};
+
+void hfdl_pdu_decoder_init(int32_t shard_cnt, bool ordered, int32_t dedup_window, bool realtime);
 int32_t hfdl_pdu_decoder_start(void *ctx);
 void hfdl_pdu_decoder_stop(void);
 bool hfdl_pdu_decoder_is_running(void);
+void hfdl_pdu_decoder_timing_enable(void);
+void hfdl_pdu_decoder_print_timing(void);
+void hfdl_pdu_decoder_report_stats(void);
 bool hfdl_pdu_fcs_check(uint8_t *buf, uint32_t hdr_len);
-void pdu_decoder_queue_push(struct metadata *metadata, struct octet_string *pdu, uint32_t flags);
-struct metadata *hfdl_pdu_metadata_create();
+int32_t hfdl_pdu_decoder_shard_get(int32_t freq);
+struct hfdl_pdu_slot *pdu_decoder_slot_claim(int32_t shard);
+struct hfdl_pdu_slot *pdu_decoder_slot_try_claim(int32_t shard);
+void pdu_decoder_slot_commit(struct hfdl_pdu_slot *slot);
+uint64_t hfdl_pdu_decoder_dropped_frame_count(void);
+uint64_t hfdl_pdu_decoder_duplicate_frame_count(void);
@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>               // PRIu64
+#include <stdio.h>                  // FILE, fopen, fread, fclose, fprintf
+#include <string.h>                 // strcmp, strdup, strerror, memcpy
+#include <errno.h>                  // errno
+#include <unistd.h>                 // usleep
+#include <time.h>                   // clock_gettime
+#include <pthread.h>                // pthread_t
+#include "util.h"                   // NEW, ASSERT, XFREE, start_thread, debug_print
+#include "globals.h"                // do_exit
+#include "fmtr-frame.h"             // frame_record_header_decode, FRAME_RECORD_HDR_LEN
+#include "pdu.h"                    // pdu_decoder_slot_*, hfdl_pdu_decoder_shard_get, HFDL_PDU_LEN_MAX
+#include "replay.h"
+
+// Raw frame replay.
+// Reads frame records produced by the "frame" output format and passes them
+// directly to the decoder, bypassing the whole DSP chain. Frames are read
+// as fast as the decoder is able to process them - when the decoder queue
+// is full, the reader waits instead of dropping frames.
+
+// How long to wait for a free slot in the decoder queue
+#define REPLAY_QUEUE_FULL_SLEEP_US 1000
+
+struct replay {
+	char *path;
+	FILE *fh;
+	uint64_t frame_cnt;
+	uint64_t byte_cnt;
+	double elapsed;
+	bool active;
+};
+
+/******************************
+ * Forward declarations
+ ******************************/
+
+static void *replay_thread(void *ctx);
+
+/******************************
+ * Public methods
+ ******************************/
+
+struct replay *replay_create(char const *path) {
+	ASSERT(path != NULL);
+	FILE *fh = NULL;
+	if(strcmp(path, "-") == 0) {
+		fh = stdin;
+	} else if((fh = fopen(path, "rb")) == NULL) {
+		fprintf(stderr, "Failed to open replay file %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	NEW(struct replay, r);
+	r->path = strdup(path);
+	r->fh = fh;
+	return r;
+}
+
+int32_t replay_start(struct replay *r) {
+	ASSERT(r != NULL);
+	pthread_t th;
+	r->active = true;
+	if(start_thread(&th, replay_thread, r) != 0) {
+		r->active = false;
+		return -1;
+	}
+	return 0;
+}
+
+bool replay_is_running(struct replay *r) {
+	return r != NULL && r->active;
+}
+
+void replay_print_stats(struct replay *r) {
+	ASSERT(r != NULL);
+	fprintf(stderr, "Replay (%s): %" PRIu64 " frames, %" PRIu64 " bytes read in %.3f s (%.0f frames/s)\n",
+			r->path, r->frame_cnt, r->byte_cnt, r->elapsed,
+			r->elapsed > 0.0 ? (double)r->frame_cnt / r->elapsed : 0.0);
+}
+
+void replay_destroy(struct replay *r) {
+	if(r != NULL) {
+		if(r->fh != NULL && r->fh != stdin) {
+			fclose(r->fh);
+		}
+		XFREE(r->path);
+		XFREE(r);
+	}
+}
+
+/****************************************
+ * Private variables and methods
+ ****************************************/
+
+static double replay_clock(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *replay_thread(void *ctx) {
+	ASSERT(ctx != NULL);
+	struct replay *r = ctx;
+	uint8_t hdr[FRAME_RECORD_HDR_LEN];
+	uint8_t buf[HFDL_PDU_LEN_MAX];
+	struct hfdl_pdu_metadata hm = {0};
+	// Consecutive frames usually come from the same channel
+	int32_t last_freq = -1, shard = 0;
+	double start = replay_clock();
+
+	while(do_exit == 0) {
+		size_t len = fread(hdr, 1, sizeof(hdr), r->fh);
+		if(len == 0) {
+			break;
+		} else if(len < sizeof(hdr)) {
+			fprintf(stderr, "replay(%s): truncated record at offset %" PRIu64 "\n", r->path, r->byte_cnt);
+			break;
+		}
+		int32_t pdu_len = frame_record_header_decode(hdr, &hm);
+		if(pdu_len < 0) {
+			fprintf(stderr, "replay(%s): invalid record at offset %" PRIu64 "\n", r->path, r->byte_cnt);
+			break;
+		}
+		if(fread(buf, 1, pdu_len, r->fh) != (size_t)pdu_len) {
+			fprintf(stderr, "replay(%s): truncated record at offset %" PRIu64 "\n", r->path, r->byte_cnt);
+			break;
+		}
+		r->byte_cnt += sizeof(hdr) + pdu_len;
+		if(hm.freq != last_freq) {
+			shard = hfdl_pdu_decoder_shard_get(hm.freq);
+			last_freq = hm.freq;
+		}
+		struct hfdl_pdu_slot *slot;
+		while((slot = pdu_decoder_slot_try_claim(shard)) == NULL && do_exit == 0) {
+			usleep(REPLAY_QUEUE_FULL_SLEEP_US);
+		}
+		if(slot == NULL) {
+			break;
+		}
+		// Copy field by field - the metadata header of the slot must stay intact
+		struct hfdl_pdu_metadata *sm = &slot->metadata;
+		sm->version = hm.version;
+		sm->freq = hm.freq;
+		sm->bit_rate = hm.bit_rate;
+		sm->freq_err_hz = hm.freq_err_hz;
+		sm->rssi = hm.rssi;
+		sm->noise_floor = hm.noise_floor;
+		sm->slot = hm.slot;
+		sm->metadata.rx_timestamp = hm.metadata.rx_timestamp;
+		memcpy(slot->buf, buf, pdu_len);
+		slot->len = pdu_len;
+		pdu_decoder_slot_commit(slot);
+		r->frame_cnt++;
+	}
+	r->elapsed = replay_clock() - start;
+	debug_print(D_MISC, "replay(%s): %" PRIu64 " frames read, exiting\n", r->path, r->frame_cnt);
+	do_exit = 1;
+	r->active = false;
+	return NULL;
+}
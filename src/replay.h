@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+struct replay;
+
+struct replay *replay_create(char const *path);
+int32_t replay_start(struct replay *r);
+bool replay_is_running(struct replay *r);
+void replay_print_stats(struct replay *r);
+void replay_destroy(struct replay *r);
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+
+// Layout of the shared memory I/Q sample ring.
+//
+// The segment is created by a single producer (eg. iq2shm) with shm_open()
+// and consists of a fixed-size header followed by a ring of ring_len
+// complex samples in the format given by sample_format. The producer writes
+// samples at index (sample_cnt % ring_len) and then advances sample_cnt
+// with release semantics. Consumers never write to the segment - each one
+// keeps its own read position and attaches read-only, so any number of
+// them may share a single stream.
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define SHM_IQ_MAGIC 0x51494648u        // "HFIQ" in little endian
+#define SHM_IQ_VERSION 1u
+#define SHM_IQ_HEADER_LEN 4096u         // offset of the sample area
+
+// Sample format identifiers used in the header.
+// These are part of the shared memory ABI and must not be renumbered.
+#define SHM_IQ_SFMT_CU8 1u
+#define SHM_IQ_SFMT_CS16 2u
+#define SHM_IQ_SFMT_CF32 3u
+
+#define SHM_IQ_STATE_INIT 0u            // header being filled, don't read
+#define SHM_IQ_STATE_RUNNING 1u         // samples are being produced
+#define SHM_IQ_STATE_FINISHED 2u        // producer has finished, drain and stop
+
+struct shm_iq_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_len;                // offset of the sample ring from the start of the segment
+	uint32_t sample_format;             // SHM_IQ_SFMT_*
+	uint32_t sample_size;               // octets per complex sample
+	int32_t sample_rate;                // samples per second
+	int32_t centerfreq;                 // Hz
+	uint32_t reserved;
+	uint64_t ring_len;                  // ring length, in samples
+	_Atomic uint64_t sample_cnt;        // total number of samples written so far
+	_Atomic uint32_t state;             // SHM_IQ_STATE_*
+};
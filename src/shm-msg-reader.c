@@ -0,0 +1,181 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>              // fprintf
+#include <stdlib.h>             // calloc, realloc, free
+#include <string.h>             // memcpy, strerror
+#include <stdatomic.h>          // atomic_*
+#include <errno.h>              // errno
+#include <fcntl.h>              // O_RDONLY
+#include <time.h>               // nanosleep
+#include <unistd.h>             // close
+#include <sys/mman.h>           // shm_open, mmap, munmap
+#include <sys/stat.h>           // fstat
+#include "shm-msg.h"            // struct shm_msg_header, struct shm_msg_record, SHM_MSG_*
+#include "shm-msg-reader.h"
+
+#define ATTACH_RETRIES 100
+#define ATTACH_RETRY_INTERVAL_NS 10000000L
+#define RECORD_OVERWRITTEN (-1)
+
+struct shm_msg_reader {
+	struct shm_msg_header const *hdr;
+	uint8_t const *data;
+	size_t map_len;
+	uint64_t data_len;
+	uint64_t pos;                       // read position
+	uint64_t next_seq;                  // sequence number of the next message expected
+	uint64_t lost;
+	uint8_t *buf;                       // copy of the current message
+	size_t buf_len;
+	int fd;
+};
+
+struct shm_msg_reader *shm_msg_reader_open(char const *name, bool from_oldest) {
+	struct shm_msg_reader *r = calloc(1, sizeof(struct shm_msg_reader));
+	if(r == NULL) {
+		return NULL;
+	}
+	r->fd = shm_open(name, O_RDONLY, 0);
+	if(r->fd < 0) {
+		fprintf(stderr, "%s: could not open shared memory segment: %s\n", name, strerror(errno));
+		goto fail;
+	}
+	struct stat st;
+	if(fstat(r->fd, &st) < 0) {
+		fprintf(stderr, "%s: fstat failed: %s\n", name, strerror(errno));
+		goto fail;
+	}
+	if((size_t)st.st_size < SHM_MSG_HEADER_LEN) {
+		fprintf(stderr, "%s: shared memory segment too short (%jd bytes)\n", name, (intmax_t)st.st_size);
+		goto fail;
+	}
+	r->map_len = st.st_size;
+	void *map = mmap(NULL, r->map_len, PROT_READ, MAP_SHARED, r->fd, 0);
+	if(map == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap failed: %s\n", name, strerror(errno));
+		r->map_len = 0;
+		goto fail;
+	}
+	r->hdr = map;
+
+	// The writer might be filling the header just now
+	struct timespec const ts = { .tv_sec = 0, .tv_nsec = ATTACH_RETRY_INTERVAL_NS };
+	for(int i = 0; atomic_load_explicit(&r->hdr->state, memory_order_acquire) == SHM_MSG_STATE_INIT; i++) {
+		if(i == ATTACH_RETRIES) {
+			fprintf(stderr, "%s: shared memory ring has not been initialized\n", name);
+			goto fail;
+		}
+		nanosleep(&ts, NULL);
+	}
+	if(r->hdr->magic != SHM_MSG_MAGIC || r->hdr->version != SHM_MSG_VERSION) {
+		fprintf(stderr, "%s: not a dumphfdl message ring or unsupported version\n", name);
+		goto fail;
+	}
+	r->data_len = r->hdr->data_len;
+	if(r->hdr->header_len < sizeof(struct shm_msg_header) || r->data_len % SHM_MSG_ALIGN != 0 ||
+			r->data_len < SHM_MSG_RECORD_LEN(0) || r->hdr->header_len + r->data_len > r->map_len) {
+		fprintf(stderr, "%s: invalid ring header\n", name);
+		goto fail;
+	}
+	r->data = (uint8_t const *)r->hdr + r->hdr->header_len;
+	if(from_oldest) {
+		r->pos = atomic_load_explicit(&r->hdr->tail_pos, memory_order_acquire);
+		r->next_seq = UINT64_MAX;       // don't count anything as lost until the first message
+	} else {
+		r->pos = atomic_load_explicit(&r->hdr->write_pos, memory_order_acquire);
+		r->next_seq = atomic_load_explicit(&r->hdr->msg_cnt, memory_order_relaxed);
+	}
+	return r;
+fail:
+	shm_msg_reader_close(r);
+	return NULL;
+}
+
+// Copies the record at the current read position, if it's complete.
+// Returns the record type, 0 if there is nothing to read, RECORD_OVERWRITTEN
+// if the record has been overwritten during the copy or SHM_MSG_READER_ERROR.
+static int32_t read_record(struct shm_msg_reader *r, struct shm_msg_record *rec, uint64_t *rec_len) {
+	uint64_t const write_pos = atomic_load_explicit(&r->hdr->write_pos, memory_order_acquire);
+	if(r->pos >= write_pos) {
+		return 0;
+	}
+	uint64_t const off = r->pos % r->data_len;
+	if(r->data_len - off < sizeof(struct shm_msg_record)) {
+		*rec_len = r->data_len - off;
+		return SHM_MSG_REC_PAD;
+	}
+	memcpy(rec, r->data + off, sizeof(struct shm_msg_record));
+	*rec_len = SHM_MSG_RECORD_LEN(rec->len);
+	// Don't trust the header until it has been validated below
+	bool sane = *rec_len <= r->data_len - off &&
+		(rec->type == SHM_MSG_REC_DATA || rec->type == SHM_MSG_REC_PAD);
+	if(sane && rec->type == SHM_MSG_REC_DATA) {
+		if(rec->len > r->buf_len) {
+			uint8_t *buf = realloc(r->buf, rec->len);
+			if(buf == NULL) {
+				fprintf(stderr, "shm_msg_reader: could not allocate %u bytes\n", rec->len);
+				return SHM_MSG_READER_ERROR;
+			}
+			r->buf = buf;
+			r->buf_len = rec->len;
+		}
+		memcpy(r->buf, r->data + off + sizeof(struct shm_msg_record), rec->len);
+	}
+	atomic_thread_fence(memory_order_acquire);
+	if(atomic_load_explicit(&r->hdr->tail_pos, memory_order_relaxed) > r->pos) {
+		return RECORD_OVERWRITTEN;
+	}
+	return sane ? (int32_t)rec->type : SHM_MSG_READER_ERROR;
+}
+
+int32_t shm_msg_reader_next(struct shm_msg_reader *r, struct shm_msg *msg) {
+	while(true) {
+		// Check the state first - the writer finishes after its last write
+		uint32_t const state = atomic_load_explicit(&r->hdr->state, memory_order_acquire);
+		uint64_t const tail_pos = atomic_load_explicit(&r->hdr->tail_pos, memory_order_acquire);
+		if(r->pos < tail_pos) {
+			r->pos = tail_pos;
+		}
+		struct shm_msg_record rec;
+		uint64_t rec_len = 0;
+		int32_t ret = read_record(r, &rec, &rec_len);
+		if(ret == 0) {
+			return state == SHM_MSG_STATE_FINISHED ? SHM_MSG_READER_EOF : 0;
+		} else if(ret == RECORD_OVERWRITTEN) {
+			continue;           // resume from the new tail
+		} else if(ret < 0) {
+			return ret;
+		}
+		r->pos += rec_len;
+		if(ret == SHM_MSG_REC_DATA) {
+			if(r->next_seq != UINT64_MAX && rec.seq > r->next_seq) {
+				r->lost += rec.seq - r->next_seq;
+			}
+			r->next_seq = rec.seq + 1;
+			msg->buf = r->buf;
+			msg->len = rec.len;
+			msg->seq = rec.seq;
+			msg->timestamp = rec.timestamp;
+			return 1;
+		}
+	}
+}
+
+uint64_t shm_msg_reader_lost(struct shm_msg_reader const *r) {
+	return r->lost;
+}
+
+void shm_msg_reader_close(struct shm_msg_reader *r) {
+	if(r == NULL) {
+		return;
+	}
+	if(r->map_len > 0) {
+		munmap((void *)r->hdr, r->map_len);
+	}
+	if(r->fd >= 0) {
+		close(r->fd);
+	}
+	free(r->buf);
+	free(r);
+}
@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Reader of the shared memory message ring written by the shm output
+// (see shm-msg.h for the layout). It depends only on the C library,
+// so shm-msg.h, shm-msg-reader.h and shm-msg-reader.c may be copied into
+// other programs as they are.
+
+#define SHM_MSG_READER_EOF (-1)         // writer has finished and all messages have been read
+#define SHM_MSG_READER_ERROR (-2)       // ring is corrupted
+
+struct shm_msg {
+	uint8_t const *buf;                 // message data (valid until the next call to shm_msg_reader_next)
+	uint32_t len;                       // message length
+	uint64_t seq;                       // message sequence number
+	int64_t timestamp;                  // reception time (microseconds since the Epoch)
+};
+
+struct shm_msg_reader;
+
+// from_oldest - start from the oldest message which is still in the ring
+// instead of the next message written
+struct shm_msg_reader *shm_msg_reader_open(char const *name, bool from_oldest);
+// Returns 1 and fills msg if a message is available, 0 if there is nothing
+// to read at the moment, SHM_MSG_READER_EOF or SHM_MSG_READER_ERROR.
+// Never blocks - the caller decides how to wait for new messages.
+int32_t shm_msg_reader_next(struct shm_msg_reader *r, struct shm_msg *msg);
+// Number of messages overwritten by the writer before they could be read
+uint64_t shm_msg_reader_lost(struct shm_msg_reader const *r);
+void shm_msg_reader_close(struct shm_msg_reader *r);
@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#pragma once
+
+// Layout of the shared memory message ring written by the shm output.
+//
+// The segment is created by a single writer (dumphfdl) with shm_open() and
+// consists of a fixed-size header followed by a data area of data_len
+// octets. Formatted messages are stored in the data area as variable-length
+// records, one after another, each one starting with struct shm_msg_record
+// and padded to a multiple of SHM_MSG_ALIGN octets. All positions are
+// 64-bit running byte counters which never wrap - the offset of a record
+// in the data area is (position % data_len).
+//
+// A record never crosses the end of the data area. If it would not fit,
+// the rest of the area is skipped and the record is written at offset 0.
+// The skipped space is covered by a record of type SHM_MSG_REC_PAD, unless
+// it is too short to hold a record header, in which case readers skip it
+// implicitly.
+//
+// The writer publishes new records by advancing write_pos with release
+// semantics. Before it overwrites the oldest records, it moves tail_pos
+// past them (followed by a release fence). Readers never write to the
+// segment. Each one keeps its own read position, which must be between
+// tail_pos and write_pos. A reader copies the record out of the ring and
+// then (after an acquire fence) checks that tail_pos has not moved past
+// the record in the meantime. If it has, the copy may be corrupted and the
+// reader must resume from tail_pos. Messages lost this way can be counted
+// with record sequence numbers, which increase by one with every message.
+//
+// src/shm-msg-reader.c contains a reader implementing the above.
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define SHM_MSG_MAGIC 0x534d4648u       // "HFMS" in little endian
+#define SHM_MSG_VERSION 1u
+#define SHM_MSG_HEADER_LEN 4096u        // offset of the data area
+#define SHM_MSG_ALIGN 8u                // alignment of records in the data area
+
+// Record types.
+// These are part of the shared memory ABI and must not be renumbered.
+#define SHM_MSG_REC_DATA 1u             // a message
+#define SHM_MSG_REC_PAD 2u              // unused space up to the end of the data area
+
+#define SHM_MSG_STATE_INIT 0u           // header being filled, don't read
+#define SHM_MSG_STATE_RUNNING 1u        // messages are being written
+#define SHM_MSG_STATE_FINISHED 2u       // writer has finished, drain and stop
+
+struct shm_msg_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_len;                // offset of the data area from the start of the segment
+	uint32_t reserved;
+	uint64_t data_len;                  // length of the data area, in octets (multiple of SHM_MSG_ALIGN)
+	_Atomic uint64_t write_pos;         // end of the last complete record
+	_Atomic uint64_t tail_pos;          // start of the oldest record which has not been overwritten
+	_Atomic uint64_t msg_cnt;           // total number of messages written so far
+	_Atomic uint32_t state;             // SHM_MSG_STATE_*
+};
+
+struct shm_msg_record {
+	uint32_t len;                       // length of the message following this header, in octets
+	uint32_t type;                      // SHM_MSG_REC_*
+	uint64_t seq;                       // message sequence number, starting from 0
+	int64_t timestamp;                  // message reception time (microseconds since the Epoch)
+};
+
+// Total length of a record carrying len octets of message data
+#define SHM_MSG_RECORD_LEN(len) \
+	(((sizeof(struct shm_msg_record) + (uint64_t)(len)) + SHM_MSG_ALIGN - 1) & ~(uint64_t)(SHM_MSG_ALIGN - 1))
@@ -0,0 +1,133 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+// shm2stdout - reference reader for the dumphfdl shared memory message ring.
+//
+// Attaches to a ring written by the shm output (see shm-msg.h) and copies
+// the messages to standard output, exactly as the file output would write
+// them. Any number of readers may attach to the same ring.
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>             // strtol, EXIT_*
+#include <string.h>             // strerror
+#include <getopt.h>             // getopt_long
+#include <errno.h>              // errno
+#include <signal.h>             // sigaction, SIG*
+#include <inttypes.h>           // PRIu64
+#include <time.h>               // nanosleep
+#include "shm-msg-reader.h"     // shm_msg_reader_*, struct shm_msg
+
+#define POLL_INTERVAL_MS_DEFAULT 10
+
+static volatile sig_atomic_t do_exit = 0;
+
+static void sighandler(int sig) {
+	(void)sig;
+	do_exit = 1;
+}
+
+static void setup_signals() {
+	struct sigaction sigact = {0};
+	sigact.sa_handler = &sighandler;
+	sigaction(SIGHUP, &sigact, NULL);
+	sigaction(SIGINT, &sigact, NULL);
+	sigaction(SIGQUIT, &sigact, NULL);
+	sigaction(SIGTERM, &sigact, NULL);
+}
+
+static void usage() {
+	fprintf(stderr,
+			"Usage: shm2stdout [--from-oldest] [--poll-interval <integer>] <shm_name>\n\n"
+			"Reads messages from a shared memory ring written by dumphfdl shm output\n"
+			"and prints them on standard output.\n\n"
+			"Options:\n"
+			"  --from-oldest                  Start from the oldest message which is still in the ring\n"
+			"                                 (default: print only new messages)\n"
+			"  --poll-interval <integer>      How often to check for new messages, in milliseconds\n"
+			"                                 (default: %d)\n",
+			POLL_INTERVAL_MS_DEFAULT);
+}
+
+int main(int argc, char **argv) {
+#define OPT_FROM_OLDEST 1
+#define OPT_POLL_INTERVAL 2
+#define OPT_HELP 3
+	static struct option const opts[] = {
+		{ "from-oldest",    no_argument,        NULL,   OPT_FROM_OLDEST },
+		{ "poll-interval",  required_argument,  NULL,   OPT_POLL_INTERVAL },
+		{ "help",           no_argument,        NULL,   OPT_HELP },
+		{ 0,                0,                  0,      0 }
+	};
+
+	bool from_oldest = false;
+	long poll_interval = POLL_INTERVAL_MS_DEFAULT;
+
+	int c;
+	while((c = getopt_long(argc, argv, "", opts, NULL)) != -1) {
+		switch(c) {
+			case OPT_FROM_OLDEST:
+				from_oldest = true;
+				break;
+			case OPT_POLL_INTERVAL: {
+				char *endptr = NULL;
+				errno = 0;
+				poll_interval = strtol(optarg, &endptr, 10);
+				if(endptr == optarg || endptr[0] != '\0') {
+					fprintf(stderr, "Parameter error: '%s': not a valid decimal integer number\n", optarg);
+					return EXIT_FAILURE;
+				} else if(errno == ERANGE) {
+					fprintf(stderr, "Parameter error: '%s': value too large\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			}
+			case OPT_HELP:
+				usage();
+				return EXIT_SUCCESS;
+			default:
+				usage();
+				return EXIT_FAILURE;
+		}
+	}
+	if(optind >= argc || poll_interval <= 0) {
+		usage();
+		return EXIT_FAILURE;
+	}
+	char const *shm_name = argv[optind];
+	struct shm_msg_reader *r = shm_msg_reader_open(shm_name, from_oldest);
+	if(r == NULL) {
+		return EXIT_FAILURE;
+	}
+	setup_signals();
+
+	struct timespec const ts = {
+		.tv_sec = poll_interval / 1000,
+		.tv_nsec = (poll_interval % 1000) * 1000000L
+	};
+	uint64_t cnt = 0;
+	int32_t ret = 0;
+	struct shm_msg msg;
+	while(do_exit == 0) {
+		ret = shm_msg_reader_next(r, &msg);
+		if(ret == 1) {
+			if(fwrite(msg.buf, 1, msg.len, stdout) != msg.len) {
+				fprintf(stderr, "Write error: %s\n", strerror(errno));
+				break;
+			}
+			cnt++;
+		} else if(ret == 0) {
+			// Nothing to read - flush what has been printed and wait
+			fflush(stdout);
+			nanosleep(&ts, NULL);
+		} else {
+			if(ret == SHM_MSG_READER_ERROR) {
+				fprintf(stderr, "%s: shared memory ring is corrupted\n", shm_name);
+			}
+			break;
+		}
+	}
+	fflush(stdout);
+	fprintf(stderr, "%s: %" PRIu64 " messages read, %" PRIu64 " lost\n",
+			shm_name, cnt, shm_msg_reader_lost(r));
+	shm_msg_reader_close(r);
+	return ret == SHM_MSG_READER_ERROR ? EXIT_FAILURE : EXIT_SUCCESS;
+}
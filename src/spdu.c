@@ -2,12 +2,14 @@
 #include <stdint.h>
 #include <libacars/libacars.h>      // la_proto_node
 #include <libacars/list.h>          // la_list
-#include <libacars/json.h>          // la_json_append_*
 #include "pdu.h"                    // struct hfdl_pdu_hdr_data, hfdl_pdu_fcs_check
 #include "spdu.h"
 #include "statsd.h"                 // statsd_*
-#include "util.h"                   // NEW, ASSERT, struct octet_string, freq_list_format_text, gs_id_format_text
+#include "util.h"                   // ASSERT, struct octet_string, freq_list_format_text, gs_id_format_text
+#include "fmtr-writer.h"            // struct fmtr_writer, fw_*
+#include "arena.h"                  // FRAME_NEW, frame_arena_noop_destroy
 #include "crc.h"                    // crc16_ccitt
+#include "filter.h"                 // struct msg_props, msg_props_header_set
 
 #define SPDU_LEN 66
 #define GS_STATUS_CNT 3
@@ -35,7 +37,7 @@ struct hfdl_spdu {
 // Forward declarations
 la_type_descriptor const proto_DEF_hfdl_spdu;
 static void gs_status_format_text(la_vstring *vstr, int32_t indent, struct gs_status const *gs);
-static void gs_status_format_json(la_vstring *vstr, struct gs_status const *gs);
+static void gs_status_serialize(struct fmtr_writer *w, struct gs_status const *gs);
 
 la_list *spdu_parse(struct octet_string *pdu, int32_t freq) {
 #ifndef WITH_STATSD
@@ -46,7 +48,7 @@ la_list *spdu_parse(struct octet_string *pdu, int32_t freq) {
 	ASSERT(pdu->len > 0);
 
 	la_list *spdu_list = NULL;
-	NEW(struct hfdl_spdu, spdu);
+	FRAME_NEW(struct hfdl_spdu, spdu);
 	spdu->pdu = pdu;
 	la_proto_node *spdu_node = la_proto_node_new();
 	spdu_node->data = spdu;
@@ -149,29 +151,29 @@ static void spdu_format_text(la_vstring *vstr, void const *data, int32_t indent)
 	indent--;
 }
 
-static void spdu_format_json(la_vstring *vstr, void const *data) {
-	ASSERT(vstr != NULL);
+void spdu_serialize(struct fmtr_writer *w, void const *data) {
+	ASSERT(w != NULL);
 	ASSERT(data);
 
 	struct hfdl_spdu const *spdu = data;
-	la_json_append_bool(vstr, "err", !spdu->header.crc_ok);
+	fw_append_bool(w, "err", !spdu->header.crc_ok);
 	if(!spdu->header.crc_ok) {
 		return;
 	}
-	gs_id_format_json(vstr, "src", spdu->header.src_id);
-	la_json_append_int64(vstr, "spdu_version", spdu->version);
-	la_json_append_bool(vstr, "rls", spdu->rls_in_use);
-	la_json_append_bool(vstr, "iso", spdu->iso8208_supported);
-	la_json_append_string(vstr, "change_note", change_note_descr[spdu->change_note]);
-	la_json_append_int64(vstr, "frame_index", spdu->frame_index);
-	la_json_append_int64(vstr, "frame_offset", spdu->frame_offset);
-	la_json_append_int64(vstr, "min_priority", spdu->min_priority);
-	la_json_append_int64(vstr, "systable_version", spdu->systable_version);
-	la_json_array_start(vstr, "gs_status");
+	gs_id_serialize(w, "src", spdu->header.src_id);
+	fw_append_int64(w, "spdu_version", spdu->version);
+	fw_append_bool(w, "rls", spdu->rls_in_use);
+	fw_append_bool(w, "iso", spdu->iso8208_supported);
+	fw_append_string(w, "change_note", change_note_descr[spdu->change_note]);
+	fw_append_int64(w, "frame_index", spdu->frame_index);
+	fw_append_int64(w, "frame_offset", spdu->frame_offset);
+	fw_append_int64(w, "min_priority", spdu->min_priority);
+	fw_append_int64(w, "systable_version", spdu->systable_version);
+	fw_array_start(w, "gs_status");
 	for(int32_t i = 0; i < GS_STATUS_CNT; i++) {
-		gs_status_format_json(vstr, &spdu->gs_data[i]);
+		gs_status_serialize(w, &spdu->gs_data[i]);
 	}
-	la_json_array_end(vstr);
+	fw_array_end(w);
 }
 
 static void gs_status_format_text(la_vstring *vstr, int32_t indent, struct gs_status const *gs) {
@@ -185,19 +187,36 @@ static void gs_status_format_text(la_vstring *vstr, int32_t indent, struct gs_st
 	freq_list_format_text(vstr, indent, "Frequencies in use", gs->id, gs->freqs_in_use);
 }
 
-static void gs_status_format_json(la_vstring *vstr, struct gs_status const *gs) {
-	ASSERT(vstr);
+static void gs_status_serialize(struct fmtr_writer *w, struct gs_status const *gs) {
+	ASSERT(w);
 	ASSERT(gs);
-	la_json_object_start(vstr, NULL);
-	gs_id_format_json(vstr, "gs", gs->id);
-	la_json_append_bool(vstr, "utc_sync", gs->utc_sync);
-	freq_list_format_json(vstr, "freqs", gs->id, gs->freqs_in_use);
-	la_json_object_end(vstr);
+	fw_object_start(w, NULL);
+	gs_id_serialize(w, "gs", gs->id);
+	fw_append_bool(w, "utc_sync", gs->utc_sync);
+	freq_list_serialize(w, "freqs", gs->id, gs->freqs_in_use);
+	fw_object_end(w);
+}
+
+bool spdu_msg_props_extract(la_proto_node *tree, struct msg_props *props) {
+	ASSERT(tree);
+	ASSERT(props);
+
+	la_proto_node *spdu_node = la_proto_tree_find_protocol(tree, &proto_DEF_hfdl_spdu);
+	if(spdu_node == NULL) {
+		return false;
+	}
+	struct hfdl_spdu const *spdu = spdu_node->data;
+	msg_props_header_set(props, &spdu->header);
+	return true;
+}
+
+static void spdu_format_json(la_vstring *vstr, void const *data) {
+	fw_format_json(vstr, spdu_serialize, data);
 }
 
 la_type_descriptor const proto_DEF_hfdl_spdu = {
 	.format_text = spdu_format_text,
 	.format_json = spdu_format_json,
 	.json_key = "spdu",
-	.destroy = NULL
+	.destroy = frame_arena_noop_destroy
 };
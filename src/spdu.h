@@ -2,6 +2,13 @@
 #pragma once
 #include <stdint.h>
 #include <libacars/list.h>          // la_list
+#include <libacars/libacars.h>      // la_proto_node
 #include "util.h"                   // struct octet_string
+#include "filter.h"                 // struct msg_props
 
 la_list *spdu_parse(struct octet_string *pdu, int32_t freq);
+bool spdu_msg_props_extract(la_proto_node *tree, struct msg_props *props);
+
+struct fmtr_writer;
+extern la_type_descriptor const proto_DEF_hfdl_spdu;
+void spdu_serialize(struct fmtr_writer *w, void const *data);
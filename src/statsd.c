@@ -22,6 +22,8 @@ static char const *counters_per_channel[] = {
 	"frame.errors.too_short",
 	"frame.dir.air2gnd",
 	"frame.dir.gnd2air",
+	"frames.dropped",
+	"frames.duplicate",
 	"frames.good",
 	"frames.processed",
 	"lpdu.errors.bad_fcs",
@@ -150,6 +152,15 @@ void statsd_gauge_per_channel_set(int32_t freq, char *gauge, size_t value) {
 	statsd_gauge(statsd, metric, value);
 }
 
+// Timers are used as histograms of arbitrary values (not only durations),
+// as the server computes percentiles for them.
+void statsd_timer_send(char *timer, uint32_t value) {
+	if(statsd == NULL) {
+		return;
+	}
+	statsd_timing(statsd, timer, value);
+}
+
 void statsd_timing_delta_per_channel_send(int32_t freq, char *timer, struct timeval ts) {
 	if(statsd == NULL) {
 		return;
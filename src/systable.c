@@ -6,9 +6,9 @@
 #include <libacars/libacars.h>      // la_proto_node
 #include <libacars/dict.h>          // la_dict_*
 #include <libacars/list.h>          // la_list
-#include <libacars/json.h>          // la_json_append_*
 #include "systable.h"
 #include "util.h"                   // NEW, XFREE, struct location, parse_coordinate
+#include "fmtr-writer.h"            // struct fmtr_writer, fw_*
 
 enum systable_err_code {
 	ST_ERR_OK = 0,
@@ -258,6 +258,43 @@ double systable_get_station_frequency(systable const *st, int32_t gs_id, int32_t
 	return -1.0;
 }
 
+// Returns a list of all frequencies (in Hz, without duplicates) used by
+// ground stations in the current system table and stores its length in *cnt.
+// Returns NULL if the system table is not available. The result must be
+// freed by the caller.
+int32_t *systable_get_frequencies(systable const *st, int32_t *cnt) {
+	ASSERT(cnt != NULL);
+	*cnt = 0;
+	if(!systable_is_available(st)) {
+		return NULL;
+	}
+	int32_t *result = XCALLOC((STATION_ID_MAX + 1) * GS_MAX_FREQ_CNT, sizeof(int32_t));
+	for(int32_t gs_id = 0; gs_id <= STATION_ID_MAX; gs_id++) {
+		if(st->current->stations[gs_id] == NULL) {
+			continue;
+		}
+		config_setting_t *frequencies = config_setting_get_member(st->current->stations[gs_id],
+				"frequencies");
+		config_setting_t *freq = NULL;
+		for(int32_t i = 0; (freq = config_setting_get_elem(frequencies, i)) != NULL; i++) {
+			double val = config_setting_type(freq) == CONFIG_TYPE_FLOAT ?
+				config_setting_get_float(freq) : (double)config_setting_get_int(freq);
+			int32_t f = (int32_t)(1e3 * val);
+			bool dup = false;
+			for(int32_t j = 0; j < *cnt; j++) {
+				if(result[j] == f) {
+					dup = true;
+					break;
+				}
+			}
+			if(!dup && *cnt < (STATION_ID_MAX + 1) * GS_MAX_FREQ_CNT) {
+				result[(*cnt)++] = f;
+			}
+		}
+	}
+	return result;
+}
+
 bool systable_is_available(systable const *st) {
 	return st != NULL && st->current->available;
 }
@@ -425,7 +462,7 @@ static bool systable_add_station_cache_entry(struct _systable *st, config_settin
 static struct systable_gs_complete systable_decode_gs(uint8_t *buf, uint32_t len);
 static uint32_t systable_decode_frequency(uint8_t const buf[3]);
 static void systable_gs_data_format_text(la_vstring *vstr, int32_t indent, struct systable_gs_data const *data);
-static void systable_gs_data_format_json(la_vstring *vstr, struct systable_gs_data const *data);
+static void systable_gs_data_serialize(struct fmtr_writer *w, struct systable_gs_data const *data);
 static bool systable_generate_station_config(struct systable_gs_data const *gs_data, config_setting_t *s);
 static bool systable_station_locations_match(config_setting_t const *s1, config_setting_t const *s2);
 
@@ -714,21 +751,21 @@ void systable_complete_format_text(la_vstring *vstr, void const *data, int32_t i
 	}
 }
 
-void systable_complete_format_json(la_vstring *vstr, void const *data) {
-	ASSERT(vstr);
+void systable_complete_serialize(struct fmtr_writer *w, void const *data) {
+	ASSERT(w);
 	ASSERT(data);
 
 	struct systable_complete const *sc = data;
-	la_json_append_bool(vstr, "err", sc->err);
+	fw_append_bool(w, "err", sc->err);
 	if(sc->err) {
 		return;
 	}
-	la_json_append_int64(vstr, "version", sc->version);
-	la_json_array_start(vstr, "ground_stations");
+	fw_append_int64(w, "version", sc->version);
+	fw_array_start(w, "ground_stations");
 	for(la_list *l = sc->gs_list; l != NULL; l = l->next) {
-		systable_gs_data_format_json(vstr, l->data);
+		systable_gs_data_serialize(w, l->data);
 	}
-	la_json_array_end(vstr);
+	fw_array_end(w);
 }
 
 static void systable_gs_data_format_text(la_vstring *vstr, int32_t indent, struct systable_gs_data const *data) {
@@ -751,28 +788,28 @@ static void systable_gs_data_format_text(la_vstring *vstr, int32_t indent, struc
 	}
 }
 
-static void systable_gs_data_format_json(la_vstring *vstr, struct systable_gs_data const *data) {
-	ASSERT(vstr);
+static void systable_gs_data_serialize(struct fmtr_writer *w, struct systable_gs_data const *data) {
+	ASSERT(w);
 	ASSERT(data);
 
-	la_json_object_start(vstr, NULL);
-	la_json_append_int64(vstr, "id", data->gs_id);
-	la_json_append_bool(vstr, "utc_sync", data->utc_sync);
-	la_json_object_start(vstr, "location");
-	la_json_append_double(vstr, "lat", data->gs_location.lat);
-	la_json_append_double(vstr, "lon", data->gs_location.lon);
-	la_json_object_end(vstr);
-	la_json_append_int64(vstr, "spdu_version", data->spdu_version);
+	fw_object_start(w, NULL);
+	fw_append_int64(w, "id", data->gs_id);
+	fw_append_bool(w, "utc_sync", data->utc_sync);
+	fw_object_start(w, "location");
+	fw_append_double(w, "lat", data->gs_location.lat);
+	fw_append_double(w, "lon", data->gs_location.lon);
+	fw_object_end(w);
+	fw_append_int64(w, "spdu_version", data->spdu_version);
 
-	la_json_array_start(vstr, "freqs");
+	fw_array_start(w, "freqs");
 	for(uint32_t f = 0; f < data->freq_cnt; f++) {
-		la_json_object_start(vstr, NULL);
-		la_json_append_int64(vstr, "freq", data->frequencies[f]);
-		la_json_append_int64(vstr, "master_frame_slot", data->master_frame_slots[f]);
-		la_json_object_end(vstr);
+		fw_object_start(w, NULL);
+		fw_append_int64(w, "freq", data->frequencies[f]);
+		fw_append_int64(w, "master_frame_slot", data->master_frame_slots[f]);
+		fw_object_end(w);
 	}
-	la_json_array_end(vstr);
-	la_json_object_end(vstr);
+	fw_array_end(w);
+	fw_object_end(w);
 }
 
 static void systable_complete_destroy(void *data) {
@@ -784,6 +821,10 @@ static void systable_complete_destroy(void *data) {
 	XFREE(sc);
 }
 
+static void systable_complete_format_json(la_vstring *vstr, void const *data) {
+	fw_format_json(vstr, systable_complete_serialize, data);
+}
+
 la_type_descriptor proto_DEF_systable_complete = {
 	.format_text = systable_complete_format_text,
 	.format_json = systable_complete_format_json,
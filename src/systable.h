@@ -24,8 +24,13 @@ int32_t systable_file_error_line(systable const *st);
 int32_t systable_get_version(systable const *st);
 char const *systable_get_station_name(systable const *st, int32_t id);
 double systable_get_station_frequency(systable const *st, int32_t gs_id, int32_t freq_id);
+int32_t *systable_get_frequencies(systable const *st, int32_t *cnt);
 bool systable_is_available(systable const *st);
 
 void systable_store_pdu(systable const *st, int16_t version, uint8_t seq_num,
 		uint8_t pdu_set_len, uint8_t *buf, uint32_t len);
 la_proto_node *systable_process_pdu_set(systable *st);
+
+struct fmtr_writer;
+extern la_type_descriptor proto_DEF_systable_complete;
+void systable_complete_serialize(struct fmtr_writer *w, void const *data);
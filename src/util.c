@@ -5,16 +5,19 @@
 #include <errno.h>                  // errno
 #include <string.h>                 // strerror
 #include <unistd.h>                 // _exit
+#include <time.h>                   // clock_gettime, struct timespec
 #include <libacars/libacars.h>      // la_proto_node, la_type_descriptor
 #include <libacars/vstring.h>       // la_vstring
-#include <libacars/json.h>          // la_json_append_*
 #include "config.h"
 #ifndef HAVE_PTHREAD_BARRIERS
 #include "pthread_barrier.h"
 #endif
 #include "util.h"                   // struct octet_string, struct location
+#include "fmtr-writer.h"            // struct fmtr_writer, fw_*
+#include "arena.h"                  // FRAME_NEW, frame_arena_noop_destroy
 #include "globals.h"                // Systable, Systable_lock, Systable_unlock,
-                                    // AC_cache, AC_cache_lock, AC_cache_unlock
+                                    // AC_cache, AC_cache_lock, AC_cache_unlock,
+                                    // AC_data, AC_data_lock, AC_data_unlock
 #include "systable.h"               // systable_get_station_name
 #include "ac_cache.h"               // ac_cache_entry_lookup
 #include "ac_data.h"                // ac_data_entry_lookup
@@ -97,6 +100,20 @@ int32_t pthread_mutex_initialize(pthread_mutex_t *mutex) {
 	return ret;
 }
 
+// Waits on the condition variable for at most timeout_ms milliseconds.
+// Returns 0 when signaled or ETIMEDOUT.
+int32_t pthread_cond_wait_ms(pthread_cond_t *cond, pthread_mutex_t *mutex, int32_t timeout_ms) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+	if(deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	return pthread_cond_timedwait(cond, mutex, &deadline);
+}
+
 struct octet_string *octet_string_new(void *buf, size_t len) {
 	NEW(struct octet_string, ostring);
 	ostring->buf = buf;
@@ -203,26 +220,32 @@ static void unknown_proto_format_text(la_vstring *vstr, void const *data, int32_
 	append_hexdump_with_indent(vstr, ostring->buf, ostring->len, indent+1);
 }
 
-static void unknown_proto_format_json(la_vstring *vstr, void const *data) {
-	ASSERT(vstr != NULL);
+void unknown_proto_serialize(struct fmtr_writer *w, void const *data) {
+	ASSERT(w != NULL);
 	ASSERT(data != NULL);
 
 	struct octet_string const *ostring = data;
 	if(ostring->buf == NULL || ostring->len == 0) {
 		return;
 	}
-	la_json_append_octet_string(vstr, "data", ostring->buf, ostring->len);
+	fw_append_octet_string(w, "data", ostring->buf, ostring->len);
+}
+
+static void unknown_proto_format_json(la_vstring *vstr, void const *data) {
+	fw_format_json(vstr, unknown_proto_serialize, data);
 }
 
-static la_type_descriptor const proto_DEF_unknown = {
+la_type_descriptor const proto_DEF_unknown = {
 	.format_text = unknown_proto_format_text,
 	.format_json = unknown_proto_format_json,
 	.json_key = "unknown_proto",
-	.destroy = NULL
+	.destroy = frame_arena_noop_destroy
 };
 
 la_proto_node *unknown_proto_pdu_new(void *buf, size_t len) {
-	struct octet_string *ostring = octet_string_new(buf, len);
+	FRAME_NEW(struct octet_string, ostring);
+	ostring->buf = buf;
+	ostring->len = len;
 	la_proto_node *node = la_proto_node_new();
 	node->td = &proto_DEF_unknown;
 	node->data = ostring;
@@ -264,25 +287,25 @@ void freq_list_format_text(la_vstring *vstr, int32_t indent, char const *label,
 	EOL(vstr);
 }
 
-void freq_list_format_json(la_vstring *vstr, char const *label, uint8_t gs_id, uint32_t freqs) {
-	ASSERT(vstr);
+void freq_list_serialize(struct fmtr_writer *w, char const *label, uint8_t gs_id, uint32_t freqs) {
+	ASSERT(w);
 	ASSERT(label);
 
-	la_json_array_start(vstr, label);
+	fw_array_start(w, label);
 	Systable_lock();
 	for(int32_t i = 0; i < GS_MAX_FREQ_CNT; i++) {
 		if((freqs >> i) & 1) {
-			la_json_object_start(vstr, NULL);
-			la_json_append_int64(vstr, "id", i);
+			fw_object_start(w, NULL);
+			fw_append_int64(w, "id", i);
 			double f = systable_get_station_frequency(Systable, gs_id, i);
 			if(f > 0.0) {
-				la_json_append_double(vstr, "freq", f);
+				fw_append_double(w, "freq", f);
 			}
-			la_json_object_end(vstr);
+			fw_object_end(w);
 		}
 	}
 	Systable_unlock();
-	la_json_array_end(vstr);
+	fw_array_end(w);
 }
 
 void gs_id_format_text(la_vstring *vstr, int32_t indent, char const *label, uint8_t gs_id) {
@@ -290,32 +313,33 @@ void gs_id_format_text(la_vstring *vstr, int32_t indent, char const *label, uint
 	ASSERT(indent >= 0);
 	ASSERT(label);
 
+	// The name is printed with the lock held, since the system table
+	// (and the name string with it) may be replaced by another decoder thread.
 	char const *gs_name = NULL;
+	LA_ISPRINTF(vstr, indent, "%s: ", label);
 	Systable_lock();
 	gs_name = systable_get_station_name(Systable, gs_id);
-	Systable_unlock();
-	LA_ISPRINTF(vstr, indent, "%s: ", label);
 	if(gs_name != NULL) {
 		la_vstring_append_sprintf(vstr, "%s\n", gs_name);
 	} else {
 		la_vstring_append_sprintf(vstr, "%hhu\n", gs_id);
 	}
+	Systable_unlock();
 }
 
-void gs_id_format_json(la_vstring *vstr, char const *label, uint8_t gs_id) {
-	ASSERT(vstr);
+void gs_id_serialize(struct fmtr_writer *w, char const *label, uint8_t gs_id) {
+	ASSERT(w);
 	ASSERT(label);
 
 	char const *gs_name = NULL;
+	fw_object_start(w, label);
+	fw_append_string(w, "type", "Ground station");
+	fw_append_int64(w, "id", gs_id);
 	Systable_lock();
 	gs_name = systable_get_station_name(Systable, gs_id);
+	SAFE_FW_APPEND_STRING(w, "name", gs_name);
 	Systable_unlock();
-
-	la_json_object_start(vstr, label);
-	la_json_append_string(vstr, "type", "Ground station");
-	la_json_append_int64(vstr, "id", gs_id);
-	SAFE_JSON_APPEND_STRING(vstr, "name", gs_name);
-	la_json_object_end(vstr);
+	fw_object_end(w);
 }
 
 void ac_id_format_text(la_vstring *vstr, int32_t indent, char const *label, int32_t freq, uint8_t ac_id) {
@@ -323,39 +347,50 @@ void ac_id_format_text(la_vstring *vstr, int32_t indent, char const *label, int3
 	ASSERT(indent >= 0);
 	ASSERT(label);
 
+	// Copy the address while holding the lock - the entry may be expired
+	// and freed by another decoder thread as soon as the lock is released.
 	struct ac_cache_entry *entry = NULL;
+	uint32_t icao_address = 0;
 	AC_cache_lock();
 	entry = ac_cache_entry_lookup(AC_cache, freq, ac_id);
+	if(entry != NULL) {
+		icao_address = entry->icao_address;
+	}
 	AC_cache_unlock();
 	LA_ISPRINTF(vstr, indent, "%s: ", label);
 	if(entry != NULL) {
-		la_vstring_append_sprintf(vstr, "%hhu (%06X)\n", ac_id, entry->icao_address);
-		ac_data_format_text(vstr, indent + 1, entry->icao_address);
+		la_vstring_append_sprintf(vstr, "%hhu (%06X)\n", ac_id, icao_address);
+		ac_data_format_text(vstr, indent + 1, icao_address);
 	} else {
 		la_vstring_append_sprintf(vstr, "%hhu\n", ac_id);
 	}
 }
 
-void ac_id_format_json(la_vstring *vstr, char const *label, int32_t freq, uint8_t ac_id) {
-	ASSERT(vstr);
+void ac_id_serialize(struct fmtr_writer *w, char const *label, int32_t freq, uint8_t ac_id) {
+	ASSERT(w);
 	ASSERT(label);
 
 	struct ac_cache_entry *entry = NULL;
+	uint32_t icao_address = 0;
 	AC_cache_lock();
 	entry = ac_cache_entry_lookup(AC_cache, freq, ac_id);
+	if(entry != NULL) {
+		icao_address = entry->icao_address;
+	}
 	AC_cache_unlock();
 
-	la_json_object_start(vstr, label);
-	la_json_append_string(vstr, "type", "Aircraft");
-	la_json_append_int64(vstr, "id", ac_id);
+	fw_object_start(w, label);
+	fw_append_string(w, "type", "Aircraft");
+	fw_append_int64(w, "id", ac_id);
 	if(entry != NULL) {
-		ac_data_format_json(vstr, "ac_info", entry->icao_address);
+		ac_data_serialize(w, "ac_info", icao_address);
 	}
-	la_json_object_end(vstr);
+	fw_object_end(w);
 }
 
 void ac_data_format_text(la_vstring *vstr, int32_t indent, uint32_t addr) {
 	if(Config.ac_data_available == true) {
+		AC_data_lock();
 		struct ac_data_entry *ac = ac_data_entry_lookup(AC_data, addr);
 		if(Config.ac_data_details == AC_DETAILS_NORMAL) {
 			LA_ISPRINTF(vstr, indent, "AC info: %s, %s, %s\n",
@@ -371,30 +406,33 @@ void ac_data_format_text(la_vstring *vstr, int32_t indent, uint32_t addr) {
 					ac && ac->registeredowners ? ac->registeredowners : "-"
 					);
 		}
+		AC_data_unlock();
 	}
 }
 
-void ac_data_format_json(la_vstring *vstr, char const *label, uint32_t addr) {
-	ASSERT(vstr != NULL);
+void ac_data_serialize(struct fmtr_writer *w, char const *label, uint32_t addr) {
+	ASSERT(w != NULL);
 
-	la_json_object_start(vstr, label);
+	fw_object_start(w, label);
 	char icao_addr[7];
 	snprintf(icao_addr, 7, "%06X", addr);
-	la_json_append_string(vstr, "icao", icao_addr);
+	fw_append_string(w, "icao", icao_addr);
 	if(Config.ac_data_available == true) {
+		AC_data_lock();
 		struct ac_data_entry *ac = ac_data_entry_lookup(AC_data, addr);
 		if(Config.ac_data_details >= AC_DETAILS_NORMAL) {
-			SAFE_JSON_APPEND_STRING(vstr, "regnr", ac->registration);
-			SAFE_JSON_APPEND_STRING(vstr, "typecode", ac->icaotypecode);
-			SAFE_JSON_APPEND_STRING(vstr, "opercode", ac->operatorflagcode);
+			SAFE_FW_APPEND_STRING(w, "regnr", ac->registration);
+			SAFE_FW_APPEND_STRING(w, "typecode", ac->icaotypecode);
+			SAFE_FW_APPEND_STRING(w, "opercode", ac->operatorflagcode);
 		}
 		if(Config.ac_data_details >= AC_DETAILS_VERBOSE) {
-			SAFE_JSON_APPEND_STRING(vstr, "manuf", ac->manufacturer);
-			SAFE_JSON_APPEND_STRING(vstr, "model", ac->type);
-			SAFE_JSON_APPEND_STRING(vstr, "owner", ac->registeredowners);
+			SAFE_FW_APPEND_STRING(w, "manuf", ac->manufacturer);
+			SAFE_FW_APPEND_STRING(w, "model", ac->type);
+			SAFE_FW_APPEND_STRING(w, "owner", ac->registeredowners);
 		}
+		AC_data_unlock();
 	}
-	la_json_object_end(vstr);
+	fw_object_end(w);
 }
 double parse_coordinate(uint32_t c) {
 	struct { int32_t coord:20; } s;
@@ -84,13 +84,6 @@
 #define debug_print_buf_hex(debug_class, buf, len, fmt, ...) nop()
 #endif
 
-#define SAFE_JSON_APPEND_STRING(v, n, val) \
-	do { \
-		if((val) != NULL) { \
-			la_json_append_string((v), (n), (val)); \
-		} \
-	} while(0)
-
 #define XCALLOC(nmemb, size) xcalloc((nmemb), (size), __FILE__, __LINE__, __func__)
 #define XREALLOC(ptr, size) xrealloc((ptr), (size), __FILE__, __LINE__, __func__)
 #define XFREE(ptr) do { free(ptr); ptr = NULL; } while(0)
@@ -108,6 +101,8 @@
 // Reverse bit order in a byte (http://graphics.stanford.edu/~seander/bithacks.html#ReverseByteWith64Bits)
 #define REVERSE_BYTE(x) (uint8_t)((((x) * 0x80200802ULL) & 0x0884422110ULL) * 0x0101010101ULL >> 32)
 
+struct fmtr_writer;
+
 void *xcalloc(size_t nmemb, size_t size, char const *file, int32_t line, char const *func);
 void *xrealloc(void *ptr, size_t size, char const *file, int32_t line, char const *func);
 int32_t start_thread(pthread_t *pth, void *(*start_routine)(void *), void *thread_ctx);
@@ -115,6 +110,7 @@ void stop_thread(pthread_t pth);
 int32_t pthread_barrier_create(pthread_barrier_t *barrier, unsigned count);
 int32_t pthread_cond_initialize(pthread_cond_t *cond);
 int32_t pthread_mutex_initialize(pthread_mutex_t *mutex);
+int32_t pthread_cond_wait_ms(pthread_cond_t *cond, pthread_mutex_t *mutex, int32_t timeout_ms);
 
 struct octet_string {
 	uint8_t *buf;
@@ -126,19 +122,21 @@ void octet_string_destroy(struct octet_string *ostring);
 
 void append_hexdump_with_indent(la_vstring *vstr, uint8_t *data, size_t len, int32_t indent);
 
+extern la_type_descriptor const proto_DEF_unknown;
 la_proto_node *unknown_proto_pdu_new(void *buf, size_t len);
+void unknown_proto_serialize(struct fmtr_writer *w, void const *data);
 
 uint32_t parse_icao_hex(uint8_t const buf[3]);
 
 #define GS_MAX_FREQ_CNT 20       // Max number of frequencies assigned to a ground station
 void freq_list_format_text(la_vstring *vstr, int32_t indent, char const *label, uint8_t gs_id, uint32_t freqs);
-void freq_list_format_json(la_vstring *vstr, char const *label, uint8_t gs_id, uint32_t freqs);
+void freq_list_serialize(struct fmtr_writer *w, char const *label, uint8_t gs_id, uint32_t freqs);
 void gs_id_format_text(la_vstring *vstr, int32_t indent, char const *label, uint8_t gs_id);
-void gs_id_format_json(la_vstring *vstr, char const *label, uint8_t gs_id);
+void gs_id_serialize(struct fmtr_writer *w, char const *label, uint8_t gs_id);
 void ac_id_format_text(la_vstring *vstr, int32_t indent, char const *label, int32_t freq, uint8_t ac_id);
-void ac_id_format_json(la_vstring *vstr, char const *label, int32_t freq, uint8_t ac_id);
+void ac_id_serialize(struct fmtr_writer *w, char const *label, int32_t freq, uint8_t ac_id);
 void ac_data_format_text(la_vstring *vstr, int32_t indent, uint32_t addr);
-void ac_data_format_json(la_vstring *vstr, char const *label, uint32_t addr);
+void ac_data_serialize(struct fmtr_writer *w, char const *label, uint32_t addr);
 
 struct location {
 	double lat, lon;